@@ -0,0 +1,425 @@
+#include "KHMAnimation.h"
+#include "KHMSimd.h"
+#include "KHMStats.h"
+
+#include <math.h>
+
+namespace KHM {
+
+//
+// tracks
+//
+
+static void SetIdentityPadding(float* pChannels, int numNodes, int numNodesPadded)
+{
+    // padded lanes hold an identity transform, so the kernels can run over them without producing NaNs
+    for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+    {
+        const float value = (ch == POSE_ROT_W || ch >= POSE_SCALE_X) ? 1.0f : 0.0f;
+        float* pChannel = pChannels + (size_t)ch * numNodesPadded;
+        for (int i = numNodes; i < numNodesPadded; ++i)
+            pChannel[i] = value;
+    }
+}
+
+static size_t GetAnimationTracksHeaderSize()
+{
+    return (sizeof(sAnimationTracks) + KHM_SIMD_ALIGNMENT - 1) & ~(size_t)(KHM_SIMD_ALIGNMENT - 1);
+}
+
+size_t GetAnimationTracksSize(int numNodes, int numNodeFrames)
+{
+    if (numNodes <= 0 || numNodeFrames <= 0)
+        return 0;
+
+    return GetAnimationTracksHeaderSize() + sizeof(float) * NUM_POSE_CHANNELS * SimdPadCount(numNodes) * (size_t)numNodeFrames;
+}
+
+sAnimationTracks* CreateAnimationTracks(const sAnimation* pAnimation)
+{
+    if (!pAnimation || !pAnimation->pNodeTransforms)
+        return NULL;
+
+    const size_t uiSize = GetAnimationTracksSize(pAnimation->numNodes, pAnimation->numNodeFrames);
+    if (!uiSize)
+        return NULL;
+
+    KHM_STATS_ALLOC(uiSize);
+    return CreateAnimationTracks(pAnimation, AlignedAlloc(uiSize));
+}
+
+sAnimationTracks* CreateAnimationTracks(const sAnimation* pAnimation, void* pMemory)
+{
+    if (!pAnimation || !pAnimation->pNodeTransforms || pAnimation->numNodes <= 0 || pAnimation->numNodeFrames <= 0)
+        return NULL;
+
+    sAnimationTracks* pTracks = (sAnimationTracks*)pMemory;
+    pTracks->numNodes = pAnimation->numNodes;
+    pTracks->numNodesPadded = SimdPadCount(pAnimation->numNodes);
+    pTracks->numNodeFrames = pAnimation->numNodeFrames;
+    pTracks->frameDurationMs = pAnimation->frameDurationMs;
+    pTracks->pData = (float*)((unsigned char*)pMemory + GetAnimationTracksHeaderSize());
+
+    for (int frame = 0; frame < pTracks->numNodeFrames; ++frame)
+    {
+        float* pFrame = (float*)pTracks->GetChannel(frame, 0);
+        const sNodeTransform* pSrc = &pAnimation->pNodeTransforms[frame * pAnimation->numNodes];
+        const int stride = pTracks->numNodesPadded;
+
+        for (int node = 0; node < pTracks->numNodes; ++node)
+        {
+            const sNodeTransform& tr = pSrc[node];
+            pFrame[POSE_ROT_X * stride + node] = tr.qRot.x;
+            pFrame[POSE_ROT_Y * stride + node] = tr.qRot.y;
+            pFrame[POSE_ROT_Z * stride + node] = tr.qRot.z;
+            pFrame[POSE_ROT_W * stride + node] = tr.qRot.w;
+            pFrame[POSE_TRANS_X * stride + node] = tr.vTrans.x;
+            pFrame[POSE_TRANS_Y * stride + node] = tr.vTrans.y;
+            pFrame[POSE_TRANS_Z * stride + node] = tr.vTrans.z;
+            pFrame[POSE_SCALE_X * stride + node] = tr.vScale.x;
+            pFrame[POSE_SCALE_Y * stride + node] = tr.vScale.y;
+            pFrame[POSE_SCALE_Z * stride + node] = tr.vScale.z;
+        }
+
+        SetIdentityPadding(pFrame, pTracks->numNodes, stride);
+    }
+
+    return pTracks;
+}
+
+void DestroyAnimationTracks(sAnimationTracks* pTracks)
+{
+    if (!pTracks)
+        return;
+
+    AlignedFree(pTracks);
+}
+
+//
+// poses
+//
+
+bool CreatePose(sPose* pPose, int numNodes)
+{
+    pPose->numNodes = numNodes;
+    pPose->numNodesPadded = SimdPadCount(Max(numNodes, 1));
+    pPose->pData = (float*)AlignedAlloc(sizeof(float) * NUM_POSE_CHANNELS * pPose->numNodesPadded);
+    if (!pPose->pData)
+        return false;
+
+    SetPoseIdentity(pPose);
+    return true;
+}
+
+void DestroyPose(sPose* pPose)
+{
+    AlignedFree(pPose->pData);
+    pPose->pData = NULL;
+    pPose->numNodes = 0;
+    pPose->numNodesPadded = 0;
+}
+
+void SetPoseIdentity(sPose* pPose)
+{
+    SetIdentityPadding(pPose->pData, 0, pPose->numNodesPadded);
+}
+
+void GetKeyframes(int numNodeFrames, float frameDurationMs, float timeMs, bool bLoop, int& frame0, int& frame1, float& alpha)
+{
+    if (numNodeFrames <= 1 || frameDurationMs <= 0.0f)
+    {
+        frame0 = frame1 = 0;
+        alpha = 0.0f;
+        return;
+    }
+
+    const float durationMs = frameDurationMs * (float)(numNodeFrames - 1);
+    if (bLoop)
+    {
+        timeMs = fmodf(timeMs, durationMs);
+        if (timeMs < 0.0f)
+            timeMs += durationMs;
+    }
+    else
+    {
+        timeMs = Max(0.0f, Min(timeMs, durationMs));
+    }
+
+    const float frame = timeMs / frameDurationMs;
+    frame0 = Min((int)frame, numNodeFrames - 2);
+    frame1 = frame0 + 1;
+    alpha = Max(0.0f, Min(frame - (float)frame0, 1.0f));
+}
+
+//
+// sampling kernels
+//
+// rotations are nlerp'ed ( shortest path, renormalized ), translation and scale are lerp'ed
+//
+
+static void SampleKernelScalar(const float* pKey0, const float* pKey1, int stride, float alpha, float* pOut, int begin, int end)
+{
+    for (int i = begin; i < end; ++i)
+    {
+        const float ax = pKey0[POSE_ROT_X * stride + i], bx = pKey1[POSE_ROT_X * stride + i];
+        const float ay = pKey0[POSE_ROT_Y * stride + i], by = pKey1[POSE_ROT_Y * stride + i];
+        const float az = pKey0[POSE_ROT_Z * stride + i], bz = pKey1[POSE_ROT_Z * stride + i];
+        const float aw = pKey0[POSE_ROT_W * stride + i], bw = pKey1[POSE_ROT_W * stride + i];
+
+        const float dot = ax * bx + ay * by + az * bz + aw * bw;
+        const float wa = 1.0f - alpha;
+        const float wb = (dot < 0.0f) ? -alpha : alpha;
+
+        const float x = ax * wa + bx * wb;
+        const float y = ay * wa + by * wb;
+        const float z = az * wa + bz * wb;
+        const float w = aw * wa + bw * wb;
+        const float invLen = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
+
+        pOut[POSE_ROT_X * stride + i] = x * invLen;
+        pOut[POSE_ROT_Y * stride + i] = y * invLen;
+        pOut[POSE_ROT_Z * stride + i] = z * invLen;
+        pOut[POSE_ROT_W * stride + i] = w * invLen;
+
+        for (int ch = POSE_TRANS_X; ch < NUM_POSE_CHANNELS; ++ch)
+        {
+            const float a = pKey0[ch * stride + i];
+            const float b = pKey1[ch * stride + i];
+            pOut[ch * stride + i] = a + (b - a) * alpha;
+        }
+    }
+}
+
+#if defined(KHM_SIMD_AVX2)
+
+static void SampleKernelAVX2(const float* pKey0, const float* pKey1, int stride, float alpha, float* pOut, int numNodesPadded)
+{
+    const __m256 vAlpha = _mm256_set1_ps(alpha);
+    const __m256 vInvAlpha = _mm256_set1_ps(1.0f - alpha);
+    const __m256 vSignBit = _mm256_set1_ps(-0.0f);
+    const __m256 vOne = _mm256_set1_ps(1.0f);
+
+    for (int i = 0; i < numNodesPadded; i += 8)
+    {
+        const __m256 ax = _mm256_load_ps(pKey0 + POSE_ROT_X * stride + i), bx = _mm256_load_ps(pKey1 + POSE_ROT_X * stride + i);
+        const __m256 ay = _mm256_load_ps(pKey0 + POSE_ROT_Y * stride + i), by = _mm256_load_ps(pKey1 + POSE_ROT_Y * stride + i);
+        const __m256 az = _mm256_load_ps(pKey0 + POSE_ROT_Z * stride + i), bz = _mm256_load_ps(pKey1 + POSE_ROT_Z * stride + i);
+        const __m256 aw = _mm256_load_ps(pKey0 + POSE_ROT_W * stride + i), bw = _mm256_load_ps(pKey1 + POSE_ROT_W * stride + i);
+
+        __m256 dot = _mm256_mul_ps(ax, bx);
+        dot = _mm256_fmadd_ps(ay, by, dot);
+        dot = _mm256_fmadd_ps(az, bz, dot);
+        dot = _mm256_fmadd_ps(aw, bw, dot);
+
+        // negative dot -> flip the sign of the second weight
+        const __m256 wb = _mm256_xor_ps(vAlpha, _mm256_and_ps(dot, vSignBit));
+
+        const __m256 x = _mm256_fmadd_ps(bx, wb, _mm256_mul_ps(ax, vInvAlpha));
+        const __m256 y = _mm256_fmadd_ps(by, wb, _mm256_mul_ps(ay, vInvAlpha));
+        const __m256 z = _mm256_fmadd_ps(bz, wb, _mm256_mul_ps(az, vInvAlpha));
+        const __m256 w = _mm256_fmadd_ps(bw, wb, _mm256_mul_ps(aw, vInvAlpha));
+
+        __m256 len2 = _mm256_mul_ps(x, x);
+        len2 = _mm256_fmadd_ps(y, y, len2);
+        len2 = _mm256_fmadd_ps(z, z, len2);
+        len2 = _mm256_fmadd_ps(w, w, len2);
+        const __m256 invLen = _mm256_div_ps(vOne, _mm256_sqrt_ps(len2));
+
+        _mm256_store_ps(pOut + POSE_ROT_X * stride + i, _mm256_mul_ps(x, invLen));
+        _mm256_store_ps(pOut + POSE_ROT_Y * stride + i, _mm256_mul_ps(y, invLen));
+        _mm256_store_ps(pOut + POSE_ROT_Z * stride + i, _mm256_mul_ps(z, invLen));
+        _mm256_store_ps(pOut + POSE_ROT_W * stride + i, _mm256_mul_ps(w, invLen));
+
+        for (int ch = POSE_TRANS_X; ch < NUM_POSE_CHANNELS; ++ch)
+        {
+            const __m256 a = _mm256_load_ps(pKey0 + ch * stride + i);
+            const __m256 b = _mm256_load_ps(pKey1 + ch * stride + i);
+            _mm256_store_ps(pOut + ch * stride + i, _mm256_fmadd_ps(_mm256_sub_ps(b, a), vAlpha, a));
+        }
+    }
+}
+
+#elif defined(KHM_SIMD_SSE)
+
+static void SampleKernelSSE(const float* pKey0, const float* pKey1, int stride, float alpha, float* pOut, int numNodesPadded)
+{
+    const __m128 vAlpha = _mm_set1_ps(alpha);
+    const __m128 vInvAlpha = _mm_set1_ps(1.0f - alpha);
+    const __m128 vSignBit = _mm_set1_ps(-0.0f);
+    const __m128 vOne = _mm_set1_ps(1.0f);
+
+    for (int i = 0; i < numNodesPadded; i += 4)
+    {
+        const __m128 ax = _mm_load_ps(pKey0 + POSE_ROT_X * stride + i), bx = _mm_load_ps(pKey1 + POSE_ROT_X * stride + i);
+        const __m128 ay = _mm_load_ps(pKey0 + POSE_ROT_Y * stride + i), by = _mm_load_ps(pKey1 + POSE_ROT_Y * stride + i);
+        const __m128 az = _mm_load_ps(pKey0 + POSE_ROT_Z * stride + i), bz = _mm_load_ps(pKey1 + POSE_ROT_Z * stride + i);
+        const __m128 aw = _mm_load_ps(pKey0 + POSE_ROT_W * stride + i), bw = _mm_load_ps(pKey1 + POSE_ROT_W * stride + i);
+
+        const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                                      _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+
+        // negative dot -> flip the sign of the second weight
+        const __m128 wb = _mm_xor_ps(vAlpha, _mm_and_ps(dot, vSignBit));
+
+        const __m128 x = _mm_add_ps(_mm_mul_ps(ax, vInvAlpha), _mm_mul_ps(bx, wb));
+        const __m128 y = _mm_add_ps(_mm_mul_ps(ay, vInvAlpha), _mm_mul_ps(by, wb));
+        const __m128 z = _mm_add_ps(_mm_mul_ps(az, vInvAlpha), _mm_mul_ps(bz, wb));
+        const __m128 w = _mm_add_ps(_mm_mul_ps(aw, vInvAlpha), _mm_mul_ps(bw, wb));
+
+        const __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                                       _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+        const __m128 invLen = _mm_div_ps(vOne, _mm_sqrt_ps(len2));
+
+        _mm_store_ps(pOut + POSE_ROT_X * stride + i, _mm_mul_ps(x, invLen));
+        _mm_store_ps(pOut + POSE_ROT_Y * stride + i, _mm_mul_ps(y, invLen));
+        _mm_store_ps(pOut + POSE_ROT_Z * stride + i, _mm_mul_ps(z, invLen));
+        _mm_store_ps(pOut + POSE_ROT_W * stride + i, _mm_mul_ps(w, invLen));
+
+        for (int ch = POSE_TRANS_X; ch < NUM_POSE_CHANNELS; ++ch)
+        {
+            const __m128 a = _mm_load_ps(pKey0 + ch * stride + i);
+            const __m128 b = _mm_load_ps(pKey1 + ch * stride + i);
+            _mm_store_ps(pOut + ch * stride + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), vAlpha)));
+        }
+    }
+}
+
+#endif
+
+void SamplePose(const sAnimationTracks* pTracks, int frame0, int frame1, float alpha, sPose* pPose)
+{
+    ASSERT(pPose->numNodesPadded == pTracks->numNodesPadded);
+
+    const float* pKey0 = pTracks->GetChannel(frame0, 0);
+    const float* pKey1 = pTracks->GetChannel(frame1, 0);
+
+#if defined(KHM_SIMD_AVX2)
+    SampleKernelAVX2(pKey0, pKey1, pTracks->numNodesPadded, alpha, pPose->pData, pTracks->numNodesPadded);
+#elif defined(KHM_SIMD_SSE)
+    SampleKernelSSE(pKey0, pKey1, pTracks->numNodesPadded, alpha, pPose->pData, pTracks->numNodesPadded);
+#else
+    SampleKernelScalar(pKey0, pKey1, pTracks->numNodesPadded, alpha, pPose->pData, 0, pTracks->numNodesPadded);
+#endif
+}
+
+void SamplePose(const sAnimationTracks* pTracks, float timeMs, bool bLoop, sPose* pPose)
+{
+    int frame0, frame1;
+    float alpha;
+    GetKeyframes(pTracks->numNodeFrames, pTracks->frameDurationMs, timeMs, bLoop, frame0, frame1, alpha);
+    SamplePose(pTracks, frame0, frame1, alpha, pPose);
+}
+
+void BlendPoses(const sPose* pPoseA, const sPose* pPoseB, float alpha, sPose* pOut)
+{
+    ASSERT(pPoseA->numNodesPadded == pPoseB->numNodesPadded && pPoseA->numNodesPadded == pOut->numNodesPadded);
+
+    // two poses are laid out like two keyframes of a track
+#if defined(KHM_SIMD_AVX2)
+    SampleKernelAVX2(pPoseA->pData, pPoseB->pData, pOut->numNodesPadded, alpha, pOut->pData, pOut->numNodesPadded);
+#elif defined(KHM_SIMD_SSE)
+    SampleKernelSSE(pPoseA->pData, pPoseB->pData, pOut->numNodesPadded, alpha, pOut->pData, pOut->numNodesPadded);
+#else
+    SampleKernelScalar(pPoseA->pData, pPoseB->pData, pOut->numNodesPadded, alpha, pOut->pData, 0, pOut->numNodesPadded);
+#endif
+}
+
+static void GatherNodeTransform(const sNodeTransform& tr, float* pChannels)
+{
+    pChannels[POSE_ROT_X] = tr.qRot.x;
+    pChannels[POSE_ROT_Y] = tr.qRot.y;
+    pChannels[POSE_ROT_Z] = tr.qRot.z;
+    pChannels[POSE_ROT_W] = tr.qRot.w;
+    pChannels[POSE_TRANS_X] = tr.vTrans.x;
+    pChannels[POSE_TRANS_Y] = tr.vTrans.y;
+    pChannels[POSE_TRANS_Z] = tr.vTrans.z;
+    pChannels[POSE_SCALE_X] = tr.vScale.x;
+    pChannels[POSE_SCALE_Y] = tr.vScale.y;
+    pChannels[POSE_SCALE_Z] = tr.vScale.z;
+}
+
+void SamplePoseReference(const sAnimation* pAnimation, float timeMs, bool bLoop, sPose* pPose)
+{
+    ASSERT(pPose->numNodes == pAnimation->numNodes);
+
+    int frame0, frame1;
+    float alpha;
+    GetKeyframes(pAnimation->numNodeFrames, pAnimation->frameDurationMs, timeMs, bLoop, frame0, frame1, alpha);
+
+    const sNodeTransform* pKey0 = &pAnimation->pNodeTransforms[frame0 * pAnimation->numNodes];
+    const sNodeTransform* pKey1 = &pAnimation->pNodeTransforms[frame1 * pAnimation->numNodes];
+
+    // one node at a time through the scalar kernel, gathered on the stack and scattered into the pose, so there's
+    // no frame sized scratch to allocate; padded lanes get the identity the kernel would make of them
+    const int stride = pPose->numNodesPadded;
+    for (int node = 0; node < pAnimation->numNodes; ++node)
+    {
+        float key0[NUM_POSE_CHANNELS], key1[NUM_POSE_CHANNELS], out[NUM_POSE_CHANNELS];
+        GatherNodeTransform(pKey0[node], key0);
+        GatherNodeTransform(pKey1[node], key1);
+        SampleKernelScalar(key0, key1, 1, alpha, out, 0, 1);
+
+        for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+            pPose->pData[ch * stride + node] = out[ch];
+    }
+
+    SetIdentityPadding(pPose->pData, pAnimation->numNodes, stride);
+}
+
+//
+// masking
+//
+
+void BlendPoseMasked(const sPose* pPoseA, const sPose* pPoseB, const sAnimationMask* pMask, sPose* pOut)
+{
+    ASSERT(pPoseA->numNodesPadded == pPoseB->numNodesPadded && pPoseA->numNodesPadded == pOut->numNodesPadded);
+
+    // nodes past KHM_MAX_BONES can't be in the mask, they stay on pose A
+    const int numMasked = Min(pOut->numNodesPadded, SimdPadCount(KHM_MAX_BONES));
+    const int stride = pOut->numNodesPadded;
+
+#if defined(KHM_SIMD_SSE)
+    for (int i = 0; i < numMasked; i += 4)
+    {
+        const __m128 vSelect = SimdBitLanes4(pMask->bits, i);
+
+        for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+        {
+            const __m128 a = _mm_load_ps(pPoseA->pData + ch * stride + i);
+            const __m128 b = _mm_load_ps(pPoseB->pData + ch * stride + i);
+            _mm_store_ps(pOut->pData + ch * stride + i, _mm_or_ps(_mm_and_ps(vSelect, b), _mm_andnot_ps(vSelect, a)));
+        }
+    }
+#else
+    for (int i = 0; i < numMasked; ++i)
+    {
+        const bool bUseB = pMask->IsUsed((unsigned int)i);
+        for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+            pOut->pData[ch * stride + i] = bUseB ? pPoseB->pData[ch * stride + i] : pPoseA->pData[ch * stride + i];
+    }
+#endif
+
+    if (pOut != pPoseA)
+    {
+        for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+            memcpy(pOut->pData + ch * stride + numMasked, pPoseA->pData + ch * stride + numMasked, sizeof(float) * (stride - numMasked));
+    }
+}
+
+float ComparePoses(const sPose* pPoseA, const sPose* pPoseB)
+{
+    ASSERT(pPoseA->numNodes == pPoseB->numNodes);
+
+    float maxDiff = 0.0f;
+    for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+    {
+        const float* a = pPoseA->GetChannel(ch);
+        const float* b = pPoseB->GetChannel(ch);
+        for (int i = 0; i < pPoseA->numNodes; ++i)
+            maxDiff = Max(maxDiff, fabsf(a[i] - b[i]));
+    }
+
+    return maxDiff;
+}
+
+}; // end namespace KHM
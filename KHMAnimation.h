@@ -0,0 +1,101 @@
+#pragma once
+
+#include "KHMModel.h"
+
+namespace KHM
+{
+    //
+    // SoA channels for animation tracks and poses
+    //
+
+    enum ePoseChannel
+    {
+        POSE_ROT_X = 0,
+        POSE_ROT_Y,
+        POSE_ROT_Z,
+        POSE_ROT_W,
+        POSE_TRANS_X,
+        POSE_TRANS_Y,
+        POSE_TRANS_Z,
+        POSE_SCALE_X,
+        POSE_SCALE_Y,
+        POSE_SCALE_Z,
+
+        NUM_POSE_CHANNELS
+    };
+
+    //
+    // KHM Animation Tracks - runtime SoA copy of sAnimation::pNodeTransforms
+    //
+    // layout is [frame][channel][node], nodes padded to KHM_SIMD_LANES ( padding is an identity transform ).
+    // a whole keyframe is NUM_POSE_CHANNELS contiguous streams, so sampling a pose reads two linear blocks
+    //
+
+    struct sAnimationTracks
+    {
+        float*                  pData;
+        int                     numNodes;
+        int                     numNodesPadded;
+        int                     numNodeFrames;
+        float                   frameDurationMs;
+
+        const float* GetChannel(int frame, int channel) const
+        {
+            return pData + ((size_t)frame * NUM_POSE_CHANNELS + channel) * numNodesPadded;
+        }
+    };
+
+    //
+    // KHM Pose - sampled local transforms for every animated node, SoA
+    //
+
+    struct sPose
+    {
+        float*                  pData;          // [channel][node]
+        int                     numNodes;
+        int                     numNodesPadded;
+
+        float* GetChannel(int channel) { return pData + (size_t)channel * numNodesPadded; }
+        const float* GetChannel(int channel) const { return pData + (size_t)channel * numNodesPadded; }
+    };
+
+    //
+    // tracks
+    //
+
+    // a single block: the header, then the data KHM_SIMD_ALIGNMENT aligned
+    sAnimationTracks*   CreateAnimationTracks(const sAnimation* pAnimation);
+    void                DestroyAnimationTracks(sAnimationTracks* pTracks);
+
+    // same block in caller memory ( KHM_SIMD_ALIGNMENT aligned, GetAnimationTracksSize bytes ); not for DestroyAnimationTracks
+    size_t              GetAnimationTracksSize(int numNodes, int numNodeFrames); // 0 = no tracks
+    sAnimationTracks*   CreateAnimationTracks(const sAnimation* pAnimation, void* pMemory);
+
+    //
+    // poses
+    //
+
+    bool                CreatePose(sPose* pPose, int numNodes);
+    void                DestroyPose(sPose* pPose);
+    void                SetPoseIdentity(sPose* pPose);
+
+    // finds the keyframe pair for a time; timeMs is wrapped if bLoop, clamped otherwise
+    void                GetKeyframes(int numNodeFrames, float frameDurationMs, float timeMs, bool bLoop, int& frame0, int& frame1, float& alpha);
+
+    // samples and nlerps every node between the two keyframes around timeMs; SIMD
+    void                SamplePose(const sAnimationTracks* pTracks, float timeMs, bool bLoop, sPose* pPose);
+    void                SamplePose(const sAnimationTracks* pTracks, int frame0, int frame1, float alpha, sPose* pPose);
+
+    // scalar reference, straight from sAnimation::pNodeTransforms; used to validate the SIMD path, and by SampleAnimation
+    // for clips loaded without tracks. Works in place, nothing is allocated
+    void                SamplePoseReference(const sAnimation* pAnimation, float timeMs, bool bLoop, sPose* pPose);
+
+    // nlerps rotations, lerps translation and scale between two poses of the same size; pOut may alias either input. SIMD
+    void                BlendPoses(const sPose* pPoseA, const sPose* pPoseB, float alpha, sPose* pOut);
+
+    // pOut = node used by the mask ? pPoseB : pPoseA; nodes are object ids. pOut may alias either input
+    void                BlendPoseMasked(const sPose* pPoseA, const sPose* pPoseB, const sAnimationMask* pMask, sPose* pOut);
+
+    // largest per channel difference between two poses
+    float               ComparePoses(const sPose* pPoseA, const sPose* pPoseB);
+};
@@ -0,0 +1,362 @@
+#include "KHMAnimationBounds.h"
+#include "KHMAnimation.h"
+#include "KHMSkeleton.h"
+#include "KHMSkinning.h"
+#include "KHMJobs.h"
+#include "KHMSimd.h"
+#include "Kernel/Log.h"
+
+#include <atomic>
+#include <float.h>
+#include <math.h>
+
+namespace KHM {
+
+//
+// bake
+//
+
+int GetAnimationBoundsGroups(int numNodeFrames, int framesPerGroup)
+{
+    if (numNodeFrames <= 0 || framesPerGroup <= 0)
+        return 0;
+
+    return (numNodeFrames - 1) / framesPerGroup + 1;
+}
+
+// the keyframe itself; sampling at its time could land on the one before with alpha ~1. rotations are
+// normalized like the samplers do
+static void PoseFromKeyframe(const sAnimation* pAnimation, int frame, sPose* pPose)
+{
+    const sNodeTransform* pKey = &pAnimation->pNodeTransforms[(size_t)frame * pAnimation->numNodes];
+    for (int node = 0; node < pAnimation->numNodes; ++node)
+    {
+        const sNodeTransform& tr = pKey[node];
+        const float lengthSq = tr.qRot.x * tr.qRot.x + tr.qRot.y * tr.qRot.y + tr.qRot.z * tr.qRot.z + tr.qRot.w * tr.qRot.w;
+        const float invLength = (lengthSq > 0.0f) ? 1.0f / sqrtf(lengthSq) : 0.0f;
+        pPose->GetChannel(POSE_ROT_X)[node] = tr.qRot.x * invLength;
+        pPose->GetChannel(POSE_ROT_Y)[node] = tr.qRot.y * invLength;
+        pPose->GetChannel(POSE_ROT_Z)[node] = tr.qRot.z * invLength;
+        pPose->GetChannel(POSE_ROT_W)[node] = (lengthSq > 0.0f) ? tr.qRot.w * invLength : 1.0f;
+        pPose->GetChannel(POSE_TRANS_X)[node] = tr.vTrans.x;
+        pPose->GetChannel(POSE_TRANS_Y)[node] = tr.vTrans.y;
+        pPose->GetChannel(POSE_TRANS_Z)[node] = tr.vTrans.z;
+        pPose->GetChannel(POSE_SCALE_X)[node] = tr.vScale.x;
+        pPose->GetChannel(POSE_SCALE_Y)[node] = tr.vScale.y;
+        pPose->GetChannel(POSE_SCALE_Z)[node] = tr.vScale.z;
+    }
+}
+
+bool ComputeAnimationBounds(const sModelDefinition* pModelDefinition, const sAnimation* pAnimation, int framesPerGroup, sAnimationBounds* pBounds, CJobPool* pJobPool)
+{
+    const sObjectMesh* pMesh = pModelDefinition->pMesh;
+    const int numGroups = pAnimation ? GetAnimationBoundsGroups(pAnimation->numNodeFrames, framesPerGroup) : 0;
+    if (!pMesh || !pMesh->pSkinWeights || !pMesh->pSkinBoneIndices || pMesh->numVertices <= 0 || !numGroups)
+        return false;
+
+    sSkeleton* pSkeleton = CreateSkeleton(pModelDefinition);
+    if (!pSkeleton || !pSkeleton->numBones)
+    {
+        LOG_ERROR("[Error] ComputeAnimationBounds(%s) - the model has no skeleton\n", pModelDefinition->szFileName);
+        DestroySkeleton(pSkeleton);
+        return false;
+    }
+
+    // a batch of keyframes goes through the skeleton and the skinning together
+    const int numVertices = pMesh->numVertices;
+    const int numPaletteBones = pSkeleton->numBones;
+    sPose lPoses[KHM_BOUNDS_BATCH_FRAMES];
+    sSkeletonInstance lSkeletons[KHM_BOUNDS_BATCH_FRAMES];
+    sSkinningInstance lSkins[KHM_BOUNDS_BATCH_FRAMES];
+    sMatrix3x4* pGlobals = new sMatrix3x4[(size_t)pSkeleton->numObjects * KHM_BOUNDS_BATCH_FRAMES];
+    sMatrix3x4* pPalettes = new sMatrix3x4[(size_t)numPaletteBones * KHM_BOUNDS_BATCH_FRAMES];
+    Vector3* pPositions = new Vector3[(size_t)numVertices * KHM_BOUNDS_BATCH_FRAMES];
+    sSkinningData* pSkinningData = CreateSkinningData(pMesh);
+    bool bOk = pSkinningData != NULL;
+
+    // every pose gets created, a failed one is left with no data for DestroyPose
+    for (int b = 0; b < KHM_BOUNDS_BATCH_FRAMES; ++b)
+    {
+        bOk = CreatePose(&lPoses[b], pAnimation->numNodes) && bOk;
+        lSkeletons[b].pPose = &lPoses[b];
+        lSkeletons[b].pRoot = NULL;
+        lSkeletons[b].pGlobals = pGlobals + (size_t)pSkeleton->numObjects * b;
+        lSkins[b].pPalette = pPalettes + (size_t)numPaletteBones * b;
+        lSkins[b].pPositions = pPositions + (size_t)numVertices * b;
+        lSkins[b].pNormals = NULL;
+    }
+
+    for (int g = 0; g < numGroups; ++g)
+    {
+        pBounds[g].min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+        pBounds[g].max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    }
+
+    if (!bOk)
+        LOG_ERROR("[Error] ComputeAnimationBounds(%s) - out of memory\n", pModelDefinition->szFileName);
+
+    for (int first = 0; bOk && first < pAnimation->numNodeFrames; first += KHM_BOUNDS_BATCH_FRAMES)
+    {
+        const int count = Min(KHM_BOUNDS_BATCH_FRAMES, pAnimation->numNodeFrames - first);
+        for (int b = 0; b < count; ++b)
+            PoseFromKeyframe(pAnimation, first + b, &lPoses[b]);
+
+        UpdateSkeletonInstances(pSkeleton, lSkeletons, count, pJobPool);
+        for (int b = 0; b < count; ++b)
+            BuildSkinningPalette(pSkeleton, lSkeletons[b].pGlobals, pPalettes + (size_t)numPaletteBones * b);
+
+        SkinInstances(pMesh, pSkinningData, lSkins, count, pJobPool);
+
+        for (int b = 0; b < count; ++b)
+        {
+            sAnimationBounds& bounds = pBounds[(first + b) / framesPerGroup];
+            const Vector3* pSkinned = lSkins[b].pPositions;
+            for (int v = 0; v < numVertices; ++v)
+            {
+                bounds.min.x = Min(bounds.min.x, pSkinned[v].x);
+                bounds.min.y = Min(bounds.min.y, pSkinned[v].y);
+                bounds.min.z = Min(bounds.min.z, pSkinned[v].z);
+                bounds.max.x = Max(bounds.max.x, pSkinned[v].x);
+                bounds.max.y = Max(bounds.max.y, pSkinned[v].y);
+                bounds.max.z = Max(bounds.max.z, pSkinned[v].z);
+            }
+        }
+    }
+
+    for (int b = 0; b < KHM_BOUNDS_BATCH_FRAMES; ++b)
+        DestroyPose(&lPoses[b]);
+
+    DestroySkinningData(pSkinningData);
+    delete[] pPositions;
+    delete[] pPalettes;
+    delete[] pGlobals;
+    DestroySkeleton(pSkeleton);
+    return bOk;
+}
+
+void GetAnimationBounds(const sAnimation* pAnimation, const sObjectMesh* pMesh, float timeMs, bool bLoop, sAnimationBounds& bounds)
+{
+    if (!pAnimation || !pAnimation->pBounds)
+    {
+        bounds.min = pMesh ? pMesh->min : Vector3(0.0f, 0.0f, 0.0f);
+        bounds.max = pMesh ? pMesh->max : Vector3(0.0f, 0.0f, 0.0f);
+        return;
+    }
+
+    int frame0, frame1;
+    float alpha;
+    GetKeyframes(pAnimation->numNodeFrames, pAnimation->frameDurationMs, timeMs, bLoop, frame0, frame1, alpha);
+
+    const sAnimationBounds& a = pAnimation->pBounds[frame0 / pAnimation->framesPerBoundsGroup];
+    const sAnimationBounds& b = pAnimation->pBounds[frame1 / pAnimation->framesPerBoundsGroup];
+    bounds.min = Vector3(Min(a.min.x, b.min.x), Min(a.min.y, b.min.y), Min(a.min.z, b.min.z));
+    bounds.max = Vector3(Max(a.max.x, b.max.x), Max(a.max.y, b.max.y), Max(a.max.z, b.max.z));
+}
+
+//
+// culling
+//
+// the local box goes to world space as a center and half extents ( |M| * extents ), which is exact for the
+// box's world AABB; a plane rejects it when the extents projected on its normal don't reach back inside
+//
+
+static inline void GetInstanceBox(const sCullInstance& instance, float* center, float* extents)
+{
+    sAnimationBounds bounds;
+    GetAnimationBounds(instance.pAnimation, instance.pMesh, instance.timeMs, instance.bLoop, bounds);
+    center[0] = (bounds.max.x + bounds.min.x) * 0.5f;
+    center[1] = (bounds.max.y + bounds.min.y) * 0.5f;
+    center[2] = (bounds.max.z + bounds.min.z) * 0.5f;
+    extents[0] = (bounds.max.x - bounds.min.x) * 0.5f;
+    extents[1] = (bounds.max.y - bounds.min.y) * 0.5f;
+    extents[2] = (bounds.max.z - bounds.min.z) * 0.5f;
+}
+
+static bool TestInstance(const sFrustum& frustum, const sCullInstance& instance)
+{
+    float center[3], extents[3];
+    GetInstanceBox(instance, center, extents);
+
+    const sMatrix3x4& m = *instance.pWorld;
+    float worldCenter[3], worldExtents[3];
+    for (int r = 0; r < 3; ++r)
+    {
+        worldCenter[r] = m.row[r][0] * center[0] + m.row[r][1] * center[1] + m.row[r][2] * center[2] + m.row[r][3];
+        worldExtents[r] = fabsf(m.row[r][0]) * extents[0] + fabsf(m.row[r][1]) * extents[1] + fabsf(m.row[r][2]) * extents[2];
+    }
+
+    for (int p = 0; p < 6; ++p)
+    {
+        const float* plane = frustum.planes[p];
+        const float distance = plane[0] * worldCenter[0] + plane[1] * worldCenter[1] + plane[2] * worldCenter[2] + plane[3];
+        const float radius = fabsf(plane[0]) * worldExtents[0] + fabsf(plane[1]) * worldExtents[1] + fabsf(plane[2]) * worldExtents[2];
+        if (distance + radius < 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+int CullInstancesReference(const sFrustum& frustum, const sCullInstance* pInstances, int numInstances, unsigned char* pVisible)
+{
+    int numVisible = 0;
+    for (int i = 0; i < numInstances; ++i)
+    {
+        pVisible[i] = TestInstance(frustum, pInstances[i]) ? 1 : 0;
+        numVisible += pVisible[i];
+    }
+
+    return numVisible;
+}
+
+//
+// SIMD kernel
+//
+// 4 instances per lane group: the boxes are looked up per instance, the matrices transposed into lanes
+//
+
+#if defined(KHM_SIMD_SSE)
+
+struct sFrustumSSE
+{
+    __m128                  normal[6][3];
+    __m128                  absNormal[6][3];
+    __m128                  d[6];
+};
+
+static void SetFrustumSSE(const sFrustum& frustum, sFrustumSSE& out)
+{
+    for (int p = 0; p < 6; ++p)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            out.normal[p][i] = _mm_set1_ps(frustum.planes[p][i]);
+            out.absNormal[p][i] = _mm_set1_ps(fabsf(frustum.planes[p][i]));
+        }
+
+        out.d[p] = _mm_set1_ps(frustum.planes[p][3]);
+    }
+}
+
+// lanes past count repeat the last instance; returns the visible lanes as bits
+static int CullInstancesSSE(const sFrustumSSE& frustum, const sCullInstance* pInstances, int count)
+{
+    float center[3][4];
+    float extents[3][4];
+    const sMatrix3x4* lWorlds[4];
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        const sCullInstance& instance = pInstances[Min(lane, count - 1)];
+        float c[3], e[3];
+        GetInstanceBox(instance, c, e);
+        for (int i = 0; i < 3; ++i)
+        {
+            center[i][lane] = c[i];
+            extents[i][lane] = e[i];
+        }
+
+        lWorlds[lane] = instance.pWorld;
+    }
+
+    const __m128 cx = _mm_loadu_ps(center[0]);
+    const __m128 cy = _mm_loadu_ps(center[1]);
+    const __m128 cz = _mm_loadu_ps(center[2]);
+    const __m128 ex = _mm_loadu_ps(extents[0]);
+    const __m128 ey = _mm_loadu_ps(extents[1]);
+    const __m128 ez = _mm_loadu_ps(extents[2]);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+    __m128 worldCenter[3], worldExtents[3];
+    for (int r = 0; r < 3; ++r)
+    {
+        __m128 m0 = _mm_loadu_ps(lWorlds[0]->row[r]);
+        __m128 m1 = _mm_loadu_ps(lWorlds[1]->row[r]);
+        __m128 m2 = _mm_loadu_ps(lWorlds[2]->row[r]);
+        __m128 m3 = _mm_loadu_ps(lWorlds[3]->row[r]);
+        _MM_TRANSPOSE4_PS(m0, m1, m2, m3);  // m0..m3 = row[r][0..3] of each instance
+
+        worldCenter[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, cx), _mm_mul_ps(m1, cy)), _mm_add_ps(_mm_mul_ps(m2, cz), m3));
+        worldExtents[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(m0, absMask), ex), _mm_mul_ps(_mm_and_ps(m1, absMask), ey)),
+                                     _mm_mul_ps(_mm_and_ps(m2, absMask), ez));
+    }
+
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; ++p)
+    {
+        const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(frustum.normal[p][0], worldCenter[0]), _mm_mul_ps(frustum.normal[p][1], worldCenter[1])),
+                                           _mm_add_ps(_mm_mul_ps(frustum.normal[p][2], worldCenter[2]), frustum.d[p]));
+        const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(frustum.absNormal[p][0], worldExtents[0]), _mm_mul_ps(frustum.absNormal[p][1], worldExtents[1])),
+                                         _mm_mul_ps(frustum.absNormal[p][2], worldExtents[2]));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+    }
+
+    return _mm_movemask_ps(inside);
+}
+
+#endif
+
+//
+// batches
+//
+
+struct sCullJob
+{
+    const sFrustum*         pFrustum;
+    const sCullInstance*    pInstances;
+    int                     numInstances;
+    unsigned char*          pVisible;
+    std::atomic<int>        numVisible;
+};
+
+// begin / end are groups of 4 instances
+static void CullInstancesJob(void* pUserData, int begin, int end)
+{
+    sCullJob* pJob = (sCullJob*)pUserData;
+    int numVisible = 0;
+
+#if defined(KHM_SIMD_SSE)
+    sFrustumSSE frustum;
+    SetFrustumSSE(*pJob->pFrustum, frustum);
+
+    for (int group = begin; group < end; ++group)
+    {
+        const int first = group * 4;
+        const int count = Min(4, pJob->numInstances - first);
+        const int lanes = CullInstancesSSE(frustum, pJob->pInstances + first, count);
+        for (int lane = 0; lane < count; ++lane)
+        {
+            pJob->pVisible[first + lane] = (unsigned char)((lanes >> lane) & 1);
+            numVisible += (lanes >> lane) & 1;
+        }
+    }
+#else
+    const int first = begin * 4;
+    const int count = Min(end * 4, pJob->numInstances) - first;
+    numVisible = CullInstancesReference(*pJob->pFrustum, pJob->pInstances + first, count, pJob->pVisible + first);
+#endif
+
+    pJob->numVisible += numVisible;
+}
+
+int CullInstances(const sFrustum& frustum, const sCullInstance* pInstances, int numInstances, unsigned char* pVisible, CJobPool* pJobPool)
+{
+    if (numInstances <= 0)
+        return 0;
+
+    sCullJob job;
+    job.pFrustum = &frustum;
+    job.pInstances = pInstances;
+    job.numInstances = numInstances;
+    job.pVisible = pVisible;
+    job.numVisible = 0;
+
+    const int numGroups = (numInstances + 3) / 4;
+    if (pJobPool)
+        pJobPool->ParallelFor(numGroups, KHM_CULL_BATCH_INSTANCES / 4, CullInstancesJob, &job);
+    else
+        CullInstancesJob(&job, 0, numGroups);
+
+    return job.numVisible;
+}
+
+}; // end namespace KHM
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMMath.h"
+
+namespace KHM
+{
+    class CJobPool;
+
+    //
+    // common defines for animated bounds and culling
+    //
+
+    #define KHM_BOUNDS_BATCH_FRAMES         16      // keyframes skinned at once by the bake
+    #define KHM_CULL_BATCH_INSTANCES        1024    // instances per culling job
+
+    //
+    // KHM Animated Bounds - the box the skinned mesh covers, per group of keyframes of a clip
+    //
+    // sMeshInfo::min / max only hold the bind pose. the boxes are baked offline ( khm-bake -bounds ) into
+    // SECTION_ANIMATION_BOUNDS and loaded in place. a time gets the union of the boxes of its two keyframes; the
+    // nlerped bones in between can reach slightly past it, larger groups give that some slack
+    //
+
+    int         GetAnimationBoundsGroups(int numNodeFrames, int framesPerGroup); // 0 = nothing to bake
+
+    // skins the mesh with every keyframe of the clip, straight from pNodeTransforms. pBounds holds
+    // GetAnimationBoundsGroups boxes. false = the mesh isn't skinned or the clip is empty
+    bool        ComputeAnimationBounds(const sModelDefinition* pModelDefinition, const sAnimation* pAnimation, int framesPerGroup, sAnimationBounds* pBounds, CJobPool* pJobPool);
+
+    // model space box at timeMs; the clip's baked boxes, else pMesh's bind pose box. timeMs is wrapped if bLoop, clamped otherwise
+    void        GetAnimationBounds(const sAnimation* pAnimation, const sObjectMesh* pMesh, float timeMs, bool bLoop, sAnimationBounds& bounds);
+
+    //
+    // KHM Cull Instance - one placed copy of an animated model
+    //
+
+    struct sCullInstance
+    {
+        const sAnimation*       pAnimation;     // optional; baked boxes at timeMs
+        const sObjectMesh*      pMesh;          // bind pose box, for clips without baked boxes
+        float                   timeMs;
+        bool                    bLoop;
+        const sMatrix3x4*       pWorld;         // model to world
+    };
+
+    // pVisible[i] = 1 if the world box of instance i touches the frustum, else 0; returns how many are visible.
+    // batches of instances per job, SIMD over the instances
+    int         CullInstances(const sFrustum& frustum, const sCullInstance* pInstances, int numInstances, unsigned char* pVisible, CJobPool* pJobPool);
+
+    // scalar reference; used to validate the SIMD path
+    int         CullInstancesReference(const sFrustum& frustum, const sCullInstance* pInstances, int numInstances, unsigned char* pVisible);
+};
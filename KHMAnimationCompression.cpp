@@ -0,0 +1,553 @@
+#include "KHMAnimationCompression.h"
+#include "KHMStats.h"
+#include "Kernel/Log.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+#include <chrono>
+
+namespace KHM {
+
+#define KHM_SMALLEST_THREE_RANGE    0.70710678f // 1 / sqrt(2); the 3 smallest components of a unit quat are within +/- this
+
+//
+// helpers
+//
+
+static void NormalizeQuat(float* q)
+{
+    const float len = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    const float invLen = (len > 0.0f) ? 1.0f / len : 0.0f;
+    q[0] *= invLen; q[1] *= invLen; q[2] *= invLen; q[3] *= invLen;
+}
+
+static void NlerpQuat(const float* a, const float* b, float t, float* out)
+{
+    const float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    const float wb = (dot < 0.0f) ? -t : t;
+    const float wa = 1.0f - t;
+    for (int c = 0; c < 4; ++c)
+        out[c] = a[c] * wa + b[c] * wb;
+    NormalizeQuat(out);
+}
+
+static float QuatError(const float* a, const float* b)
+{
+    // q and -q are the same rotation
+    float errPos = 0.0f, errNeg = 0.0f;
+    for (int c = 0; c < 4; ++c)
+    {
+        errPos = Max(errPos, fabsf(a[c] - b[c]));
+        errNeg = Max(errNeg, fabsf(a[c] + b[c]));
+    }
+    return Min(errPos, errNeg);
+}
+
+static void EncodeSmallestThree(const float* qIn, unsigned short* pOut)
+{
+    float q[4] = { qIn[0], qIn[1], qIn[2], qIn[3] };
+    NormalizeQuat(q);
+
+    int largest = 0;
+    for (int c = 1; c < 4; ++c)
+    {
+        if (fabsf(q[c]) > fabsf(q[largest]))
+            largest = c;
+    }
+
+    // the dropped component is rebuilt as positive
+    const float sign = (q[largest] < 0.0f) ? -1.0f : 1.0f;
+    const unsigned int maxValue = (1u << KHM_ROTATION_BITS) - 1;
+
+    unsigned long long packed = (unsigned long long)largest;
+    int shift = 2;
+    for (int c = 0; c < 4; ++c)
+    {
+        if (c == largest)
+            continue;
+
+        const float v = (q[c] * sign + KHM_SMALLEST_THREE_RANGE) / (2.0f * KHM_SMALLEST_THREE_RANGE);
+        const unsigned int qv = (unsigned int)Max(0.0f, Min(v * (float)maxValue + 0.5f, (float)maxValue));
+        packed |= (unsigned long long)qv << shift;
+        shift += KHM_ROTATION_BITS;
+    }
+
+    pOut[0] = (unsigned short)(packed);
+    pOut[1] = (unsigned short)(packed >> 16);
+    pOut[2] = (unsigned short)(packed >> 32);
+}
+
+static void DecodeSmallestThree(const unsigned short* pIn, float* q)
+{
+    const unsigned long long packed = (unsigned long long)pIn[0] | ((unsigned long long)pIn[1] << 16) | ((unsigned long long)pIn[2] << 32);
+    const unsigned int maxValue = (1u << KHM_ROTATION_BITS) - 1;
+    const float scale = (2.0f * KHM_SMALLEST_THREE_RANGE) / (float)maxValue;
+
+    const int largest = (int)(packed & 3);
+    int shift = 2;
+    float sum = 0.0f;
+    for (int c = 0; c < 4; ++c)
+    {
+        if (c == largest)
+            continue;
+
+        const unsigned int qv = (unsigned int)(packed >> shift) & maxValue;
+        q[c] = (float)qv * scale - KHM_SMALLEST_THREE_RANGE;
+        sum += q[c] * q[c];
+        shift += KHM_ROTATION_BITS;
+    }
+
+    q[largest] = sqrtf(Max(0.0f, 1.0f - sum));
+}
+
+static unsigned int ReadBits(const unsigned int* pWords, unsigned int uiBitOffset, unsigned int numBits)
+{
+    // the stream has a padding word at the end, so reading the next word is always safe
+    const unsigned int index = uiBitOffset >> 5;
+    const unsigned int shift = uiBitOffset & 31;
+    const unsigned long long v = (unsigned long long)pWords[index] | ((unsigned long long)pWords[index + 1] << 32);
+    return (unsigned int)(v >> shift) & ((1u << numBits) - 1);
+}
+
+static void WriteBits(std::vector<unsigned int>& words, unsigned int& uiBitOffset, unsigned int value, unsigned int numBits)
+{
+    while (words.size() < ((uiBitOffset + numBits) >> 5) + 2)
+        words.push_back(0);
+
+    const unsigned int index = uiBitOffset >> 5;
+    const unsigned int shift = uiBitOffset & 31;
+    const unsigned long long v = (unsigned long long)value << shift;
+    words[index] |= (unsigned int)v;
+    words[index + 1] |= (unsigned int)(v >> 32);
+    uiBitOffset += numBits;
+}
+
+static void GetNodeValue(const sNodeTransform& tr, int type, float* out)
+{
+    switch (type)
+    {
+        case TRACK_ROTATION:
+            out[0] = tr.qRot.x; out[1] = tr.qRot.y; out[2] = tr.qRot.z; out[3] = tr.qRot.w;
+            break;
+        case TRACK_TRANSLATION:
+            out[0] = tr.vTrans.x; out[1] = tr.vTrans.y; out[2] = tr.vTrans.z;
+            break;
+        default:
+            out[0] = tr.vScale.x; out[1] = tr.vScale.y; out[2] = tr.vScale.z;
+            break;
+    }
+}
+
+//
+// compression
+//
+
+struct sTrackBuilder
+{
+    std::vector<sCompressedTrack>   tracks;
+    std::vector<float>              floats;
+    std::vector<unsigned short>     rotations;
+    std::vector<unsigned int>       bits;
+    unsigned int                    uiBitOffset;
+    int                             numCappedTracks;
+};
+
+static void CompressRotationTrack(const sAnimation* pAnimation, int node, float maxError, sTrackBuilder& builder, sCompressedTrack& track)
+{
+    const int numFrames = pAnimation->numNodeFrames;
+
+    // keep the track continuous, so constant / linear detection isn't fooled by q / -q flips
+    std::vector<float> values(numFrames * 4);
+    for (int f = 0; f < numFrames; ++f)
+    {
+        float* q = &values[f * 4];
+        GetNodeValue(pAnimation->pNodeTransforms[f * pAnimation->numNodes + node], TRACK_ROTATION, q);
+        NormalizeQuat(q);
+
+        if (f > 0)
+        {
+            const float* prev = &values[(f - 1) * 4];
+            if (q[0] * prev[0] + q[1] * prev[1] + q[2] * prev[2] + q[3] * prev[3] < 0.0f)
+            {
+                q[0] = -q[0]; q[1] = -q[1]; q[2] = -q[2]; q[3] = -q[3];
+            }
+        }
+    }
+
+    const float* first = &values[0];
+    const float* last = &values[(numFrames - 1) * 4];
+
+    bool bConstant = true;
+    bool bLinear = numFrames > 2;
+    for (int f = 1; f < numFrames && (bConstant || bLinear); ++f)
+    {
+        const float* q = &values[f * 4];
+        if (QuatError(q, first) > maxError)
+            bConstant = false;
+
+        float ql[4];
+        NlerpQuat(first, last, (float)f / (float)(numFrames - 1), ql);
+        if (QuatError(q, ql) > maxError)
+            bLinear = false;
+    }
+
+    track.uiFloatOffset = (unsigned int)builder.floats.size();
+    if (bConstant)
+    {
+        track.format = TRACK_CONSTANT;
+        builder.floats.insert(builder.floats.end(), first, first + 4);
+    }
+    else if (bLinear)
+    {
+        track.format = TRACK_LINEAR;
+        builder.floats.insert(builder.floats.end(), first, first + 4);
+        builder.floats.insert(builder.floats.end(), last, last + 4);
+    }
+    else
+    {
+        track.format = TRACK_ANIMATED;
+        track.uiDataOffset = (unsigned int)builder.rotations.size();
+        builder.rotations.resize(builder.rotations.size() + numFrames * 3);
+        for (int f = 0; f < numFrames; ++f)
+            EncodeSmallestThree(&values[f * 4], &builder.rotations[track.uiDataOffset + f * 3]);
+    }
+}
+
+static void CompressVectorTrack(const sAnimation* pAnimation, int node, int type, float maxError, sTrackBuilder& builder, sCompressedTrack& track)
+{
+    const int numFrames = pAnimation->numNodeFrames;
+
+    std::vector<float> values(numFrames * 3);
+    for (int f = 0; f < numFrames; ++f)
+        GetNodeValue(pAnimation->pNodeTransforms[f * pAnimation->numNodes + node], type, &values[f * 3]);
+
+    const float* first = &values[0];
+    const float* last = &values[(numFrames - 1) * 3];
+
+    bool bConstant = true;
+    bool bLinear = numFrames > 2;
+    float vMin[3] = { first[0], first[1], first[2] };
+    float vMax[3] = { first[0], first[1], first[2] };
+    for (int f = 1; f < numFrames; ++f)
+    {
+        const float* v = &values[f * 3];
+        const float t = (float)f / (float)(numFrames - 1);
+        for (int c = 0; c < 3; ++c)
+        {
+            if (fabsf(v[c] - first[c]) > maxError)
+                bConstant = false;
+            if (fabsf(v[c] - (first[c] + (last[c] - first[c]) * t)) > maxError)
+                bLinear = false;
+
+            vMin[c] = Min(vMin[c], v[c]);
+            vMax[c] = Max(vMax[c], v[c]);
+        }
+    }
+
+    track.uiFloatOffset = (unsigned int)builder.floats.size();
+    if (bConstant)
+    {
+        track.format = TRACK_CONSTANT;
+        builder.floats.insert(builder.floats.end(), first, first + 3);
+        return;
+    }
+
+    if (bLinear)
+    {
+        track.format = TRACK_LINEAR;
+        builder.floats.insert(builder.floats.end(), first, first + 3);
+        builder.floats.insert(builder.floats.end(), last, last + 3);
+        return;
+    }
+
+    // variable bit rate: the fewest bits that keep the quantization error ( half a step ) within budget
+    float extent[3];
+    unsigned int numBits = 1;
+    for (int c = 0; c < 3; ++c)
+    {
+        extent[c] = vMax[c] - vMin[c];
+        while (numBits < KHM_MAX_TRACK_BITS && (extent[c] / (float)((1u << numBits) - 1)) * 0.5f > maxError)
+            ++numBits;
+    }
+
+    // KHM_MAX_TRACK_BITS wins over the budget; counted so the caller gets to know
+    for (int c = 0; c < 3; ++c)
+    {
+        if ((extent[c] / (float)((1u << numBits) - 1)) * 0.5f > maxError)
+        {
+            ++builder.numCappedTracks;
+            break;
+        }
+    }
+
+    track.format = TRACK_ANIMATED;
+    track.numBits = (unsigned char)numBits;
+    track.uiDataOffset = builder.uiBitOffset;
+    builder.floats.insert(builder.floats.end(), vMin, vMin + 3);
+    builder.floats.insert(builder.floats.end(), extent, extent + 3);
+
+    const unsigned int maxValue = (1u << numBits) - 1;
+    for (int f = 0; f < numFrames; ++f)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            const float v = (extent[c] > 0.0f) ? (values[f * 3 + c] - vMin[c]) / extent[c] : 0.0f;
+            const unsigned int qv = (unsigned int)Max(0.0f, Min(v * (float)maxValue + 0.5f, (float)maxValue));
+            WriteBits(builder.bits, builder.uiBitOffset, qv, numBits);
+        }
+    }
+}
+
+sCompressedAnimation* CompressAnimation(const sAnimation* pAnimation, const sCompressionSettings& settings, sCompressionStats* pStats)
+{
+    if (!pAnimation || !pAnimation->pNodeTransforms || pAnimation->numNodes <= 0 || pAnimation->numNodeFrames <= 0)
+        return NULL;
+
+    sTrackBuilder builder;
+    builder.uiBitOffset = 0;
+    builder.numCappedTracks = 0;
+    builder.tracks.resize(pAnimation->numNodes * NUM_TRACK_TYPES);
+
+    for (int node = 0; node < pAnimation->numNodes; ++node)
+    {
+        sCompressedTrack* pTracks = &builder.tracks[node * NUM_TRACK_TYPES];
+        memset(pTracks, 0, sizeof(sCompressedTrack) * NUM_TRACK_TYPES);
+
+        CompressRotationTrack(pAnimation, node, settings.rotationError, builder, pTracks[TRACK_ROTATION]);
+        CompressVectorTrack(pAnimation, node, TRACK_TRANSLATION, settings.translationError, builder, pTracks[TRACK_TRANSLATION]);
+        CompressVectorTrack(pAnimation, node, TRACK_SCALE, settings.scaleError, builder, pTracks[TRACK_SCALE]);
+    }
+
+    // the stream always ends with a padding word, ReadBits relies on it
+    builder.bits.resize(((builder.uiBitOffset + 31) >> 5) + 1, 0);
+
+    sCompressedAnimation header;
+    header.uiVer = KHM_COMPRESSED_ANIM_VERSION;
+    header.numNodes = pAnimation->numNodes;
+    header.numNodeFrames = pAnimation->numNodeFrames;
+    header.frameDurationMs = pAnimation->frameDurationMs;
+    header.numFloats = (unsigned int)builder.floats.size();
+    header.numRotationWords = (unsigned int)builder.rotations.size();
+    header.numBitWords = (unsigned int)builder.bits.size();
+
+    const unsigned int uiRotationWordsPadded = (header.numRotationWords + 1) & ~1u;
+    header.uiSize = (unsigned int)(sizeof(sCompressedAnimation) +
+                                   sizeof(sCompressedTrack) * builder.tracks.size() +
+                                   sizeof(float) * header.numFloats +
+                                   sizeof(unsigned short) * uiRotationWordsPadded +
+                                   sizeof(unsigned int) * header.numBitWords);
+
+    if (builder.numCappedTracks)
+        LOG_ERROR("[Warning] CompressAnimation() - %d tracks need more than %d bits, their error is over budget\n", builder.numCappedTracks, KHM_MAX_TRACK_BITS);
+
+    sCompressedAnimation* pCompressed = (sCompressedAnimation*)malloc(header.uiSize);
+    if (!pCompressed)
+    {
+        LOG_ERROR("[Error] CompressAnimation() - out of memory\n");
+        return NULL;
+    }
+    KHM_STATS_ALLOC(header.uiSize);
+
+    // the builder's scratch, once per vector at its final size; the growth steps are not counted
+    KHM_STATS_ALLOC(sizeof(sCompressedTrack) * builder.tracks.capacity());
+    KHM_STATS_ALLOC(sizeof(float) * builder.floats.capacity());
+    KHM_STATS_ALLOC(sizeof(unsigned short) * builder.rotations.capacity());
+    KHM_STATS_ALLOC(sizeof(unsigned int) * builder.bits.capacity());
+    memset(pCompressed, 0, header.uiSize);
+    *pCompressed = header;
+
+    memcpy((void*)pCompressed->GetTracks(), &builder.tracks[0], sizeof(sCompressedTrack) * builder.tracks.size());
+    if (header.numFloats)
+        memcpy((void*)pCompressed->GetFloats(), &builder.floats[0], sizeof(float) * header.numFloats);
+    if (header.numRotationWords)
+        memcpy((void*)pCompressed->GetRotations(), &builder.rotations[0], sizeof(unsigned short) * header.numRotationWords);
+    memcpy((void*)pCompressed->GetBits(), &builder.bits[0], sizeof(unsigned int) * header.numBitWords);
+
+    if (pStats)
+    {
+        memset(pStats, 0, sizeof(sCompressionStats));
+        pStats->uiRawBytes = (unsigned int)(sizeof(sNodeTransform) * pAnimation->numNodes * pAnimation->numNodeFrames);
+        pStats->uiCompressedBytes = header.uiSize;
+        for (size_t i = 0; i < builder.tracks.size(); ++i)
+            ++pStats->numTracks[i % NUM_TRACK_TYPES][builder.tracks[i].format];
+        pStats->numCappedTracks = builder.numCappedTracks;
+    }
+
+    return pCompressed;
+}
+
+void DestroyCompressedAnimation(sCompressedAnimation* pCompressed)
+{
+    free(pCompressed);
+}
+
+//
+// decompression
+//
+
+static void DecodeVector(const sCompressedAnimation* pCompressed, const sCompressedTrack& track, int frame0, int frame1, float alpha, float* out)
+{
+    const float* pFloats = pCompressed->GetFloats() + track.uiFloatOffset;
+    switch (track.format)
+    {
+        case TRACK_CONSTANT:
+            out[0] = pFloats[0]; out[1] = pFloats[1]; out[2] = pFloats[2];
+            break;
+
+        case TRACK_LINEAR:
+        {
+            const float t = ((float)frame0 + alpha) / (float)Max(pCompressed->numNodeFrames - 1, 1);
+            for (int c = 0; c < 3; ++c)
+                out[c] = pFloats[c] + (pFloats[3 + c] - pFloats[c]) * t;
+            break;
+        }
+
+        default:
+        {
+            const unsigned int* pBits = pCompressed->GetBits();
+            const unsigned int numBits = track.numBits;
+            const float invMax = 1.0f / (float)((1u << numBits) - 1);
+            const unsigned int uiOffset0 = track.uiDataOffset + frame0 * 3 * numBits;
+            const unsigned int uiOffset1 = track.uiDataOffset + frame1 * 3 * numBits;
+            for (int c = 0; c < 3; ++c)
+            {
+                const float v0 = (float)ReadBits(pBits, uiOffset0 + c * numBits, numBits) * invMax;
+                const float v1 = (float)ReadBits(pBits, uiOffset1 + c * numBits, numBits) * invMax;
+                out[c] = pFloats[c] + (v0 + (v1 - v0) * alpha) * pFloats[3 + c];
+            }
+            break;
+        }
+    }
+}
+
+static void DecodeRotation(const sCompressedAnimation* pCompressed, const sCompressedTrack& track, int frame0, int frame1, float alpha, float* out)
+{
+    const float* pFloats = pCompressed->GetFloats() + track.uiFloatOffset;
+    switch (track.format)
+    {
+        case TRACK_CONSTANT:
+            out[0] = pFloats[0]; out[1] = pFloats[1]; out[2] = pFloats[2]; out[3] = pFloats[3];
+            break;
+
+        case TRACK_LINEAR:
+            NlerpQuat(pFloats, pFloats + 4, ((float)frame0 + alpha) / (float)Max(pCompressed->numNodeFrames - 1, 1), out);
+            break;
+
+        default:
+        {
+            const unsigned short* pRotations = pCompressed->GetRotations() + track.uiDataOffset;
+            float q0[4], q1[4];
+            DecodeSmallestThree(pRotations + frame0 * 3, q0);
+            DecodeSmallestThree(pRotations + frame1 * 3, q1);
+            NlerpQuat(q0, q1, alpha, out);
+            break;
+        }
+    }
+}
+
+void SampleCompressedPose(const sCompressedAnimation* pCompressed, int frame0, int frame1, float alpha, sPose* pPose)
+{
+    ASSERT(pPose->numNodes == pCompressed->numNodes);
+
+    const sCompressedTrack* pTracks = pCompressed->GetTracks();
+    float* pOut[NUM_POSE_CHANNELS];
+    for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+        pOut[ch] = pPose->GetChannel(ch);
+
+    for (int node = 0; node < pCompressed->numNodes; ++node)
+    {
+        const sCompressedTrack* pNodeTracks = &pTracks[node * NUM_TRACK_TYPES];
+
+        float q[4], t[3], s[3];
+        DecodeRotation(pCompressed, pNodeTracks[TRACK_ROTATION], frame0, frame1, alpha, q);
+        DecodeVector(pCompressed, pNodeTracks[TRACK_TRANSLATION], frame0, frame1, alpha, t);
+        DecodeVector(pCompressed, pNodeTracks[TRACK_SCALE], frame0, frame1, alpha, s);
+
+        pOut[POSE_ROT_X][node] = q[0];
+        pOut[POSE_ROT_Y][node] = q[1];
+        pOut[POSE_ROT_Z][node] = q[2];
+        pOut[POSE_ROT_W][node] = q[3];
+        pOut[POSE_TRANS_X][node] = t[0];
+        pOut[POSE_TRANS_Y][node] = t[1];
+        pOut[POSE_TRANS_Z][node] = t[2];
+        pOut[POSE_SCALE_X][node] = s[0];
+        pOut[POSE_SCALE_Y][node] = s[1];
+        pOut[POSE_SCALE_Z][node] = s[2];
+    }
+}
+
+void SampleCompressedPose(const sCompressedAnimation* pCompressed, float timeMs, bool bLoop, sPose* pPose)
+{
+    int frame0, frame1;
+    float alpha;
+    GetKeyframes(pCompressed->numNodeFrames, pCompressed->frameDurationMs, timeMs, bLoop, frame0, frame1, alpha);
+    SampleCompressedPose(pCompressed, frame0, frame1, alpha, pPose);
+}
+
+//
+// stats
+//
+
+void MeasureCompressedAnimation(const sAnimation* pAnimation, const sCompressedAnimation* pCompressed, sCompressionStats* pStats)
+{
+    sPose pose;
+    if (!CreatePose(&pose, pAnimation->numNodes))
+        return;
+
+    // error, on every keyframe
+    for (int type = 0; type < NUM_TRACK_TYPES; ++type)
+        pStats->maxError[type] = 0.0f;
+
+    for (int f = 0; f < pAnimation->numNodeFrames; ++f)
+    {
+        SampleCompressedPose(pCompressed, f, f, 0.0f, &pose);
+
+        for (int node = 0; node < pAnimation->numNodes; ++node)
+        {
+            const sNodeTransform& tr = pAnimation->pNodeTransforms[f * pAnimation->numNodes + node];
+
+            float src[4], dst[4];
+            GetNodeValue(tr, TRACK_ROTATION, src);
+            NormalizeQuat(src);
+            for (int c = 0; c < 4; ++c)
+                dst[c] = pose.GetChannel(POSE_ROT_X + c)[node];
+            pStats->maxError[TRACK_ROTATION] = Max(pStats->maxError[TRACK_ROTATION], QuatError(src, dst));
+
+            for (int type = TRACK_TRANSLATION; type < NUM_TRACK_TYPES; ++type)
+            {
+                const int channel = (type == TRACK_TRANSLATION) ? POSE_TRANS_X : POSE_SCALE_X;
+                GetNodeValue(tr, type, src);
+                for (int c = 0; c < 3; ++c)
+                    pStats->maxError[type] = Max(pStats->maxError[type], fabsf(src[c] - pose.GetChannel(channel + c)[node]));
+            }
+        }
+    }
+
+    // sampling cost, compressed vs SoA tracks, over the whole clip
+    const int numSamples = 256;
+    const float durationMs = pAnimation->frameDurationMs * (float)Max(pAnimation->numNodeFrames - 1, 1);
+    const float stepMs = durationMs / (float)numSamples;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numSamples; ++i)
+        SampleCompressedPose(pCompressed, stepMs * (float)i, true, &pose);
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    pStats->sampleCostNs = (float)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (float)numSamples;
+
+    sAnimationTracks* pTracks = CreateAnimationTracks(pAnimation);
+    if (pTracks)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < numSamples; ++i)
+            SamplePose(pTracks, stepMs * (float)i, true, &pose);
+        end = std::chrono::high_resolution_clock::now();
+        pStats->rawSampleCostNs = (float)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (float)numSamples;
+
+        DestroyAnimationTracks(pTracks);
+    }
+
+    DestroyPose(&pose);
+}
+
+}; // end namespace KHM
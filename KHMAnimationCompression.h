@@ -0,0 +1,112 @@
+#pragma once
+
+#include "KHMAnimation.h"
+
+namespace KHM
+{
+    //
+    // common defines for compressed animations
+    //
+
+    #define KHM_COMPRESSED_ANIM_VERSION     1
+    #define KHM_ROTATION_BITS               15      // per component, smallest three; 3 * 15 + 2 bits index = 48 bits per rotation
+    #define KHM_MAX_TRACK_BITS              16      // max bits per component for translation / scale
+
+    //
+    // KHM Compressed Animation
+    //
+    // every node has 3 tracks ( rotation, translation, scale ), each one stored as:
+    //  constant - a single value
+    //  linear   - first and last value, the track is a straight line in between ( within the error budget )
+    //  animated - rotation: smallest three, 48 bits per frame
+    //             translation / scale: per track range + N bits per component, N picked from the error budget
+    //
+    // the whole clip is a single relocatable block: [sCompressedAnimation][tracks][floats][rotations][bitstream]
+    // so it can be saved / loaded / packed as is
+    //
+
+    enum eTrackFormat
+    {
+        TRACK_CONSTANT = 0,
+        TRACK_LINEAR,
+        TRACK_ANIMATED,
+    };
+
+    enum eTrackType
+    {
+        TRACK_ROTATION = 0,
+        TRACK_TRANSLATION,
+        TRACK_SCALE,
+
+        NUM_TRACK_TYPES
+    };
+
+    struct sCompressedTrack // keep 4-byte aligned
+    {
+        unsigned char           format;         // eTrackFormat
+        unsigned char           numBits;        // bits per component; animated translation / scale only
+        unsigned short          reserved;
+        unsigned int            uiFloatOffset;  // constant: value; linear: first, last; animated vec3: min, extent
+        unsigned int            uiDataOffset;   // animated rotation: first ushort; animated vec3: first bit
+    };
+
+    struct sCompressedAnimation
+    {
+        unsigned int            uiVer;
+        unsigned int            uiSize;             // total size of the block, this header included
+        int                     numNodes;
+        int                     numNodeFrames;
+        float                   frameDurationMs;
+        unsigned int            numFloats;
+        unsigned int            numRotationWords;   // ushorts
+        unsigned int            numBitWords;        // uints; the stream is padded with an extra word
+
+        const sCompressedTrack* GetTracks() const { return (const sCompressedTrack*)(this + 1); }
+        const float*            GetFloats() const { return (const float*)(GetTracks() + numNodes * NUM_TRACK_TYPES); }
+        const unsigned short*   GetRotations() const { return (const unsigned short*)(GetFloats() + numFloats); }
+        const unsigned int*     GetBits() const { return (const unsigned int*)(GetRotations() + ((numRotationWords + 1) & ~1u)); }
+    };
+
+    struct sCompressionSettings
+    {
+        sCompressionSettings()
+        {
+            rotationError       = 0.0005f;  // quaternion component
+            translationError    = 0.0005f;  // model units
+            scaleError          = 0.0005f;
+        }
+
+        float                   rotationError;
+        float                   translationError;
+        float                   scaleError;
+    };
+
+    struct sCompressionStats
+    {
+        unsigned int            uiRawBytes;         // pNodeTransforms
+        unsigned int            uiCompressedBytes;
+        int                     numTracks[NUM_TRACK_TYPES][TRACK_ANIMATED + 1]; // [type][format]
+        int                     numCappedTracks;    // animated tracks held to KHM_MAX_TRACK_BITS, over their error budget
+        float                   maxError[NUM_TRACK_TYPES];  // measured over every frame
+        float                   sampleCostNs;       // per pose, compressed
+        float                   rawSampleCostNs;    // per pose, SoA tracks; for reference
+    };
+
+    //
+    // compression
+    //
+
+    // returns a block allocated with malloc(); free it with DestroyCompressedAnimation
+    sCompressedAnimation*   CompressAnimation(const sAnimation* pAnimation, const sCompressionSettings& settings, sCompressionStats* pStats);
+    void                    DestroyCompressedAnimation(sCompressedAnimation* pCompressed);
+
+    // fills in the error and sampling cost members of pStats
+    void                    MeasureCompressedAnimation(const sAnimation* pAnimation, const sCompressedAnimation* pCompressed, sCompressionStats* pStats);
+
+    //
+    // decompression - samples straight from the compressed data
+    //
+
+    void                    SampleCompressedPose(const sCompressedAnimation* pCompressed, float timeMs, bool bLoop, sPose* pPose);
+    void                    SampleCompressedPose(const sCompressedAnimation* pCompressed, int frame0, int frame1, float alpha, sPose* pPose);
+};
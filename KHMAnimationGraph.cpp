@@ -0,0 +1,631 @@
+#include "KHMAnimationGraph.h"
+#include "KHMAnimationCompression.h"
+#include "KHMJobs.h"
+#include "KHMSimd.h"
+#include "Kernel/Log.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace KHM {
+
+//
+// clips
+//
+
+static bool IsClipUsable(const sAnimation* pAnimation)
+{
+    return pAnimation && pAnimation->numNodes > 0 && pAnimation->numNodeFrames > 0;
+}
+
+static void SetPosePadding(sPose* pPose)
+{
+    for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+    {
+        const float value = (ch == POSE_ROT_W || ch >= POSE_SCALE_X) ? 1.0f : 0.0f;
+        float* pChannel = pPose->GetChannel(ch);
+        for (int i = pPose->numNodes; i < pPose->numNodesPadded; ++i)
+            pChannel[i] = value;
+    }
+}
+
+void SampleAnimation(const sAnimation* pAnimation, float timeMs, bool bLoop, sPose* pPose)
+{
+    if (pAnimation->pTracks)
+    {
+        SamplePose(pAnimation->pTracks, timeMs, bLoop, pPose);
+    }
+    else if (pAnimation->pCompressed)
+    {
+        // only writes the nodes; the kernels below run over the padding too
+        SampleCompressedPose(pAnimation->pCompressed, timeMs, bLoop, pPose);
+        SetPosePadding(pPose);
+    }
+    else
+    {
+        SamplePoseReference(pAnimation, timeMs, bLoop, pPose);
+    }
+}
+
+void SampleAnimation(const sAnimation* pAnimation, int frame0, int frame1, float alpha, sPose* pPose)
+{
+    if (pAnimation->pTracks)
+    {
+        SamplePose(pAnimation->pTracks, frame0, frame1, alpha, pPose);
+    }
+    else if (pAnimation->pCompressed)
+    {
+        SampleCompressedPose(pAnimation->pCompressed, frame0, frame1, alpha, pPose);
+        SetPosePadding(pPose);
+    }
+    else
+    {
+        // the reference sampler only takes a time; frame1 is frame0 or the one after it
+        const float frame = (frame1 > frame0) ? (float)frame0 + alpha : (float)frame0;
+        SamplePoseReference(pAnimation, frame * pAnimation->frameDurationMs, false, pPose);
+    }
+}
+
+// pOut = the rest pose, identity past it
+static void SetRestPose(const sAnimationGraph* pGraph, sPose* pOut)
+{
+    SetPoseIdentity(pOut);
+
+    const sPose* pRest = pGraph->pRestPose;
+    if (!pRest)
+        return;
+
+    const int numNodes = Min(pRest->numNodes, pOut->numNodes);
+    for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+        memcpy(pOut->GetChannel(ch), pRest->GetChannel(ch), sizeof(float) * numNodes);
+}
+
+//
+// graph
+//
+
+bool CreateAnimationGraph(sAnimationGraph* pGraph)
+{
+    ASSERT(pGraph->numLayers >= 0 && pGraph->numLayers <= KHM_MAX_GRAPH_LAYERS);
+
+    pGraph->numNodes = 0;
+    for (int l = 0; l < KHM_MAX_GRAPH_LAYERS; ++l)
+    {
+        for (int c = 0; c < KHM_MAX_LAYER_CLIPS; ++c)
+        {
+            sPose& reference = pGraph->layers[l].references[c];
+            reference.pData = NULL;
+            reference.numNodes = 0;
+            reference.numNodesPadded = 0;
+        }
+    }
+
+    for (int l = 0; l < pGraph->numLayers; ++l)
+    {
+        sAnimationGraphLayer& layer = pGraph->layers[l];
+        ASSERT(layer.numClips >= 0 && layer.numClips <= KHM_MAX_LAYER_CLIPS);
+
+        for (int c = 0; c < layer.numClips; ++c)
+        {
+            const sAnimation* pAnimation = layer.clips[c].pAnimation;
+            if (!IsClipUsable(pAnimation))
+                continue;
+
+            pGraph->numNodes = Max(pGraph->numNodes, pAnimation->numNodes);
+            if (layer.mode != LAYER_ADDITIVE)
+                continue;
+
+            sPose& reference = layer.references[c];
+            if (!CreatePose(&reference, pAnimation->numNodes))
+            {
+                LOG_ERROR("[Error] CreateAnimationGraph() - out of memory for the additive reference of layer %d\n", l);
+                DestroyAnimationGraph(pGraph);
+                return false;
+            }
+
+            // first frame, inverted: conjugate rotation, translation as is ( subtracted ), reciprocal scale
+            SampleAnimation(pAnimation, 0, 0, 0.0f, &reference);
+            for (int ch = POSE_ROT_X; ch <= POSE_ROT_Z; ++ch)
+            {
+                float* pChannel = reference.GetChannel(ch);
+                for (int i = 0; i < reference.numNodes; ++i)
+                    pChannel[i] = -pChannel[i];
+            }
+            for (int ch = POSE_SCALE_X; ch <= POSE_SCALE_Z; ++ch)
+            {
+                float* pChannel = reference.GetChannel(ch);
+                for (int i = 0; i < reference.numNodes; ++i)
+                    pChannel[i] = (pChannel[i] != 0.0f) ? 1.0f / pChannel[i] : 1.0f;
+            }
+        }
+    }
+
+    return true;
+}
+
+void DestroyAnimationGraph(sAnimationGraph* pGraph)
+{
+    for (int l = 0; l < KHM_MAX_GRAPH_LAYERS; ++l)
+    {
+        for (int c = 0; c < KHM_MAX_LAYER_CLIPS; ++c)
+        {
+            if (pGraph->layers[l].references[c].pData)
+                DestroyPose(&pGraph->layers[l].references[c]);
+        }
+    }
+}
+
+void InitAnimationGraphInstance(sAnimationGraphInstance* pInstance, const sAnimationGraph* pGraph, sPose* pPose)
+{
+    memset(pInstance, 0, sizeof(sAnimationGraphInstance));
+    pInstance->pGraph = pGraph;
+    pInstance->pPose = pPose;
+
+    // the first clip of every layer, full weight
+    for (int l = 0; l < KHM_MAX_GRAPH_LAYERS; ++l)
+    {
+        pInstance->clipWeights[l][0] = 1.0f;
+        pInstance->layerWeights[l] = 1.0f;
+    }
+}
+
+//
+// scalar reference
+//
+
+static void MultiplyQuaternion(const float* a, const float* b, float* out)
+{
+    const float x = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+    const float y = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+    const float z = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+    const float w = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+    out[0] = x;
+    out[1] = y;
+    out[2] = z;
+    out[3] = w;
+}
+
+static void NormalizeQuaternion(float* q)
+{
+    const float lenSq = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+    const float invLen = 1.0f / sqrtf(Max(lenSq, 1e-30f));
+    for (int k = 0; k < 4; ++k)
+        q[k] *= invLen;
+}
+
+//
+// scratch
+//
+
+// one clip pose and the layer accumulator, grown as needed; the SIMD path keeps the channels then the weight sums,
+// the reference path the channels and the weight sum per node
+static bool ReserveGraphScratch(sAnimationGraphScratch& scratch, int numNodesPadded)
+{
+    if (numNodesPadded <= scratch.numNodesPadded)
+        return true;
+
+    AlignedFree(scratch.pData);
+    scratch.pData = (float*)AlignedAlloc(sizeof(float) * (NUM_POSE_CHANNELS * 2 + 1) * numNodesPadded);
+    scratch.numNodesPadded = scratch.pData ? numNodesPadded : 0;
+    return scratch.pData != NULL;
+}
+
+void DestroyAnimationGraphScratch(sAnimationGraphScratch* pScratch)
+{
+    AlignedFree(pScratch->pData);
+    pScratch->pData = NULL;
+    pScratch->numNodesPadded = 0;
+}
+
+void EvaluateAnimationGraphReference(const sAnimationGraphInstance& instance, sAnimationGraphScratch* pScratch)
+{
+    const sAnimationGraph* pGraph = instance.pGraph;
+    sPose* pOut = instance.pPose;
+    ASSERT(pOut->numNodes == pGraph->numNodes);
+
+    const int stride = pOut->numNodesPadded;
+    if (!ReserveGraphScratch(*pScratch, stride))
+        return;
+
+    SetRestPose(pGraph, pOut);
+
+    // per node: the weighted channels, then the weight sum; clips are never larger than the output pose
+    const int numNodes = pGraph->numNodes;
+    const int layerStride = NUM_POSE_CHANNELS + 1;
+    float* pLayer = pScratch->pData;
+    sPose clipPose;
+    clipPose.pData = pLayer + layerStride * stride;
+
+    for (int l = 0; l < pGraph->numLayers; ++l)
+    {
+        const sAnimationGraphLayer& layer = pGraph->layers[l];
+        const float layerWeight = Min(instance.layerWeights[l], 1.0f);
+        if (layerWeight <= 0.0f)
+            continue;
+
+        memset(pLayer, 0, sizeof(float) * layerStride * numNodes);
+        bool bSampled = false;
+
+        for (int c = 0; c < layer.numClips; ++c)
+        {
+            const sAnimation* pAnimation = layer.clips[c].pAnimation;
+            const float weight = instance.clipWeights[l][c];
+            if (weight <= 0.0f || !IsClipUsable(pAnimation))
+                continue;
+
+            clipPose.numNodes = pAnimation->numNodes;
+            clipPose.numNodesPadded = SimdPadCount(pAnimation->numNodes);
+            SamplePoseReference(pAnimation, instance.clipTimesMs[l][c], layer.clips[c].bLoop, &clipPose);
+
+            for (int node = 0; node < pAnimation->numNodes; ++node)
+            {
+                float x[NUM_POSE_CHANNELS];
+                for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+                    x[ch] = clipPose.GetChannel(ch)[node];
+
+                if (layer.mode == LAYER_ADDITIVE)
+                {
+                    // relative to the first frame: inverse(first) * x
+                    const sNodeTransform& first = pAnimation->pNodeTransforms[node];
+                    float qInverse[4] = { -first.qRot.x, -first.qRot.y, -first.qRot.z, first.qRot.w };
+                    NormalizeQuaternion(qInverse);
+                    MultiplyQuaternion(qInverse, x, x);
+                    x[POSE_TRANS_X] -= first.vTrans.x;
+                    x[POSE_TRANS_Y] -= first.vTrans.y;
+                    x[POSE_TRANS_Z] -= first.vTrans.z;
+                    x[POSE_SCALE_X] *= (first.vScale.x != 0.0f) ? 1.0f / first.vScale.x : 1.0f;
+                    x[POSE_SCALE_Y] *= (first.vScale.y != 0.0f) ? 1.0f / first.vScale.y : 1.0f;
+                    x[POSE_SCALE_Z] *= (first.vScale.z != 0.0f) ? 1.0f / first.vScale.z : 1.0f;
+                }
+
+                // rotations go to the hemisphere of what is accumulated so far
+                float* pAcc = &pLayer[node * layerStride];
+                const float dot = pAcc[0] * x[0] + pAcc[1] * x[1] + pAcc[2] * x[2] + pAcc[3] * x[3];
+                const float sign = (dot < 0.0f) ? -1.0f : 1.0f;
+                for (int ch = POSE_ROT_X; ch <= POSE_ROT_W; ++ch)
+                    pAcc[ch] += x[ch] * sign * weight;
+                for (int ch = POSE_TRANS_X; ch < NUM_POSE_CHANNELS; ++ch)
+                    pAcc[ch] += x[ch] * weight;
+                pAcc[NUM_POSE_CHANNELS] += weight;
+            }
+
+            bSampled = true;
+        }
+
+        if (!bSampled)
+            continue;
+
+        for (int node = 0; node < numNodes; ++node)
+        {
+            const float* pAcc = &pLayer[node * layerStride];
+            const float weightSum = pAcc[NUM_POSE_CHANNELS];
+            if (weightSum <= 0.0f || (layer.pMask && !layer.pMask->IsUsed((unsigned int)node)))
+                continue;
+
+            float q[4] = { pAcc[0], pAcc[1], pAcc[2], pAcc[3] };
+            NormalizeQuaternion(q);
+
+            float o[NUM_POSE_CHANNELS];
+            for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+                o[ch] = pOut->GetChannel(ch)[node];
+
+            if (layer.mode == LAYER_ADDITIVE)
+            {
+                // o = o * nlerp(identity, q, w); t += w * t; s *= lerp(1, s, w)
+                const float sign = (q[3] < 0.0f) ? -1.0f : 1.0f;
+                float d[4] = { q[0] * sign * layerWeight, q[1] * sign * layerWeight, q[2] * sign * layerWeight, 1.0f + (q[3] * sign - 1.0f) * layerWeight };
+                NormalizeQuaternion(d);
+                MultiplyQuaternion(o, d, o);
+
+                for (int ch = POSE_TRANS_X; ch <= POSE_TRANS_Z; ++ch)
+                    o[ch] += pAcc[ch] / weightSum * layerWeight;
+                for (int ch = POSE_SCALE_X; ch <= POSE_SCALE_Z; ++ch)
+                    o[ch] *= 1.0f + (pAcc[ch] / weightSum - 1.0f) * layerWeight;
+            }
+            else
+            {
+                const float dot = o[0] * q[0] + o[1] * q[1] + o[2] * q[2] + o[3] * q[3];
+                const float sign = (dot < 0.0f) ? -1.0f : 1.0f;
+                for (int ch = POSE_ROT_X; ch <= POSE_ROT_W; ++ch)
+                    o[ch] += (q[ch] * sign - o[ch]) * layerWeight;
+                NormalizeQuaternion(o);
+
+                for (int ch = POSE_TRANS_X; ch < NUM_POSE_CHANNELS; ++ch)
+                    o[ch] += (pAcc[ch] / weightSum - o[ch]) * layerWeight;
+            }
+
+            for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+                pOut->GetChannel(ch)[node] = o[ch];
+        }
+    }
+}
+
+//
+// SIMD kernels
+//
+// 4 nodes per lane group; every pose and the layer accumulator are padded to KHM_SIMD_LANES
+//
+
+#if defined(KHM_SIMD_SSE)
+
+static inline __m128 RcpLength4(__m128 x, __m128 y, __m128 z, __m128 w)
+{
+    const __m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+    return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(lenSq, _mm_set1_ps(1e-30f))));
+}
+
+static inline void MultiplyQuaternion4(const __m128* a, const __m128* b, __m128* out)
+{
+    const __m128 x = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a[3], b[0]), _mm_mul_ps(a[0], b[3])), _mm_mul_ps(a[1], b[2])), _mm_mul_ps(a[2], b[1]));
+    const __m128 y = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(a[3], b[1]), _mm_mul_ps(a[0], b[2])), _mm_mul_ps(a[1], b[3])), _mm_mul_ps(a[2], b[0]));
+    const __m128 z = _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(a[3], b[2]), _mm_mul_ps(a[0], b[1])), _mm_mul_ps(a[1], b[0])), _mm_mul_ps(a[2], b[3]));
+    const __m128 w = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(a[3], b[3]), _mm_mul_ps(a[0], b[0])), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+    out[0] = x;
+    out[1] = y;
+    out[2] = z;
+    out[3] = w;
+}
+
+// all ones for the lanes the mask uses; nodes past KHM_MAX_BONES can't be in a mask
+static inline __m128 GetMaskLanes(const sAnimationMask* pMask, int i)
+{
+    if (!pMask)
+        return _mm_castsi128_ps(_mm_set1_epi32(-1));
+    if (i >= KHM_MAX_BONES)
+        return _mm_setzero_ps();
+
+    return SimdBitLanes4(pMask->bits, i);
+}
+
+// pClip = inverse(first frame) * pClip, in place
+static void MakeAdditiveSSE(sPose* pClip, const sPose* pReference)
+{
+    const int stride = pClip->numNodesPadded;
+    float* p = pClip->pData;
+    const float* r = pReference->pData;
+
+    for (int i = 0; i < stride; i += 4)
+    {
+        const __m128 a[4] = { _mm_load_ps(r + POSE_ROT_X * stride + i), _mm_load_ps(r + POSE_ROT_Y * stride + i),
+                              _mm_load_ps(r + POSE_ROT_Z * stride + i), _mm_load_ps(r + POSE_ROT_W * stride + i) };
+        const __m128 b[4] = { _mm_load_ps(p + POSE_ROT_X * stride + i), _mm_load_ps(p + POSE_ROT_Y * stride + i),
+                              _mm_load_ps(p + POSE_ROT_Z * stride + i), _mm_load_ps(p + POSE_ROT_W * stride + i) };
+        __m128 q[4];
+        MultiplyQuaternion4(a, b, q);
+        for (int k = 0; k < 4; ++k)
+            _mm_store_ps(p + (POSE_ROT_X + k) * stride + i, q[k]);
+
+        for (int ch = POSE_TRANS_X; ch <= POSE_TRANS_Z; ++ch)
+            _mm_store_ps(p + ch * stride + i, _mm_sub_ps(_mm_load_ps(p + ch * stride + i), _mm_load_ps(r + ch * stride + i)));
+        for (int ch = POSE_SCALE_X; ch <= POSE_SCALE_Z; ++ch)
+            _mm_store_ps(p + ch * stride + i, _mm_mul_ps(_mm_load_ps(p + ch * stride + i), _mm_load_ps(r + ch * stride + i)));
+    }
+}
+
+// pLayer += pClip * weight for the clip's nodes, rotations sign aligned to pLayer; pWeights += weight
+static void AccumulateSSE(const sPose* pClip, float weight, float* pLayer, float* pWeights, int layerStride)
+{
+    const int stride = pClip->numNodesPadded;
+    const float* p = pClip->pData;
+    const __m128i vCount = _mm_set1_epi32(pClip->numNodes);
+    const __m128 vSignBit = _mm_set1_ps(-0.0f);
+
+    for (int i = 0; i < stride; i += 4)
+    {
+        // padding lanes get no weight, so a shorter clip leaves the nodes past its end to the others
+        const __m128i vIndex = _mm_add_epi32(_mm_set1_epi32(i), _mm_set_epi32(3, 2, 1, 0));
+        const __m128 vWeight = _mm_and_ps(_mm_castsi128_ps(_mm_cmplt_epi32(vIndex, vCount)), _mm_set1_ps(weight));
+
+        __m128 q[4], acc[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            q[k] = _mm_load_ps(p + (POSE_ROT_X + k) * stride + i);
+            acc[k] = _mm_load_ps(pLayer + (POSE_ROT_X + k) * layerStride + i);
+        }
+
+        const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(acc[0], q[0]), _mm_mul_ps(acc[1], q[1])),
+                                      _mm_add_ps(_mm_mul_ps(acc[2], q[2]), _mm_mul_ps(acc[3], q[3])));
+        const __m128 vWeightSigned = _mm_xor_ps(vWeight, _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), vSignBit));
+        for (int k = 0; k < 4; ++k)
+            _mm_store_ps(pLayer + (POSE_ROT_X + k) * layerStride + i, _mm_add_ps(acc[k], _mm_mul_ps(q[k], vWeightSigned)));
+
+        for (int ch = POSE_TRANS_X; ch < NUM_POSE_CHANNELS; ++ch)
+        {
+            const __m128 x = _mm_load_ps(p + ch * stride + i);
+            _mm_store_ps(pLayer + ch * layerStride + i, _mm_add_ps(_mm_load_ps(pLayer + ch * layerStride + i), _mm_mul_ps(x, vWeight)));
+        }
+
+        _mm_store_ps(pWeights + i, _mm_add_ps(_mm_load_ps(pWeights + i), vWeight));
+    }
+}
+
+// pOut = blend of pOut and the normalized layer, by the layer weight where the layer has data and the mask allows
+static void ApplyLayerSSE(const float* pLayer, const float* pWeights, int mode, float layerWeight, const sAnimationMask* pMask, sPose* pOut)
+{
+    const int stride = pOut->numNodesPadded;
+    float* o = pOut->pData;
+    const __m128 vOne = _mm_set1_ps(1.0f);
+    const __m128 vSignBit = _mm_set1_ps(-0.0f);
+
+    for (int i = 0; i < stride; i += 4)
+    {
+        const __m128 weightSum = _mm_load_ps(pWeights + i);
+        const __m128 vCovered = _mm_cmpgt_ps(weightSum, _mm_setzero_ps());
+        const __m128 b = _mm_and_ps(_mm_and_ps(vCovered, GetMaskLanes(pMask, i)), _mm_set1_ps(layerWeight));
+        if (_mm_movemask_ps(_mm_cmpgt_ps(b, _mm_setzero_ps())) == 0)
+            continue;
+
+        const __m128 invWeightSum = _mm_div_ps(vOne, _mm_max_ps(weightSum, _mm_set1_ps(1e-30f)));
+
+        __m128 lq[4], oq[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            lq[k] = _mm_load_ps(pLayer + (POSE_ROT_X + k) * stride + i);
+            oq[k] = _mm_load_ps(o + (POSE_ROT_X + k) * stride + i);
+        }
+        const __m128 lRcpLen = RcpLength4(lq[0], lq[1], lq[2], lq[3]);
+        for (int k = 0; k < 4; ++k)
+            lq[k] = _mm_mul_ps(lq[k], lRcpLen);
+
+        __m128 q[4];
+        if (mode == LAYER_ADDITIVE)
+        {
+            // o = o * nlerp(identity, delta, b), delta on the positive w side
+            const __m128 vSign = _mm_and_ps(_mm_cmplt_ps(lq[3], _mm_setzero_ps()), vSignBit);
+            __m128 d[4];
+            for (int k = 0; k < 3; ++k)
+                d[k] = _mm_mul_ps(_mm_xor_ps(lq[k], vSign), b);
+            d[3] = _mm_add_ps(vOne, _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(lq[3], vSign), vOne), b));
+            const __m128 dRcpLen = RcpLength4(d[0], d[1], d[2], d[3]);
+            for (int k = 0; k < 4; ++k)
+                d[k] = _mm_mul_ps(d[k], dRcpLen);
+            MultiplyQuaternion4(oq, d, q);
+
+            for (int ch = POSE_TRANS_X; ch <= POSE_TRANS_Z; ++ch)
+            {
+                const __m128 t = _mm_mul_ps(_mm_load_ps(pLayer + ch * stride + i), invWeightSum);
+                _mm_store_ps(o + ch * stride + i, _mm_add_ps(_mm_load_ps(o + ch * stride + i), _mm_mul_ps(t, b)));
+            }
+            for (int ch = POSE_SCALE_X; ch <= POSE_SCALE_Z; ++ch)
+            {
+                const __m128 s = _mm_mul_ps(_mm_load_ps(pLayer + ch * stride + i), invWeightSum);
+                const __m128 factor = _mm_add_ps(vOne, _mm_mul_ps(_mm_sub_ps(s, vOne), b));
+                _mm_store_ps(o + ch * stride + i, _mm_mul_ps(_mm_load_ps(o + ch * stride + i), factor));
+            }
+        }
+        else
+        {
+            // nlerp( o, layer, b ), lerp for translation and scale
+            const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(oq[0], lq[0]), _mm_mul_ps(oq[1], lq[1])),
+                                          _mm_add_ps(_mm_mul_ps(oq[2], lq[2]), _mm_mul_ps(oq[3], lq[3])));
+            const __m128 vSign = _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), vSignBit);
+            for (int k = 0; k < 4; ++k)
+                q[k] = _mm_add_ps(oq[k], _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(lq[k], vSign), oq[k]), b));
+            const __m128 qRcpLen = RcpLength4(q[0], q[1], q[2], q[3]);
+            for (int k = 0; k < 4; ++k)
+                q[k] = _mm_mul_ps(q[k], qRcpLen);
+
+            for (int ch = POSE_TRANS_X; ch < NUM_POSE_CHANNELS; ++ch)
+            {
+                const __m128 x = _mm_mul_ps(_mm_load_ps(pLayer + ch * stride + i), invWeightSum);
+                const __m128 current = _mm_load_ps(o + ch * stride + i);
+                _mm_store_ps(o + ch * stride + i, _mm_add_ps(current, _mm_mul_ps(_mm_sub_ps(x, current), b)));
+            }
+        }
+
+        for (int k = 0; k < 4; ++k)
+            _mm_store_ps(o + (POSE_ROT_X + k) * stride + i, q[k]);
+    }
+}
+
+static void EvaluateAnimationGraphSSE(const sAnimationGraphInstance& instance, const sClipSampler* pSampler, sAnimationGraphScratch& scratch)
+{
+    const sAnimationGraph* pGraph = instance.pGraph;
+    sPose* pOut = instance.pPose;
+    ASSERT(pOut->numNodes == pGraph->numNodes);
+
+    const int stride = pOut->numNodesPadded;
+    if (!ReserveGraphScratch(scratch, stride))
+        return;
+
+    float* pLayer = scratch.pData;
+    float* pWeights = pLayer + NUM_POSE_CHANNELS * stride;
+    sPose clipPose;
+    clipPose.pData = pWeights + stride;
+
+    SetRestPose(pGraph, pOut);
+
+    for (int l = 0; l < pGraph->numLayers; ++l)
+    {
+        const sAnimationGraphLayer& layer = pGraph->layers[l];
+        const float layerWeight = Min(instance.layerWeights[l], 1.0f);
+        if (layerWeight <= 0.0f)
+            continue;
+
+        memset(pLayer, 0, sizeof(float) * (NUM_POSE_CHANNELS + 1) * stride);
+        bool bSampled = false;
+
+        for (int c = 0; c < layer.numClips; ++c)
+        {
+            const sAnimation* pAnimation = layer.clips[c].pAnimation;
+            const float weight = instance.clipWeights[l][c];
+            if (weight <= 0.0f || !IsClipUsable(pAnimation))
+                continue;
+
+            const float timeMs = instance.clipTimesMs[l][c];
+            const bool bLoop = layer.clips[c].bLoop;
+            const sPose* pSample = pSampler ? pSampler->sample(pSampler->pUserData, pAnimation, timeMs, bLoop) : NULL;
+
+            clipPose.numNodes = pAnimation->numNodes;
+            clipPose.numNodesPadded = SimdPadCount(pAnimation->numNodes);
+            if (layer.mode == LAYER_ADDITIVE)
+            {
+                // made relative in place; a shared sample is copied first
+                if (pSample)
+                    memcpy(clipPose.pData, pSample->pData, sizeof(float) * NUM_POSE_CHANNELS * clipPose.numNodesPadded);
+                else
+                    SampleAnimation(pAnimation, timeMs, bLoop, &clipPose);
+
+                MakeAdditiveSSE(&clipPose, &layer.references[c]);
+                pSample = &clipPose;
+            }
+            else if (!pSample)
+            {
+                SampleAnimation(pAnimation, timeMs, bLoop, &clipPose);
+                pSample = &clipPose;
+            }
+
+            ASSERT(pSample->numNodesPadded == clipPose.numNodesPadded);
+            AccumulateSSE(pSample, weight, pLayer, pWeights, stride);
+            bSampled = true;
+        }
+
+        if (bSampled)
+            ApplyLayerSSE(pLayer, pWeights, layer.mode, layerWeight, layer.pMask, pOut);
+    }
+}
+
+#endif
+
+//
+// batches
+//
+
+struct sAnimationGraphJob
+{
+    const sAnimationGraphInstance*  pInstances;
+    const sClipSampler*             pSampler;
+};
+
+static void EvaluateAnimationGraphJob(void* pUserData, int begin, int end)
+{
+    const sAnimationGraphJob* pJob = (const sAnimationGraphJob*)pUserData;
+
+    // per job scratch
+    sAnimationGraphScratch scratch;
+#if defined(KHM_SIMD_SSE)
+    for (int i = begin; i < end; ++i)
+        EvaluateAnimationGraphSSE(pJob->pInstances[i], pJob->pSampler, scratch);
+#else
+    for (int i = begin; i < end; ++i)
+        EvaluateAnimationGraphReference(pJob->pInstances[i], &scratch);
+#endif
+    DestroyAnimationGraphScratch(&scratch);
+}
+
+void EvaluateAnimationGraphs(const sAnimationGraphInstance* pInstances, int numInstances, CJobPool* pJobPool, const sClipSampler* pSampler)
+{
+    if (numInstances <= 0)
+        return;
+
+    sAnimationGraphJob job;
+    job.pInstances = pInstances;
+    job.pSampler = pSampler;
+
+    if (pJobPool)
+        pJobPool->ParallelFor(numInstances, 32, EvaluateAnimationGraphJob, &job);
+    else
+        EvaluateAnimationGraphJob(&job, 0, numInstances);
+}
+
+}; // end namespace KHM
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "KHMAnimation.h"
+
+namespace KHM
+{
+    class CJobPool;
+
+    //
+    // common defines for animation graphs
+    //
+
+    #define KHM_MAX_GRAPH_LAYERS            8
+    #define KHM_MAX_LAYER_CLIPS             8
+
+    enum eLayerMode
+    {
+        LAYER_OVERRIDE = 0,         // the layer's blend replaces what the layers below produced, by the layer weight
+        LAYER_ADDITIVE,             // the layer's blend, taken relative to each clip's first frame, goes on top
+    };
+
+    struct sAnimationGraphClip
+    {
+        const sAnimation*       pAnimation;     // sampled from pTracks, else pCompressed, else pNodeTransforms
+        bool                    bLoop;
+    };
+
+    struct sAnimationGraphLayer
+    {
+        int                     mode;           // eLayerMode
+        const sAnimationMask*   pMask;          // nodes the layer may change; NULL = every node
+        int                     numClips;
+        sAnimationGraphClip     clips[KHM_MAX_LAYER_CLIPS];
+
+        sPose                   references[KHM_MAX_LAYER_CLIPS]; // built by CreateAnimationGraph; additive only, inverse of the first frame
+    };
+
+    // optional source of clip samples for EvaluateAnimationGraphs, e.g. shared between instances. the pose is sized for
+    // the clip, padding lanes identity; NULL = the evaluation samples the clip itself
+    typedef const sPose* (*ClipSampleFunc)(void* pUserData, const sAnimation* pAnimation, float timeMs, bool bLoop);
+
+    struct sClipSampler
+    {
+        ClipSampleFunc          sample;
+        void*                   pUserData;
+    };
+
+    //
+    // KHM Animation Graph - layers of weighted clip blends, shared by every character playing it
+    //
+    // layers are evaluated bottom up on top of the rest pose; within a layer, the clip weights are normalized per
+    // node over the clips that have the node, so clips with fewer nodes ( numNodes != number of bones, attachments )
+    // blend with the others only where they have data. a node no clip of a layer has is left as the layers below made it
+    //
+
+    struct sAnimationGraph
+    {
+        int                     numLayers;
+        sAnimationGraphLayer    layers[KHM_MAX_GRAPH_LAYERS];
+        const sPose*            pRestPose;      // optional; what nodes start from, identity past its numNodes
+
+        int                     numNodes;       // built by CreateAnimationGraph; of the output poses, the largest clip
+    };
+
+    // fill numLayers, layers ( mode, pMask, clips ) and pRestPose first
+    bool        CreateAnimationGraph(sAnimationGraph* pGraph);
+    void        DestroyAnimationGraph(sAnimationGraph* pGraph);
+
+    //
+    // KHM Animation Graph Instance - one character's parameters and output
+    //
+
+    struct sAnimationGraphInstance
+    {
+        const sAnimationGraph*  pGraph;
+        float                   clipTimesMs[KHM_MAX_GRAPH_LAYERS][KHM_MAX_LAYER_CLIPS];
+        float                   clipWeights[KHM_MAX_GRAPH_LAYERS][KHM_MAX_LAYER_CLIPS]; // 0 = not sampled
+        float                   layerWeights[KHM_MAX_GRAPH_LAYERS];                     // 0 = layer skipped, 1 = full
+        sPose*                  pPose;          // out; CreatePose'd with the graph's numNodes
+    };
+
+    void        InitAnimationGraphInstance(sAnimationGraphInstance* pInstance, const sAnimationGraph* pGraph, sPose* pPose);
+
+    //
+    // KHM Animation Graph Scratch - an evaluation's working memory; grown on demand, reuse it across instances
+    //
+
+    struct sAnimationGraphScratch
+    {
+        sAnimationGraphScratch() : pData(NULL), numNodesPadded(0) {}
+
+        float*                  pData;          // the layer accumulator and a clip pose
+        int                     numNodesPadded; // of the largest output pose so far
+    };
+
+    void        DestroyAnimationGraphScratch(sAnimationGraphScratch* pScratch);
+
+    // batches of instances per job; SIMD over the nodes. instances may use different graphs. pSampler may be NULL
+    void        EvaluateAnimationGraphs(const sAnimationGraphInstance* pInstances, int numInstances, CJobPool* pJobPool, const sClipSampler* pSampler);
+
+    // from the fastest copy the clip has: pTracks, else pCompressed, else pNodeTransforms. pPose is sized for the clip,
+    // its padding lanes come out identity
+    void        SampleAnimation(const sAnimation* pAnimation, float timeMs, bool bLoop, sPose* pPose);
+    void        SampleAnimation(const sAnimation* pAnimation, int frame0, int frame1, float alpha, sPose* pPose);
+
+    // scalar reference for a single instance; never uses a sampler, straight from sAnimation::pNodeTransforms; used to validate the SIMD path
+    void        EvaluateAnimationGraphReference(const sAnimationGraphInstance& instance, sAnimationGraphScratch* pScratch);
+};
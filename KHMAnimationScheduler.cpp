@@ -0,0 +1,479 @@
+#include "KHMAnimationScheduler.h"
+#include "KHMJobs.h"
+#include "KHMHash.h"
+#include "KHMSimd.h"
+#include "Kernel/Log.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace KHM {
+
+//
+// agents
+//
+
+bool InitAnimationAgent(sAnimationAgent* pAgent, const sAnimationGraph* pGraph, sPose* pPose)
+{
+    InitAnimationGraphInstance(&pAgent->instance, pGraph, pPose);
+    pAgent->timeScale = 1.0f;
+    pAgent->lod = 0;
+    pAgent->frame = 0;
+    pAgent->span = 0;
+
+    pAgent->to.pData = NULL;
+    if (!CreatePose(&pAgent->from, pGraph->numNodes) || !CreatePose(&pAgent->to, pGraph->numNodes))
+    {
+        LOG_ERROR("[Error] InitAnimationAgent() - out of memory for the cached poses\n");
+        DestroyAnimationAgent(pAgent);
+        return false;
+    }
+
+    return true;
+}
+
+void DestroyAnimationAgent(sAnimationAgent* pAgent)
+{
+    if (pAgent->from.pData)
+        DestroyPose(&pAgent->from);
+    if (pAgent->to.pData)
+        DestroyPose(&pAgent->to);
+}
+
+static bool IsClipSampled(const sAnimationGraphInstance& instance, int layer, int clip)
+{
+    const sAnimation* pAnimation = instance.pGraph->layers[layer].clips[clip].pAnimation;
+    return instance.layerWeights[layer] > 0.0f && instance.clipWeights[layer][clip] > 0.0f &&
+           pAnimation && pAnimation->numNodes > 0 && pAnimation->numNodeFrames > 0;
+}
+
+static void AdvanceClips(sAnimationGraphInstance& instance, float deltaMs)
+{
+    const sAnimationGraph* pGraph = instance.pGraph;
+    for (int l = 0; l < pGraph->numLayers; ++l)
+    {
+        for (int c = 0; c < pGraph->layers[l].numClips; ++c)
+        {
+            float& timeMs = instance.clipTimesMs[l][c];
+            timeMs += deltaMs;
+
+            // looping clocks wrap, so they keep their precision
+            const sAnimation* pAnimation = pGraph->layers[l].clips[c].pAnimation;
+            if (!pGraph->layers[l].clips[c].bLoop || !pAnimation)
+                continue;
+
+            const float durationMs = pAnimation->frameDurationMs * (float)(pAnimation->numNodeFrames - 1);
+            if (durationMs > 0.0f && (timeMs >= durationMs || timeMs < 0.0f))
+            {
+                timeMs = fmodf(timeMs, durationMs);
+                if (timeMs < 0.0f)
+                    timeMs += durationMs;
+            }
+        }
+    }
+}
+
+// 0 first; frames late ( or waiting for a first evaluation ), capped, then the LOD
+#define KHM_SCHEDULER_MAX_LATENESS      31
+#define KHM_SCHEDULER_PRIORITIES        ((KHM_SCHEDULER_MAX_LATENESS + 1) * KHM_MAX_ANIMATION_LODS)
+
+static int GetPriority(const sAnimationAgent& agent)
+{
+    const int lateness = (agent.span == 0) ? agent.frame : agent.frame - agent.span;
+    const int lod = Max(0, Min(agent.lod, KHM_MAX_ANIMATION_LODS - 1));
+    return (KHM_SCHEDULER_MAX_LATENESS - Max(0, Min(lateness, KHM_SCHEDULER_MAX_LATENESS))) * KHM_MAX_ANIMATION_LODS + lod;
+}
+
+static float GetAgentAlpha(const sAnimationAgent& agent)
+{
+    return Min((float)agent.frame / (float)agent.span, 1.0f);
+}
+
+//
+// jobs
+//
+
+struct sAgentJob
+{
+    sAnimationAgent*            pAgents;
+    const int*                  lAgents;        // NULL = every agent
+};
+
+// from = what is shown right now; before the evaluation replaces to
+static void CatchUpJob(void* pUserData, int begin, int end)
+{
+    const sAgentJob* pJob = (const sAgentJob*)pUserData;
+    for (int i = begin; i < end; ++i)
+    {
+        sAnimationAgent& agent = pJob->pAgents[pJob->lAgents[i]];
+        if (agent.span > 0)
+            BlendPoses(&agent.from, &agent.to, GetAgentAlpha(agent), &agent.from);
+    }
+}
+
+static void PresentJob(void* pUserData, int begin, int end)
+{
+    const sAgentJob* pJob = (const sAgentJob*)pUserData;
+    for (int i = begin; i < end; ++i)
+    {
+        sAnimationAgent& agent = pJob->pAgents[i];
+        if (agent.span > 0)
+            BlendPoses(&agent.from, &agent.to, GetAgentAlpha(agent), agent.instance.pPose);
+    }
+}
+
+static void RunJob(CJobPool* pJobPool, int count, int grainSize, JobRangeFunc pFunc, void* pUserData)
+{
+    if (count <= 0)
+        return;
+
+    if (pJobPool)
+        pJobPool->ParallelFor(count, grainSize, pFunc, pUserData);
+    else
+        pFunc(pUserData, 0, count);
+}
+
+//
+// scheduler
+//
+
+CAnimationScheduler::CAnimationScheduler()
+    : uiSampleFloats(0)
+    , pSampleData(NULL)
+    , uiSampleCapacity(0)
+{
+    memset(&settings, 0, sizeof(settings));
+    ResetStats();
+}
+
+CAnimationScheduler::~CAnimationScheduler()
+{
+    Shutdown();
+}
+
+void CAnimationScheduler::Init(const sAnimationSchedulerSettings& newSettings)
+{
+    ASSERT(newSettings.numLods >= 0 && newSettings.numLods <= KHM_MAX_ANIMATION_LODS);
+
+    settings = newSettings;
+    ResetStats();
+}
+
+void CAnimationScheduler::Shutdown()
+{
+    AlignedFree(pSampleData);
+    pSampleData = NULL;
+    uiSampleCapacity = 0;
+
+    dueAgents.clear();
+    evaluatedAgents.clear();
+    evaluations.clear();
+    samples.clear();
+    sampleTable.clear();
+}
+
+void CAnimationScheduler::ResetStats()
+{
+    memset(&totals, 0, sizeof(totals));
+    memset(&lastFrame, 0, sizeof(lastFrame));
+}
+
+int CAnimationScheduler::GetInterval(int lod) const
+{
+    if (settings.numLods <= 0)
+        return 1;
+
+    return Max(settings.updateIntervals[Max(0, Min(lod, settings.numLods - 1))], 1);
+}
+
+void CAnimationScheduler::Update(sAnimationAgent* pAgents, int numAgents, float dtMs, CJobPool* pJobPool)
+{
+    memset(&lastFrame, 0, sizeof(lastFrame));
+    lastFrame.numFrames = 1;
+    lastFrame.numAgentUpdates = (unsigned long long)Max(numAgents, 0);
+
+    // clocks, then who is due: never evaluated, the look ahead reached, or a LOD finer than what the last span assumed
+    dueAgents.clear();
+    for (int i = 0; i < numAgents; ++i)
+    {
+        sAnimationAgent& agent = pAgents[i];
+        AdvanceClips(agent.instance, dtMs * agent.timeScale);
+        ++agent.frame;
+
+        if (agent.span == 0 || agent.frame >= agent.span || agent.span - agent.frame > GetInterval(agent.lod))
+            dueAgents.push_back(i);
+    }
+
+    // budget; a first evaluation costs two ( the pose now and the look ahead )
+    evaluatedAgents.clear();
+    if (settings.maxEvaluationsPerFrame <= 0)
+    {
+        evaluatedAgents = dueAgents;
+    }
+    else
+    {
+        // counting sort by priority: the agents waiting the longest first, then the finest LOD; nobody starves
+        int lCounts[KHM_SCHEDULER_PRIORITIES + 1];
+        memset(lCounts, 0, sizeof(lCounts));
+        for (size_t d = 0; d < dueAgents.size(); ++d)
+            ++lCounts[GetPriority(pAgents[dueAgents[d]]) + 1];
+        for (int p = 0; p < KHM_SCHEDULER_PRIORITIES; ++p)
+            lCounts[p + 1] += lCounts[p];
+
+        evaluatedAgents.resize(dueAgents.size());
+        for (size_t d = 0; d < dueAgents.size(); ++d)
+            evaluatedAgents[lCounts[GetPriority(pAgents[dueAgents[d]])]++] = dueAgents[d];
+
+        int budget = settings.maxEvaluationsPerFrame;
+        size_t numSelected = 0;
+        for (size_t e = 0; e < evaluatedAgents.size() && budget > 0; ++e)
+        {
+            const int cost = (pAgents[evaluatedAgents[e]].span == 0) ? 2 : 1;
+            if (cost > budget)
+                continue;
+
+            evaluatedAgents[numSelected++] = evaluatedAgents[e];
+            budget -= cost;
+        }
+        evaluatedAgents.resize(numSelected);
+    }
+
+    lastFrame.numDeferrals = dueAgents.size() - evaluatedAgents.size();
+
+    sAgentJob job;
+    job.pAgents = pAgents;
+    job.lAgents = evaluatedAgents.empty() ? NULL : &evaluatedAgents[0];
+    RunJob(pJobPool, (int)evaluatedAgents.size(), 64, CatchUpJob, &job);
+
+    // the evaluations look ahead by the span; a first one is phased by the agent index so the LOD spreads over its frames
+    evaluations.clear();
+    for (size_t e = 0; e < evaluatedAgents.size(); ++e)
+    {
+        const int index = evaluatedAgents[e];
+        sAnimationAgent& agent = pAgents[index];
+        const int interval = GetInterval(agent.lod);
+
+        if (agent.span == 0)
+        {
+            evaluations.push_back(agent.instance);
+            evaluations.back().pPose = &agent.from;
+            agent.span = 1 + index % interval;
+        }
+        else
+        {
+            agent.span = interval;
+        }
+        agent.frame = 0;
+
+        evaluations.push_back(agent.instance);
+        sAnimationGraphInstance& lookAhead = evaluations.back();
+        lookAhead.pPose = &agent.to;
+        AdvanceClips(lookAhead, dtMs * agent.timeScale * (float)agent.span);
+    }
+
+    lastFrame.numEvaluations = evaluations.size();
+    lastFrame.numInterpolations = 0;
+    for (int i = 0; i < numAgents; ++i)
+    {
+        if (pAgents[i].span > 0 && pAgents[i].frame > 0)
+            ++lastFrame.numInterpolations;
+    }
+
+    // one sample per ( clip, time ) for the whole frame, taken in parallel before the graphs run
+    sClipSampler sampler;
+    sampler.sample = SampleShared;
+    sampler.pUserData = this;
+    const sClipSampler* pSampler = NULL;
+
+    if (settings.bShareSamples && !evaluations.empty())
+    {
+        samples.clear();
+        uiSampleFloats = 0;
+        if (sampleTable.empty())
+            sampleTable.resize(256);
+        for (size_t t = 0; t < sampleTable.size(); ++t)
+            sampleTable[t] = -1;
+
+        for (size_t e = 0; e < evaluations.size(); ++e)
+            lastFrame.numSamplesRequested += ShareSamples(evaluations[e], true);
+
+        if (ReserveSamples())
+        {
+            RunJob(pJobPool, (int)samples.size(), 16, TakeSamplesJob, this);
+            lastFrame.numSamplesTaken = samples.size();
+            pSampler = &sampler;
+        }
+    }
+
+    if (!pSampler)
+    {
+        for (size_t e = 0; e < evaluations.size(); ++e)
+            lastFrame.numSamplesRequested += ShareSamples(evaluations[e], false);
+        lastFrame.numSamplesTaken = lastFrame.numSamplesRequested;
+    }
+
+    if (!evaluations.empty())
+        EvaluateAnimationGraphs(&evaluations[0], (int)evaluations.size(), pJobPool, pSampler);
+
+    job.lAgents = NULL;
+    RunJob(pJobPool, numAgents, 64, PresentJob, &job);
+
+    totals.numAgentUpdates += lastFrame.numAgentUpdates;
+    totals.numEvaluations += lastFrame.numEvaluations;
+    totals.numInterpolations += lastFrame.numInterpolations;
+    totals.numDeferrals += lastFrame.numDeferrals;
+    totals.numSamplesRequested += lastFrame.numSamplesRequested;
+    totals.numSamplesTaken += lastFrame.numSamplesTaken;
+    totals.numFrames += 1;
+}
+
+//
+// shared samples
+//
+
+void CAnimationScheduler::GetSampleKey(const sAnimation* pAnimation, float timeMs, bool bLoop, int& frame0, int& frame1, int& alphaStep)
+{
+    float alpha;
+    GetKeyframes(pAnimation->numNodeFrames, pAnimation->frameDurationMs, timeMs, bLoop, frame0, frame1, alpha);
+
+    // a blend rounded to either end is that keyframe alone
+    alphaStep = (int)(alpha * KHM_POSE_CACHE_ALPHA_STEPS + 0.5f);
+    if (alphaStep >= KHM_POSE_CACHE_ALPHA_STEPS)
+    {
+        frame0 = frame1;
+        alphaStep = 0;
+    }
+    if (alphaStep == 0)
+        frame1 = frame0;
+}
+
+static unsigned int HashSampleKey(const sAnimation* pAnimation, int frame0, int frame1, int alphaStep)
+{
+    unsigned long long h = HashDataRound(KHM_HASH64_PRIME3, (unsigned long long)(size_t)pAnimation);
+    h = HashDataRound(h, ((unsigned long long)(unsigned int)frame0 << 32) | (unsigned int)frame1);
+    h = HashDataRound(h, (unsigned long long)alphaStep);
+    return (unsigned int)(h >> 32);
+}
+
+int CAnimationScheduler::FindSample(const sAnimation* pAnimation, int frame0, int frame1, int alphaStep) const
+{
+    const unsigned int uiMask = (unsigned int)sampleTable.size() - 1;
+    for (unsigned int uiSlot = HashSampleKey(pAnimation, frame0, frame1, alphaStep) & uiMask; ; uiSlot = (uiSlot + 1) & uiMask)
+    {
+        const int index = sampleTable[uiSlot];
+        if (index < 0)
+            return -1;
+
+        const sSharedSample& sample = samples[index];
+        if (sample.pAnimation == pAnimation && sample.frame0 == frame0 && sample.frame1 == frame1 && sample.alphaStep == alphaStep)
+            return index;
+    }
+}
+
+void CAnimationScheduler::GrowSampleTable()
+{
+    sampleTable.assign(sampleTable.size() * 2, -1);
+
+    const unsigned int uiMask = (unsigned int)sampleTable.size() - 1;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const sSharedSample& sample = samples[i];
+        unsigned int uiSlot = HashSampleKey(sample.pAnimation, sample.frame0, sample.frame1, sample.alphaStep) & uiMask;
+        while (sampleTable[uiSlot] >= 0)
+            uiSlot = (uiSlot + 1) & uiMask;
+        sampleTable[uiSlot] = (int)i;
+    }
+}
+
+// the clips the graph evaluation will sample, same rules; returns how many
+int CAnimationScheduler::ShareSamples(const sAnimationGraphInstance& instance, bool bInsert)
+{
+    int numRequested = 0;
+    const sAnimationGraph* pGraph = instance.pGraph;
+    for (int l = 0; l < pGraph->numLayers; ++l)
+    {
+        for (int c = 0; c < pGraph->layers[l].numClips; ++c)
+        {
+            if (!IsClipSampled(instance, l, c))
+                continue;
+
+            ++numRequested;
+            if (!bInsert)
+                continue;
+
+            const sAnimation* pAnimation = pGraph->layers[l].clips[c].pAnimation;
+            int frame0, frame1, alphaStep;
+            GetSampleKey(pAnimation, instance.clipTimesMs[l][c], pGraph->layers[l].clips[c].bLoop, frame0, frame1, alphaStep);
+            if (FindSample(pAnimation, frame0, frame1, alphaStep) >= 0)
+                continue;
+
+            if ((samples.size() + 1) * 2 > sampleTable.size())
+                GrowSampleTable();
+
+            sSharedSample sample;
+            sample.pAnimation = pAnimation;
+            sample.frame0 = frame0;
+            sample.frame1 = frame1;
+            sample.alphaStep = alphaStep;
+            sample.uiOffset = uiSampleFloats;
+            sample.pose.pData = NULL;
+            sample.pose.numNodes = pAnimation->numNodes;
+            sample.pose.numNodesPadded = SimdPadCount(pAnimation->numNodes);
+            uiSampleFloats += (size_t)NUM_POSE_CHANNELS * sample.pose.numNodesPadded;
+
+            const unsigned int uiMask = (unsigned int)sampleTable.size() - 1;
+            unsigned int uiSlot = HashSampleKey(pAnimation, frame0, frame1, alphaStep) & uiMask;
+            while (sampleTable[uiSlot] >= 0)
+                uiSlot = (uiSlot + 1) & uiMask;
+            sampleTable[uiSlot] = (int)samples.size();
+            samples.push_back(sample);
+        }
+    }
+
+    return numRequested;
+}
+
+bool CAnimationScheduler::ReserveSamples()
+{
+    if (uiSampleFloats > uiSampleCapacity)
+    {
+        // grows only; a crowd asks for about the same every frame
+        AlignedFree(pSampleData);
+        uiSampleCapacity = uiSampleFloats + uiSampleFloats / 2;
+        pSampleData = (float*)AlignedAlloc(sizeof(float) * uiSampleCapacity);
+        if (!pSampleData)
+        {
+            LOG_ERROR("[Error] CAnimationScheduler::ReserveSamples() - out of memory for %u shared samples\n", (unsigned int)samples.size());
+            uiSampleCapacity = 0;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < samples.size(); ++i)
+        samples[i].pose.pData = pSampleData + samples[i].uiOffset;
+
+    return true;
+}
+
+void CAnimationScheduler::TakeSamplesJob(void* pUserData, int begin, int end)
+{
+    CAnimationScheduler* pScheduler = (CAnimationScheduler*)pUserData;
+    for (int i = begin; i < end; ++i)
+    {
+        sSharedSample& sample = pScheduler->samples[i];
+        SampleAnimation(sample.pAnimation, sample.frame0, sample.frame1, (float)sample.alphaStep / KHM_POSE_CACHE_ALPHA_STEPS, &sample.pose);
+    }
+}
+
+// ClipSampleFunc; read only, the table is complete before the graphs run
+const sPose* CAnimationScheduler::SampleShared(void* pUserData, const sAnimation* pAnimation, float timeMs, bool bLoop)
+{
+    const CAnimationScheduler* pScheduler = (const CAnimationScheduler*)pUserData;
+
+    int frame0, frame1, alphaStep;
+    GetSampleKey(pAnimation, timeMs, bLoop, frame0, frame1, alphaStep);
+    const int index = pScheduler->FindSample(pAnimation, frame0, frame1, alphaStep);
+    return (index >= 0) ? &pScheduler->samples[index].pose : NULL;
+}
+
+}; // end namespace KHM
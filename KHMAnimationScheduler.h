@@ -0,0 +1,124 @@
+#pragma once
+
+#include "KHMAnimationGraph.h"
+
+#include <vector>
+
+namespace KHM
+{
+    class CJobPool;
+
+    //
+    // common defines for the animation scheduler
+    //
+
+    #define KHM_MAX_ANIMATION_LODS          8
+    #define KHM_POSE_CACHE_ALPHA_STEPS      256 // shared samples round the keyframe blend to this many steps, so near times share too
+
+    struct sAnimationSchedulerSettings
+    {
+        int                     numLods;
+        int                     updateIntervals[KHM_MAX_ANIMATION_LODS];   // frames between evaluations, by LOD; 1 = every frame
+        int                     maxEvaluationsPerFrame;                     // graph evaluations; 0 = no budget
+        bool                    bShareSamples;                              // one sample per ( clip, time ) and frame, for every agent
+    };
+
+    //
+    // KHM Animation Agent - a character whose graph the scheduler evaluates
+    //
+    // an evaluation looks ahead: it samples the graph where the clips will be when the agent is due next, and the
+    // frames in between nlerp from what was shown at the evaluation to it. an agent over the budget holds its pose
+    //
+
+    struct sAnimationAgent
+    {
+        sAnimationGraphInstance instance;       // the caller drives the weights; clip times are advanced by Update. pPose = output
+        float                   timeScale;      // playback speed of every clip; 1 = real time
+        int                     lod;            // into the scheduler's updateIntervals; set by the caller ( distance, visibility... )
+
+        // scheduler state
+        sPose                   from;           // what was shown when the last evaluation was issued
+        sPose                   to;             // the last evaluation, span frames ahead of it
+        int                     frame;          // frames since the last evaluation, or since the agent waits for its first
+        int                     span;           // 0 = never evaluated
+    };
+
+    bool        InitAnimationAgent(sAnimationAgent* pAgent, const sAnimationGraph* pGraph, sPose* pPose);
+    void        DestroyAnimationAgent(sAnimationAgent* pAgent);
+
+    struct sAnimationSchedulerStats
+    {
+        unsigned long long      numAgentUpdates;        // agents x frames
+        unsigned long long      numEvaluations;         // graph evaluations
+        unsigned long long      numInterpolations;      // agent frames served from the cached poses
+        unsigned long long      numDeferrals;           // agents due but past the budget; their pose holds
+        unsigned long long      numSamplesRequested;    // clip samples the evaluations needed
+        unsigned long long      numSamplesTaken;        // what was actually sampled; less with bShareSamples
+        unsigned int            numFrames;
+    };
+
+    //
+    // KHM Animation Scheduler - time sliced animation updates for crowds
+    //
+    // agents of a LOD with an interval of N are evaluated every N frames, spread over the N frames by their index in
+    // the agent array ( keep it stable ). under a budget, the agents waiting the longest go first, then the finest LODs
+    //
+
+    class CAnimationScheduler
+    {
+        public:
+            CAnimationScheduler();
+            ~CAnimationScheduler();
+
+        public:
+            void Init(const sAnimationSchedulerSettings& settings);
+            void Shutdown();
+
+            // advances the clips of every agent by dtMs, evaluates the ones that are due and writes every instance.pPose
+            void Update(sAnimationAgent* pAgents, int numAgents, float dtMs, CJobPool* pJobPool);
+
+            void GetStats(sAnimationSchedulerStats* pStats) const { *pStats = totals; }         // since Init or ResetStats
+            void GetFrameStats(sAnimationSchedulerStats* pStats) const { *pStats = lastFrame; } // the last Update
+            void ResetStats();
+
+        private:
+            CAnimationScheduler(const CAnimationScheduler&);
+            CAnimationScheduler& operator=(const CAnimationScheduler&);
+
+            struct sSharedSample
+            {
+                const sAnimation*   pAnimation;
+                int                 frame0;
+                int                 frame1;
+                int                 alphaStep;      // of KHM_POSE_CACHE_ALPHA_STEPS
+                size_t              uiOffset;       // into pSampleData
+                sPose               pose;           // pData set once the frame's samples are reserved
+            };
+
+            int GetInterval(int lod) const;
+            int ShareSamples(const sAnimationGraphInstance& instance, bool bInsert);
+            void GrowSampleTable();
+            int FindSample(const sAnimation* pAnimation, int frame0, int frame1, int alphaStep) const;
+            bool ReserveSamples();
+
+            static void GetSampleKey(const sAnimation* pAnimation, float timeMs, bool bLoop, int& frame0, int& frame1, int& alphaStep);
+            static const sPose* SampleShared(void* pUserData, const sAnimation* pAnimation, float timeMs, bool bLoop);
+            static void TakeSamplesJob(void* pUserData, int begin, int end);
+
+        private:
+            sAnimationSchedulerSettings         settings;
+            sAnimationSchedulerStats            totals;
+            sAnimationSchedulerStats            lastFrame;
+
+            std::vector<int>                    dueAgents;
+            std::vector<int>                    evaluatedAgents;
+            std::vector<sAnimationGraphInstance> evaluations;
+
+            // this frame's shared samples
+            std::vector<sSharedSample>          samples;
+            std::vector<int>                    sampleTable;    // open addressing, power of 2, -1 = empty
+            size_t                              uiSampleFloats; // needed by the frame
+            float*                              pSampleData;
+            size_t                              uiSampleCapacity;
+    };
+};
@@ -0,0 +1,293 @@
+#include "KHMBake.h"
+#include "KHMAnimationBounds.h"
+#include "KHMMeshLod.h"
+#include "Kernel/Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace KHM {
+
+CBaker::CBaker() :
+    lData(NULL),
+    uiSize(0),
+    numPending(0),
+    boundsFramesPerGroup(0),
+    numMeshLods(0),
+    pCollisionData(NULL),
+    pMaskEntries(NULL),
+    pAnimationBounds(NULL),
+    pMeshLods(NULL)
+{
+}
+
+CBaker::~CBaker()
+{
+    Reset();
+}
+
+void CBaker::Reset()
+{
+    free(lData);
+    free(pCollisionData);
+    free(pMaskEntries);
+    free(pAnimationBounds);
+    DestroyMeshLods(pMeshLods);
+
+    lData = NULL;
+    uiSize = 0;
+    numPending = 0;
+    pCollisionData = NULL;
+    pMaskEntries = NULL;
+    pAnimationBounds = NULL;
+    pMeshLods = NULL;
+}
+
+void CBaker::AddSection(unsigned int uiType, unsigned int uiCount, const void* pData, unsigned int uiSize, const void* pData2, unsigned int uiSize2)
+{
+    if (!pData || !uiSize)
+        return;
+
+    ASSERT(numPending < KHM_BAKE_MAX_SECTIONS);
+    sPendingSection& section = lPending[numPending++];
+    section.uiType = uiType;
+    section.uiCount = uiCount;
+    section.pData[0] = pData;
+    section.uiSize[0] = uiSize;
+    section.pData[1] = pData2;
+    section.uiSize[1] = pData2 ? uiSize2 : 0;
+}
+
+// same records ReadCollisionData parses
+static unsigned int WriteCollisionData(const sObjectMesh* pMesh, unsigned char* pDest)
+{
+    unsigned int uiOffset = 0;
+#define WRITE_COLLISION(pSrc, size) { if (pDest) memcpy(pDest + uiOffset, (pSrc), (size)); uiOffset += (size); }
+
+    WRITE_COLLISION(&pMesh->numCollisions, sizeof(int));
+    for (int i = 0; i < pMesh->numCollisions; ++i)
+    {
+        const sCollisionShape& col = pMesh->pCollisions[i];
+
+        const unsigned int uiType = (unsigned int)col.type;
+        WRITE_COLLISION(&uiType, sizeof(unsigned int));
+        WRITE_COLLISION(&col.transform, sizeof(float) * 16);
+
+        switch (col.type)
+        {
+            case sCollisionShape::SPHERE:
+                WRITE_COLLISION(&col.params.sphere.radius, sizeof(float));
+                break;
+
+            case sCollisionShape::BOX:
+                WRITE_COLLISION(col.params.box.extents, sizeof(float) * 3);
+                break;
+
+            case sCollisionShape::CAPSULE:
+                WRITE_COLLISION(&col.params.capsule.radius, sizeof(float));
+                WRITE_COLLISION(&col.params.capsule.halfHeight, sizeof(float));
+                break;
+
+            case sCollisionShape::CONVEX_MESH:
+                WRITE_COLLISION(&col.params.mesh.numPolys, sizeof(int));
+                WRITE_COLLISION(col.params.mesh.pPolygons, sizeof(sCollisionPolygon) * col.params.mesh.numPolys);
+                WRITE_COLLISION(&col.params.mesh.numIndices, sizeof(int));
+                WRITE_COLLISION(col.params.mesh.pIndices, sizeof(unsigned short) * col.params.mesh.numIndices);
+                WRITE_COLLISION(&col.params.mesh.numVertices, sizeof(int));
+                WRITE_COLLISION(col.params.mesh.pVertices, sizeof(Vector3) * col.params.mesh.numVertices);
+                break;
+
+            default:
+                DEBUG_BREAK();
+                break;
+        }
+    }
+
+#undef WRITE_COLLISION
+    return uiOffset;
+}
+
+bool CBaker::Bake(const sModelDefinition* pModelDefinition)
+{
+    Reset();
+
+    if (pModelDefinition->uiSections != MODEL_SECTIONS_ALL)
+    {
+        LOG_ERROR("[Error] CBaker::Bake(%s) - the model has to be loaded entirely\n", pModelDefinition->szFileName);
+        return false;
+    }
+
+    AddSection(SECTION_BONES, pModelDefinition->numBones, pModelDefinition->lBones, sizeof(sObjectBase) * pModelDefinition->numBones);
+    AddSection(SECTION_HELPERS, pModelDefinition->numHelpers, pModelDefinition->lHelpers, sizeof(sObjectBase) * pModelDefinition->numHelpers);
+
+    const sObjectMesh* pMesh = pModelDefinition->pMesh;
+    if (pMesh)
+    {
+        memcpy(&meshInfo.base, (const sObjectBase*)pMesh, sizeof(sObjectBase));
+        meshInfo.numVertices = pMesh->numVertices;
+        meshInfo.numIndices = pMesh->numIndices;
+        meshInfo.min = pMesh->min;
+        meshInfo.max = pMesh->max;
+        meshInfo.volume = pMesh->volume;
+        AddSection(SECTION_MESH, 1, &meshInfo, sizeof(meshInfo));
+
+        const unsigned int numVertices = pMesh->numVertices;
+        const unsigned int numFaces = pMesh->numIndices / 3;
+        AddSection(SECTION_VERTICES, numVertices, pMesh->pVertices, sizeof(Vector3) * numVertices);
+        AddSection(SECTION_NORMALS, numVertices, pMesh->pNormals, sizeof(Vector3) * numVertices);
+        AddSection(SECTION_INDICES, pMesh->numIndices, pMesh->pIndices, sizeof(unsigned short) * pMesh->numIndices);
+        AddSection(SECTION_FACE_NORMALS, numFaces, pMesh->pFaceNormals, sizeof(Vector3) * numFaces);
+        AddSection(SECTION_COLORS, numVertices, pMesh->pColors, sizeof(unsigned int) * numVertices);
+        AddSection(SECTION_TEXCOORDS, numVertices, pMesh->pTexCoords[0], sizeof(Vector2) * numVertices);
+        AddSection(SECTION_SKIN_WEIGHTS, numVertices, pMesh->pSkinWeights, sizeof(Vector4) * numVertices);
+        AddSection(SECTION_SKIN_INDICES, numVertices, pMesh->pSkinBoneIndices, sizeof(sBoneIndices) * numVertices);
+
+        const sMeshLod* pLods = pMesh->pLods;
+        const unsigned short* pLodIndices = pMesh->pLodIndices;
+        meshLodInfo.numLods = pMesh->numLods;
+        meshLodInfo.numIndices = pMesh->numLodIndices;
+        if (numMeshLods > 0)
+        {
+            sMeshLodSettings settings;
+            settings.numLods = Min(numMeshLods, KHM_MAX_MESH_LODS);
+            pMeshLods = CreateMeshLods(pMesh, settings);
+            if (pMeshLods)
+            {
+                pLods = pMeshLods->lods;
+                pLodIndices = pMeshLods->pIndices;
+                meshLodInfo.numLods = pMeshLods->numLods;
+                meshLodInfo.numIndices = pMeshLods->numIndices;
+            }
+        }
+
+        meshLodInfo.uiReserved[0] = meshLodInfo.uiReserved[1] = 0;
+        memset(meshLodInfo.lods, 0, sizeof(meshLodInfo.lods));
+        if (meshLodInfo.numLods > 0)
+        {
+            memcpy(meshLodInfo.lods, pLods, sizeof(sMeshLod) * meshLodInfo.numLods);
+            AddSection(SECTION_MESH_LODS, meshLodInfo.numLods, &meshLodInfo, sizeof(meshLodInfo), pLodIndices, sizeof(unsigned short) * meshLodInfo.numIndices);
+        }
+
+        if (pMesh->numCollisions)
+        {
+            const unsigned int uiCollisionSize = WriteCollisionData(pMesh, NULL);
+            pCollisionData = (unsigned char*)malloc(uiCollisionSize);
+            WriteCollisionData(pMesh, pCollisionData);
+            AddSection(SECTION_COLLISION, pMesh->numCollisions, pCollisionData, uiCollisionSize);
+        }
+    }
+
+    const sAnimation* pAnimation = pModelDefinition->pAnimation;
+    if (pAnimation)
+    {
+        animationInfo.numNodes = pAnimation->numNodes;
+        animationInfo.numNodeFrames = pAnimation->numNodeFrames;
+        animationInfo.frameDurationMs = pAnimation->frameDurationMs;
+        animationInfo.uiReserved = 0;
+        AddSection(SECTION_ANIMATION, 1, &animationInfo, sizeof(animationInfo),
+                   pAnimation->pNodeTransforms, sizeof(sNodeTransform) * pAnimation->numNodes * pAnimation->numNodeFrames);
+
+        const sAnimationBounds* pBounds = pAnimation->pBounds;
+        boundsInfo.numGroups = pAnimation->numBoundsGroups;
+        boundsInfo.framesPerGroup = pAnimation->framesPerBoundsGroup;
+        if (boundsFramesPerGroup > 0)
+        {
+            // models without a skinned mesh have nothing to bake; they keep what they have
+            const int numGroups = GetAnimationBoundsGroups(pAnimation->numNodeFrames, boundsFramesPerGroup);
+            pAnimationBounds = numGroups ? (sAnimationBounds*)malloc(sizeof(sAnimationBounds) * numGroups) : NULL;
+            if (pAnimationBounds && ComputeAnimationBounds(pModelDefinition, pAnimation, boundsFramesPerGroup, pAnimationBounds, NULL))
+            {
+                pBounds = pAnimationBounds;
+                boundsInfo.numGroups = numGroups;
+                boundsInfo.framesPerGroup = boundsFramesPerGroup;
+            }
+        }
+
+        boundsInfo.uiReserved[0] = boundsInfo.uiReserved[1] = 0;
+        if (pBounds)
+            AddSection(SECTION_ANIMATION_BOUNDS, boundsInfo.numGroups, &boundsInfo, sizeof(boundsInfo), pBounds, sizeof(sAnimationBounds) * boundsInfo.numGroups);
+    }
+
+    const sAnimationMask* pMask = pModelDefinition->pAnimationMask;
+    if (pMask)
+    {
+        pMaskEntries = (sAnimationMaskEntry*)malloc(sizeof(sAnimationMaskEntry) * KHM_MAX_BONES);
+        unsigned int numEntries = 0;
+        for (unsigned int uiId = 0; uiId < KHM_MAX_BONES; ++uiId)
+        {
+            const sObjectBase* pObject = pMask->IsUsed(uiId) ? pModelDefinition->GetObjectById(uiId) : NULL;
+            if (!pObject)
+                continue;
+
+            sAnimationMaskEntry& entry = pMaskEntries[numEntries++];
+            memset(&entry, 0, sizeof(entry));
+            memcpy(entry.szObjectName, pObject->szName, KHM_MAX_OBJECT_NAME - 1);
+            entry.szObjectName[KHM_MAX_OBJECT_NAME - 1] = 0;
+            entry.mask = 1;
+        }
+
+        // an empty mask still masks everything, so keep the section
+        AddSection(SECTION_ANIMATION_MASK, numEntries, pMaskEntries, Max(numEntries, 1u) * sizeof(sAnimationMaskEntry));
+        if (!numEntries)
+            memset(pMaskEntries, 0, sizeof(sAnimationMaskEntry));
+    }
+
+    // layout: header, table, then the sections on aligned offsets
+    const unsigned int uiAlignMask = KHM_SECTION_ALIGNMENT - 1;
+    unsigned int uiOffset = sizeof(sHeader) + sizeof(sSectionTable) + sizeof(sSectionEntry) * numPending;
+    sSectionEntry lEntries[KHM_BAKE_MAX_SECTIONS];
+    for (int i = 0; i < numPending; ++i)
+    {
+        uiOffset = (uiOffset + uiAlignMask) & ~uiAlignMask;
+        lEntries[i].uiType = lPending[i].uiType;
+        lEntries[i].uiOffset = uiOffset;
+        lEntries[i].uiSize = lPending[i].uiSize[0] + lPending[i].uiSize[1];
+        lEntries[i].uiCount = lPending[i].uiCount;
+        uiOffset += lEntries[i].uiSize;
+    }
+
+    uiSize = (uiOffset + uiAlignMask) & ~uiAlignMask;
+    lData = (unsigned char*)calloc(1, uiSize);
+
+    sHeader header;
+    header.uiVer = KHM_VERSION_SECTIONS;
+    sSectionTable table;
+    table.numSections = numPending;
+    table.uiFileSize = uiSize;
+
+    memcpy(lData, &header, sizeof(header));
+    memcpy(lData + sizeof(header), &table, sizeof(table));
+    memcpy(lData + sizeof(header) + sizeof(table), lEntries, sizeof(sSectionEntry) * numPending);
+    for (int i = 0; i < numPending; ++i)
+    {
+        memcpy(lData + lEntries[i].uiOffset, lPending[i].pData[0], lPending[i].uiSize[0]);
+        if (lPending[i].uiSize[1])
+            memcpy(lData + lEntries[i].uiOffset + lPending[i].uiSize[0], lPending[i].pData[1], lPending[i].uiSize[1]);
+    }
+
+    return true;
+}
+
+bool CBaker::Write(const char* pszPath) const
+{
+    if (!lData)
+        return false;
+
+    FILE* f = fopen(pszPath, "wb");
+    if (!f)
+    {
+        LOG_ERROR("[Error] CBaker::Write(%s) - can't open file for writing.\n", pszPath);
+        return false;
+    }
+
+    bool bOk = fwrite(lData, uiSize, 1, f) == 1;
+    if (fclose(f) != 0)
+        bOk = false;
+
+    if (!bOk)
+        LOG_ERROR("[Error] CBaker::Write(%s) - write failed.\n", pszPath);
+
+    return bOk;
+}
+
+}; // end namespace KHM
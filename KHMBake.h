@@ -0,0 +1,80 @@
+#pragma once
+
+#include "KHMModel.h"
+
+namespace KHM
+{
+    struct sMeshLodChain;
+
+    //
+    // common defines for the baker
+    //
+
+    #define KHM_BAKE_MAX_SECTIONS           20
+
+    //
+    // KHM Baker - writes a loaded model out in the v102 section layout
+    //
+    // the volume is taken from the loaded mesh, so it's computed once here instead of on every load.
+    // the second uv set and the node animation names are not written. mask entries are rebuilt from the
+    // compiled bits, so only the objects that resolved at load time are kept. animation bounds loaded with the
+    // model are written back, unless SetAnimationBoundsFrames asks for them to be baked again; same for the mesh
+    // LODs and SetMeshLods
+    //
+
+    class CBaker
+    {
+        public:
+            CBaker();
+            ~CBaker();
+
+        public:
+            // the model must stay loaded ( its buffer alive ) until Bake returns; the result is kept until the next Bake
+            bool Bake(const sModelDefinition* pModelDefinition);
+
+            // bakes a box per framesPerGroup keyframes of the skinned mesh ( KHMAnimationBounds.h ); 0 = keep what was loaded
+            void SetAnimationBoundsFrames(int framesPerGroup) { boundsFramesPerGroup = framesPerGroup; }
+
+            // builds a chain of numLods simplified levels of the mesh ( KHMMeshLod.h ); 0 = keep what was loaded
+            void SetMeshLods(int numLods) { numMeshLods = numLods; }
+
+            const unsigned char* GetData() const { return lData; }
+            unsigned int GetSize() const { return uiSize; }
+
+            bool Write(const char* pszPath) const;
+
+        private:
+            CBaker(const CBaker&);
+            CBaker& operator=(const CBaker&);
+
+            struct sPendingSection
+            {
+                unsigned int            uiType;
+                unsigned int            uiCount;
+                const void*             pData[2];   // written back to back; eg. info struct + array
+                unsigned int            uiSize[2];
+            };
+
+            void AddSection(unsigned int uiType, unsigned int uiCount, const void* pData, unsigned int uiSize, const void* pData2 = NULL, unsigned int uiSize2 = 0);
+            void Reset();
+
+        private:
+            unsigned char*          lData;
+            unsigned int            uiSize;
+
+            sPendingSection         lPending[KHM_BAKE_MAX_SECTIONS];
+            int                     numPending;
+            int                     boundsFramesPerGroup;
+            int                     numMeshLods;
+
+            // scratch owned by the current bake
+            unsigned char*          pCollisionData;
+            sAnimationMaskEntry*    pMaskEntries;
+            sAnimationBounds*       pAnimationBounds;
+            sMeshLodChain*          pMeshLods;
+            sMeshInfo               meshInfo;
+            sMeshLodInfo            meshLodInfo;
+            sAnimationInfo          animationInfo;
+            sAnimationBoundsInfo    boundsInfo;
+    };
+};
@@ -0,0 +1,633 @@
+#include "KHMCache.h"
+#include "KHMStats.h"
+#include "KHMHash.h"
+#include "Kernel/Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace KHM {
+
+//
+// helpers
+//
+
+// same rules as HashPath: case insensitive, '\' == '/'
+static bool PathEquals(const char* pszA, const char* pszB)
+{
+    for (;; ++pszA, ++pszB)
+    {
+        unsigned char a = *pszA;
+        unsigned char b = *pszB;
+        if (a >= 'A' && a <= 'Z')
+            a += 'a' - 'A';
+        else if (a == '\\')
+            a = '/';
+        if (b >= 'A' && b <= 'Z')
+            b += 'a' - 'A';
+        else if (b == '\\')
+            b = '/';
+
+        if (a != b)
+            return false;
+        if (!a)
+            return true;
+    }
+}
+
+// what the loader allocated on top of the file buffer
+static unsigned long long ComputeModelBytes(const sModelDefinition& md)
+{
+    sModelMemory memory;
+    ComputeModelMemory(&md, &memory);
+    return memory.uiArenaBytes;
+}
+
+//
+// CModelCache
+//
+
+CModelCache::CModelCache()
+{
+    pLoader = NULL;
+    uiByteBudget = 0;
+    uiBytesResident = 0;
+    uiClock = 0;
+    uiNextSerial = 0;
+    numHits = 0;
+    numMisses = 0;
+    numDedups = 0;
+    numEvictions = 0;
+    numFailures = 0;
+
+    for (int i = 0; i < KHM_CACHE_SHARDS; ++i)
+    {
+        modelShards[i].lBuckets = NULL;
+        modelShards[i].numBuckets = 0;
+        modelShards[i].numModels = 0;
+        modelShards[i].pLruHead = NULL;
+        modelShards[i].pLruTail = NULL;
+
+        pathShards[i].lBuckets = NULL;
+        pathShards[i].numBuckets = 0;
+        pathShards[i].numPaths = 0;
+    }
+}
+
+CModelCache::~CModelCache()
+{
+    Shutdown();
+}
+
+void CModelCache::Init(const CLoader* pCacheLoader, unsigned long long uiBudget)
+{
+    Shutdown();
+
+    pLoader = pCacheLoader;
+    uiByteBudget = uiBudget;
+
+    for (int i = 0; i < KHM_CACHE_SHARDS; ++i)
+    {
+        modelShards[i].numBuckets = KHM_CACHE_MIN_BUCKETS;
+        modelShards[i].lBuckets = new sCacheModel*[KHM_CACHE_MIN_BUCKETS];
+        memset(modelShards[i].lBuckets, 0, sizeof(sCacheModel*) * KHM_CACHE_MIN_BUCKETS);
+
+        pathShards[i].numBuckets = KHM_CACHE_MIN_BUCKETS;
+        pathShards[i].lBuckets = new sCachePath*[KHM_CACHE_MIN_BUCKETS];
+        memset(pathShards[i].lBuckets, 0, sizeof(sCachePath*) * KHM_CACHE_MIN_BUCKETS);
+    }
+}
+
+void CModelCache::Shutdown()
+{
+    for (int i = 0; i < KHM_CACHE_SHARDS; ++i)
+    {
+        sModelShard& modelShard = modelShards[i];
+        for (unsigned int b = 0; b < modelShard.numBuckets; ++b)
+        {
+            for (sCacheModel* pModel = modelShard.lBuckets[b]; pModel; )
+            {
+                sCacheModel* pNext = pModel->pNext;
+                if (pModel->numRefs)
+                    LOG_ERROR("[Error] CModelCache::Shutdown(%s) - model still referenced ( %d )\n", pModel->model.szFileName, pModel->numRefs);
+                DestroyModel(pModel);
+                pModel = pNext;
+            }
+        }
+        delete [] modelShard.lBuckets;
+        modelShard.lBuckets = NULL;
+        modelShard.numBuckets = 0;
+        modelShard.numModels = 0;
+        modelShard.pLruHead = NULL;
+        modelShard.pLruTail = NULL;
+
+        sPathShard& pathShard = pathShards[i];
+        for (unsigned int b = 0; b < pathShard.numBuckets; ++b)
+        {
+            for (sCachePath* pPath = pathShard.lBuckets[b]; pPath; )
+            {
+                sCachePath* pNext = pPath->pNext;
+                free(pPath);
+                pPath = pNext;
+            }
+        }
+        delete [] pathShard.lBuckets;
+        pathShard.lBuckets = NULL;
+        pathShard.numBuckets = 0;
+        pathShard.numPaths = 0;
+    }
+
+    uiBytesResident = 0;
+    pLoader = NULL;
+}
+
+void CModelCache::SetByteBudget(unsigned long long uiBudget)
+{
+    uiByteBudget = uiBudget;
+    Trim(uiBudget);
+}
+
+const sModelDefinition* CModelCache::Find(const char* pszFilePath)
+{
+    const unsigned int uiPathHash = HashPath(pszFilePath);
+
+    unsigned long long uiContentHash = 0;
+    unsigned long long uiSerial = 0;
+    {
+        sPathShard& shard = GetPathShard(uiPathHash);
+        std::lock_guard<std::mutex> lock(shard.lock);
+
+        const sCachePath* pPath = shard.lBuckets[(uiPathHash / KHM_CACHE_SHARDS) & (shard.numBuckets - 1)];
+        while (pPath && (pPath->uiPathHash != uiPathHash || !PathEquals(pPath->szPath, pszFilePath)))
+            pPath = pPath->pNext;
+        if (!pPath)
+            return NULL;
+
+        uiContentHash = pPath->uiContentHash;
+        uiSerial = pPath->uiSerial;
+    }
+
+    // the model may have been evicted since; its aliases go right after it
+    sModelShard& shard = GetModelShard(uiContentHash);
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    sCacheModel* pModel = shard.lBuckets[(uiContentHash / KHM_CACHE_SHARDS) & (shard.numBuckets - 1)];
+    while (pModel && pModel->uiSerial != uiSerial)
+        pModel = pModel->pNext;
+    if (!pModel)
+        return NULL;
+
+    AddRefLocked(shard, pModel);
+    ++numHits;
+    return &pModel->model;
+}
+
+const sModelDefinition* CModelCache::Acquire(const char* pszFilePath)
+{
+    const sModelDefinition* pModelDefinition = Find(pszFilePath);
+    if (pModelDefinition)
+        return pModelDefinition;
+
+    ++numMisses;
+
+    FILE* f = fopen(pszFilePath, "rb");
+    if (!f)
+    {
+        LOG_ERROR("[Error] CModelCache::Acquire(%s) - can't open file\n", pszFilePath);
+        ++numFailures;
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    const unsigned int fileSize = (size > 0) ? (unsigned int)size : 0;
+    unsigned char* fileBuff = (unsigned char*)malloc(Max(fileSize, 1u));
+    const bool bRead = fileSize && fread(fileBuff, fileSize, 1, f) == 1;
+    fclose(f);
+
+    if (!bRead)
+    {
+        LOG_ERROR("[Error] CModelCache::Acquire(%s) - read failed\n", pszFilePath);
+        free(fileBuff);
+        ++numFailures;
+        return NULL;
+    }
+
+    return Insert(pszFilePath, fileBuff, fileSize);
+}
+
+const sModelDefinition* CModelCache::Acquire(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize)
+{
+    const sModelDefinition* pModelDefinition = Find(pszFilePath);
+    if (pModelDefinition)
+    {
+        free(fileBuff);
+        return pModelDefinition;
+    }
+
+    ++numMisses;
+    return Insert(pszFilePath, fileBuff, fileSize);
+}
+
+const sModelDefinition* CModelCache::Insert(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize)
+{
+    const unsigned long long uiContentHash = HashData(fileBuff, fileSize);
+    sModelShard& shard = GetModelShard(uiContentHash);
+
+    // same bytes under another name
+    sCacheModel* pModel = NULL;
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        pModel = FindContent(shard, uiContentHash, fileBuff, fileSize);
+        if (pModel)
+            AddRefLocked(shard, pModel);
+    }
+
+    if (pModel)
+    {
+        ++numDedups;
+        free(fileBuff);
+        AddPath(pModel, pszFilePath);
+        return &pModel->model;
+    }
+
+    pModel = new sCacheModel();
+    if (!pLoader->LoadModel(pszFilePath, fileBuff, fileSize, &pModel->model))
+    {
+        pModel->model.Destroy();
+        delete pModel;
+        free(fileBuff);
+        ++numFailures;
+        return NULL;
+    }
+
+    pModel->uiContentHash = uiContentHash;
+    pModel->uiSerial = ++uiNextSerial;
+    pModel->fileBuff = fileBuff;
+    pModel->fileSize = fileSize;
+    pModel->uiBytes = sizeof(sCacheModel) + fileSize + ComputeModelBytes(pModel->model);
+    pModel->numRefs = 1;
+    pModel->uiLastUse = 0;
+    pModel->pNext = NULL;
+    pModel->pLruPrev = NULL;
+    pModel->pLruNext = NULL;
+    pModel->lPathHashes = NULL;
+    pModel->numPathHashes = 0;
+    pModel->maxPathHashes = 0;
+
+    // someone else may have loaded the same bytes meanwhile; theirs wins
+    sCacheModel* pExisting = NULL;
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        pExisting = FindContent(shard, uiContentHash, fileBuff, fileSize);
+        if (pExisting)
+            AddRefLocked(shard, pExisting);
+        else
+            InsertModelLocked(shard, pModel);
+    }
+
+    if (pExisting)
+    {
+        ++numDedups;
+        DestroyModel(pModel);
+        pModel = pExisting;
+    }
+    else
+    {
+        uiBytesResident += pModel->uiBytes;
+    }
+
+    AddPath(pModel, pszFilePath);
+
+    if (uiBytesResident > uiByteBudget)
+    {
+        // whoever is evicting already will get there
+        std::unique_lock<std::mutex> evictGuard(evictLock, std::try_to_lock);
+        if (evictGuard.owns_lock())
+        {
+            while (uiBytesResident > uiByteBudget && EvictOne())
+                ;
+        }
+    }
+
+    return &pModel->model;
+}
+
+void CModelCache::AddRef(const sModelDefinition* pModelDefinition)
+{
+    sCacheModel* pModel = (sCacheModel*)pModelDefinition;
+    sModelShard& shard = GetModelShard(pModel->uiContentHash);
+
+    std::lock_guard<std::mutex> lock(shard.lock);
+    ASSERT(pModel->numRefs > 0);
+    AddRefLocked(shard, pModel);
+}
+
+void CModelCache::Release(const sModelDefinition* pModelDefinition)
+{
+    if (!pModelDefinition)
+        return;
+
+    sCacheModel* pModel = (sCacheModel*)pModelDefinition;
+    sModelShard& shard = GetModelShard(pModel->uiContentHash);
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        ASSERT(pModel->numRefs > 0);
+        if (--pModel->numRefs)
+            return;
+
+        // most recently released at the head; stamps only grow, so every shard's list is sorted by them
+        pModel->uiLastUse = ++uiClock;
+        pModel->pLruPrev = NULL;
+        pModel->pLruNext = shard.pLruHead;
+        if (shard.pLruHead)
+            shard.pLruHead->pLruPrev = pModel;
+        else
+            shard.pLruTail = pModel;
+        shard.pLruHead = pModel;
+    }
+
+    if (uiBytesResident > uiByteBudget)
+    {
+        std::unique_lock<std::mutex> evictGuard(evictLock, std::try_to_lock);
+        if (evictGuard.owns_lock())
+        {
+            while (uiBytesResident > uiByteBudget && EvictOne())
+                ;
+        }
+    }
+}
+
+void CModelCache::Trim(unsigned long long uiBytes)
+{
+    std::lock_guard<std::mutex> evictGuard(evictLock);
+    while (uiBytesResident > uiBytes && EvictOne())
+        ;
+}
+
+void CModelCache::GetStats(sCacheStats* pStats) const
+{
+    pStats->numHits = numHits;
+    pStats->numMisses = numMisses;
+    pStats->numDedups = numDedups;
+    pStats->numEvictions = numEvictions;
+    pStats->numFailures = numFailures;
+    pStats->uiBytesResident = uiBytesResident;
+    pStats->uiByteBudget = uiByteBudget;
+
+    // a snapshot, the shards keep going while we count
+    pStats->numModels = 0;
+    pStats->numPaths = 0;
+    for (int i = 0; i < KHM_CACHE_SHARDS; ++i)
+    {
+        sModelShard& modelShard = const_cast<sModelShard&>(modelShards[i]);
+        {
+            std::lock_guard<std::mutex> lock(modelShard.lock);
+            pStats->numModels += modelShard.numModels;
+        }
+
+        sPathShard& pathShard = const_cast<sPathShard&>(pathShards[i]);
+        {
+            std::lock_guard<std::mutex> lock(pathShard.lock);
+            pStats->numPaths += pathShard.numPaths;
+        }
+    }
+}
+
+//
+// paths
+//
+
+void CModelCache::AddPath(sCacheModel* pModel, const char* pszFilePath)
+{
+    const unsigned int uiPathHash = HashPath(pszFilePath);
+    {
+        sPathShard& shard = GetPathShard(uiPathHash);
+        std::lock_guard<std::mutex> lock(shard.lock);
+
+        sCachePath* pPath = shard.lBuckets[(uiPathHash / KHM_CACHE_SHARDS) & (shard.numBuckets - 1)];
+        while (pPath && (pPath->uiPathHash != uiPathHash || !PathEquals(pPath->szPath, pszFilePath)))
+            pPath = pPath->pNext;
+
+        // a path left over from an evicted model is pointed at the new one
+        if (!pPath)
+        {
+            const size_t len = strlen(pszFilePath);
+            pPath = (sCachePath*)malloc(sizeof(sCachePath) + len);
+            pPath->uiPathHash = uiPathHash;
+            memcpy(pPath->szPath, pszFilePath, len + 1);
+
+            sCachePath*& pBucket = shard.lBuckets[(uiPathHash / KHM_CACHE_SHARDS) & (shard.numBuckets - 1)];
+            pPath->pNext = pBucket;
+            pBucket = pPath;
+            if (++shard.numPaths > (int)shard.numBuckets)
+                GrowPathShard(shard);
+        }
+
+        pPath->uiContentHash = pModel->uiContentHash;
+        pPath->uiSerial = pModel->uiSerial;
+    }
+
+    // we hold a reference, so the model can't be evicted while its alias list grows
+    sModelShard& shard = GetModelShard(pModel->uiContentHash);
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    for (int i = 0; i < pModel->numPathHashes; ++i)
+    {
+        if (pModel->lPathHashes[i] == uiPathHash)
+            return;
+    }
+
+    if (pModel->numPathHashes == pModel->maxPathHashes)
+    {
+        pModel->maxPathHashes = pModel->maxPathHashes ? pModel->maxPathHashes * 2 : 4;
+        pModel->lPathHashes = (unsigned int*)realloc(pModel->lPathHashes, sizeof(unsigned int) * pModel->maxPathHashes);
+    }
+    pModel->lPathHashes[pModel->numPathHashes++] = uiPathHash;
+}
+
+void CModelCache::RemovePaths(sCacheModel* pModel)
+{
+    for (int i = 0; i < pModel->numPathHashes; ++i)
+    {
+        const unsigned int uiPathHash = pModel->lPathHashes[i];
+        sPathShard& shard = GetPathShard(uiPathHash);
+        std::lock_guard<std::mutex> lock(shard.lock);
+
+        // only the aliases still pointing at this load; a path reloaded meanwhile keeps its alias
+        sCachePath** ppPath = &shard.lBuckets[(uiPathHash / KHM_CACHE_SHARDS) & (shard.numBuckets - 1)];
+        while (*ppPath)
+        {
+            sCachePath* pPath = *ppPath;
+            if (pPath->uiSerial == pModel->uiSerial)
+            {
+                *ppPath = pPath->pNext;
+                free(pPath);
+                --shard.numPaths;
+            }
+            else
+            {
+                ppPath = &pPath->pNext;
+            }
+        }
+    }
+}
+
+//
+// eviction
+//
+
+bool CModelCache::EvictOne()
+{
+    // the oldest unreferenced model is at the tail of one of the shard lists
+    int victimShard = -1;
+    unsigned long long uiOldest = 0;
+    for (int i = 0; i < KHM_CACHE_SHARDS; ++i)
+    {
+        std::lock_guard<std::mutex> lock(modelShards[i].lock);
+        const sCacheModel* pTail = modelShards[i].pLruTail;
+        if (pTail && (victimShard < 0 || pTail->uiLastUse < uiOldest))
+        {
+            victimShard = i;
+            uiOldest = pTail->uiLastUse;
+        }
+    }
+
+    if (victimShard < 0)
+        return false;
+
+    sModelShard& shard = modelShards[victimShard];
+    sCacheModel* pModel = NULL;
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+
+        // acquired again since we looked; whatever is the oldest there now is close enough
+        pModel = shard.pLruTail;
+        if (!pModel)
+            return true;
+
+        UnlinkLru(shard, pModel);
+
+        sCacheModel** ppModel = &shard.lBuckets[(pModel->uiContentHash / KHM_CACHE_SHARDS) & (shard.numBuckets - 1)];
+        while (*ppModel != pModel)
+            ppModel = &(*ppModel)->pNext;
+        *ppModel = pModel->pNext;
+        --shard.numModels;
+    }
+
+    RemovePaths(pModel);
+
+    uiBytesResident -= pModel->uiBytes;
+    ++numEvictions;
+    DestroyModel(pModel);
+    return true;
+}
+
+//
+// shard internals; shard lock held
+//
+
+CModelCache::sCacheModel* CModelCache::FindContent(sModelShard& shard, unsigned long long uiContentHash, const unsigned char* fileBuff, unsigned int fileSize) const
+{
+    // the loader may have rewritten the cached buffer; then the hash and the size have to do
+    const bool bCompareBytes = (pLoader->GetFlags() & LOAD_FLAGS_WRITE_BUFFER) == 0;
+
+    for (sCacheModel* pModel = shard.lBuckets[(uiContentHash / KHM_CACHE_SHARDS) & (shard.numBuckets - 1)]; pModel; pModel = pModel->pNext)
+    {
+        if (pModel->uiContentHash == uiContentHash && pModel->fileSize == fileSize &&
+            (!bCompareBytes || memcmp(pModel->fileBuff, fileBuff, fileSize) == 0))
+            return pModel;
+    }
+
+    return NULL;
+}
+
+void CModelCache::AddRefLocked(sModelShard& shard, sCacheModel* pModel)
+{
+    if (pModel->numRefs++ == 0)
+        UnlinkLru(shard, pModel);
+}
+
+void CModelCache::InsertModelLocked(sModelShard& shard, sCacheModel* pModel)
+{
+    sCacheModel*& pBucket = shard.lBuckets[(pModel->uiContentHash / KHM_CACHE_SHARDS) & (shard.numBuckets - 1)];
+    pModel->pNext = pBucket;
+    pBucket = pModel;
+
+    if (++shard.numModels > (int)shard.numBuckets)
+        GrowModelShard(shard);
+}
+
+void CModelCache::UnlinkLru(sModelShard& shard, sCacheModel* pModel)
+{
+    if (pModel->pLruPrev)
+        pModel->pLruPrev->pLruNext = pModel->pLruNext;
+    else
+        shard.pLruHead = pModel->pLruNext;
+
+    if (pModel->pLruNext)
+        pModel->pLruNext->pLruPrev = pModel->pLruPrev;
+    else
+        shard.pLruTail = pModel->pLruPrev;
+
+    pModel->pLruPrev = NULL;
+    pModel->pLruNext = NULL;
+}
+
+void CModelCache::GrowModelShard(sModelShard& shard)
+{
+    const unsigned int numBuckets = shard.numBuckets * 2;
+    sCacheModel** lBuckets = new sCacheModel*[numBuckets];
+    memset(lBuckets, 0, sizeof(sCacheModel*) * numBuckets);
+
+    for (unsigned int b = 0; b < shard.numBuckets; ++b)
+    {
+        for (sCacheModel* pModel = shard.lBuckets[b]; pModel; )
+        {
+            sCacheModel* pNext = pModel->pNext;
+            sCacheModel*& pBucket = lBuckets[(pModel->uiContentHash / KHM_CACHE_SHARDS) & (numBuckets - 1)];
+            pModel->pNext = pBucket;
+            pBucket = pModel;
+            pModel = pNext;
+        }
+    }
+
+    delete [] shard.lBuckets;
+    shard.lBuckets = lBuckets;
+    shard.numBuckets = numBuckets;
+}
+
+void CModelCache::GrowPathShard(sPathShard& shard)
+{
+    const unsigned int numBuckets = shard.numBuckets * 2;
+    sCachePath** lBuckets = new sCachePath*[numBuckets];
+    memset(lBuckets, 0, sizeof(sCachePath*) * numBuckets);
+
+    for (unsigned int b = 0; b < shard.numBuckets; ++b)
+    {
+        for (sCachePath* pPath = shard.lBuckets[b]; pPath; )
+        {
+            sCachePath* pNext = pPath->pNext;
+            sCachePath*& pBucket = lBuckets[(pPath->uiPathHash / KHM_CACHE_SHARDS) & (numBuckets - 1)];
+            pPath->pNext = pBucket;
+            pBucket = pPath;
+            pPath = pNext;
+        }
+    }
+
+    delete [] shard.lBuckets;
+    shard.lBuckets = lBuckets;
+    shard.numBuckets = numBuckets;
+}
+
+void CModelCache::DestroyModel(sCacheModel* pModel)
+{
+    pModel->model.Destroy();
+    free(pModel->fileBuff);
+    free(pModel->lPathHashes);
+    delete pModel;
+}
+
+}; // end namespace KHM
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "KHMModel.h"
+
+#include <mutex>
+#include <atomic>
+
+namespace KHM
+{
+    //
+    // common defines for the model cache
+    //
+
+    #define KHM_CACHE_SHARDS                16 // power of 2; lookups that land on different shards never wait on each other
+    #define KHM_CACHE_MIN_BUCKETS           16 // per shard; the tables double as they fill
+
+    struct sCacheStats
+    {
+        unsigned long long      numHits;            // Acquire or Find found the path
+        unsigned long long      numMisses;          // Acquire had to load
+        unsigned long long      numDedups;          // misses whose bytes were already cached under another path; no load
+        unsigned long long      numEvictions;
+        unsigned long long      numFailures;        // files that didn't load
+        unsigned long long      uiBytesResident;    // every cached model, its file buffer included
+        unsigned long long      uiByteBudget;
+        int                     numModels;          // distinct contents
+        int                     numPaths;
+    };
+
+    //
+    // KHM Model Cache - shared, immutable model definitions, refcounted
+    //
+    // models are keyed by the content of their file, so the same bytes under different names are loaded once;
+    // paths are aliases to a content. every Acquire returns a handle ( the shared definition ) that has to be
+    // released; models nobody holds stay cached, least recently released first out, as long as the cache fits in
+    // its byte budget. a budget of 0 keeps nothing that isn't held.
+    //
+    // both tables are split in KHM_CACHE_SHARDS shards, each with its own lock held only for the table operation;
+    // files are read, hashed and loaded outside of any lock. two threads missing on the same path at once both load
+    // it, the second one to finish drops its copy and takes the first one's ( it counts as a dedup )
+    //
+
+    class CModelCache
+    {
+        public:
+            CModelCache();
+            ~CModelCache();
+
+        public:
+            // the loader ( and its flags ) is used for every model loaded by the cache
+            void Init(const CLoader* pLoader, unsigned long long uiByteBudget);
+            // every handle must have been released
+            void Shutdown();
+
+            void SetByteBudget(unsigned long long uiByteBudget);
+
+            // NULL if the file can't be read or doesn't load
+            const sModelDefinition* Acquire(const char* pszFilePath);
+            // for files that are already in memory; takes fileBuff ( malloc'd ), it is freed when the model is evicted or
+            // right away if the path or the content is cached already
+            const sModelDefinition* Acquire(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize);
+            // cached models only; never loads. a hit is a handle like any other
+            const sModelDefinition* Find(const char* pszFilePath);
+
+            void AddRef(const sModelDefinition* pModelDefinition);
+            void Release(const sModelDefinition* pModelDefinition);
+
+            // evicts models nobody holds until the cache fits in uiBytes
+            void Trim(unsigned long long uiBytes);
+
+            void GetStats(sCacheStats* pStats) const;
+
+        private:
+            CModelCache(const CModelCache&);
+            CModelCache& operator=(const CModelCache&);
+
+            struct sCacheModel
+            {
+                sModelDefinition    model;          // first, the handles point here
+                unsigned long long  uiContentHash;  // HashData of the file
+                unsigned long long  uiSerial;       // unique per load, so a stale alias can't find a reload of the same bytes
+                unsigned char*      fileBuff;
+                unsigned int        fileSize;
+                unsigned long long  uiBytes;        // what evicting it gives back
+
+                // under the shard lock
+                int                 numRefs;
+                unsigned long long  uiLastUse;      // stamp of the last release
+                sCacheModel*        pNext;          // bucket chain
+                sCacheModel*        pLruPrev;       // unreferenced models only; most recently released first
+                sCacheModel*        pLruNext;
+                unsigned int*       lPathHashes;    // aliases to remove on eviction
+                int                 numPathHashes;
+                int                 maxPathHashes;
+            };
+
+            struct sCachePath
+            {
+                unsigned int        uiPathHash;     // HashPath
+                unsigned long long  uiContentHash;
+                unsigned long long  uiSerial;
+                sCachePath*         pNext;
+                char                szPath[1];      // allocated to fit
+            };
+
+            struct sModelShard
+            {
+                std::mutex          lock;
+                sCacheModel**       lBuckets;
+                unsigned int        numBuckets;
+                int                 numModels;
+                sCacheModel*        pLruHead;
+                sCacheModel*        pLruTail;
+            };
+
+            struct sPathShard
+            {
+                std::mutex          lock;
+                sCachePath**        lBuckets;
+                unsigned int        numBuckets;
+                int                 numPaths;
+            };
+
+            sModelShard& GetModelShard(unsigned long long uiContentHash) { return modelShards[uiContentHash & (KHM_CACHE_SHARDS - 1)]; }
+            sPathShard& GetPathShard(unsigned int uiPathHash) { return pathShards[uiPathHash & (KHM_CACHE_SHARDS - 1)]; }
+
+            const sModelDefinition* Insert(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize);
+            void AddPath(sCacheModel* pModel, const char* pszFilePath);
+            void RemovePaths(sCacheModel* pModel);
+            bool EvictOne();
+
+            // shard lock held
+            sCacheModel* FindContent(sModelShard& shard, unsigned long long uiContentHash, const unsigned char* fileBuff, unsigned int fileSize) const;
+            void AddRefLocked(sModelShard& shard, sCacheModel* pModel);
+            void InsertModelLocked(sModelShard& shard, sCacheModel* pModel);
+            void UnlinkLru(sModelShard& shard, sCacheModel* pModel);
+            static void GrowModelShard(sModelShard& shard);
+            static void GrowPathShard(sPathShard& shard);
+
+            static void DestroyModel(sCacheModel* pModel);
+
+        private:
+            const CLoader*                      pLoader;
+            sModelShard                         modelShards[KHM_CACHE_SHARDS];
+            sPathShard                          pathShards[KHM_CACHE_SHARDS];
+
+            std::atomic<unsigned long long>     uiByteBudget;
+            std::atomic<unsigned long long>     uiBytesResident;
+            std::atomic<unsigned long long>     uiClock;        // release stamps
+            std::atomic<unsigned long long>     uiNextSerial;
+            std::mutex                          evictLock;      // one evicting thread at a time
+
+            std::atomic<unsigned long long>     numHits;
+            std::atomic<unsigned long long>     numMisses;
+            std::atomic<unsigned long long>     numDedups;
+            std::atomic<unsigned long long>     numEvictions;
+            std::atomic<unsigned long long>     numFailures;
+    };
+};
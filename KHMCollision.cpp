@@ -0,0 +1,1006 @@
+#include "KHMCollision.h"
+#include "KHMConvex.h"
+#include "KHMJobs.h"
+#include "KHMSimd.h"
+#include "Kernel/Log.h"
+
+#include <float.h>
+#include <math.h>
+
+namespace KHM {
+
+//
+// primitive bounds
+//
+
+struct sBuildItem
+{
+    float                   min[3];
+    float                   max[3];
+    float                   center[3];
+};
+
+static void SetItemBounds(sBuildItem& item, const Vector3& min, const Vector3& max)
+{
+    item.min[0] = min.x; item.min[1] = min.y; item.min[2] = min.z;
+    item.max[0] = max.x; item.max[1] = max.y; item.max[2] = max.z;
+    for (int k = 0; k < 3; ++k)
+        item.center[k] = 0.5f * (item.min[k] + item.max[k]);
+}
+
+// bounds of a local [-extents, extents] box placed by m
+static void TransformedBoxBounds(const sMatrix3x4& m, const float* extents, sBuildItem& item)
+{
+    Vector3 center(m.row[0][3], m.row[1][3], m.row[2][3]);
+    float half[3];
+    for (int r = 0; r < 3; ++r)
+        half[r] = fabsf(m.row[r][0]) * extents[0] + fabsf(m.row[r][1]) * extents[1] + fabsf(m.row[r][2]) * extents[2];
+
+    const Vector3 h(half[0], half[1], half[2]);
+    SetItemBounds(item, center - h, center + h);
+}
+
+static bool GetShapeBounds(const sCollisionShape& shape, const sMatrix3x4& transform, sBuildItem& item)
+{
+    switch (shape.type)
+    {
+        case sCollisionShape::SPHERE:
+        {
+            const float extents[3] = { shape.params.sphere.radius, shape.params.sphere.radius, shape.params.sphere.radius };
+            TransformedBoxBounds(transform, extents, item);
+            return true;
+        }
+
+        case sCollisionShape::BOX:
+            TransformedBoxBounds(transform, shape.params.box.extents, item);
+            return true;
+
+        case sCollisionShape::CAPSULE:
+        {
+            const float r = shape.params.capsule.radius;
+            const float extents[3] = { shape.params.capsule.halfHeight + r, r, r };
+            TransformedBoxBounds(transform, extents, item);
+            return true;
+        }
+
+        case sCollisionShape::CONVEX_MESH:
+        {
+            if (shape.params.mesh.numVertices <= 0)
+                return false;
+
+            Vector3 min(FLT_MAX, FLT_MAX, FLT_MAX);
+            Vector3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            for (int v = 0; v < shape.params.mesh.numVertices; ++v)
+            {
+                const Vector3 p = TransformPoint(transform, shape.params.mesh.pVertices[v]);
+                min = Vector3(Min(min.x, p.x), Min(min.y, p.y), Min(min.z, p.z));
+                max = Vector3(Max(max.x, p.x), Max(max.y, p.y), Max(max.z, p.z));
+            }
+            SetItemBounds(item, min, max);
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+//
+// binned SAH build
+//
+
+struct sBVHBuilder
+{
+    sBuildItem*             pItems;
+    int*                    pOrder;         // item indices, partitioned in place
+    sCollisionBVHNode*      pNodes;
+    int                     numNodes;
+};
+
+static float SurfaceArea(const float* min, const float* max)
+{
+    const float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static void GrowBounds(float* min, float* max, const float* itemMin, const float* itemMax)
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        min[k] = Min(min[k], itemMin[k]);
+        max[k] = Max(max[k], itemMax[k]);
+    }
+}
+
+static void BuildNode(sBVHBuilder& builder, int nodeIndex, int first, int count, int depth)
+{
+    sCollisionBVHNode& node = builder.pNodes[nodeIndex];
+
+    float centerMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float centerMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int k = 0; k < 3; ++k)
+    {
+        node.min[k] = FLT_MAX;
+        node.max[k] = -FLT_MAX;
+    }
+
+    for (int i = first; i < first + count; ++i)
+    {
+        const sBuildItem& item = builder.pItems[builder.pOrder[i]];
+        GrowBounds(node.min, node.max, item.min, item.max);
+        GrowBounds(centerMin, centerMax, item.center, item.center);
+    }
+
+    node.first = first;
+    node.count = count;
+    if (count <= 1 || depth >= KHM_BVH_MAX_DEPTH - 1)
+        return;
+
+    int axis = 0;
+    for (int k = 1; k < 3; ++k)
+    {
+        if (centerMax[k] - centerMin[k] > centerMax[axis] - centerMin[axis])
+            axis = k;
+    }
+
+    int split = first + count / 2; // median, when all the centers fall in one spot
+    const float extent = centerMax[axis] - centerMin[axis];
+    if (extent > 0.0f)
+    {
+        int binCount[KHM_BVH_SAH_BINS];
+        float binMin[KHM_BVH_SAH_BINS][3];
+        float binMax[KHM_BVH_SAH_BINS][3];
+        for (int b = 0; b < KHM_BVH_SAH_BINS; ++b)
+        {
+            binCount[b] = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                binMin[b][k] = FLT_MAX;
+                binMax[b][k] = -FLT_MAX;
+            }
+        }
+
+        const float binScale = (float)KHM_BVH_SAH_BINS / extent;
+        for (int i = first; i < first + count; ++i)
+        {
+            const sBuildItem& item = builder.pItems[builder.pOrder[i]];
+            const int b = Min((int)((item.center[axis] - centerMin[axis]) * binScale), KHM_BVH_SAH_BINS - 1);
+            ++binCount[b];
+            GrowBounds(binMin[b], binMax[b], item.min, item.max);
+        }
+
+        // sweep from the right for the suffix areas, then from the left for the costs
+        float rightArea[KHM_BVH_SAH_BINS];
+        int rightCount[KHM_BVH_SAH_BINS];
+        float accMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float accMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        int acc = 0;
+        for (int b = KHM_BVH_SAH_BINS - 1; b > 0; --b)
+        {
+            acc += binCount[b];
+            GrowBounds(accMin, accMax, binMin[b], binMax[b]);
+            rightCount[b] = acc;
+            rightArea[b] = acc ? SurfaceArea(accMin, accMax) : 0.0f;
+        }
+
+        float bestCost = FLT_MAX;
+        int bestBin = -1;
+        for (int k = 0; k < 3; ++k)
+        {
+            accMin[k] = FLT_MAX;
+            accMax[k] = -FLT_MAX;
+        }
+        acc = 0;
+        for (int b = 0; b < KHM_BVH_SAH_BINS - 1; ++b)
+        {
+            acc += binCount[b];
+            GrowBounds(accMin, accMax, binMin[b], binMax[b]);
+            if (!acc || !rightCount[b + 1])
+                continue;
+
+            const float cost = SurfaceArea(accMin, accMax) * acc + rightArea[b + 1] * rightCount[b + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestBin = b;
+            }
+        }
+
+        // traversal step costs about one primitive test
+        const float leafCost = (float)count;
+        const float splitCost = 1.0f + bestCost / SurfaceArea(node.min, node.max);
+        if (bestBin < 0 || (count <= KHM_BVH_MAX_LEAF_PRIMITIVES && splitCost >= leafCost))
+        {
+            if (count <= KHM_BVH_MAX_LEAF_PRIMITIVES)
+                return;
+        }
+        else
+        {
+            int* pLeft = &builder.pOrder[first];
+            int* pRight = &builder.pOrder[first + count - 1];
+            while (pLeft <= pRight)
+            {
+                const sBuildItem& item = builder.pItems[*pLeft];
+                const int b = Min((int)((item.center[axis] - centerMin[axis]) * binScale), KHM_BVH_SAH_BINS - 1);
+                if (b <= bestBin)
+                {
+                    ++pLeft;
+                }
+                else
+                {
+                    const int tmp = *pLeft; *pLeft = *pRight; *pRight = tmp;
+                    --pRight;
+                }
+            }
+            split = (int)(pLeft - builder.pOrder);
+        }
+    }
+    else if (count <= KHM_BVH_MAX_LEAF_PRIMITIVES)
+    {
+        return;
+    }
+
+    const int left = builder.numNodes;
+    builder.numNodes += 2;
+
+    node.first = left;
+    node.count = -1 - axis;
+    BuildNode(builder, left, first, split - first, depth + 1);
+    BuildNode(builder, left + 1, split, first + count - split, depth + 1);
+}
+
+sCollisionBVH* CreateCollisionBVH(const sModelDefinition* pModelDefinition, unsigned int uiFlags)
+{
+    const sObjectMesh* pMesh = pModelDefinition->pMesh;
+    if (!pMesh)
+        return NULL;
+
+    const int numShapes = (uiFlags & COLLISION_BVH_SHAPES) ? pMesh->numCollisions : 0;
+    const int numTris = ((uiFlags & COLLISION_BVH_TRIANGLES) && pMesh->pIndices) ? pMesh->numIndices / 3 : 0;
+    if (numShapes + numTris <= 0)
+        return NULL;
+
+    sCollisionPrimitive* pSource = new sCollisionPrimitive[numShapes + numTris];
+    sBuildItem* pItems = new sBuildItem[numShapes + numTris];
+    int numPrimitives = 0;
+
+    for (int i = 0; i < numShapes; ++i)
+    {
+        const sCollisionShape& shape = pMesh->pCollisions[i];
+        sCollisionPrimitive& prim = pSource[numPrimitives];
+
+        sMatrix3x4 transform;
+        Matrix3x4FromMatrix(shape.transform, transform);
+        if (!InvertMatrix3x4(transform, prim.invTransform) || !GetShapeBounds(shape, transform, pItems[numPrimitives]))
+        {
+            LOG_ERROR("[Error] CreateCollisionBVH(%s) - skipping collision shape %d\n", pModelDefinition->szFileName, i);
+            continue;
+        }
+
+        switch (shape.type)
+        {
+            case sCollisionShape::SPHERE:   prim.type = sCollisionPrimitive::PRIMITIVE_SPHERE; break;
+            case sCollisionShape::BOX:      prim.type = sCollisionPrimitive::PRIMITIVE_BOX; break;
+            case sCollisionShape::CAPSULE:  prim.type = sCollisionPrimitive::PRIMITIVE_CAPSULE; break;
+            default:                        prim.type = sCollisionPrimitive::PRIMITIVE_CONVEX; break;
+        }
+        prim.index = i;
+        ++numPrimitives;
+    }
+
+    for (int t = 0; t < numTris; ++t)
+    {
+        const Vector3& v0 = pMesh->pVertices[pMesh->pIndices[t * 3 + 0]];
+        const Vector3& v1 = pMesh->pVertices[pMesh->pIndices[t * 3 + 1]];
+        const Vector3& v2 = pMesh->pVertices[pMesh->pIndices[t * 3 + 2]];
+
+        sCollisionPrimitive& prim = pSource[numPrimitives];
+        prim.type = sCollisionPrimitive::PRIMITIVE_TRIANGLE;
+        prim.index = t;
+        SetIdentity(prim.invTransform);
+
+        SetItemBounds(pItems[numPrimitives++],
+                      Vector3(Min(v0.x, Min(v1.x, v2.x)), Min(v0.y, Min(v1.y, v2.y)), Min(v0.z, Min(v1.z, v2.z))),
+                      Vector3(Max(v0.x, Max(v1.x, v2.x)), Max(v0.y, Max(v1.y, v2.y)), Max(v0.z, Max(v1.z, v2.z))));
+    }
+
+    if (!numPrimitives)
+    {
+        delete [] pSource;
+        delete [] pItems;
+        return NULL;
+    }
+
+    sBVHBuilder builder;
+    builder.pItems = pItems;
+    builder.pOrder = new int[numPrimitives];
+    builder.pNodes = new sCollisionBVHNode[numPrimitives * 2];
+    builder.numNodes = 1;
+    for (int i = 0; i < numPrimitives; ++i)
+        builder.pOrder[i] = i;
+
+    BuildNode(builder, 0, 0, numPrimitives, 0);
+
+    sCollisionBVH* pBVH = new sCollisionBVH();
+    pBVH->pMesh = pMesh;
+    pBVH->numNodes = builder.numNodes;
+    pBVH->pNodes = builder.pNodes;
+    pBVH->numPrimitives = numPrimitives;
+    pBVH->pPrimitives = new sCollisionPrimitive[numPrimitives];
+    for (int i = 0; i < numPrimitives; ++i)
+        pBVH->pPrimitives[i] = pSource[builder.pOrder[i]];
+
+    // support mapping for GJK; the polygons come straight from the file, the adjacency is only built here
+    pBVH->ppHulls = NULL;
+    if (numShapes)
+    {
+        pBVH->ppHulls = new sConvexHull*[numShapes];
+        for (int i = 0; i < numShapes; ++i)
+            pBVH->ppHulls[i] = CreateConvexHull(pMesh->pCollisions[i], true);
+    }
+
+    delete [] builder.pOrder;
+    delete [] pSource;
+    delete [] pItems;
+    return pBVH;
+}
+
+void DestroyCollisionBVH(sCollisionBVH* pBVH)
+{
+    if (!pBVH)
+        return;
+
+    if (pBVH->ppHulls)
+    {
+        for (int i = 0; i < pBVH->pMesh->numCollisions; ++i)
+            DestroyConvexHull(pBVH->ppHulls[i]);
+        delete [] pBVH->ppHulls;
+    }
+
+    delete [] pBVH->pNodes;
+    delete [] pBVH->pPrimitives;
+    delete pBVH;
+}
+
+void SetCollisionInstance(sCollisionInstance& instance, const sCollisionBVH* pBVH, const sMatrix3x4& transform)
+{
+    instance.pBVH = pBVH;
+    instance.transform = transform;
+    if (!InvertMatrix3x4(transform, instance.invTransform))
+        SetIdentity(instance.invTransform);
+
+    sBuildItem item;
+    const sCollisionBVHNode& root = pBVH->pNodes[0];
+    sMatrix3x4 m = transform;
+    const float extents[3] = { 0.5f * (root.max[0] - root.min[0]), 0.5f * (root.max[1] - root.min[1]), 0.5f * (root.max[2] - root.min[2]) };
+    const Vector3 center = TransformPoint(transform, Vector3(0.5f * (root.max[0] + root.min[0]), 0.5f * (root.max[1] + root.min[1]), 0.5f * (root.max[2] + root.min[2])));
+    m.row[0][3] = center.x;
+    m.row[1][3] = center.y;
+    m.row[2][3] = center.z;
+    TransformedBoxBounds(m, extents, item);
+
+    instance.min = Vector3(item.min[0], item.min[1], item.min[2]);
+    instance.max = Vector3(item.max[0], item.max[1], item.max[2]);
+}
+
+//
+// primitive tests; all return the first entry t in [0, maxT] and the surface normal ( not normalized )
+//
+
+static bool IntersectSphere(const Vector3& o, const Vector3& d, const Vector3& center, float radius, float maxT, float& t, Vector3& normal)
+{
+    const Vector3 oc = o - center;
+    const float c = Dot3(oc, oc) - radius * radius;
+    if (c < 0.0f)
+        return false; // starts inside
+
+    const float a = Dot3(d, d);
+    const float b = Dot3(d, oc);
+    if (b > 0.0f)
+        return false;
+
+    // from the closest approach rather than b * b - a * c, which cancels when the ray starts far away
+    const float tm = -b / a;
+    const Vector3 pm = oc + d * tm;
+    const float h = radius * radius - Dot3(pm, pm);
+    if (h < 0.0f)
+        return false;
+
+    const float tt = Max(0.0f, tm - sqrtf(h / a));
+    if (tt > maxT)
+        return false;
+
+    t = tt;
+    normal = oc + d * tt;
+    return true;
+}
+
+static bool IntersectCapsule(const Vector3& o, const Vector3& d, const Vector3& p0, const Vector3& p1, float radius, float maxT, float& t, Vector3& normal)
+{
+    const Vector3 ba = p1 - p0;
+    const Vector3 oa = o - p0;
+    const float baba = Dot3(ba, ba);
+    const float baoa = Dot3(ba, oa);
+
+    // starts inside
+    const float s = (baba > 0.0f) ? Max(0.0f, Min(1.0f, baoa / baba)) : 0.0f;
+    const Vector3 closest = oa - ba * s;
+    if (Dot3(closest, closest) < radius * radius)
+        return false;
+
+    bool bHit = false;
+    const float dd = Dot3(d, d);
+    const float bard = Dot3(ba, d);
+    const float a = baba * dd - bard * bard;
+    if (a > 1e-12f * baba * dd)
+    {
+        // solved from the ray's closest approach to the segment's middle: from far away the quadratic's terms are
+        // large and nearly equal, and the cancellation moves the hit by more than the sweeps can tell apart
+        const float tm = Max(0.0f, -Dot3(d, oa - ba * 0.5f) / dd);
+        const Vector3 om = oa + d * tm;
+        const float baom = Dot3(ba, om);
+        const float b = baba * Dot3(d, om) - baom * bard;
+        const float c = baba * Dot3(om, om) - baom * baom - radius * radius * baba;
+        const float h = b * b - a * c;
+        if (h >= 0.0f)
+        {
+            const float dt = (-b - sqrtf(h)) / a;
+            const float tt = tm + dt;
+            const float y = baom + dt * bard;
+            if (tt >= 0.0f && tt <= maxT && y > 0.0f && y < baba)
+            {
+                t = maxT = tt;
+                normal = om + d * dt - ba * (y / baba);
+                bHit = true;
+            }
+        }
+    }
+
+    // the body missed or was entered past an end; the caps can only be closer
+    if (!bHit)
+    {
+        if (IntersectSphere(o, d, p0, radius, maxT, t, normal))
+        {
+            maxT = t;
+            bHit = true;
+        }
+        if (IntersectSphere(o, d, p1, radius, maxT, t, normal))
+            bHit = true;
+    }
+    return bHit;
+}
+
+static bool IntersectBox(const Vector3& o, const Vector3& d, const float* extents, float radius, float maxT, float& t, Vector3& normal)
+{
+    const float orig[3] = { o.x, o.y, o.z };
+    const float dir[3] = { d.x, d.y, d.z };
+
+    float tNear = -FLT_MAX;
+    float tFar = FLT_MAX;
+    int nearAxis = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+        const float e = extents[k] + radius;
+        if (fabsf(dir[k]) < 1e-20f)
+        {
+            if (fabsf(orig[k]) > e)
+                return false;
+            continue;
+        }
+
+        const float inv = 1.0f / dir[k];
+        float t0 = (-e - orig[k]) * inv;
+        float t1 = (e - orig[k]) * inv;
+        if (t0 > t1)
+        {
+            const float tmp = t0; t0 = t1; t1 = tmp;
+        }
+        if (t0 > tNear)
+        {
+            tNear = t0;
+            nearAxis = k;
+        }
+        tFar = Min(tFar, t1);
+    }
+
+    if (tNear > tFar || tNear < 0.0f || tNear > maxT)
+        return false;
+
+    if (radius > 0.0f)
+    {
+        // the inflated box is only exact on the faces; past an edge, the rounded box is the edge capsules
+        const Vector3 p = o + d * tNear;
+        const float pt[3] = { p.x, p.y, p.z };
+        int numOutside = 0;
+        for (int k = 0; k < 3; ++k)
+            numOutside += (fabsf(pt[k]) > extents[k]) ? 1 : 0;
+
+        if (numOutside >= 2)
+        {
+            bool bHit = false;
+            for (int k = 0; k < 3; ++k)
+            {
+                const int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+                for (int corner = 0; corner < 4; ++corner)
+                {
+                    float a[3], b[3];
+                    a[k] = -extents[k];
+                    b[k] = extents[k];
+                    a[k1] = b[k1] = (corner & 1) ? extents[k1] : -extents[k1];
+                    a[k2] = b[k2] = (corner & 2) ? extents[k2] : -extents[k2];
+
+                    if (IntersectCapsule(o, d, Vector3(a[0], a[1], a[2]), Vector3(b[0], b[1], b[2]), radius, maxT, t, normal))
+                    {
+                        maxT = t;
+                        bHit = true;
+                    }
+                }
+            }
+            return bHit;
+        }
+    }
+
+    float n[3] = { 0.0f, 0.0f, 0.0f };
+    n[nearAxis] = (dir[nearAxis] > 0.0f) ? -1.0f : 1.0f;
+    t = tNear;
+    normal = Vector3(n[0], n[1], n[2]);
+    return true;
+}
+
+static bool IntersectConvex(const Vector3& o, const Vector3& d, const sCollisionShape& shape, float radius, float maxT, float& t, Vector3& normal)
+{
+    if (!shape.params.mesh.numPolys)
+    {
+        // no planes exported; the vertex bounds will have to do
+        Vector3 min(FLT_MAX, FLT_MAX, FLT_MAX);
+        Vector3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (int v = 0; v < shape.params.mesh.numVertices; ++v)
+        {
+            const Vector3& p = shape.params.mesh.pVertices[v];
+            min = Vector3(Min(min.x, p.x), Min(min.y, p.y), Min(min.z, p.z));
+            max = Vector3(Max(max.x, p.x), Max(max.y, p.y), Max(max.z, p.z));
+        }
+
+        const Vector3 center = (min + max) * 0.5f;
+        const float extents[3] = { 0.5f * (max.x - min.x), 0.5f * (max.y - min.y), 0.5f * (max.z - min.z) };
+        return IntersectBox(o - center, d, extents, radius, maxT, t, normal);
+    }
+
+    // clip against the planes pushed out by the radius; n.p + w <= 0 inside
+    float tNear = -FLT_MAX;
+    float tFar = maxT;
+    int nearPoly = -1;
+    for (int i = 0; i < shape.params.mesh.numPolys; ++i)
+    {
+        const float* plane = shape.params.mesh.pPolygons[i].plane;
+        const Vector3 n(plane[0], plane[1], plane[2]);
+        const float dist = Dot3(n, o) + plane[3] - radius;
+        const float denom = Dot3(n, d);
+        if (denom == 0.0f)
+        {
+            if (dist > 0.0f)
+                return false;
+            continue;
+        }
+
+        const float tt = -dist / denom;
+        if (denom < 0.0f)
+        {
+            if (tt > tNear)
+            {
+                tNear = tt;
+                nearPoly = i;
+            }
+        }
+        else
+        {
+            tFar = Min(tFar, tt);
+        }
+
+        if (tNear > tFar)
+            return false;
+    }
+
+    if (nearPoly < 0 || tNear < 0.0f)
+        return false;
+
+    const float* plane = shape.params.mesh.pPolygons[nearPoly].plane;
+    const Vector3 n(plane[0], plane[1], plane[2]);
+    if (radius > 0.0f && shape.params.mesh.numIndices > 0)
+    {
+        // the pushed out planes are only exact on the faces; if the contact is off the hull, the edge capsules decide
+        const Vector3 contact = o + d * tNear - n * radius;
+        bool bOnHull = true;
+        for (int i = 0; i < shape.params.mesh.numPolys && bOnHull; ++i)
+        {
+            const float* other = shape.params.mesh.pPolygons[i].plane;
+            bOnHull = (other[0] * contact.x + other[1] * contact.y + other[2] * contact.z + other[3]) <= radius * 1e-3f;
+        }
+
+        if (!bOnHull)
+        {
+            bool bHit = false;
+            for (int i = 0; i < shape.params.mesh.numPolys; ++i)
+            {
+                const sCollisionPolygon& poly = shape.params.mesh.pPolygons[i];
+                const unsigned short* pPolyIndices = &shape.params.mesh.pIndices[poly.indexBase];
+                for (int k = 0; k < poly.numVerts; ++k)
+                {
+                    const Vector3& p0 = shape.params.mesh.pVertices[pPolyIndices[k]];
+                    const Vector3& p1 = shape.params.mesh.pVertices[pPolyIndices[(k + 1) % poly.numVerts]];
+                    if (IntersectCapsule(o, d, p0, p1, radius, maxT, t, normal))
+                    {
+                        maxT = t;
+                        bHit = true;
+                    }
+                }
+            }
+            return bHit;
+        }
+    }
+
+    t = tNear;
+    normal = n;
+    return true;
+}
+
+static bool IntersectTriangle(const Vector3& o, const Vector3& d, const Vector3& v0, const Vector3& v1, const Vector3& v2, float radius, float maxT, float& t, Vector3& normal)
+{
+    const Vector3 e1 = v1 - v0;
+    const Vector3 e2 = v2 - v0;
+
+    if (radius <= 0.0f)
+    {
+        // Moller-Trumbore, double sided
+        const Vector3 p = Cross3(d, e2);
+        const float det = Dot3(e1, p);
+        if (fabsf(det) < 1e-20f)
+            return false;
+
+        const float invDet = 1.0f / det;
+        const Vector3 s = o - v0;
+        const float u = Dot3(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        const Vector3 q = Cross3(s, e1);
+        const float v = Dot3(d, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        const float tt = Dot3(e2, q) * invDet;
+        if (tt < 0.0f || tt > maxT)
+            return false;
+
+        t = tt;
+        normal = Cross3(e1, e2);
+        if (Dot3(normal, d) > 0.0f)
+            normal = normal * -1.0f;
+        return true;
+    }
+
+    // sphere sweep: the face, pushed out by the radius towards the sphere, then the edge capsules
+    const Vector3 n = Normalize3(Cross3(e1, e2));
+    const float dist = Dot3(n, o - v0);
+    const float side = (dist >= 0.0f) ? 1.0f : -1.0f;
+    const float approach = -Dot3(n, d) * side;
+    if (fabsf(dist) >= radius && approach > 0.0f)
+    {
+        const float tt = (fabsf(dist) - radius) / approach;
+        if (tt > maxT)
+            return false;
+
+        // contact point on the plane, tested with barycentrics
+        const Vector3 c = o + d * tt - n * (side * radius) - v0;
+        const float d00 = Dot3(e1, e1), d01 = Dot3(e1, e2), d11 = Dot3(e2, e2);
+        const float d20 = Dot3(c, e1), d21 = Dot3(c, e2);
+        const float denom = d00 * d11 - d01 * d01;
+        if (denom > 0.0f)
+        {
+            const float v = (d11 * d20 - d01 * d21) / denom;
+            const float w = (d00 * d21 - d01 * d20) / denom;
+            if (v >= 0.0f && w >= 0.0f && v + w <= 1.0f)
+            {
+                t = tt;
+                normal = n * side;
+                return true;
+            }
+        }
+    }
+
+    bool bHit = false;
+    const Vector3* lVerts[3] = { &v0, &v1, &v2 };
+    for (int k = 0; k < 3; ++k)
+    {
+        if (IntersectCapsule(o, d, *lVerts[k], *lVerts[(k + 1) % 3], radius, maxT, t, normal))
+        {
+            maxT = t;
+            bHit = true;
+        }
+    }
+    return bHit;
+}
+
+// o, d in model space
+static bool IntersectPrimitive(const sCollisionBVH* pBVH, const sCollisionPrimitive& prim, const Vector3& o, const Vector3& d, float radius, float maxT, float& t, Vector3& normal)
+{
+    const sObjectMesh* pMesh = pBVH->pMesh;
+    if (prim.type == sCollisionPrimitive::PRIMITIVE_TRIANGLE)
+    {
+        const unsigned short* pTri = &pMesh->pIndices[prim.index * 3];
+        return IntersectTriangle(o, d, pMesh->pVertices[pTri[0]], pMesh->pVertices[pTri[1]], pMesh->pVertices[pTri[2]], radius, maxT, t, normal);
+    }
+
+    // shape space; shape transforms are rigid, so the radius carries over
+    const sCollisionShape& shape = pMesh->pCollisions[prim.index];
+    const Vector3 so = TransformPoint(prim.invTransform, o);
+    const Vector3 sd = TransformVector(prim.invTransform, d);
+
+    bool bHit = false;
+    switch (prim.type)
+    {
+        case sCollisionPrimitive::PRIMITIVE_SPHERE:
+            bHit = IntersectSphere(so, sd, Vector3(0.0f, 0.0f, 0.0f), shape.params.sphere.radius + radius, maxT, t, normal);
+            break;
+
+        case sCollisionPrimitive::PRIMITIVE_BOX:
+            bHit = IntersectBox(so, sd, shape.params.box.extents, radius, maxT, t, normal);
+            break;
+
+        case sCollisionPrimitive::PRIMITIVE_CAPSULE:
+        {
+            const float h = shape.params.capsule.halfHeight;
+            bHit = IntersectCapsule(so, sd, Vector3(-h, 0.0f, 0.0f), Vector3(h, 0.0f, 0.0f), shape.params.capsule.radius + radius, maxT, t, normal);
+            break;
+        }
+
+        case sCollisionPrimitive::PRIMITIVE_CONVEX:
+            bHit = IntersectConvex(so, sd, shape, radius, maxT, t, normal);
+            break;
+    }
+
+    if (bHit)
+        normal = TransformVectorTransposed(prim.invTransform, normal);
+    return bHit;
+}
+
+// world radius -> model radius; the largest stretch of the inverse, exact for rotation * scale
+static float GetRadiusScale(const sMatrix3x4& invTransform)
+{
+    float scale = 0.0f;
+    for (int r = 0; r < 3; ++r)
+        scale = Max(scale, invTransform.row[r][0] * invTransform.row[r][0] + invTransform.row[r][1] * invTransform.row[r][1] + invTransform.row[r][2] * invTransform.row[r][2]);
+    return sqrtf(scale);
+}
+
+void CastRayReference(const sCollisionInstance* pInstances, int numInstances, const sRay& ray, sRayHit& hit)
+{
+    hit.t = ray.maxT;
+    hit.instance = -1;
+    hit.primitive = -1;
+    hit.normal = Vector3(0.0f, 0.0f, 0.0f);
+
+    for (int i = 0; i < numInstances; ++i)
+    {
+        const sCollisionInstance& instance = pInstances[i];
+        const Vector3 o = TransformPoint(instance.invTransform, ray.origin);
+        const Vector3 d = TransformVector(instance.invTransform, ray.dir);
+        const float radius = ray.radius * GetRadiusScale(instance.invTransform);
+
+        for (int p = 0; p < instance.pBVH->numPrimitives; ++p)
+        {
+            float t;
+            Vector3 normal;
+            if (IntersectPrimitive(instance.pBVH, instance.pBVH->pPrimitives[p], o, d, radius, hit.t, t, normal))
+            {
+                hit.t = t;
+                hit.instance = i;
+                hit.primitive = p;
+                hit.normal = Normalize3(TransformVectorTransposed(instance.invTransform, normal));
+            }
+        }
+    }
+}
+
+//
+// packet traversal
+//
+
+struct sRayPacket
+{
+    float                   o[3][KHM_RAY_PACKET_SIZE];
+    float                   d[3][KHM_RAY_PACKET_SIZE];
+    float                   invD[3][KHM_RAY_PACKET_SIZE];
+    float                   radius[KHM_RAY_PACKET_SIZE];
+    float                   maxT[KHM_RAY_PACKET_SIZE];  // shrinks as hits are found
+};
+
+static void SetPacketRay(sRayPacket& packet, int lane, const Vector3& o, const Vector3& d, float radius)
+{
+    const float orig[3] = { o.x, o.y, o.z };
+    const float dir[3] = { d.x, d.y, d.z };
+    for (int k = 0; k < 3; ++k)
+    {
+        packet.o[k][lane] = orig[k];
+        packet.d[k][lane] = dir[k];
+
+        // keep the slab math finite for axis aligned rays
+        const float safeDir = (fabsf(dir[k]) < 1e-20f) ? (dir[k] < 0.0f ? -1e-20f : 1e-20f) : dir[k];
+        packet.invD[k][lane] = 1.0f / safeDir;
+    }
+    packet.radius[lane] = radius;
+}
+
+// lanes whose ray ( grown by its radius ) enters the box before its maxT
+static int TestPacketBox(const sRayPacket& packet, const float* min, const float* max)
+{
+#if defined(KHM_SIMD_SSE)
+    const __m128 radius = _mm_loadu_ps(packet.radius);
+    __m128 tNear = _mm_setzero_ps();
+    __m128 tFar = _mm_loadu_ps(packet.maxT);
+    for (int k = 0; k < 3; ++k)
+    {
+        const __m128 o = _mm_loadu_ps(packet.o[k]);
+        const __m128 invD = _mm_loadu_ps(packet.invD[k]);
+        const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_set1_ps(min[k]), radius), o), invD);
+        const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_set1_ps(max[k]), radius), o), invD);
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+    }
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+#else
+    int mask = 0;
+    for (int lane = 0; lane < KHM_RAY_PACKET_SIZE; ++lane)
+    {
+        float tNear = 0.0f;
+        float tFar = packet.maxT[lane];
+        for (int k = 0; k < 3; ++k)
+        {
+            const float t0 = (min[k] - packet.radius[lane] - packet.o[k][lane]) * packet.invD[k][lane];
+            const float t1 = (max[k] + packet.radius[lane] - packet.o[k][lane]) * packet.invD[k][lane];
+            tNear = Max(tNear, Min(t0, t1));
+            tFar = Min(tFar, Max(t0, t1));
+        }
+        mask |= (tNear <= tFar) ? (1 << lane) : 0;
+    }
+    return mask;
+#endif
+}
+
+static inline int FirstLane(int mask)
+{
+    int lane = 0;
+    while (!(mask & (1 << lane)))
+        ++lane;
+    return lane;
+}
+
+static void CastPacket(const sCollisionInstance* pInstances, int numInstances, const sRay* pRays, int numRays, sRayHit* pHits)
+{
+    sRayPacket world;
+    sRayPacket local;
+    for (int lane = 0; lane < KHM_RAY_PACKET_SIZE; ++lane)
+    {
+        // unused lanes repeat the last ray and never report
+        const sRay& ray = pRays[Min(lane, numRays - 1)];
+        SetPacketRay(world, lane, ray.origin, ray.dir, ray.radius);
+        world.maxT[lane] = ray.maxT;
+
+        if (lane < numRays)
+        {
+            pHits[lane].t = ray.maxT;
+            pHits[lane].instance = -1;
+            pHits[lane].primitive = -1;
+            pHits[lane].normal = Vector3(0.0f, 0.0f, 0.0f);
+        }
+    }
+
+    const int activeMask = (1 << numRays) - 1;
+
+    int stack[KHM_BVH_MAX_DEPTH + 1];
+    for (int i = 0; i < numInstances; ++i)
+    {
+        const sCollisionInstance& instance = pInstances[i];
+        const float instMin[3] = { instance.min.x, instance.min.y, instance.min.z };
+        const float instMax[3] = { instance.max.x, instance.max.y, instance.max.z };
+        if (!(TestPacketBox(world, instMin, instMax) & activeMask))
+            continue;
+
+        // into model space; t is unchanged by the transform
+        const float radiusScale = GetRadiusScale(instance.invTransform);
+        for (int lane = 0; lane < KHM_RAY_PACKET_SIZE; ++lane)
+        {
+            const Vector3 o(world.o[0][lane], world.o[1][lane], world.o[2][lane]);
+            const Vector3 d(world.d[0][lane], world.d[1][lane], world.d[2][lane]);
+            SetPacketRay(local, lane, TransformPoint(instance.invTransform, o), TransformVector(instance.invTransform, d), world.radius[lane] * radiusScale);
+            local.maxT[lane] = world.maxT[lane];
+        }
+
+        const sCollisionBVH* pBVH = instance.pBVH;
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize)
+        {
+            const sCollisionBVHNode& node = pBVH->pNodes[stack[--stackSize]];
+            const int mask = TestPacketBox(local, node.min, node.max) & activeMask;
+            if (!mask)
+                continue;
+
+            if (node.count < 0)
+            {
+                // near child last, so it's popped first; ordered by the first active ray
+                const int axis = -1 - node.count;
+                const bool bFlip = local.d[axis][FirstLane(mask)] < 0.0f;
+                stack[stackSize++] = node.first + (bFlip ? 0 : 1);
+                stack[stackSize++] = node.first + (bFlip ? 1 : 0);
+                continue;
+            }
+
+            for (int p = node.first; p < node.first + node.count; ++p)
+            {
+                const sCollisionPrimitive& prim = pBVH->pPrimitives[p];
+                for (int lane = 0; lane < numRays; ++lane)
+                {
+                    if (!(mask & (1 << lane)))
+                        continue;
+
+                    const Vector3 o(local.o[0][lane], local.o[1][lane], local.o[2][lane]);
+                    const Vector3 d(local.d[0][lane], local.d[1][lane], local.d[2][lane]);
+
+                    float t;
+                    Vector3 normal;
+                    if (IntersectPrimitive(pBVH, prim, o, d, local.radius[lane], local.maxT[lane], t, normal))
+                    {
+                        local.maxT[lane] = world.maxT[lane] = t;
+
+                        sRayHit& hit = pHits[lane];
+                        hit.t = t;
+                        hit.instance = i;
+                        hit.primitive = p;
+                        hit.normal = Normalize3(TransformVectorTransposed(instance.invTransform, normal));
+                    }
+                }
+            }
+        }
+    }
+}
+
+struct sCastRaysJob
+{
+    const sCollisionInstance*   pInstances;
+    int                         numInstances;
+    const sRay*                 pRays;
+    int                         numRays;
+    sRayHit*                    pHits;
+};
+
+static void CastRaysJob(void* pUserData, int begin, int end)
+{
+    const sCastRaysJob* pJob = (const sCastRaysJob*)pUserData;
+    for (int packet = begin; packet < end; ++packet)
+    {
+        const int first = packet * KHM_RAY_PACKET_SIZE;
+        CastPacket(pJob->pInstances, pJob->numInstances, &pJob->pRays[first], Min(KHM_RAY_PACKET_SIZE, pJob->numRays - first), &pJob->pHits[first]);
+    }
+}
+
+void CastRays(const sCollisionInstance* pInstances, int numInstances, const sRay* pRays, int numRays, sRayHit* pHits, CJobPool* pJobPool)
+{
+    if (numRays <= 0)
+        return;
+
+    sCastRaysJob job;
+    job.pInstances = pInstances;
+    job.numInstances = numInstances;
+    job.pRays = pRays;
+    job.numRays = numRays;
+    job.pHits = pHits;
+
+    const int numPackets = (numRays + KHM_RAY_PACKET_SIZE - 1) / KHM_RAY_PACKET_SIZE;
+    if (pJobPool)
+        pJobPool->ParallelFor(numPackets, 16, CastRaysJob, &job);
+    else
+        CastRaysJob(&job, 0, numPackets);
+}
+
+}; // end namespace KHM
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMMath.h"
+
+namespace KHM
+{
+    //
+    // common defines for collision queries
+    //
+
+    #define KHM_BVH_MAX_LEAF_PRIMITIVES     4
+    #define KHM_BVH_SAH_BINS                12
+    #define KHM_BVH_MAX_DEPTH               64  // traversal stack size
+    #define KHM_RAY_PACKET_SIZE             4   // rays traversed together, one per SIMD lane
+
+    // CreateCollisionBVH flags
+    #define COLLISION_BVH_SHAPES            (1 << 0)    // collision primitives from pCollisions
+    #define COLLISION_BVH_TRIANGLES         (1 << 1)    // render triangles from pIndices
+
+    class CJobPool;
+    struct sConvexHull;
+
+    //
+    // KHM Collision Primitive - a BVH leaf item, in model space
+    //
+
+    struct sCollisionPrimitive
+    {
+        enum ePrimitiveType
+        {
+            PRIMITIVE_SPHERE = 0,
+            PRIMITIVE_BOX,
+            PRIMITIVE_CAPSULE,          // along the local X axis
+            PRIMITIVE_CONVEX,
+            PRIMITIVE_TRIANGLE,
+        };
+
+        unsigned int            type;           // ePrimitiveType
+        int                     index;          // into pCollisions, or the triangle index
+        sMatrix3x4              invTransform;   // model -> shape space; identity for triangles
+    };
+
+    //
+    // KHM Collision BVH - binary SAH tree over the primitives of one model
+    //
+
+    struct sCollisionBVHNode // 32 bytes
+    {
+        float                   min[3];
+        int                     first;          // leaf: first primitive; node: left child ( right child is first + 1 )
+        float                   max[3];
+        int                     count;          // leaf: number of primitives; node: -1 - split axis
+    };
+
+    struct sCollisionBVH
+    {
+        const sObjectMesh*      pMesh;          // shapes and triangles are read from here; must outlive the BVH
+        int                     numNodes;
+        sCollisionBVHNode*      pNodes;         // root is pNodes[0]
+        int                     numPrimitives;
+        sCollisionPrimitive*    pPrimitives;    // in leaf order
+        sConvexHull**           ppHulls;        // by shape, pMesh->numCollisions; CONVEX_MESH shapes only, NULL for the rest
+    };
+
+    sCollisionBVH*  CreateCollisionBVH(const sModelDefinition* pModelDefinition, unsigned int uiFlags);
+    void            DestroyCollisionBVH(sCollisionBVH* pBVH);
+
+    //
+    // KHM Collision Instance - a placed copy of a model
+    //
+
+    struct sCollisionInstance
+    {
+        const sCollisionBVH*    pBVH;
+        sMatrix3x4              transform;      // model -> world
+        sMatrix3x4              invTransform;   // world -> model
+        Vector3                 min;            // world bounds
+        Vector3                 max;
+    };
+
+    // fills the inverse and the world bounds
+    void            SetCollisionInstance(sCollisionInstance& instance, const sCollisionBVH* pBVH, const sMatrix3x4& transform);
+
+    //
+    // queries
+    //
+
+    struct sRay
+    {
+        Vector3                 origin;
+        float                   radius;         // 0 for rays; > 0 sweeps a sphere
+        Vector3                 dir;            // need not be normalized; t is in units of dir
+        float                   maxT;
+    };
+
+    struct sRayHit
+    {
+        float                   t;              // maxT if nothing was hit
+        int                     instance;       // -1 if nothing was hit
+        int                     primitive;      // into the instance's BVH pPrimitives
+        Vector3                 normal;         // world space, normalized
+    };
+
+    // closest hit of every ray / sphere sweep against every instance. rays are traversed in packets of
+    // KHM_RAY_PACKET_SIZE, so keep coherent rays next to each other. shapes a ray starts inside of are ignored;
+    // sweeps against convex meshes without polygon indices are conservative near the edges
+    void            CastRays(const sCollisionInstance* pInstances, int numInstances, const sRay* pRays, int numRays, sRayHit* pHits, CJobPool* pJobPool);
+
+    // brute force over every primitive, for validation
+    void            CastRayReference(const sCollisionInstance* pInstances, int numInstances, const sRay& ray, sRayHit& hit);
+};
@@ -0,0 +1,1017 @@
+#include "KHMConvex.h"
+#include "KHMSimd.h"
+#include "Kernel/Log.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace KHM {
+
+//
+// hull build
+//
+
+struct sWeldVertex
+{
+    float                   p[3];
+    int                     index;
+};
+
+static int ComparePositions(const float* a, const float* b)
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        if (a[k] != b[k])
+            return (a[k] < b[k]) ? -1 : 1;
+    }
+    return 0;
+}
+
+static int CompareWeldVertices(const void* pA, const void* pB)
+{
+    const sWeldVertex* a = (const sWeldVertex*)pA;
+    const sWeldVertex* b = (const sWeldVertex*)pB;
+    const int position = ComparePositions(a->p, b->p);
+    return position ? position : a->index - b->index;
+}
+
+static int CompareEdges(const void* pA, const void* pB)
+{
+    const unsigned int a = *(const unsigned int*)pA;
+    const unsigned int b = *(const unsigned int*)pB;
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+static inline float DotVertex(const sConvexHull* pHull, int v, const Vector3& dir)
+{
+    const float* p = pHull->pVertices;
+    return p[v] * dir.x + p[pHull->numVerticesPadded + v] * dir.y + p[2 * pHull->numVerticesPadded + v] * dir.z;
+}
+
+static int ClimbHull(const sConvexHull* pHull, const Vector3& dir, int start)
+{
+    int v = (start >= 0 && start < pHull->numVertices) ? start : 0;
+    float best = DotVertex(pHull, v, dir);
+    for (;;)
+    {
+        // steepest neighbour; strictly better, so the walk can't cycle
+        int next = v;
+        for (int e = pHull->pAdjacencyOffsets[v]; e < pHull->pAdjacencyOffsets[v + 1]; ++e)
+        {
+            const int n = pHull->pAdjacency[e];
+            const float d = DotVertex(pHull, n, dir);
+            if (d > best)
+            {
+                best = d;
+                next = n;
+            }
+        }
+
+        if (next == v)
+            return v;
+        v = next;
+    }
+}
+
+// the edge graph has to reach every vertex, and climbing has to land on the scan's support; a non convex hull fails
+// the second one for some direction, these are the ones a box or a cylinder would fail on first
+static bool CheckAdjacency(const sConvexHull* pHull)
+{
+    const int numVertices = pHull->numVertices;
+    if (numVertices == 1)
+        return true;
+
+    int* lStack = new int[numVertices];
+    unsigned char* lSeen = new unsigned char[numVertices];
+    memset(lSeen, 0, numVertices);
+    int numSeen = 1, stackSize = 1;
+    lStack[0] = 0;
+    lSeen[0] = 1;
+    while (stackSize)
+    {
+        const int v = lStack[--stackSize];
+        for (int e = pHull->pAdjacencyOffsets[v]; e < pHull->pAdjacencyOffsets[v + 1]; ++e)
+        {
+            const int n = pHull->pAdjacency[e];
+            if (!lSeen[n])
+            {
+                lSeen[n] = 1;
+                lStack[stackSize++] = n;
+                ++numSeen;
+            }
+        }
+    }
+    delete [] lStack;
+    delete [] lSeen;
+    if (numSeen != numVertices)
+        return false;
+
+    float scale = 0.0f;
+    for (int v = 0; v < numVertices; ++v)
+        scale = Max(scale, Max(fabsf(DotVertex(pHull, v, Vector3(1.0f, 0.0f, 0.0f))), Max(fabsf(DotVertex(pHull, v, Vector3(0.0f, 1.0f, 0.0f))), fabsf(DotVertex(pHull, v, Vector3(0.0f, 0.0f, 1.0f))))));
+
+    for (int i = 0; i < 27; ++i)
+    {
+        const Vector3 dir((float)(i % 3) - 1.0f, (float)(i / 3 % 3) - 1.0f, (float)(i / 9) - 1.0f);
+        if (i == 13)
+            continue;
+
+        const float best = DotVertex(pHull, GetHullSupportScan(pHull, dir), dir);
+        const int lStarts[2] = { 0, numVertices - 1 };
+        for (int s = 0; s < 2; ++s)
+        {
+            if (DotVertex(pHull, ClimbHull(pHull, dir, lStarts[s]), dir) < best - 1e-5f * scale)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void BuildAdjacency(sConvexHull* pHull, const sCollisionShape& shape, const int* lRemap)
+{
+    int numEdges = 0;
+    for (int i = 0; i < shape.params.mesh.numPolys; ++i)
+        numEdges += shape.params.mesh.pPolygons[i].numVerts * 2;
+
+    // both directions of every polygon edge, packed ( from << 16 | to ) so sorting groups them by vertex
+    unsigned int* lEdges = new unsigned int[Max(numEdges, 1)];
+    numEdges = 0;
+    for (int i = 0; i < shape.params.mesh.numPolys; ++i)
+    {
+        const sCollisionPolygon& poly = shape.params.mesh.pPolygons[i];
+        if ((int)poly.indexBase + (int)poly.numVerts > shape.params.mesh.numIndices)
+            continue;
+
+        const unsigned short* pPolyIndices = &shape.params.mesh.pIndices[poly.indexBase];
+        for (int k = 0; k < poly.numVerts; ++k)
+        {
+            const int i0 = pPolyIndices[k];
+            const int i1 = pPolyIndices[(k + 1) % poly.numVerts];
+            if (i0 >= shape.params.mesh.numVertices || i1 >= shape.params.mesh.numVertices)
+                continue;
+
+            const unsigned int a = (unsigned int)lRemap[i0];
+            const unsigned int b = (unsigned int)lRemap[i1];
+            if (a == b)
+                continue;
+
+            lEdges[numEdges++] = (a << 16) | b;
+            lEdges[numEdges++] = (b << 16) | a;
+        }
+    }
+
+    qsort(lEdges, numEdges, sizeof(unsigned int), CompareEdges);
+    int numUnique = 0;
+    for (int e = 0; e < numEdges; ++e)
+    {
+        if (!numUnique || lEdges[e] != lEdges[numUnique - 1])
+            lEdges[numUnique++] = lEdges[e];
+    }
+
+    pHull->pAdjacencyOffsets = new int[pHull->numVertices + 1];
+    pHull->pAdjacency = new unsigned short[Max(numUnique, 1)];
+    pHull->numAdjacency = numUnique;
+    memset(pHull->pAdjacencyOffsets, 0, sizeof(int) * (pHull->numVertices + 1));
+    for (int e = 0; e < numUnique; ++e)
+    {
+        ++pHull->pAdjacencyOffsets[(lEdges[e] >> 16) + 1];
+        pHull->pAdjacency[e] = (unsigned short)(lEdges[e] & 0xFFFF);
+    }
+    for (int v = 0; v < pHull->numVertices; ++v)
+        pHull->pAdjacencyOffsets[v + 1] += pHull->pAdjacencyOffsets[v];
+
+    delete [] lEdges;
+}
+
+sConvexHull* CreateConvexHull(const sCollisionShape& shape, bool bAdjacency)
+{
+    if (shape.type != sCollisionShape::CONVEX_MESH || shape.params.mesh.numVertices <= 0 || !shape.params.mesh.pVertices)
+        return NULL;
+
+    // weld: sorted by position, each run of equal positions becomes one vertex
+    const int numSource = shape.params.mesh.numVertices;
+    sWeldVertex* lWeld = new sWeldVertex[numSource];
+    for (int i = 0; i < numSource; ++i)
+    {
+        const Vector3& p = shape.params.mesh.pVertices[i];
+        lWeld[i].p[0] = p.x;
+        lWeld[i].p[1] = p.y;
+        lWeld[i].p[2] = p.z;
+        lWeld[i].index = i;
+    }
+    qsort(lWeld, numSource, sizeof(sWeldVertex), CompareWeldVertices);
+
+    int* lRemap = new int[numSource];
+    int numVertices = 0;
+    for (int i = 0; i < numSource; ++i)
+    {
+        if (!i || ComparePositions(lWeld[i].p, lWeld[i - 1].p))
+            ++numVertices;
+        lRemap[lWeld[i].index] = numVertices - 1;
+    }
+
+    sConvexHull* pHull = new sConvexHull();
+    pHull->numVertices = numVertices;
+    pHull->numVerticesPadded = SimdPadCount(numVertices);
+    pHull->pVertices = (float*)AlignedAlloc(sizeof(float) * 3 * pHull->numVerticesPadded);
+    pHull->pAdjacencyOffsets = NULL;
+    pHull->pAdjacency = NULL;
+    pHull->numAdjacency = 0;
+
+    for (int i = 0; i < numSource; ++i)
+    {
+        for (int k = 0; k < 3; ++k)
+            pHull->pVertices[k * pHull->numVerticesPadded + lRemap[lWeld[i].index]] = lWeld[i].p[k];
+    }
+    for (int v = numVertices; v < pHull->numVerticesPadded; ++v)
+    {
+        for (int k = 0; k < 3; ++k)
+            pHull->pVertices[k * pHull->numVerticesPadded + v] = pHull->pVertices[k * pHull->numVerticesPadded];
+    }
+
+    // 16 bit neighbours, like the polygon indices
+    if (bAdjacency && shape.params.mesh.numPolys > 0 && shape.params.mesh.pIndices && numVertices <= 0x10000)
+    {
+        BuildAdjacency(pHull, shape, lRemap);
+        if (!CheckAdjacency(pHull))
+        {
+            LOG_ERROR("[Error] CreateConvexHull() - the polygons of the hull don't walk like a convex one, scanning its %d vertices instead\n", numVertices);
+            delete [] pHull->pAdjacencyOffsets;
+            delete [] pHull->pAdjacency;
+            pHull->pAdjacencyOffsets = NULL;
+            pHull->pAdjacency = NULL;
+            pHull->numAdjacency = 0;
+        }
+    }
+
+    delete [] lRemap;
+    delete [] lWeld;
+    return pHull;
+}
+
+void DestroyConvexHull(sConvexHull* pHull)
+{
+    if (!pHull)
+        return;
+
+    AlignedFree(pHull->pVertices);
+    delete [] pHull->pAdjacencyOffsets;
+    delete [] pHull->pAdjacency;
+    delete pHull;
+}
+
+//
+// support
+//
+
+int GetHullSupport(const sConvexHull* pHull, const Vector3& dir, int start)
+{
+    if (!pHull->pAdjacencyOffsets || pHull->numVertices < KHM_HULL_CLIMB_MIN_VERTICES)
+        return GetHullSupportScan(pHull, dir);
+    return ClimbHull(pHull, dir, start);
+}
+
+int GetHullSupportScan(const sConvexHull* pHull, const Vector3& dir)
+{
+    const float* pX = pHull->pVertices;
+    const float* pY = pX + pHull->numVerticesPadded;
+    const float* pZ = pY + pHull->numVerticesPadded;
+
+#if defined(KHM_SIMD_SSE)
+    const __m128 dx = _mm_set1_ps(dir.x);
+    const __m128 dy = _mm_set1_ps(dir.y);
+    const __m128 dz = _mm_set1_ps(dir.z);
+    const __m128i step = _mm_set1_epi32(4);
+    __m128 best = _mm_set1_ps(-FLT_MAX);
+    __m128i bestIndex = _mm_setzero_si128();
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+
+    // per lane maximum and where it was; strictly greater, so each lane keeps its first
+    for (int v = 0; v < pHull->numVerticesPadded; v += 4)
+    {
+        const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(pX + v), dx), _mm_mul_ps(_mm_load_ps(pY + v), dy)), _mm_mul_ps(_mm_load_ps(pZ + v), dz));
+        const __m128i mask = _mm_castps_si128(_mm_cmpgt_ps(d, best));
+        best = _mm_max_ps(best, d);
+        bestIndex = _mm_or_si128(_mm_and_si128(mask, index), _mm_andnot_si128(mask, bestIndex));
+        index = _mm_add_epi32(index, step);
+    }
+
+    float lBest[4];
+    int lIndex[4];
+    _mm_storeu_ps(lBest, best);
+    _mm_storeu_si128((__m128i*)lIndex, bestIndex);
+
+    int result = lIndex[0];
+    float resultDot = lBest[0];
+    for (int lane = 1; lane < 4; ++lane)
+    {
+        if (lBest[lane] > resultDot || (lBest[lane] == resultDot && lIndex[lane] < result))
+        {
+            result = lIndex[lane];
+            resultDot = lBest[lane];
+        }
+    }
+
+    // the padding repeats vertex 0, which wins the tie
+    return (result < pHull->numVertices) ? result : 0;
+#else
+    int result = 0;
+    float best = -FLT_MAX;
+    for (int v = 0; v < pHull->numVertices; ++v)
+    {
+        const float d = pX[v] * dir.x + pY[v] * dir.y + pZ[v] * dir.z;
+        if (d > best)
+        {
+            best = d;
+            result = v;
+        }
+    }
+    return result;
+#endif
+}
+
+int GetShapeSupportReference(const sCollisionShape& shape, const Vector3& dir)
+{
+    int result = 0;
+    float best = -FLT_MAX;
+    for (int v = 0; v < shape.params.mesh.numVertices; ++v)
+    {
+        const float d = Dot3(shape.params.mesh.pVertices[v], dir);
+        if (d > best)
+        {
+            best = d;
+            result = v;
+        }
+    }
+    return result;
+}
+
+//
+// convex shapes
+//
+
+bool SetConvexShape(sConvexShape& convex, const sCollisionShape& shape, const sConvexHull* pHull, const sMatrix3x4& placement)
+{
+    float radius = 0.0f;
+    switch (shape.type)
+    {
+        case sCollisionShape::SPHERE:       radius = shape.params.sphere.radius; break;
+        case sCollisionShape::CAPSULE:      radius = shape.params.capsule.radius; break;
+        case sCollisionShape::BOX:          break;
+
+        case sCollisionShape::CONVEX_MESH:
+            if (shape.params.mesh.numVertices <= 0 || !shape.params.mesh.pVertices)
+                return false;
+            break;
+
+        default:
+            return false;
+    }
+
+    sMatrix3x4 local;
+    Matrix3x4FromMatrix(shape.transform, local);
+    MultiplyMatrix3x4(placement, local, convex.transform);
+
+    // uniform scale: any column's length
+    float scale = 0.0f;
+    for (int c = 0; c < 3; ++c)
+        scale = Max(scale, convex.transform.row[0][c] * convex.transform.row[0][c] + convex.transform.row[1][c] * convex.transform.row[1][c] + convex.transform.row[2][c] * convex.transform.row[2][c]);
+
+    convex.pShape = &shape;
+    convex.pHull = (shape.type == sCollisionShape::CONVEX_MESH) ? pHull : NULL;
+    convex.margin = radius * sqrtf(scale);
+    return true;
+}
+
+bool SetConvexShape(sConvexShape& convex, const sCollisionInstance& instance, int primitive)
+{
+    const sCollisionBVH* pBVH = instance.pBVH;
+    const sCollisionPrimitive& prim = pBVH->pPrimitives[primitive];
+    if (prim.type == sCollisionPrimitive::PRIMITIVE_TRIANGLE)
+        return false;
+
+    const sConvexHull* pHull = pBVH->ppHulls ? pBVH->ppHulls[prim.index] : NULL;
+    return SetConvexShape(convex, pBVH->pMesh->pCollisions[prim.index], pHull, instance.transform);
+}
+
+// the core of the shape ( no margin ) furthest along dir, world space; start is the warm start of hull climbs
+static Vector3 SupportCore(const sConvexShape& convex, const Vector3& dir, int& start)
+{
+    const sCollisionShape& shape = *convex.pShape;
+    const Vector3 d = TransformVectorTransposed(convex.transform, dir);
+
+    Vector3 p(0.0f, 0.0f, 0.0f);
+    switch (shape.type)
+    {
+        case sCollisionShape::CAPSULE:
+            p.x = (d.x >= 0.0f) ? shape.params.capsule.halfHeight : -shape.params.capsule.halfHeight;
+            break;
+
+        case sCollisionShape::BOX:
+            p = Vector3((d.x >= 0.0f) ? shape.params.box.extents[0] : -shape.params.box.extents[0],
+                        (d.y >= 0.0f) ? shape.params.box.extents[1] : -shape.params.box.extents[1],
+                        (d.z >= 0.0f) ? shape.params.box.extents[2] : -shape.params.box.extents[2]);
+            break;
+
+        case sCollisionShape::CONVEX_MESH:
+            if (convex.pHull)
+            {
+                start = GetHullSupport(convex.pHull, d, start);
+                p = GetHullVertex(convex.pHull, start);
+            }
+            else
+            {
+                p = shape.params.mesh.pVertices[GetShapeSupportReference(shape, d)];
+            }
+            break;
+
+        default:
+            break;
+    }
+    return TransformPoint(convex.transform, p);
+}
+
+//
+// GJK
+//
+
+struct sSimplexPoint
+{
+    Vector3                 w;              // a - b
+    Vector3                 a;
+    Vector3                 b;
+};
+
+struct sSimplex
+{
+    sSimplexPoint           p[4];
+    float                   bary[4];
+    int                     count;
+};
+
+struct sGjk
+{
+    const sConvexShape*     pA;
+    const sConvexShape*     pB;
+    int                     startA;
+    int                     startB;
+    float                   maxW2;          // largest squared support seen; the scale of the tolerances
+    sSimplex                simplex;
+    Vector3                 v;              // closest point of the simplex to the origin
+    int                     numIterations;
+};
+
+enum eGjkResult
+{
+    GJK_SEPARATED = 0,                      // early out; v isn't the closest point
+    GJK_DISTANCE,                           // the cores are |v| apart
+    GJK_OVERLAP,                            // the cores overlap
+};
+
+// support of A - B
+static void SupportPoint(sGjk& gjk, const Vector3& dir, sSimplexPoint& point)
+{
+    point.a = SupportCore(*gjk.pA, dir, gjk.startA);
+    point.b = SupportCore(*gjk.pB, dir * -1.0f, gjk.startB);
+    point.w = point.a - point.b;
+    gjk.maxW2 = Max(gjk.maxW2, Dot3(point.w, point.w));
+}
+
+static void KeepPoints(sSimplex& simplex, int i0, int i1, int i2, float b0, float b1, float b2, int count)
+{
+    const sSimplexPoint p0 = simplex.p[i0];
+    const sSimplexPoint p1 = simplex.p[i1];
+    const sSimplexPoint p2 = simplex.p[i2];
+    simplex.p[0] = p0;
+    simplex.p[1] = p1;
+    simplex.p[2] = p2;
+    simplex.bary[0] = b0;
+    simplex.bary[1] = b1;
+    simplex.bary[2] = b2;
+    simplex.count = count;
+}
+
+static void ClosestOnSegment(sSimplex& simplex)
+{
+    const Vector3& a = simplex.p[0].w;
+    const Vector3 ab = simplex.p[1].w - a;
+    const float denom = Dot3(ab, ab);
+    const float t = (denom > 0.0f) ? -Dot3(a, ab) / denom : 0.0f;
+    if (t <= 0.0f)
+        KeepPoints(simplex, 0, 0, 0, 1.0f, 0.0f, 0.0f, 1);
+    else if (t >= 1.0f)
+        KeepPoints(simplex, 1, 1, 1, 1.0f, 0.0f, 0.0f, 1);
+    else
+        KeepPoints(simplex, 0, 1, 1, 1.0f - t, t, 0.0f, 2);
+}
+
+// Voronoi regions of the triangle, in the order of Ericson's ClosestPtPointTriangle
+static void ClosestOnTriangle(sSimplex& simplex)
+{
+    const Vector3& a = simplex.p[0].w;
+    const Vector3& b = simplex.p[1].w;
+    const Vector3& c = simplex.p[2].w;
+    const Vector3 ab = b - a;
+    const Vector3 ac = c - a;
+
+    const float d1 = -Dot3(ab, a);
+    const float d2 = -Dot3(ac, a);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    {
+        KeepPoints(simplex, 0, 0, 0, 1.0f, 0.0f, 0.0f, 1);
+        return;
+    }
+
+    const float d3 = -Dot3(ab, b);
+    const float d4 = -Dot3(ac, b);
+    if (d3 >= 0.0f && d4 <= d3)
+    {
+        KeepPoints(simplex, 1, 1, 1, 1.0f, 0.0f, 0.0f, 1);
+        return;
+    }
+
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        const float t = d1 / (d1 - d3);
+        KeepPoints(simplex, 0, 1, 1, 1.0f - t, t, 0.0f, 2);
+        return;
+    }
+
+    const float d5 = -Dot3(ab, c);
+    const float d6 = -Dot3(ac, c);
+    if (d6 >= 0.0f && d5 <= d6)
+    {
+        KeepPoints(simplex, 2, 2, 2, 1.0f, 0.0f, 0.0f, 1);
+        return;
+    }
+
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    {
+        const float t = d2 / (d2 - d6);
+        KeepPoints(simplex, 0, 2, 2, 1.0f - t, t, 0.0f, 2);
+        return;
+    }
+
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    {
+        const float t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        KeepPoints(simplex, 1, 2, 2, 1.0f - t, t, 0.0f, 2);
+        return;
+    }
+
+    const float denom = va + vb + vc;
+    if (!(denom > 0.0f))
+    {
+        // flat triangle; its longest edge covers it
+        const float lLengths[3] = { Dot3(ab, ab), Dot3(c - b, c - b), Dot3(ac, ac) };
+        const int edge = (lLengths[0] >= lLengths[1] && lLengths[0] >= lLengths[2]) ? 0 : (lLengths[1] >= lLengths[2]) ? 1 : 2;
+        KeepPoints(simplex, (edge == 1) ? 1 : 0, (edge == 0) ? 1 : 2, 2, 0.0f, 0.0f, 0.0f, 2);
+        ClosestOnSegment(simplex);
+        return;
+    }
+
+    const float v = vb / denom;
+    const float w = vc / denom;
+    KeepPoints(simplex, 0, 1, 2, 1.0f - v - w, v, w, 3);
+}
+
+// the origin and d on opposite sides of the plane of a, b, c; a flat tetrahedron counts every face as outside
+static bool OriginOutsideFace(const Vector3& a, const Vector3& b, const Vector3& c, const Vector3& d)
+{
+    const Vector3 n = Cross3(b - a, c - a);
+    const float signOrigin = -Dot3(a, n);
+    const float signD = Dot3(d - a, n);
+    return signD * signD <= 1e-12f * Dot3(n, n) * Dot3(d - a, d - a) || signOrigin * signD < 0.0f;
+}
+
+// false if the origin is inside
+static bool ClosestOnTetrahedron(sSimplex& simplex)
+{
+    static const int s_faces[4][4] = { { 0, 1, 2, 3 }, { 0, 3, 1, 2 }, { 0, 2, 3, 1 }, { 1, 3, 2, 0 } };
+
+    sSimplex best;
+    float bestDist = FLT_MAX;
+    for (int f = 0; f < 4; ++f)
+    {
+        const int* face = s_faces[f];
+        if (!OriginOutsideFace(simplex.p[face[0]].w, simplex.p[face[1]].w, simplex.p[face[2]].w, simplex.p[face[3]].w))
+            continue;
+
+        sSimplex candidate;
+        candidate.p[0] = simplex.p[face[0]];
+        candidate.p[1] = simplex.p[face[1]];
+        candidate.p[2] = simplex.p[face[2]];
+        candidate.count = 3;
+        ClosestOnTriangle(candidate);
+
+        Vector3 v(0.0f, 0.0f, 0.0f);
+        for (int i = 0; i < candidate.count; ++i)
+            v = v + candidate.p[i].w * candidate.bary[i];
+        const float dist = Dot3(v, v);
+        if (dist < bestDist)
+        {
+            bestDist = dist;
+            best = candidate;
+        }
+    }
+
+    if (bestDist == FLT_MAX)
+        return false;
+
+    simplex = best;
+    return true;
+}
+
+static eGjkResult RunGjk(sGjk& gjk, float separation)
+{
+    const Vector3 centerA(gjk.pA->transform.row[0][3], gjk.pA->transform.row[1][3], gjk.pA->transform.row[2][3]);
+    const Vector3 centerB(gjk.pB->transform.row[0][3], gjk.pB->transform.row[1][3], gjk.pB->transform.row[2][3]);
+    gjk.v = centerA - centerB;
+    if (Dot3(gjk.v, gjk.v) == 0.0f)
+        gjk.v = Vector3(1.0f, 0.0f, 0.0f);
+
+    gjk.simplex.count = 0;
+    gjk.maxW2 = 0.0f;
+    gjk.numIterations = 0;
+    float vv = FLT_MAX;
+
+    while (gjk.numIterations < KHM_GJK_MAX_ITERATIONS)
+    {
+        ++gjk.numIterations;
+
+        sSimplexPoint point;
+        SupportPoint(gjk, gjk.v * -1.0f, point);
+
+        // v.w / |v| is a lower bound of the distance
+        const float vw = Dot3(gjk.v, point.w);
+        if (separation >= 0.0f && vw > 0.0f && vw * vw > separation * separation * Dot3(gjk.v, gjk.v))
+            return GJK_SEPARATED;
+
+        if (gjk.simplex.count)
+        {
+            if (vv - vw <= KHM_GJK_TOLERANCE * vv)
+                return GJK_DISTANCE;
+
+            bool bKnown = false;
+            for (int i = 0; i < gjk.simplex.count && !bKnown; ++i)
+                bKnown = ComparePositions(&gjk.simplex.p[i].w.x, &point.w.x) == 0;
+            if (bKnown)
+                return GJK_DISTANCE;
+        }
+
+        const sSimplex previous = gjk.simplex;
+        gjk.simplex.p[gjk.simplex.count++] = point;
+        switch (gjk.simplex.count)
+        {
+            case 1:
+                gjk.simplex.bary[0] = 1.0f;
+                break;
+
+            case 2:
+                ClosestOnSegment(gjk.simplex);
+                break;
+
+            case 3:
+                ClosestOnTriangle(gjk.simplex);
+                break;
+
+            default:
+                if (!ClosestOnTetrahedron(gjk.simplex))
+                    return GJK_OVERLAP;
+                break;
+        }
+
+        Vector3 v(0.0f, 0.0f, 0.0f);
+        for (int i = 0; i < gjk.simplex.count; ++i)
+            v = v + gjk.simplex.p[i].w * gjk.simplex.bary[i];
+
+        const float newVV = Dot3(v, v);
+        if (newVV <= 1e-10f * gjk.maxW2)
+        {
+            gjk.v = v;
+            return GJK_OVERLAP;
+        }
+
+        // no progress; the rounding is all that's left
+        if (newVV >= vv)
+        {
+            gjk.simplex = previous;
+            return GJK_DISTANCE;
+        }
+
+        gjk.v = v;
+        vv = newVV;
+    }
+    return GJK_DISTANCE;
+}
+
+static void GetClosestPoints(const sSimplex& simplex, Vector3& pointA, Vector3& pointB)
+{
+    pointA = pointB = Vector3(0.0f, 0.0f, 0.0f);
+    for (int i = 0; i < simplex.count; ++i)
+    {
+        pointA = pointA + simplex.p[i].a * simplex.bary[i];
+        pointB = pointB + simplex.p[i].b * simplex.bary[i];
+    }
+}
+
+//
+// EPA
+//
+
+struct sEpaFace
+{
+    int                     v[3];
+    Vector3                 n;              // unit, outward
+    float                   d;              // distance of the plane to the origin
+};
+
+struct sEpaEdge
+{
+    int                     a;
+    int                     b;
+};
+
+struct sEpa
+{
+    sSimplexPoint           lVerts[KHM_EPA_MAX_VERTICES];
+    int                     numVerts;
+    sEpaFace                lFaces[KHM_EPA_MAX_FACES];
+    int                     numFaces;
+};
+
+static bool AddFace(sEpa& epa, int a, int b, int c)
+{
+    if (epa.numFaces >= KHM_EPA_MAX_FACES)
+        return false;
+
+    const Vector3 n = Cross3(epa.lVerts[b].w - epa.lVerts[a].w, epa.lVerts[c].w - epa.lVerts[a].w);
+    const float length = Length3(n);
+    if (!(length > 0.0f))
+        return false;
+
+    sEpaFace& face = epa.lFaces[epa.numFaces++];
+    face.v[0] = a;
+    face.v[1] = b;
+    face.v[2] = c;
+    face.n = n * (1.0f / length);
+    face.d = Dot3(face.n, epa.lVerts[a].w);
+    return true;
+}
+
+// grows what GJK stopped on ( the origin is in it or on it ) to a tetrahedron; false if A - B is flat
+static bool BuildTetrahedron(sGjk& gjk, float tolerance)
+{
+    sSimplex& simplex = gjk.simplex;
+    if (simplex.count == 1)
+    {
+        for (int k = 0; k < 6 && simplex.count == 1; ++k)
+        {
+            Vector3 dir(0.0f, 0.0f, 0.0f);
+            (&dir.x)[k >> 1] = (k & 1) ? -1.0f : 1.0f;
+            SupportPoint(gjk, dir, simplex.p[1]);
+            const Vector3 e = simplex.p[1].w - simplex.p[0].w;
+            if (Dot3(e, e) > tolerance * tolerance)
+                simplex.count = 2;
+        }
+    }
+
+    if (simplex.count == 2)
+    {
+        const Vector3 line = Normalize3(simplex.p[1].w - simplex.p[0].w);
+        const Vector3 axis = (fabsf(line.x) < 0.57f) ? Vector3(1.0f, 0.0f, 0.0f) : (fabsf(line.y) < 0.57f) ? Vector3(0.0f, 1.0f, 0.0f) : Vector3(0.0f, 0.0f, 1.0f);
+        const Vector3 e1 = Normalize3(Cross3(line, axis));
+        const Vector3 e2 = Cross3(line, e1);
+        for (int k = 0; k < 6 && simplex.count == 2; ++k)
+        {
+            const float angle = (float)k * 1.04719755f;
+            SupportPoint(gjk, e1 * cosf(angle) + e2 * sinf(angle), simplex.p[2]);
+            const Vector3 off = simplex.p[2].w - simplex.p[0].w;
+            const Vector3 perp = off - line * Dot3(off, line);
+            if (Dot3(perp, perp) > tolerance * tolerance)
+                simplex.count = 3;
+        }
+    }
+
+    if (simplex.count == 3)
+    {
+        const Vector3 n = Normalize3(Cross3(simplex.p[1].w - simplex.p[0].w, simplex.p[2].w - simplex.p[0].w));
+        for (int k = 0; k < 2 && simplex.count == 3; ++k)
+        {
+            SupportPoint(gjk, k ? n * -1.0f : n, simplex.p[3]);
+            if (fabsf(Dot3(simplex.p[3].w - simplex.p[0].w, n)) > tolerance)
+                simplex.count = 4;
+        }
+    }
+
+    return simplex.count == 4;
+}
+
+// depth and normal of the overlapping cores, from the tetrahedron GJK ended on
+static bool RunEpa(sGjk& gjk, sConvexContact& contact)
+{
+    const float tolerance = KHM_EPA_TOLERANCE * sqrtf(gjk.maxW2);
+    if (!BuildTetrahedron(gjk, tolerance))
+        return false;
+
+    sEpa* pEpa = new sEpa();
+    sEpa& epa = *pEpa;
+    epa.numVerts = 4;
+    epa.numFaces = 0;
+    for (int i = 0; i < 4; ++i)
+        epa.lVerts[i] = gjk.simplex.p[i];
+
+    // outward: away from the tetrahedron's centroid
+    const Vector3 centroid = (epa.lVerts[0].w + epa.lVerts[1].w + epa.lVerts[2].w + epa.lVerts[3].w) * 0.25f;
+    static const int s_faces[4][3] = { { 0, 1, 2 }, { 0, 3, 1 }, { 0, 2, 3 }, { 1, 3, 2 } };
+    bool bOk = true;
+    for (int f = 0; f < 4 && bOk; ++f)
+    {
+        int a = s_faces[f][0], b = s_faces[f][1], c = s_faces[f][2];
+        const Vector3 n = Cross3(epa.lVerts[b].w - epa.lVerts[a].w, epa.lVerts[c].w - epa.lVerts[a].w);
+        if (Dot3(n, epa.lVerts[a].w - centroid) < 0.0f)
+        {
+            const int tmp = b; b = c; c = tmp;
+        }
+        bOk = AddFace(epa, a, b, c);
+    }
+
+    sEpaEdge lHorizon[KHM_EPA_MAX_FACES];
+    int best = 0;
+    for (int iteration = 0; bOk; ++iteration)
+    {
+        best = 0;
+        for (int f = 1; f < epa.numFaces; ++f)
+        {
+            if (epa.lFaces[f].d < epa.lFaces[best].d)
+                best = f;
+        }
+
+        const sEpaFace face = epa.lFaces[best];
+        if (iteration >= KHM_EPA_MAX_ITERATIONS || epa.numVerts >= KHM_EPA_MAX_VERTICES)
+            break;
+
+        ++gjk.numIterations;
+        sSimplexPoint& point = epa.lVerts[epa.numVerts];
+        SupportPoint(gjk, face.n, point);
+        if (Dot3(face.n, point.w) - face.d <= tolerance)
+            break;
+        const int newVert = epa.numVerts++;
+
+        // drop the faces the new point sees; the edges they don't share make the horizon
+        int numHorizon = 0;
+        for (int f = 0; f < epa.numFaces; )
+        {
+            const sEpaFace& visible = epa.lFaces[f];
+            if (Dot3(visible.n, point.w - epa.lVerts[visible.v[0]].w) <= 0.0f)
+            {
+                ++f;
+                continue;
+            }
+
+            for (int k = 0; k < 3; ++k)
+            {
+                const int a = visible.v[k], b = visible.v[(k + 1) % 3];
+                int shared = -1;
+                for (int e = 0; e < numHorizon && shared < 0; ++e)
+                {
+                    if (lHorizon[e].a == b && lHorizon[e].b == a)
+                        shared = e;
+                }
+
+                if (shared >= 0)
+                {
+                    lHorizon[shared] = lHorizon[--numHorizon];
+                }
+                else if (numHorizon < KHM_EPA_MAX_FACES)
+                {
+                    lHorizon[numHorizon].a = a;
+                    lHorizon[numHorizon].b = b;
+                    ++numHorizon;
+                }
+            }
+            epa.lFaces[f] = epa.lFaces[--epa.numFaces];
+        }
+
+        // the last closest face is as good as it gets once the polytope is full
+        if (epa.numFaces + numHorizon > KHM_EPA_MAX_FACES)
+        {
+            epa.lFaces[0] = face;
+            epa.numFaces = 1;
+            best = 0;
+            break;
+        }
+
+        // a point in line with a horizon edge makes no face; the sliver it leaves out has no area
+        for (int e = 0; e < numHorizon; ++e)
+            AddFace(epa, lHorizon[e].a, lHorizon[e].b, newVert);
+
+        if (!epa.numFaces)
+        {
+            bOk = false;
+            break;
+        }
+    }
+
+    if (bOk)
+    {
+        // the origin's projection on the closest face, in barycentrics of the face
+        const sEpaFace& face = epa.lFaces[best];
+        const sSimplexPoint& a = epa.lVerts[face.v[0]];
+        const sSimplexPoint& b = epa.lVerts[face.v[1]];
+        const sSimplexPoint& c = epa.lVerts[face.v[2]];
+        const Vector3 p = face.n * face.d;
+        const Vector3 v0 = b.w - a.w, v1 = c.w - a.w, v2 = p - a.w;
+        const float d00 = Dot3(v0, v0), d01 = Dot3(v0, v1), d11 = Dot3(v1, v1);
+        const float d20 = Dot3(v2, v0), d21 = Dot3(v2, v1);
+        const float denom = d00 * d11 - d01 * d01;
+        const float v = (denom > 0.0f) ? (d11 * d20 - d01 * d21) / denom : 0.0f;
+        const float w = (denom > 0.0f) ? (d00 * d21 - d01 * d20) / denom : 0.0f;
+        const float u = 1.0f - v - w;
+
+        contact.normal = face.n;
+        contact.distance = -Max(face.d, 0.0f);
+        contact.pointA = a.a * u + b.a * v + c.a * w;
+        contact.pointB = a.b * u + b.b * v + c.b * w;
+    }
+
+    delete pEpa;
+    return bOk;
+}
+
+//
+// queries
+//
+
+bool ComputeConvexContact(const sConvexShape& a, const sConvexShape& b, sConvexContact& contact)
+{
+    sGjk gjk;
+    gjk.pA = &a;
+    gjk.pB = &b;
+    gjk.startA = 0;
+    gjk.startB = 0;
+
+    const eGjkResult result = RunGjk(gjk, -1.0f);
+    if (result == GJK_DISTANCE)
+    {
+        Vector3 pointA, pointB;
+        GetClosestPoints(gjk.simplex, pointA, pointB);
+        const float dist = Length3(pointB - pointA);
+        contact.normal = (dist > 0.0f) ? (pointB - pointA) * (1.0f / dist) : Normalize3(gjk.v * -1.0f);
+        contact.distance = dist;
+        contact.pointA = pointA;
+        contact.pointB = pointB;
+    }
+    else if (!RunEpa(gjk, contact))
+    {
+        // A - B is flat: the cores only touch. any normal will do, the one between the centers makes sense
+        Vector3 pointA, pointB;
+        GetClosestPoints(gjk.simplex, pointA, pointB);
+        const Vector3 centers(b.transform.row[0][3] - a.transform.row[0][3], b.transform.row[1][3] - a.transform.row[1][3], b.transform.row[2][3] - a.transform.row[2][3]);
+        contact.normal = (Dot3(centers, centers) > 0.0f) ? Normalize3(centers) : Vector3(1.0f, 0.0f, 0.0f);
+        contact.distance = 0.0f;
+        contact.pointA = pointA;
+        contact.pointB = pointB;
+    }
+
+    // back to the rounded shapes
+    contact.pointA = contact.pointA + contact.normal * a.margin;
+    contact.pointB = contact.pointB - contact.normal * b.margin;
+    contact.distance -= a.margin + b.margin;
+    contact.numIterations = gjk.numIterations;
+    return contact.distance <= 0.0f;
+}
+
+bool TestConvexOverlap(const sConvexShape& a, const sConvexShape& b)
+{
+    sGjk gjk;
+    gjk.pA = &a;
+    gjk.pB = &b;
+    gjk.startA = 0;
+    gjk.startB = 0;
+
+    const float margin = a.margin + b.margin;
+    switch (RunGjk(gjk, margin))
+    {
+        case GJK_SEPARATED:
+            return false;
+
+        case GJK_OVERLAP:
+            return true;
+
+        default:
+        {
+            Vector3 pointA, pointB;
+            GetClosestPoints(gjk.simplex, pointA, pointB);
+            const Vector3 gap = pointB - pointA;
+            return Dot3(gap, gap) <= margin * margin;
+        }
+    }
+}
+
+}; // end namespace KHM
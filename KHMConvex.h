@@ -0,0 +1,96 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMMath.h"
+#include "KHMCollision.h"
+
+namespace KHM
+{
+    //
+    // common defines for convex queries
+    //
+
+    #define KHM_HULL_CLIMB_MIN_VERTICES     128     // smaller hulls are scanned; a SIMD pass over a few vertices beats walking the edges
+    #define KHM_GJK_MAX_ITERATIONS          64
+    #define KHM_GJK_TOLERANCE               1e-6f   // relative; GJK stops once a step gets the squared distance less than this closer
+    #define KHM_EPA_MAX_ITERATIONS          64
+    #define KHM_EPA_MAX_VERTICES            128
+    #define KHM_EPA_MAX_FACES               (2 * KHM_EPA_MAX_VERTICES)
+    #define KHM_EPA_TOLERANCE               1e-4f   // relative to the size of the shapes
+
+    //
+    // KHM Convex Hull - support mapping data for a CONVEX_MESH shape, built at load
+    //
+    // vertices are welded by position, so hulls exported with their polygons apart still share their corners, and
+    // stored SoA for the SIMD scan. the adjacency is the edge graph of the polygons; on a convex polytope a vertex
+    // that no neighbour beats in a direction is the support in that direction, so GetHullSupport walks from a start
+    // vertex to it. the walk is checked against the scan when the hull is built, and hulls that aren't convex ( or
+    // have no polygons ) lose their adjacency
+    //
+
+    struct sConvexHull
+    {
+        int                     numVertices;
+        int                     numVerticesPadded;  // KHM_SIMD_LANES; the padding repeats vertex 0
+        float*                  pVertices;          // [3][numVerticesPadded]
+        int*                    pAdjacencyOffsets;  // numVertices + 1; NULL = no adjacency
+        unsigned short*         pAdjacency;         // neighbours of v: [pAdjacencyOffsets[v], pAdjacencyOffsets[v + 1])
+        int                     numAdjacency;
+    };
+
+    // NULL unless shape is a CONVEX_MESH with vertices; bAdjacency = false builds a scan only hull
+    sConvexHull*    CreateConvexHull(const sCollisionShape& shape, bool bAdjacency);
+    void            DestroyConvexHull(sConvexHull* pHull);
+
+    inline Vector3 GetHullVertex(const sConvexHull* pHull, int v)
+    {
+        const float* p = pHull->pVertices;
+        return Vector3(p[v], p[pHull->numVerticesPadded + v], p[2 * pHull->numVerticesPadded + v]);
+    }
+
+    // vertex furthest along dir; climbs from start over the adjacency when there is one, scans otherwise. start is
+    // any vertex, the last support of a nearby direction is the quickest
+    int             GetHullSupport(const sConvexHull* pHull, const Vector3& dir, int start);
+
+    // SIMD over every vertex; ties go to the lowest index
+    int             GetHullSupportScan(const sConvexHull* pHull, const Vector3& dir);
+
+    // scalar, over the shape's own vertices; the reference for both
+    int             GetShapeSupportReference(const sCollisionShape& shape, const Vector3& dir);
+
+    //
+    // KHM Convex Shape - a collision shape placed in world space, for GJK
+    //
+    // spheres and capsules are a point and a segment grown by their radius: GJK and EPA run on those cores and the
+    // radii are added at the end, which keeps rounded shapes exact
+    //
+
+    struct sConvexShape
+    {
+        const sCollisionShape*  pShape;
+        const sConvexHull*      pHull;          // CONVEX_MESH; NULL scans the shape's vertices
+        sMatrix3x4              transform;      // shape -> world; rigid or uniformly scaled
+        float                   margin;         // sphere / capsule radius, world units
+    };
+
+    // world = placement * shape.transform. false for shapes that aren't convex ( MESH ) or have nothing to support
+    bool            SetConvexShape(sConvexShape& convex, const sCollisionShape& shape, const sConvexHull* pHull, const sMatrix3x4& placement);
+
+    // a shape primitive of a placed model, with the hull the BVH built for it; false for triangles
+    bool            SetConvexShape(sConvexShape& convex, const sCollisionInstance& instance, int primitive);
+
+    struct sConvexContact
+    {
+        float                   distance;       // > 0 apart, < 0 penetrating
+        Vector3                 normal;         // unit, from A to B; moving B along it by -distance makes them touch
+        Vector3                 pointA;         // closest ( or deepest ) points, world space, on the surfaces
+        Vector3                 pointB;
+        int                     numIterations;  // GJK, plus EPA when the cores overlap
+    };
+
+    // GJK distance; EPA for the depth when the cores overlap. true = overlapping ( distance <= 0 )
+    bool            ComputeConvexContact(const sConvexShape& a, const sConvexShape& b, sConvexContact& contact);
+
+    // GJK only, and it stops at the first separating direction
+    bool            TestConvexOverlap(const sConvexShape& a, const sConvexShape& b);
+};
@@ -0,0 +1,482 @@
+#include "KHMGenerator.h"
+#include "KHMMath.h"
+#include "Kernel/Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace KHM {
+
+sGeneratorSettings::sGeneratorSettings() :
+    uiSeed(1),
+    numBones(32),
+    numHelpers(8),
+    numVertices(4096),
+    numTexCoordMaps(1),
+    bColors(true),
+    bSkin(true),
+    numCollisions(4),
+    numFrames(60),
+    numMaskEntries(8)
+{
+}
+
+//
+// helpers
+//
+
+// xorshift; rand() differs between platforms and the corpus has to be reproducible
+struct sGeneratorRandom
+{
+    unsigned int uiState;
+
+    unsigned int Next()
+    {
+        uiState ^= uiState << 13;
+        uiState ^= uiState >> 17;
+        uiState ^= uiState << 5;
+        return uiState;
+    }
+
+    // [-1, 1]
+    float NextFloat()
+    {
+        return (float)(Next() & 0xFFFFFF) / (float)0x7FFFFF - 1.0f;
+    }
+};
+
+// sizes the file when pDest is NULL
+struct sGeneratorWriter
+{
+    unsigned char*  pDest;
+    unsigned int    uiOffset;
+
+    void Write(const void* pSrc, unsigned int uiBytes)
+    {
+        if (pDest)
+            memcpy(pDest + uiOffset, pSrc, uiBytes);
+        uiOffset += uiBytes;
+    }
+
+    void WriteByte(unsigned char value) { Write(&value, sizeof(value)); }
+    void WriteInt(int value) { Write(&value, sizeof(value)); }
+    void WriteFloat(float value) { Write(&value, sizeof(value)); }
+};
+
+static void MakeObject(sObjectBase& object, const char* pszName, unsigned int uiId, unsigned int uiParentId, const Vector3& vLocal, const Vector3& vGlobal)
+{
+    memset(&object, 0, sizeof(object));
+    strncpy(object.szName, pszName, KHM_MAX_OBJECT_NAME - 1);
+    object.uiId = uiId;
+    object.uiParentId = uiParentId;
+
+    // translation only; row vectors, so it sits in the last row
+    float* pLocal = (float*)&object.matLocal;
+    float* pGlobal = (float*)&object.matGlobal;
+    for (int i = 0; i < 16; ++i)
+        pLocal[i] = pGlobal[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+
+    pLocal[12] = vLocal.x; pLocal[13] = vLocal.y; pLocal[14] = vLocal.z;
+    pGlobal[12] = vGlobal.x; pGlobal[13] = vGlobal.y; pGlobal[14] = vGlobal.z;
+}
+
+// bones hang off an earlier bone and fill lBoneGlobals; helpers hang off any bone
+static void WriteObjects(sGeneratorWriter& writer, sGeneratorRandom& rnd, bool bBones, int count, int numBones, Vector3* lBoneGlobals)
+{
+    writer.WriteByte((unsigned char)count);
+    for (int i = 0; i < count; ++i)
+    {
+        const int numCandidates = bBones ? i : numBones;
+        const int parent = numCandidates ? (int)(rnd.Next() % numCandidates) : -1;
+
+        const Vector3 vLocal(rnd.NextFloat(), rnd.NextFloat() + 1.0f, rnd.NextFloat());
+        const Vector3 vGlobal = (parent >= 0) ? lBoneGlobals[parent] + vLocal : vLocal;
+        if (bBones)
+            lBoneGlobals[i] = vGlobal;
+
+        char szName[KHM_MAX_OBJECT_NAME];
+        snprintf(szName, sizeof(szName), bBones ? "bone%d" : "helper%d", i);
+
+        sObjectBase object;
+        MakeObject(object, szName, bBones ? i : numBones + i, (parent >= 0) ? (unsigned int)parent : (unsigned int)-1, vLocal, vGlobal);
+        writer.Write(&object, sizeof(object));
+    }
+}
+
+// same records ReadCollisionData parses
+static void WriteCollisions(sGeneratorWriter& writer, int numCollisions, const Vector3& vMin, const Vector3& vMax)
+{
+    static const sCollisionShape::eCollisionType s_types[] =
+    {
+        sCollisionShape::SPHERE,
+        sCollisionShape::BOX,
+        sCollisionShape::CAPSULE,
+        sCollisionShape::CONVEX_MESH,
+    };
+
+    const Vector3 vCenter = (vMin + vMax) * 0.5f;
+    const Vector3 vExtents = (vMax - vMin) * 0.5f;
+
+    writer.WriteInt(numCollisions);
+    for (int i = 0; i < numCollisions; ++i)
+    {
+        const sCollisionShape::eCollisionType type = s_types[i % (sizeof(s_types) / sizeof(s_types[0]))];
+        writer.WriteInt((int)type);
+
+        // spread along x, inside the bounds
+        float transform[16];
+        for (int k = 0; k < 16; ++k)
+            transform[k] = (k % 5 == 0) ? 1.0f : 0.0f;
+        transform[12] = vMin.x + (vMax.x - vMin.x) * (i + 0.5f) / numCollisions;
+        transform[13] = vCenter.y;
+        transform[14] = vCenter.z;
+        writer.Write(transform, sizeof(transform));
+
+        switch (type)
+        {
+            case sCollisionShape::SPHERE:
+                writer.WriteFloat(vExtents.y + 0.5f);
+                break;
+
+            case sCollisionShape::BOX:
+            {
+                const float extents[3] = { 0.5f, vExtents.y + 0.5f, vExtents.z };
+                writer.Write(extents, sizeof(extents));
+                break;
+            }
+
+            case sCollisionShape::CAPSULE:
+                writer.WriteFloat(0.5f);
+                writer.WriteFloat(vExtents.z);
+                break;
+
+            case sCollisionShape::CONVEX_MESH:
+            {
+                // unit box hull; one quad per face
+                static const unsigned short s_faces[6][4] =
+                {
+                    { 0, 2, 6, 4 }, { 1, 5, 7, 3 }, // -x, +x
+                    { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, // -y, +y
+                    { 0, 1, 3, 2 }, { 4, 6, 7, 5 }, // -z, +z
+                };
+
+                writer.WriteInt(6);
+                for (int f = 0; f < 6; ++f)
+                {
+                    sCollisionPolygon polygon;
+                    memset(&polygon, 0, sizeof(polygon));
+                    polygon.plane[f >> 1] = (f & 1) ? 1.0f : -1.0f;
+                    polygon.plane[3] = -0.5f;
+                    polygon.numVerts = 4;
+                    polygon.indexBase = (unsigned short)(f * 4);
+                    writer.Write(&polygon, sizeof(polygon));
+                }
+
+                writer.WriteInt(6 * 4);
+                writer.Write(s_faces, sizeof(s_faces));
+
+                writer.WriteInt(8);
+                for (int v = 0; v < 8; ++v)
+                {
+                    const Vector3 vCorner((v & 1) ? 0.5f : -0.5f, (v & 2) ? 0.5f : -0.5f, (v & 4) ? 0.5f : -0.5f);
+                    writer.Write(&vCorner, sizeof(vCorner));
+                }
+                break;
+            }
+
+            default:
+                DEBUG_BREAK();
+                break;
+        }
+    }
+}
+
+static void WriteMesh(sGeneratorWriter& writer, sGeneratorRandom& rnd, const sGeneratorSettings& settings, unsigned int uiId)
+{
+    sObjectBase object;
+    MakeObject(object, "mesh", uiId, (unsigned int)-1, Vector3(0.0f, 0.0f, 0.0f), Vector3(0.0f, 0.0f, 0.0f));
+    writer.Write(&object, sizeof(object));
+
+    int grid = 2;
+    while (grid * grid < settings.numVertices)
+        ++grid;
+
+    const int numVertices = grid * grid;
+    const int numIndices = (grid - 1) * (grid - 1) * 6;
+
+    // heights first; the rest of the streams are derived from them
+    float* lHeights = (float*)malloc(sizeof(float) * numVertices);
+    for (int i = 0; i < numVertices; ++i)
+        lHeights[i] = rnd.NextFloat() * 0.25f;
+
+    writer.WriteInt(numVertices);
+    for (int i = 0; i < numVertices; ++i)
+    {
+        const Vector3 vPos((float)(i % grid), lHeights[i], (float)(i / grid));
+        writer.Write(&vPos, sizeof(vPos));
+    }
+
+    for (int i = 0; i < numVertices; ++i)
+    {
+        const int x = i % grid, z = i / grid;
+        const float dx = lHeights[z * grid + Min(x + 1, grid - 1)] - lHeights[z * grid + Max(x - 1, 0)];
+        const float dz = lHeights[Min(z + 1, grid - 1) * grid + x] - lHeights[Max(z - 1, 0) * grid + x];
+        const Vector3 vNormal = Normalize3(Vector3(-dx, 2.0f, -dz));
+        writer.Write(&vNormal, sizeof(vNormal));
+    }
+
+    writer.WriteInt(numIndices);
+    for (int z = 0; z < grid - 1; ++z)
+    {
+        for (int x = 0; x < grid - 1; ++x)
+        {
+            const unsigned short a = (unsigned short)(z * grid + x);
+            const unsigned short lQuad[6] = { a, (unsigned short)(a + grid), (unsigned short)(a + 1), (unsigned short)(a + 1), (unsigned short)(a + grid), (unsigned short)(a + grid + 1) };
+            writer.Write(lQuad, sizeof(lQuad));
+        }
+    }
+
+    for (int z = 0; z < grid - 1; ++z)
+    {
+        for (int x = 0; x < grid - 1; ++x)
+        {
+            const int a = z * grid + x;
+            const Vector3 p0((float)x, lHeights[a], (float)z);
+            const Vector3 p1((float)x, lHeights[a + grid], (float)(z + 1));
+            const Vector3 p2((float)(x + 1), lHeights[a + 1], (float)z);
+            const Vector3 p3((float)(x + 1), lHeights[a + grid + 1], (float)(z + 1));
+
+            const Vector3 n0 = Normalize3(Cross3(p1 - p0, p2 - p0));
+            const Vector3 n1 = Normalize3(Cross3(p1 - p2, p3 - p2));
+            writer.Write(&n0, sizeof(n0));
+            writer.Write(&n1, sizeof(n1));
+        }
+    }
+
+    writer.WriteByte(settings.bColors ? 1 : 0);
+    if (settings.bColors)
+    {
+        for (int i = 0; i < numVertices; ++i)
+        {
+            const unsigned int uiColor = 0xFF000000u | (rnd.Next() & 0x00FFFFFFu);
+            writer.Write(&uiColor, sizeof(uiColor));
+        }
+    }
+
+    writer.WriteInt(settings.numTexCoordMaps);
+    for (int m = 0; m < settings.numTexCoordMaps; ++m)
+    {
+        for (int i = 0; i < numVertices; ++i)
+        {
+            Vector2 uv;
+            uv.x = (float)(i % grid) / (float)(grid - 1);
+            uv.y = (float)(i / grid) / (float)(grid - 1) + (float)m;
+            writer.Write(&uv, sizeof(uv));
+        }
+    }
+
+    const bool bSkin = settings.bSkin && settings.numBones > 0;
+    writer.WriteByte(bSkin ? 1 : 0);
+    if (bSkin)
+    {
+        // up to four influences, heaviest first, summing to one
+        for (int i = 0; i < numVertices; ++i)
+        {
+            const int numInfluences = 1 + (int)(rnd.Next() % KHM_MAX_BONE_INFLUENCES);
+            float lWeights[KHM_MAX_BONE_INFLUENCES] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            float fTotal = 0.0f;
+            for (int k = 0; k < numInfluences; ++k)
+            {
+                lWeights[k] = (float)(numInfluences - k);
+                fTotal += lWeights[k];
+            }
+
+            Vector4 vWeights;
+            vWeights.x = lWeights[0] / fTotal;
+            vWeights.y = lWeights[1] / fTotal;
+            vWeights.z = lWeights[2] / fTotal;
+            vWeights.w = lWeights[3] / fTotal;
+            writer.Write(&vWeights, sizeof(vWeights));
+        }
+
+        for (int i = 0; i < numVertices; ++i)
+        {
+            sBoneIndices indices;
+            for (int k = 0; k < KHM_MAX_BONE_INFLUENCES; ++k)
+                indices.ind[k] = (unsigned char)(rnd.Next() % settings.numBones);
+            writer.Write(&indices, sizeof(indices));
+        }
+    }
+
+    const Vector3 vMin(0.0f, -0.25f, 0.0f);
+    const Vector3 vMax((float)(grid - 1), 0.25f, (float)(grid - 1));
+    WriteCollisions(writer, settings.numCollisions, vMin, vMax);
+
+    writer.Write(&vMin, sizeof(vMin));
+    writer.Write(&vMax, sizeof(vMax));
+
+    free(lHeights);
+}
+
+static void WriteAnimation(sGeneratorWriter& writer, sGeneratorRandom& rnd, const sGeneratorSettings& settings)
+{
+    const int numNodes = settings.numBones + settings.numHelpers;
+    writer.WriteInt(numNodes);
+    writer.WriteFloat(0.0f);
+    writer.WriteFloat((float)(settings.numFrames - 1) / 30.0f);
+    writer.WriteInt(settings.numFrames);
+
+    for (int i = 0; i < numNodes; ++i)
+    {
+        sNodeAnimation node;
+        memset(&node, 0, sizeof(node));
+        node.uiNodeId = i;
+        if (i < settings.numBones)
+            snprintf(node.szNodeName, sizeof(node.szNodeName), "bone%d", i);
+        else
+            snprintf(node.szNodeName, sizeof(node.szNodeName), "helper%d", i - settings.numBones);
+        writer.Write(&node, sizeof(node));
+    }
+
+    // every node turns around its own random axis at its own speed
+    for (int f = 0; f < settings.numFrames; ++f)
+    {
+        sGeneratorRandom nodeRnd;
+        nodeRnd.uiState = rnd.uiState;
+        for (int i = 0; i < numNodes; ++i)
+        {
+            const Vector3 vAxis = Normalize3(Vector3(nodeRnd.NextFloat(), nodeRnd.NextFloat() + 2.0f, nodeRnd.NextFloat()));
+            const float fAngle = (float)f * 0.05f * (1.0f + nodeRnd.NextFloat());
+            const float fSin = sinf(fAngle * 0.5f);
+
+            sNodeTransform transform;
+            transform.qRot.x = vAxis.x * fSin;
+            transform.qRot.y = vAxis.y * fSin;
+            transform.qRot.z = vAxis.z * fSin;
+            transform.qRot.w = cosf(fAngle * 0.5f);
+            transform.vTrans = Vector3(0.0f, 1.0f + 0.1f * sinf((float)f * 0.1f + (float)i), 0.0f);
+            transform.vScale = Vector3(1.0f, 1.0f, 1.0f);
+            writer.Write(&transform, sizeof(transform));
+        }
+    }
+
+    for (int i = 0; i < 2 * numNodes; ++i)
+        rnd.Next();
+}
+
+static void WriteAnimationMask(sGeneratorWriter& writer, const sGeneratorSettings& settings)
+{
+    const int numObjects = settings.numBones + settings.numHelpers;
+    writer.WriteInt(settings.numMaskEntries);
+    for (int i = 0; i < settings.numMaskEntries; ++i)
+    {
+        sAnimationMaskEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        if (!numObjects)
+            snprintf(entry.szObjectName, sizeof(entry.szObjectName), "missing%d", i);
+        else if (i % numObjects < settings.numBones)
+            snprintf(entry.szObjectName, sizeof(entry.szObjectName), "bone%d", i % numObjects);
+        else
+            snprintf(entry.szObjectName, sizeof(entry.szObjectName), "helper%d", i % numObjects - settings.numBones);
+        entry.mask = 1;
+        writer.Write(&entry, sizeof(entry));
+    }
+}
+
+static void WriteModel(sGeneratorWriter& writer, const sGeneratorSettings& settings)
+{
+    sGeneratorRandom rnd;
+    rnd.uiState = settings.uiSeed ? settings.uiSeed : 1;
+
+    sHeader header;
+    header.uiVer = KHM_VERSION_SEQUENTIAL;
+    writer.Write(&header, sizeof(header));
+
+    Vector3 lBoneGlobals[KHM_MAX_BONES];
+    WriteObjects(writer, rnd, true, settings.numBones, settings.numBones, lBoneGlobals);
+    WriteObjects(writer, rnd, false, settings.numHelpers, settings.numBones, lBoneGlobals);
+
+    writer.WriteByte(settings.numVertices ? 1 : 0);
+    if (settings.numVertices)
+        WriteMesh(writer, rnd, settings, settings.numBones + settings.numHelpers);
+
+    writer.WriteByte(settings.numFrames ? 1 : 0);
+    if (settings.numFrames)
+        WriteAnimation(writer, rnd, settings);
+
+    writer.WriteByte(settings.numMaskEntries ? 1 : 0);
+    if (settings.numMaskEntries)
+        WriteAnimationMask(writer, settings);
+}
+
+//
+// CGenerator
+//
+
+CGenerator::CGenerator() :
+    lData(NULL),
+    uiSize(0)
+{
+}
+
+CGenerator::~CGenerator()
+{
+    free(lData);
+}
+
+bool CGenerator::Generate(const sGeneratorSettings& settings)
+{
+    free(lData);
+    lData = NULL;
+    uiSize = 0;
+
+    if (settings.numBones < 0 || settings.numBones > KHM_MAX_BONES ||
+        settings.numHelpers < 0 || settings.numBones + settings.numHelpers > 255 ||
+        settings.numVertices < 0 || settings.numVertices > KHM_GENERATOR_MAX_VERTICES ||
+        settings.numTexCoordMaps < 0 || settings.numTexCoordMaps > 2 ||
+        settings.numCollisions < 0 || settings.numFrames < 0 || settings.numMaskEntries < 0)
+    {
+        LOG_ERROR("[Error] CGenerator::Generate() - settings out of range\n");
+        return false;
+    }
+
+    // sized by a dry run
+    sGeneratorWriter writer;
+    writer.pDest = NULL;
+    writer.uiOffset = 0;
+    WriteModel(writer, settings);
+
+    uiSize = writer.uiOffset;
+    lData = (unsigned char*)malloc(uiSize);
+
+    writer.pDest = lData;
+    writer.uiOffset = 0;
+    WriteModel(writer, settings);
+
+    ASSERT(writer.uiOffset == uiSize);
+    return true;
+}
+
+bool CGenerator::Write(const char* pszPath) const
+{
+    if (!lData)
+        return false;
+
+    FILE* f = fopen(pszPath, "wb");
+    if (!f)
+    {
+        LOG_ERROR("[Error] CGenerator::Write(%s) - can't open file for writing.\n", pszPath);
+        return false;
+    }
+
+    bool bOk = fwrite(lData, uiSize, 1, f) == 1;
+    if (fclose(f) != 0)
+        bOk = false;
+
+    if (!bOk)
+        LOG_ERROR("[Error] CGenerator::Write(%s) - write failed.\n", pszPath);
+
+    return bOk;
+}
+
+}; // end namespace KHM
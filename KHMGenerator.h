@@ -0,0 +1,63 @@
+#pragma once
+
+#include "KHMModel.h"
+
+namespace KHM
+{
+    //
+    // common defines for the generator
+    //
+
+    #define KHM_GENERATOR_MAX_VERTICES      (256 * 256) // the grid has to stay addressable by 16 bit indices
+
+    //
+    // KHM Generator Settings - what goes in a synthetic model
+    //
+
+    struct sGeneratorSettings
+    {
+        sGeneratorSettings();
+
+        unsigned int            uiSeed;             // same seed, same bytes
+        int                     numBones;           // up to KHM_MAX_BONES
+        int                     numHelpers;         // bones + helpers + mesh have to fit the 8 bit ids
+        int                     numVertices;        // rounded up to a square grid; 0 = no mesh
+        int                     numTexCoordMaps;    // 0 .. 2
+        bool                    bColors;
+        bool                    bSkin;              // needs bones
+        int                     numCollisions;      // cycles through sphere, box, capsule and convex mesh
+        int                     numFrames;          // 0 = no animation; animates every bone and helper
+        int                     numMaskEntries;     // 0 = no mask; cycles through the bones and helpers
+    };
+
+    //
+    // KHM Generator - writes synthetic but valid v101 models, for benchmarks and tests
+    //
+    // the mesh is a bumpy grid in the xz plane with matching face normals and bounds. bone locals only translate,
+    // so the globals are exact. timings match a 30 fps export
+    //
+
+    class CGenerator
+    {
+        public:
+            CGenerator();
+            ~CGenerator();
+
+        public:
+            // the result is kept until the next Generate
+            bool Generate(const sGeneratorSettings& settings);
+
+            const unsigned char* GetData() const { return lData; }
+            unsigned int GetSize() const { return uiSize; }
+
+            bool Write(const char* pszPath) const;
+
+        private:
+            CGenerator(const CGenerator&);
+            CGenerator& operator=(const CGenerator&);
+
+        private:
+            unsigned char*          lData;
+            unsigned int            uiSize;
+    };
+};
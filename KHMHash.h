@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string.h>
+
+namespace KHM
+{
+    //
+    // name hashing for KHM ( FNV-1a, 32 bit )
+    //
+
+    #define KHM_HASH_SEED                   2166136261u
+    #define KHM_HASH_PRIME                  16777619u
+
+    // exact hash; used for object names
+    inline unsigned int HashName(const char* szName)
+    {
+        unsigned int h = KHM_HASH_SEED;
+        for (const unsigned char* p = (const unsigned char*)szName; *p; ++p)
+            h = (h ^ *p) * KHM_HASH_PRIME;
+        return h;
+    }
+
+    // compile time version of HashName, so call sites can resolve names once:
+    //  static const unsigned int s_uiMuzzleHash = KHM::HashNameConst("muzzle");
+    constexpr unsigned int HashNameConst(const char* szName, unsigned int h = KHM_HASH_SEED)
+    {
+        return *szName ? HashNameConst(szName + 1, (h ^ (unsigned char)*szName) * KHM_HASH_PRIME) : h;
+    }
+
+    // case insensitive and separator agnostic hash; used for file paths ( 'Models\A.khm' == 'models/a.khm' )
+    inline unsigned int HashPath(const char* szPath)
+    {
+        unsigned int h = KHM_HASH_SEED;
+        for (const unsigned char* p = (const unsigned char*)szPath; *p; ++p)
+        {
+            unsigned char c = *p;
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            else if (c == '\\')
+                c = '/';
+            h = (h ^ c) * KHM_HASH_PRIME;
+        }
+        return h;
+    }
+
+    // content hash for whole files ( 64 bit ); four independent lanes over 8 byte words, so it keeps up with memory.
+    // not cryptographic: callers that can't afford a collision compare the bytes as well
+    #define KHM_HASH64_PRIME1               11400714785074694791ull
+    #define KHM_HASH64_PRIME2               14029467366897019727ull
+    #define KHM_HASH64_PRIME3               1609587929392839161ull
+
+    inline unsigned long long HashDataRound(unsigned long long h, unsigned long long w)
+    {
+        h += w * KHM_HASH64_PRIME2;
+        h = (h << 31) | (h >> 33);
+        return h * KHM_HASH64_PRIME1;
+    }
+
+    inline unsigned long long HashData(const void* pData, size_t size)
+    {
+        const unsigned char* p = (const unsigned char*)pData;
+        const unsigned char* pEnd = p + size;
+
+        unsigned long long h0 = KHM_HASH64_PRIME1 + KHM_HASH64_PRIME2;
+        unsigned long long h1 = KHM_HASH64_PRIME2;
+        unsigned long long h2 = 0;
+        unsigned long long h3 = 0 - KHM_HASH64_PRIME1;
+        for (; pEnd - p >= 32; p += 32)
+        {
+            unsigned long long w[4];
+            memcpy(w, p, sizeof(w));
+            h0 = HashDataRound(h0, w[0]);
+            h1 = HashDataRound(h1, w[1]);
+            h2 = HashDataRound(h2, w[2]);
+            h3 = HashDataRound(h3, w[3]);
+        }
+
+        unsigned long long h = ((h0 << 1) | (h0 >> 63)) + ((h1 << 7) | (h1 >> 57)) + ((h2 << 12) | (h2 >> 52)) + ((h3 << 18) | (h3 >> 46));
+        h += (unsigned long long)size;
+        for (; p < pEnd; ++p)
+            h = HashDataRound(h, *p);
+
+        // final avalanche
+        h ^= h >> 33;
+        h *= KHM_HASH64_PRIME2;
+        h ^= h >> 29;
+        h *= KHM_HASH64_PRIME3;
+        h ^= h >> 32;
+        return h;
+    }
+};
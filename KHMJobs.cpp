@@ -0,0 +1,215 @@
+#include "KHMJobs.h"
+#include "Kernel/CommonDefs.h"
+
+namespace KHM {
+
+// set while the thread executes a job; nested ParallelFor calls run inline
+static thread_local bool s_bInsideJob = false;
+
+//
+// CJobPool
+//
+
+CJobPool::CJobPool() :
+    lThreads(NULL),
+    numThreads(1),
+    pCurrentJob(NULL),
+    jobGeneration(0),
+    numActiveWorkers(0),
+    bQuit(false)
+{
+}
+
+CJobPool::~CJobPool()
+{
+    Shutdown();
+}
+
+bool CJobPool::Init(int numThreadsWanted)
+{
+    Shutdown();
+
+    if (numThreadsWanted <= 0)
+        numThreadsWanted = (int)std::thread::hardware_concurrency();
+
+    numThreads = Max(1, Min(numThreadsWanted, KHM_MAX_JOB_THREADS));
+    bQuit = false;
+
+    // the calling thread is worker 0
+    if (numThreads > 1)
+    {
+        lThreads = new std::thread[numThreads - 1];
+        for (int i = 0; i < numThreads - 1; ++i)
+            lThreads[i] = std::thread(WorkerMain, this);
+    }
+
+    return true;
+}
+
+void CJobPool::Shutdown()
+{
+    if (lThreads)
+    {
+        {
+            std::lock_guard<std::mutex> lock(stateLock);
+            bQuit = true;
+        }
+        wakeWorkers.notify_all();
+
+        for (int i = 0; i < numThreads - 1; ++i)
+            lThreads[i].join();
+
+        delete [] lThreads;
+        lThreads = NULL;
+    }
+
+    numThreads = 1;
+}
+
+bool CJobPool::PopRange(sSlice& slice, int grainSize, int& begin, int& end)
+{
+    std::lock_guard<std::mutex> lock(slice.lock);
+    if (slice.begin >= slice.end)
+        return false;
+
+    begin = slice.begin;
+    end = Min(slice.begin + grainSize, slice.end);
+    slice.begin = end;
+    return true;
+}
+
+bool CJobPool::StealRange(sJob* pJob, int slot, int numSlots)
+{
+    for (;;)
+    {
+        // pick the fullest victim
+        int victim = -1;
+        int victimSize = 0;
+        for (int i = 0; i < numSlots; ++i)
+        {
+            if (i == slot)
+                continue;
+
+            sSlice& slice = pJob->slices[i];
+            std::lock_guard<std::mutex> lock(slice.lock);
+            const int size = slice.end - slice.begin;
+            if (size > victimSize)
+            {
+                victim = i;
+                victimSize = size;
+            }
+        }
+
+        if (victim < 0)
+            return false; // everything has been handed out
+
+        int begin, end;
+        {
+            sSlice& slice = pJob->slices[victim];
+            std::lock_guard<std::mutex> lock(slice.lock);
+            const int size = slice.end - slice.begin;
+            if (size <= 0)
+                continue; // drained while we were looking, try again
+
+            // take the back half, the owner keeps eating from the front
+            begin = slice.begin + size / 2;
+            end = slice.end;
+            slice.end = begin;
+        }
+
+        sSlice& own = pJob->slices[slot];
+        std::lock_guard<std::mutex> lock(own.lock);
+        own.begin = begin;
+        own.end = end;
+        return true;
+    }
+}
+
+void CJobPool::RunJob(sJob* pJob, int slot, int numSlots)
+{
+    s_bInsideJob = true;
+
+    int begin, end;
+    do
+    {
+        while (PopRange(pJob->slices[slot], pJob->grainSize, begin, end))
+            pJob->pFunc(pJob->pUserData, begin, end);
+    }
+    while (StealRange(pJob, slot, numSlots));
+
+    s_bInsideJob = false;
+}
+
+void CJobPool::WorkerMain(CJobPool* pPool)
+{
+    unsigned int uiSeenGeneration = 0;
+    for (;;)
+    {
+        sJob* pJob;
+        {
+            std::unique_lock<std::mutex> lock(pPool->stateLock);
+            while (!pPool->bQuit && (!pPool->pCurrentJob || pPool->jobGeneration == uiSeenGeneration))
+                pPool->wakeWorkers.wait(lock);
+
+            if (pPool->bQuit)
+                return;
+
+            uiSeenGeneration = pPool->jobGeneration;
+            pJob = pPool->pCurrentJob;
+            ++pPool->numActiveWorkers;
+        }
+
+        const int slot = pJob->nextSlot.fetch_add(1);
+        ASSERT(slot < pPool->numThreads);
+        RunJob(pJob, slot, pPool->numThreads);
+
+        {
+            std::lock_guard<std::mutex> lock(pPool->stateLock);
+            if (--pPool->numActiveWorkers == 0)
+                pPool->jobDone.notify_all();
+        }
+    }
+}
+
+void CJobPool::ParallelFor(int count, int grainSize, JobRangeFunc pFunc, void* pUserData)
+{
+    if (count <= 0)
+        return;
+
+    grainSize = Max(grainSize, 1);
+    if (numThreads == 1 || s_bInsideJob || count <= grainSize)
+    {
+        pFunc(pUserData, 0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> jobGuard(jobLock);
+
+    sJob job;
+    job.pFunc = pFunc;
+    job.pUserData = pUserData;
+    job.grainSize = grainSize;
+    job.nextSlot = 1; // slot 0 is ours
+    for (int i = 0; i < numThreads; ++i)
+    {
+        job.slices[i].begin = (int)(((long long)count * i) / numThreads);
+        job.slices[i].end = (int)(((long long)count * (i + 1)) / numThreads);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stateLock);
+        pCurrentJob = &job;
+        ++jobGeneration;
+    }
+    wakeWorkers.notify_all();
+
+    RunJob(&job, 0, numThreads);
+
+    // everything is handed out; wait for the chunks still in flight. workers waking up after this point won't see the job
+    std::unique_lock<std::mutex> lock(stateLock);
+    pCurrentJob = NULL;
+    while (numActiveWorkers > 0)
+        jobDone.wait(lock);
+}
+
+}; // end namespace KHM
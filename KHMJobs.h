@@ -0,0 +1,80 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace KHM
+{
+    //
+    // common defines for KHM jobs
+    //
+
+    #define KHM_MAX_JOB_THREADS             64
+
+    // job callback; processes items [begin, end)
+    typedef void (*JobRangeFunc)(void* pUserData, int begin, int end);
+
+    //
+    // KHM Job Pool - small work-stealing pool for parallel loops
+    //
+    // every thread ( the caller included ) starts with an equal slice of the range and eats it in grain sized chunks
+    // from the front; a thread that runs dry steals the back half of the largest remaining slice.
+    // ParallelFor calls are serialized; a ParallelFor issued from inside a job runs inline on the calling thread
+    //
+
+    class CJobPool
+    {
+        public:
+            CJobPool();
+            ~CJobPool();
+
+        public:
+            // numThreads includes the calling thread; 0 = one per hardware thread
+            bool Init(int numThreads);
+            void Shutdown();
+
+            int GetNumThreads() const { return numThreads; }
+
+            void ParallelFor(int count, int grainSize, JobRangeFunc pFunc, void* pUserData);
+
+        private:
+            CJobPool(const CJobPool&);
+            CJobPool& operator=(const CJobPool&);
+
+            struct sSlice
+            {
+                std::mutex          lock;
+                int                 begin;
+                int                 end;
+            };
+
+            struct sJob
+            {
+                JobRangeFunc        pFunc;
+                void*               pUserData;
+                int                 grainSize;
+                std::atomic<int>    nextSlot;
+                sSlice              slices[KHM_MAX_JOB_THREADS];
+            };
+
+            static void WorkerMain(CJobPool* pPool);
+            static void RunJob(sJob* pJob, int slot, int numSlots);
+            static bool PopRange(sSlice& slice, int grainSize, int& begin, int& end);
+            static bool StealRange(sJob* pJob, int slot, int numSlots);
+
+        private:
+            std::thread*            lThreads;
+            int                     numThreads;
+
+            std::mutex              jobLock;        // serializes ParallelFor callers
+            std::mutex              stateLock;
+            std::condition_variable wakeWorkers;
+            std::condition_variable jobDone;
+            sJob*                   pCurrentJob;
+            unsigned int            jobGeneration;
+            int                     numActiveWorkers;
+            bool                    bQuit;
+    };
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "Kernel/Matrix.h"
+#include "Kernel/Vector.h"
+
+#include <math.h>
+
+namespace KHM
+{
+    //
+    // KHM 3x4 matrix - affine transform, row major
+    //
+    //  p' = ( dot(row[0], p1), dot(row[1], p1), dot(row[2], p1) ), p1 = (p, 1)
+    //
+
+    struct sMatrix3x4
+    {
+        float                   row[3][4];
+    };
+
+    inline void SetIdentity(sMatrix3x4& m)
+    {
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                m.row[r][c] = (r == c) ? 1.0f : 0.0f;
+    }
+
+    // engine matrices are row-vector ( translation in elements 12..14 ), so the 3x4 is the transposed upper 4x3
+    inline void Matrix3x4FromMatrix(const Matrix& src, sMatrix3x4& dst)
+    {
+        const float* m = (const float*)&src;
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                dst.row[r][c] = m[c * 4 + r];
+    }
+
+    // a * b; applies b first, then a
+    inline void MultiplyMatrix3x4(const sMatrix3x4& a, const sMatrix3x4& b, sMatrix3x4& out)
+    {
+        sMatrix3x4 res;
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                res.row[r][c] = a.row[r][0] * b.row[0][c] + a.row[r][1] * b.row[1][c] + a.row[r][2] * b.row[2][c];
+                if (c == 3)
+                    res.row[r][c] += a.row[r][3];
+            }
+        }
+        out = res;
+    }
+
+    // general affine inverse; returns false for singular matrices
+    inline bool InvertMatrix3x4(const sMatrix3x4& m, sMatrix3x4& out)
+    {
+        const float a = m.row[0][0], b = m.row[0][1], c = m.row[0][2];
+        const float d = m.row[1][0], e = m.row[1][1], f = m.row[1][2];
+        const float g = m.row[2][0], h = m.row[2][1], i = m.row[2][2];
+
+        const float A = e * i - f * h, B = f * g - d * i, C = d * h - e * g;
+        const float det = a * A + b * B + c * C;
+        if (det == 0.0f)
+            return false;
+
+        const float invDet = 1.0f / det;
+        sMatrix3x4 res;
+        res.row[0][0] = A * invDet; res.row[0][1] = (c * h - b * i) * invDet; res.row[0][2] = (b * f - c * e) * invDet;
+        res.row[1][0] = B * invDet; res.row[1][1] = (a * i - c * g) * invDet; res.row[1][2] = (c * d - a * f) * invDet;
+        res.row[2][0] = C * invDet; res.row[2][1] = (b * g - a * h) * invDet; res.row[2][2] = (a * e - b * d) * invDet;
+
+        for (int r = 0; r < 3; ++r)
+            res.row[r][3] = -(res.row[r][0] * m.row[0][3] + res.row[r][1] * m.row[1][3] + res.row[r][2] * m.row[2][3]);
+
+        out = res;
+        return true;
+    }
+
+    inline Vector3 TransformPoint(const sMatrix3x4& m, const Vector3& p)
+    {
+        return Vector3(m.row[0][0] * p.x + m.row[0][1] * p.y + m.row[0][2] * p.z + m.row[0][3],
+                       m.row[1][0] * p.x + m.row[1][1] * p.y + m.row[1][2] * p.z + m.row[1][3],
+                       m.row[2][0] * p.x + m.row[2][1] * p.y + m.row[2][2] * p.z + m.row[2][3]);
+    }
+
+    inline Vector3 TransformVector(const sMatrix3x4& m, const Vector3& v)
+    {
+        return Vector3(m.row[0][0] * v.x + m.row[0][1] * v.y + m.row[0][2] * v.z,
+                       m.row[1][0] * v.x + m.row[1][1] * v.y + m.row[1][2] * v.z,
+                       m.row[2][0] * v.x + m.row[2][1] * v.y + m.row[2][2] * v.z);
+    }
+
+    // for normals: transpose of the 3x3; pass the inverse of the transform the normal goes through
+    inline Vector3 TransformVectorTransposed(const sMatrix3x4& m, const Vector3& v)
+    {
+        return Vector3(m.row[0][0] * v.x + m.row[1][0] * v.y + m.row[2][0] * v.z,
+                       m.row[0][1] * v.x + m.row[1][1] * v.y + m.row[2][1] * v.z,
+                       m.row[0][2] * v.x + m.row[1][2] * v.y + m.row[2][2] * v.z);
+    }
+
+    //
+    // Vector3 helpers
+    //
+
+    inline float Dot3(const Vector3& a, const Vector3& b)
+    {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    inline Vector3 Cross3(const Vector3& a, const Vector3& b)
+    {
+        return Vector3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    }
+
+    inline float Length3(const Vector3& v)
+    {
+        return sqrtf(Dot3(v, v));
+    }
+
+    inline Vector3 Normalize3(const Vector3& v)
+    {
+        const float len = Length3(v);
+        return (len > 0.0f) ? v * (1.0f / len) : v;
+    }
+
+    //
+    // KHM Frustum - 6 planes, normals pointing in
+    //
+
+    struct sFrustum
+    {
+        float                   planes[6][4];   // a, b, c, d; inside where a*x + b*y + c*z + d >= 0
+    };
+
+    // from an engine ( row-vector ) view projection matrix, clip depth 0..1; the planes come out normalized
+    inline void SetFrustum(const Matrix& viewProj, sFrustum& frustum)
+    {
+        // clip = ( p, 1 ) * viewProj, so each clip coordinate is a column
+        const float* m = (const float*)&viewProj;
+        for (int i = 0; i < 4; ++i)
+        {
+            const float c0 = m[i * 4 + 0];
+            const float c1 = m[i * 4 + 1];
+            const float c2 = m[i * 4 + 2];
+            const float c3 = m[i * 4 + 3];
+            frustum.planes[0][i] = c3 + c0;     // left
+            frustum.planes[1][i] = c3 - c0;     // right
+            frustum.planes[2][i] = c3 + c1;     // bottom
+            frustum.planes[3][i] = c3 - c1;     // top
+            frustum.planes[4][i] = c2;          // near
+            frustum.planes[5][i] = c3 - c2;     // far
+        }
+
+        for (int p = 0; p < 6; ++p)
+        {
+            float* plane = frustum.planes[p];
+            const float len = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            const float invLen = (len > 0.0f) ? 1.0f / len : 0.0f;
+            for (int i = 0; i < 4; ++i)
+                plane[i] *= invLen;
+        }
+    }
+};
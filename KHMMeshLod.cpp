@@ -0,0 +1,498 @@
+#include "KHMMeshLod.h"
+#include "KHMMeshOptimizer.h"
+#include "Kernel/Log.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace KHM {
+
+//
+// quadrics
+//
+
+// area weighted sum of squared distances to the planes of the triangles merged into a vertex
+struct sQuadric
+{
+    double                  a00, a01, a02, a11, a12, a22;
+    double                  b0, b1, b2;
+    double                  c;
+    double                  weight;
+};
+
+static void AddPlane(sQuadric& q, const Vector3& n, float d, double weight)
+{
+    q.a00 += weight * n.x * n.x;
+    q.a01 += weight * n.x * n.y;
+    q.a02 += weight * n.x * n.z;
+    q.a11 += weight * n.y * n.y;
+    q.a12 += weight * n.y * n.z;
+    q.a22 += weight * n.z * n.z;
+    q.b0 += weight * n.x * d;
+    q.b1 += weight * n.y * d;
+    q.b2 += weight * n.z * d;
+    q.c += weight * d * d;
+    q.weight += weight;
+}
+
+static void AddQuadric(sQuadric& q, const sQuadric& other)
+{
+    q.a00 += other.a00;
+    q.a01 += other.a01;
+    q.a02 += other.a02;
+    q.a11 += other.a11;
+    q.a12 += other.a12;
+    q.a22 += other.a22;
+    q.b0 += other.b0;
+    q.b1 += other.b1;
+    q.b2 += other.b2;
+    q.c += other.c;
+    q.weight += other.weight;
+}
+
+// mean squared distance of p to the planes of a + b
+static float EvaluateQuadrics(const sQuadric& a, const sQuadric& b, const Vector3& p)
+{
+    const double x = p.x, y = p.y, z = p.z;
+    const double a00 = a.a00 + b.a00, a01 = a.a01 + b.a01, a02 = a.a02 + b.a02;
+    const double a11 = a.a11 + b.a11, a12 = a.a12 + b.a12, a22 = a.a22 + b.a22;
+    const double sum = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                       2.0 * ((a.b0 + b.b0) * x + (a.b1 + b.b1) * y + (a.b2 + b.b2) * z) + a.c + b.c;
+    const double weight = a.weight + b.weight;
+    return (weight > 0.0 && sum > 0.0) ? (float)(sum / weight) : 0.0f;
+}
+
+//
+// builder
+//
+
+struct sLodCollapse
+{
+    float                   cost;
+    unsigned int            uiFrom;
+    unsigned int            uiTo;
+};
+
+struct sLodBuilder
+{
+    const sObjectMesh*              pMesh;
+    const sMeshLodSettings*         pSettings;
+
+    std::vector<unsigned short>     lIndices;       // the current level, dead triangles included until the next compaction
+    std::vector<unsigned char>      lLive;
+    int                             numLive;
+
+    std::vector<unsigned char>      lLocked;
+    std::vector<unsigned char>      lTouched;       // moved, or next to a move, this pass
+    std::vector<sQuadric>           lQuadrics;
+    std::vector<unsigned int>       lAdjacencyOffsets;  // vertex -> first of its live triangles in lAdjacency
+    std::vector<unsigned int>       lAdjacency;
+    std::vector<sLodCollapse>       lCollapses;
+
+    float                           error;          // largest collapse so far
+};
+
+static int CompareCollapses(const void* pA, const void* pB)
+{
+    const float a = ((const sLodCollapse*)pA)->cost;
+    const float b = ((const sLodCollapse*)pB)->cost;
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+static void BuildAdjacency(sLodBuilder& builder)
+{
+    const int numVertices = builder.pMesh->numVertices;
+    const int numTris = (int)builder.lLive.size();
+    builder.lAdjacencyOffsets.assign(numVertices + 1, 0);
+    for (int t = 0; t < numTris; ++t)
+    {
+        if (!builder.lLive[t])
+            continue;
+        for (int k = 0; k < 3; ++k)
+            ++builder.lAdjacencyOffsets[builder.lIndices[t * 3 + k] + 1];
+    }
+
+    for (int v = 0; v < numVertices; ++v)
+        builder.lAdjacencyOffsets[v + 1] += builder.lAdjacencyOffsets[v];
+
+    builder.lAdjacency.resize(builder.lAdjacencyOffsets[numVertices]);
+    std::vector<unsigned int> lCursor(builder.lAdjacencyOffsets.begin(), builder.lAdjacencyOffsets.end() - 1);
+    for (int t = 0; t < numTris; ++t)
+    {
+        if (!builder.lLive[t])
+            continue;
+        for (int k = 0; k < 3; ++k)
+            builder.lAdjacency[lCursor[builder.lIndices[t * 3 + k]]++] = t;
+    }
+}
+
+// open edges ( seams included, the vertices are split there ) and vertices sharing a position
+static void LockVertices(sLodBuilder& builder)
+{
+    const sObjectMesh* pMesh = builder.pMesh;
+    const int numVertices = pMesh->numVertices;
+    builder.lLocked.assign(numVertices, 0);
+
+    unsigned int uiTableSize = 16;
+    while (uiTableSize < (unsigned int)numVertices * 2)
+        uiTableSize <<= 1;
+
+    std::vector<int> lTable(uiTableSize, -1);
+    for (int v = 0; v < numVertices; ++v)
+    {
+        unsigned int key[3];
+        memcpy(key, &pMesh->pVertices[v], sizeof(key));
+        unsigned int h = (key[0] * 73856093u) ^ (key[1] * 19349663u) ^ (key[2] * 83492791u);
+        for (h &= uiTableSize - 1; lTable[h] >= 0; h = (h + 1) & (uiTableSize - 1))
+        {
+            if (memcmp(&pMesh->pVertices[lTable[h]], key, sizeof(key)) == 0)
+            {
+                builder.lLocked[v] = 1;
+                builder.lLocked[lTable[h]] = 1;
+                break;
+            }
+        }
+
+        if (lTable[h] < 0)
+            lTable[h] = v;
+    }
+
+    // a directed edge a -> b is open when no triangle around b runs b -> a
+    const int numTris = (int)builder.lLive.size();
+    for (int t = 0; t < numTris; ++t)
+    {
+        if (!builder.lLive[t])
+            continue;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            const unsigned int a = builder.lIndices[t * 3 + k];
+            const unsigned int b = builder.lIndices[t * 3 + (k + 1) % 3];
+            bool bShared = false;
+            for (unsigned int i = builder.lAdjacencyOffsets[b]; i < builder.lAdjacencyOffsets[b + 1] && !bShared; ++i)
+            {
+                const unsigned short* pOther = &builder.lIndices[builder.lAdjacency[i] * 3];
+                for (int j = 0; j < 3; ++j)
+                    bShared |= pOther[j] == b && pOther[(j + 1) % 3] == a;
+            }
+
+            if (!bShared)
+                builder.lLocked[a] = builder.lLocked[b] = 1;
+        }
+    }
+}
+
+static bool FindBone(const unsigned char* pBones, int numSlots, unsigned char bone)
+{
+    for (int k = 0; k < numSlots; ++k)
+    {
+        if (pBones[k] == bone)
+            return true;
+    }
+    return false;
+}
+
+static float GetBoneWeight(const unsigned char* pBones, const float* pWeights, unsigned char bone)
+{
+    float weight = 0.0f;
+    for (int k = 0; k < KHM_MAX_BONE_INFLUENCES; ++k)
+        weight += (pBones[k] == bone) ? pWeights[k] : 0.0f;
+    return weight;
+}
+
+static bool AttributesMatch(const sLodBuilder& builder, unsigned int u, unsigned int v)
+{
+    const sObjectMesh* pMesh = builder.pMesh;
+    if (pMesh->pColors)
+    {
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            const int cu = (pMesh->pColors[u] >> shift) & 0xFF;
+            const int cv = (pMesh->pColors[v] >> shift) & 0xFF;
+            if (cu - cv > builder.pSettings->colorTolerance || cv - cu > builder.pSettings->colorTolerance)
+                return false;
+        }
+    }
+
+    if (pMesh->pSkinWeights && pMesh->pSkinBoneIndices)
+    {
+        float wu[KHM_MAX_BONE_INFLUENCES];
+        float wv[KHM_MAX_BONE_INFLUENCES];
+        memcpy(wu, &pMesh->pSkinWeights[u], sizeof(wu));
+        memcpy(wv, &pMesh->pSkinWeights[v], sizeof(wv));
+        const unsigned char* pBonesU = pMesh->pSkinBoneIndices[u].ind;
+        const unsigned char* pBonesV = pMesh->pSkinBoneIndices[v].ind;
+
+        // per bone, the weight u gives it against the one v gives it; each bone once, at its first slot
+        float diff = 0.0f;
+        for (int k = 0; k < KHM_MAX_BONE_INFLUENCES; ++k)
+        {
+            if (!FindBone(pBonesU, k, pBonesU[k]))
+                diff += fabsf(GetBoneWeight(pBonesU, wu, pBonesU[k]) - GetBoneWeight(pBonesV, wv, pBonesU[k]));
+            if (!FindBone(pBonesV, k, pBonesV[k]) && !FindBone(pBonesU, KHM_MAX_BONE_INFLUENCES, pBonesV[k]))
+                diff += GetBoneWeight(pBonesV, wv, pBonesV[k]);
+        }
+
+        if (diff > builder.pSettings->skinTolerance)
+            return false;
+    }
+
+    return true;
+}
+
+// moving u onto v may not turn any of the triangles that stay around
+static bool KeepsOrientation(const sLodBuilder& builder, unsigned int u, unsigned int v)
+{
+    const Vector3* pVertices = builder.pMesh->pVertices;
+    for (unsigned int i = builder.lAdjacencyOffsets[u]; i < builder.lAdjacencyOffsets[u + 1]; ++i)
+    {
+        const unsigned short* pTri = &builder.lIndices[builder.lAdjacency[i] * 3];
+        if (pTri[0] == v || pTri[1] == v || pTri[2] == v)
+            continue;
+
+        Vector3 p[3];
+        for (int k = 0; k < 3; ++k)
+            p[k] = pVertices[pTri[k]];
+
+        const Vector3 before = Cross3(p[1] - p[0], p[2] - p[0]);
+        for (int k = 0; k < 3; ++k)
+            p[k] = (pTri[k] == u) ? pVertices[v] : p[k];
+
+        const Vector3 after = Cross3(p[1] - p[0], p[2] - p[0]);
+        if (!(Dot3(before, after) > 0.0f))
+            return false;
+    }
+
+    return true;
+}
+
+// collapses in cost order, each vertex moved or next to a move at most once; false = nothing left to collapse
+static bool CollapsePass(sLodBuilder& builder, int targetTriangles, float maxCost)
+{
+    BuildAdjacency(builder);
+
+    const Vector3* pVertices = builder.pMesh->pVertices;
+    const int numTris = (int)builder.lLive.size();
+    builder.lCollapses.clear();
+    for (int t = 0; t < numTris; ++t)
+    {
+        if (!builder.lLive[t])
+            continue;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            // interior edges show up once per side; take the side running up
+            const unsigned int a = builder.lIndices[t * 3 + k];
+            const unsigned int b = builder.lIndices[t * 3 + (k + 1) % 3];
+            if (a > b)
+                continue;
+
+            const float costAB = builder.lLocked[a] ? FLT_MAX : EvaluateQuadrics(builder.lQuadrics[a], builder.lQuadrics[b], pVertices[b]);
+            const float costBA = builder.lLocked[b] ? FLT_MAX : EvaluateQuadrics(builder.lQuadrics[a], builder.lQuadrics[b], pVertices[a]);
+            if (Min(costAB, costBA) > maxCost || !AttributesMatch(builder, a, b))
+                continue;
+
+            sLodCollapse collapse;
+            collapse.cost = Min(costAB, costBA);
+            collapse.uiFrom = (costAB <= costBA) ? a : b;
+            collapse.uiTo = (costAB <= costBA) ? b : a;
+            builder.lCollapses.push_back(collapse);
+        }
+    }
+
+    if (builder.lCollapses.empty())
+        return false;
+
+    qsort(&builder.lCollapses[0], builder.lCollapses.size(), sizeof(sLodCollapse), CompareCollapses);
+
+    // a vertex untouched this pass still has its adjacency right: every triangle that changed had a touched vertex
+    builder.lTouched.assign(builder.pMesh->numVertices, 0);
+    int numCollapsed = 0;
+    for (size_t c = 0; c < builder.lCollapses.size() && builder.numLive > targetTriangles; ++c)
+    {
+        const sLodCollapse& collapse = builder.lCollapses[c];
+        const unsigned int u = collapse.uiFrom;
+        const unsigned int v = collapse.uiTo;
+        if (builder.lTouched[u] || builder.lTouched[v] || !KeepsOrientation(builder, u, v))
+            continue;
+
+        for (unsigned int i = builder.lAdjacencyOffsets[u]; i < builder.lAdjacencyOffsets[u + 1]; ++i)
+        {
+            const unsigned int t = builder.lAdjacency[i];
+            unsigned short* pTri = &builder.lIndices[t * 3];
+            for (int k = 0; k < 3; ++k)
+                builder.lTouched[pTri[k]] = 1;
+
+            if (pTri[0] == v || pTri[1] == v || pTri[2] == v)
+            {
+                builder.lLive[t] = 0;
+                --builder.numLive;
+                continue;
+            }
+
+            for (int k = 0; k < 3; ++k)
+                pTri[k] = (pTri[k] == u) ? (unsigned short)v : pTri[k];
+        }
+
+        AddQuadric(builder.lQuadrics[v], builder.lQuadrics[u]);
+        builder.error = Max(builder.error, sqrtf(collapse.cost));
+        ++numCollapsed;
+    }
+
+    return numCollapsed > 0;
+}
+
+static void CompactTriangles(sLodBuilder& builder)
+{
+    const int numTris = (int)builder.lLive.size();
+    int numKept = 0;
+    for (int t = 0; t < numTris; ++t)
+    {
+        if (!builder.lLive[t])
+            continue;
+        for (int k = 0; k < 3; ++k)
+            builder.lIndices[numKept * 3 + k] = builder.lIndices[t * 3 + k];
+        ++numKept;
+    }
+
+    builder.lIndices.resize(numKept * 3);
+    builder.lLive.assign(numKept, 1);
+}
+
+//
+// chain
+//
+
+sMeshLodChain* CreateMeshLods(const sObjectMesh* pMesh, const sMeshLodSettings& settings)
+{
+    if (!pMesh || !pMesh->pVertices || !pMesh->pIndices || pMesh->numVertices <= 0 || pMesh->numIndices < 3 ||
+        settings.numLods < 0 || settings.numLods > KHM_MAX_MESH_LODS || !(settings.reduction > 0.0f && settings.reduction < 1.0f))
+    {
+        LOG_ERROR("[Error] CreateMeshLods() - bad mesh or settings\n");
+        return NULL;
+    }
+
+    const int numVertices = pMesh->numVertices;
+    const int numTris = pMesh->numIndices / 3;
+
+    sLodBuilder builder;
+    builder.pMesh = pMesh;
+    builder.pSettings = &settings;
+    builder.lIndices.assign(pMesh->pIndices, pMesh->pIndices + numTris * 3);
+    builder.lLive.assign(numTris, 1);
+    builder.numLive = 0;
+    builder.error = 0.0f;
+
+    // degenerate triangles go right away; they'd only pin their vertices
+    sQuadric zero;
+    memset(&zero, 0, sizeof(zero));
+    builder.lQuadrics.assign(numVertices, zero);
+
+    Vector3 boundsMin = pMesh->pVertices[0];
+    Vector3 boundsMax = pMesh->pVertices[0];
+    for (int t = 0; t < numTris; ++t)
+    {
+        const unsigned short* pTri = &builder.lIndices[t * 3];
+        const Vector3& p0 = pMesh->pVertices[pTri[0]];
+        const Vector3 n = Cross3(pMesh->pVertices[pTri[1]] - p0, pMesh->pVertices[pTri[2]] - p0);
+        const float area2 = Length3(n);
+        if (!(area2 > 0.0f) || pTri[0] == pTri[1] || pTri[1] == pTri[2] || pTri[0] == pTri[2])
+        {
+            builder.lLive[t] = 0;
+            continue;
+        }
+
+        const Vector3 normal = n * (1.0f / area2);
+        for (int k = 0; k < 3; ++k)
+        {
+            const Vector3& p = pMesh->pVertices[pTri[k]];
+            AddPlane(builder.lQuadrics[pTri[k]], normal, -Dot3(normal, p0), area2 * 0.5);
+            boundsMin = Vector3(Min(boundsMin.x, p.x), Min(boundsMin.y, p.y), Min(boundsMin.z, p.z));
+            boundsMax = Vector3(Max(boundsMax.x, p.x), Max(boundsMax.y, p.y), Max(boundsMax.z, p.z));
+        }
+        ++builder.numLive;
+    }
+
+    CompactTriangles(builder);
+    BuildAdjacency(builder);
+    LockVertices(builder);
+
+    const float maxError = settings.maxError * Length3(boundsMax - boundsMin);
+    std::vector<unsigned short> lOutput;
+
+    sMeshLodChain* pChain = new sMeshLodChain;
+    memset(pChain, 0, sizeof(*pChain));
+    for (int level = 0; level < settings.numLods; ++level)
+    {
+        const int numBefore = builder.numLive;
+        const int target = (int)(numBefore * settings.reduction);
+        for (int pass = 0; pass < KHM_MESH_LOD_MAX_PASSES && builder.numLive > target; ++pass)
+        {
+            if (!CollapsePass(builder, target, maxError * maxError))
+                break;
+        }
+
+        if (builder.numLive > numBefore * KHM_MESH_LOD_MIN_REDUCTION || builder.numLive == 0)
+            break;
+
+        CompactTriangles(builder);
+
+        sMeshLod& lod = pChain->lods[pChain->numLods++];
+        lod.uiFirstIndex = (unsigned int)lOutput.size();
+        lod.numIndices = builder.numLive * 3;
+        lod.error = builder.error;
+        lod.uiReserved = 0;
+        lOutput.insert(lOutput.end(), builder.lIndices.begin(), builder.lIndices.end());
+        OptimizeTriangles(&lOutput[lod.uiFirstIndex], lod.numIndices, numVertices);
+    }
+
+    pChain->numIndices = (int)lOutput.size();
+    pChain->pIndices = new unsigned short[lOutput.size() + 1];
+    if (!lOutput.empty())
+        memcpy(pChain->pIndices, &lOutput[0], sizeof(unsigned short) * lOutput.size());
+
+    return pChain;
+}
+
+void DestroyMeshLods(sMeshLodChain* pChain)
+{
+    if (!pChain)
+        return;
+
+    delete [] pChain->pIndices;
+    delete pChain;
+}
+
+//
+// selection
+//
+
+int SelectMeshLod(const sMeshLod* pLods, int numLods, float distance, float screenScale, float maxPixelError)
+{
+    ASSERT(screenScale > 0.0f);
+
+    // the errors only grow along the chain
+    const float maxError = maxPixelError * Max(distance, 0.0f) / screenScale;
+    int level = 0;
+    while (level < numLods && pLods[level].error <= maxError)
+        ++level;
+    return level;
+}
+
+const unsigned short* GetMeshLodIndices(const sObjectMesh* pMesh, int level, int* pNumIndices)
+{
+    if (level <= 0 || level > pMesh->numLods)
+    {
+        *pNumIndices = pMesh->numIndices;
+        return pMesh->pIndices;
+    }
+
+    const sMeshLod& lod = pMesh->pLods[level - 1];
+    *pNumIndices = lod.numIndices;
+    return pMesh->pLodIndices + lod.uiFirstIndex;
+}
+
+}; // end namespace KHM
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMMath.h"
+
+namespace KHM
+{
+    //
+    // common defines for mesh LODs
+    //
+
+    #define KHM_MESH_LOD_MIN_REDUCTION      0.85f   // a level keeping more of the triangles of the one before isn't worth its indices
+    #define KHM_MESH_LOD_MAX_PASSES         64      // collapse passes per level; each one ends up on fewer candidates
+
+    //
+    // KHM Mesh LOD Chain - quadric error edge collapses over the mesh's own vertices
+    //
+    // every collapse moves a vertex onto one of its neighbours ( half edge ), so a level is just an index buffer over
+    // the full mesh's streams: positions, uvs, colors, skin weights and bone indices are the same on every level.
+    // vertices on an open edge are locked, and in an indexed mesh every uv, normal or color seam is one ( the vertices
+    // are split there ); so are vertices sharing their position with another one. a collapse also needs the two
+    // vertices to agree on color and skinning, within the tolerances, so the influence boundaries hold
+    //
+
+    struct sMeshLodSettings
+    {
+        sMeshLodSettings()
+        {
+            numLods             = 4;
+            reduction           = 0.5f;     // triangles each level keeps of the one before
+            maxError            = 0.05f;    // of the bounds diagonal; the chain stops short rather than go past it
+            colorTolerance      = 16;       // per channel, 0..255
+            skinTolerance       = 0.25f;    // summed weight difference per bone, 0..2
+        }
+
+        int                     numLods;    // KHM_MAX_MESH_LODS max
+        float                   reduction;
+        float                   maxError;
+        int                     colorTolerance;
+        float                   skinTolerance;
+    };
+
+    // the levels laid out the way SECTION_MESH_LODS and sObjectMesh hold them
+    struct sMeshLodChain
+    {
+        int                     numLods;
+        sMeshLod                lods[KHM_MAX_MESH_LODS];
+        int                     numIndices;
+        unsigned short*         pIndices;
+    };
+
+    // fewer levels than asked when the mesh runs out of collapses under maxError; each level's triangles are
+    // reordered for the vertex cache. NULL on bad input
+    sMeshLodChain*  CreateMeshLods(const sObjectMesh* pMesh, const sMeshLodSettings& settings);
+    void            DestroyMeshLods(sMeshLodChain* pChain);
+
+    //
+    // LOD selection
+    //
+
+    // pixels a model unit covers at distance 1
+    inline float GetLodScreenScale(float viewportHeight, float fovY)
+    {
+        return viewportHeight / (2.0f * tanf(fovY * 0.5f));
+    }
+
+    // coarsest level whose error, seen from distance, stays under maxPixelError; 0 = the full mesh, l = pLods[l - 1].
+    // the errors are in model space, so a scaled instance passes distance / scale
+    int             SelectMeshLod(const sMeshLod* pLods, int numLods, float distance, float screenScale, float maxPixelError);
+
+    // triangles of a level picked by SelectMeshLod from pMesh->pLods
+    const unsigned short* GetMeshLodIndices(const sObjectMesh* pMesh, int level, int* pNumIndices);
+};
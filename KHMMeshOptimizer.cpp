@@ -0,0 +1,328 @@
+#include "KHMMeshOptimizer.h"
+#include "KHMStats.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+namespace KHM {
+
+//
+// statistics
+//
+
+void AnalyzeVertexCache(const unsigned short* pIndices, int numIndices, int numVertices, int cacheSize, sVertexCacheStats* pStats)
+{
+    // timestamp FIFO: a vertex is in the cache if it was inserted less than cacheSize misses ago
+    int* pInsertedAt = new int[numVertices];
+    for (int i = 0; i < numVertices; ++i)
+        pInsertedAt[i] = -cacheSize - 1;
+
+    int numTransforms = 0;
+    int numReferenced = 0;
+    for (int i = 0; i < numIndices; ++i)
+    {
+        const int v = pIndices[i];
+        if (numTransforms - pInsertedAt[v] > cacheSize)
+        {
+            if (pInsertedAt[v] < -cacheSize)
+                ++numReferenced;
+
+            pInsertedAt[v] = numTransforms++;
+        }
+    }
+
+    delete [] pInsertedAt;
+
+    pStats->numTransforms = numTransforms;
+    pStats->acmr = (numIndices >= 3) ? (float)numTransforms / (float)(numIndices / 3) : 0.0f;
+    pStats->atvr = (numReferenced > 0) ? (float)numTransforms / (float)numReferenced : 0.0f;
+}
+
+//
+// Forsyth, "Linear-Speed Vertex Cache Optimisation"
+//
+
+#define FORSYTH_CACHE_DECAY_POWER       1.5f
+#define FORSYTH_LAST_TRI_SCORE          0.75f
+#define FORSYTH_VALENCE_BOOST_SCALE     2.0f
+#define FORSYTH_VALENCE_BOOST_POWER     0.5f
+
+static float ScoreVertex(int cachePos, int numActiveTris)
+{
+    if (numActiveTris == 0)
+        return -1.0f; // nothing left to draw with this vertex
+
+    float score = 0.0f;
+    if (cachePos >= 0)
+    {
+        if (cachePos < 3)
+        {
+            // used by the last triangle; fixed score, so we don't just strip along
+            score = FORSYTH_LAST_TRI_SCORE;
+        }
+        else
+        {
+            const float scale = 1.0f / (float)(KHM_FORSYTH_CACHE_SIZE - 3);
+            score = powf(1.0f - (float)(cachePos - 3) * scale, FORSYTH_CACHE_DECAY_POWER);
+        }
+    }
+
+    // boost vertices with few triangles left, so we don't leave lone triangles behind
+    score += FORSYTH_VALENCE_BOOST_SCALE * powf((float)numActiveTris, -FORSYTH_VALENCE_BOOST_POWER);
+    return score;
+}
+
+static void OptimizeTriangleOrder(const unsigned short* pIndices, int numTris, int numVertices, int* pTriOrder)
+{
+    // vertex -> triangles adjacency
+    int* pActiveCount = new int[numVertices];
+    KHM_STATS_ALLOC(sizeof(int) * numVertices);
+    int* pTriOffset = new int[numVertices + 1];
+    KHM_STATS_ALLOC(sizeof(int) * (numVertices + 1));
+    int* pTriList = new int[numTris * 3];
+    KHM_STATS_ALLOC(sizeof(int) * (numTris * 3));
+    int* pCachePos = new int[numVertices];
+    KHM_STATS_ALLOC(sizeof(int) * numVertices);
+    float* pVertexScore = new float[numVertices];
+    KHM_STATS_ALLOC(sizeof(float) * numVertices);
+    float* pTriScore = new float[numTris];
+    KHM_STATS_ALLOC(sizeof(float) * numTris);
+    bool* pTriAdded = new bool[numTris];
+    KHM_STATS_ALLOC(sizeof(bool) * numTris);
+
+    memset(pActiveCount, 0, sizeof(int) * numVertices);
+    for (int i = 0; i < numTris * 3; ++i)
+        ++pActiveCount[pIndices[i]];
+
+    pTriOffset[0] = 0;
+    for (int v = 0; v < numVertices; ++v)
+    {
+        pTriOffset[v + 1] = pTriOffset[v] + pActiveCount[v];
+        pActiveCount[v] = 0;
+    }
+
+    for (int t = 0; t < numTris; ++t)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            const int v = pIndices[t * 3 + k];
+            pTriList[pTriOffset[v] + pActiveCount[v]++] = t;
+        }
+    }
+
+    for (int v = 0; v < numVertices; ++v)
+    {
+        pCachePos[v] = -1;
+        pVertexScore[v] = ScoreVertex(-1, pActiveCount[v]);
+    }
+
+    int bestTri = -1;
+    float bestScore = -1.0f;
+    for (int t = 0; t < numTris; ++t)
+    {
+        pTriAdded[t] = false;
+        pTriScore[t] = pVertexScore[pIndices[t * 3]] + pVertexScore[pIndices[t * 3 + 1]] + pVertexScore[pIndices[t * 3 + 2]];
+        if (pTriScore[t] > bestScore)
+        {
+            bestScore = pTriScore[t];
+            bestTri = t;
+        }
+    }
+
+    int cache[KHM_FORSYTH_CACHE_SIZE + 3];
+    int cacheSize = 0;
+    int scanPos = 0;
+
+    for (int i = 0; i < numTris; ++i)
+    {
+        if (bestTri < 0)
+        {
+            // nothing good in the cache, pick the best of what's left
+            bestScore = -1.0f;
+            for (; scanPos < numTris && pTriAdded[scanPos]; ++scanPos) {}
+            for (int t = scanPos; t < numTris; ++t)
+            {
+                if (!pTriAdded[t] && pTriScore[t] > bestScore)
+                {
+                    bestScore = pTriScore[t];
+                    bestTri = t;
+                }
+            }
+        }
+
+        pTriOrder[i] = bestTri;
+        pTriAdded[bestTri] = true;
+
+        // new cache: the triangle's vertices in front, then the old contents
+        int newCache[KHM_FORSYTH_CACHE_SIZE + 3];
+        int newCacheSize = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            const int v = pIndices[bestTri * 3 + k];
+            newCache[newCacheSize++] = v;
+
+            // remove the triangle from the vertex's active list
+            int* pList = &pTriList[pTriOffset[v]];
+            for (int j = 0; j < pActiveCount[v]; ++j)
+            {
+                if (pList[j] == bestTri)
+                {
+                    pList[j] = pList[--pActiveCount[v]];
+                    pList[pActiveCount[v]] = bestTri;
+                    break;
+                }
+            }
+        }
+
+        for (int j = 0; j < cacheSize; ++j)
+        {
+            const int v = cache[j];
+            if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+                newCache[newCacheSize++] = v;
+        }
+
+        // rescore everything that moved ( the evicted vertices included )
+        bestTri = -1;
+        bestScore = -1.0f;
+        for (int j = 0; j < newCacheSize; ++j)
+        {
+            const int v = newCache[j];
+            pCachePos[v] = (j < KHM_FORSYTH_CACHE_SIZE) ? j : -1;
+
+            const float newScore = ScoreVertex(pCachePos[v], pActiveCount[v]);
+            const float delta = newScore - pVertexScore[v];
+            pVertexScore[v] = newScore;
+
+            const int* pList = &pTriList[pTriOffset[v]];
+            for (int k = 0; k < pActiveCount[v]; ++k)
+            {
+                const int t = pList[k];
+                pTriScore[t] += delta;
+                if (pTriScore[t] > bestScore)
+                {
+                    bestScore = pTriScore[t];
+                    bestTri = t;
+                }
+            }
+        }
+
+        cacheSize = Min(newCacheSize, KHM_FORSYTH_CACHE_SIZE);
+        memcpy(cache, newCache, sizeof(int) * cacheSize);
+    }
+
+    delete [] pActiveCount;
+    delete [] pTriOffset;
+    delete [] pTriList;
+    delete [] pCachePos;
+    delete [] pVertexScore;
+    delete [] pTriScore;
+    delete [] pTriAdded;
+}
+
+//
+// in place reordering
+//
+
+static void ReorderStream(void* pStream, int elementSize, int numElements, const int* pOldToNew)
+{
+    if (!pStream)
+        return;
+
+    unsigned char* pCopy = (unsigned char*)malloc((size_t)elementSize * numElements);
+    KHM_STATS_ALLOC((size_t)elementSize * numElements);
+    memcpy(pCopy, pStream, (size_t)elementSize * numElements);
+    for (int i = 0; i < numElements; ++i)
+        memcpy((unsigned char*)pStream + (size_t)pOldToNew[i] * elementSize, pCopy + (size_t)i * elementSize, elementSize);
+    free(pCopy);
+}
+
+void OptimizeTriangles(unsigned short* pIndices, int numIndices, int numVertices)
+{
+    const int numTris = numIndices / 3;
+    if (numTris <= 0)
+        return;
+
+    int* pTriOrder = new int[numTris];
+    KHM_STATS_ALLOC(sizeof(int) * numTris);
+    OptimizeTriangleOrder(pIndices, numTris, numVertices, pTriOrder);
+
+    int* pTriNewPos = new int[numTris];
+    KHM_STATS_ALLOC(sizeof(int) * numTris);
+    for (int i = 0; i < numTris; ++i)
+        pTriNewPos[pTriOrder[i]] = i;
+
+    ReorderStream(pIndices, sizeof(unsigned short) * 3, numTris, pTriNewPos);
+
+    delete [] pTriOrder;
+    delete [] pTriNewPos;
+}
+
+bool OptimizeMesh(sObjectMesh* pMesh, sMeshOptimizeStats* pStats)
+{
+    if (!pMesh || !pMesh->pIndices || pMesh->numIndices < 3 || pMesh->numVertices <= 0)
+        return false;
+
+    const int numTris = pMesh->numIndices / 3;
+    const int numVertices = pMesh->numVertices;
+
+    if (pStats)
+        AnalyzeVertexCache(pMesh->pIndices, numTris * 3, numVertices, KHM_FIFO_CACHE_SIZE, &pStats->before);
+
+    // triangles
+    int* pTriOrder = new int[numTris];
+    KHM_STATS_ALLOC(sizeof(int) * numTris);
+    OptimizeTriangleOrder(pMesh->pIndices, numTris, numVertices, pTriOrder);
+
+    int* pTriNewPos = new int[numTris];
+    KHM_STATS_ALLOC(sizeof(int) * numTris);
+    for (int i = 0; i < numTris; ++i)
+        pTriNewPos[pTriOrder[i]] = i;
+
+    ReorderStream(pMesh->pIndices, sizeof(unsigned short) * 3, numTris, pTriNewPos);
+    ReorderStream(pMesh->pFaceNormals, sizeof(Vector3), numTris, pTriNewPos);
+
+    // vertices, in the order the optimized index buffer fetches them; unreferenced ones go last
+    int* pVertexNewPos = new int[numVertices];
+    KHM_STATS_ALLOC(sizeof(int) * numVertices);
+    for (int v = 0; v < numVertices; ++v)
+        pVertexNewPos[v] = -1;
+
+    int next = 0;
+    for (int i = 0; i < numTris * 3; ++i)
+    {
+        const int v = pMesh->pIndices[i];
+        if (pVertexNewPos[v] < 0)
+            pVertexNewPos[v] = next++;
+        pMesh->pIndices[i] = (unsigned short)pVertexNewPos[v];
+    }
+
+    for (int v = 0; v < numVertices; ++v)
+    {
+        if (pVertexNewPos[v] < 0)
+            pVertexNewPos[v] = next++;
+    }
+
+    ReorderStream(pMesh->pVertices, sizeof(Vector3), numVertices, pVertexNewPos);
+    ReorderStream(pMesh->pNormals, sizeof(Vector3), numVertices, pVertexNewPos);
+    ReorderStream(pMesh->pColors, sizeof(unsigned int), numVertices, pVertexNewPos);
+    ReorderStream(pMesh->pTexCoords[0], sizeof(Vector2), numVertices, pVertexNewPos);
+    ReorderStream(pMesh->pTexCoords[1], sizeof(Vector2), numVertices, pVertexNewPos);
+    ReorderStream(pMesh->pSkinWeights, sizeof(Vector4), numVertices, pVertexNewPos);
+    ReorderStream(pMesh->pSkinBoneIndices, sizeof(sBoneIndices), numVertices, pVertexNewPos);
+
+    for (int i = 0; i < pMesh->numLodIndices; ++i)
+        pMesh->pLodIndices[i] = (unsigned short)pVertexNewPos[pMesh->pLodIndices[i]];
+    for (int l = 0; l < pMesh->numLods; ++l)
+        OptimizeTriangles(pMesh->pLodIndices + pMesh->pLods[l].uiFirstIndex, pMesh->pLods[l].numIndices, numVertices);
+
+    delete [] pTriOrder;
+    delete [] pTriNewPos;
+    delete [] pVertexNewPos;
+
+    if (pStats)
+        AnalyzeVertexCache(pMesh->pIndices, numTris * 3, numVertices, KHM_FIFO_CACHE_SIZE, &pStats->after);
+
+    return true;
+}
+
+}; // end namespace KHM
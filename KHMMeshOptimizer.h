@@ -0,0 +1,42 @@
+#pragma once
+
+#include "KHMModel.h"
+
+namespace KHM
+{
+    //
+    // common defines for the mesh optimizer
+    //
+
+    #define KHM_FORSYTH_CACHE_SIZE          32  // LRU cache size modeled by the triangle reordering
+    #define KHM_FIFO_CACHE_SIZE             16  // FIFO cache size used for the statistics; typical post-transform cache
+
+    //
+    // KHM Vertex Cache Stats
+    //
+
+    struct sVertexCacheStats
+    {
+        int                     numTransforms;  // vertex shader invocations, simulated
+        float                   acmr;           // average cache miss ratio: transforms / triangles; 0.5 is ideal, 3 is worst
+        float                   atvr;           // average transform to vertex ratio: transforms / vertices; 1 is ideal
+    };
+
+    struct sMeshOptimizeStats
+    {
+        sVertexCacheStats       before;
+        sVertexCacheStats       after;
+    };
+
+    // simulates a FIFO post-transform cache over the index buffer
+    void    AnalyzeVertexCache(const unsigned short* pIndices, int numIndices, int numVertices, int cacheSize, sVertexCacheStats* pStats);
+
+    // Forsyth triangle reordering for the post-transform cache, then vertices are renumbered in fetch order.
+    // works in place: triangles ( with pFaceNormals ) and every vertex stream are reordered where they are,
+    // so when the mesh points into a file buffer, that buffer is now the optimized file. the LOD levels are
+    // renumbered to match and reordered on their own
+    bool    OptimizeMesh(sObjectMesh* pMesh, sMeshOptimizeStats* pStats);
+
+    // the triangle reordering alone, for index buffers that share the vertices of another one ( mesh LODs )
+    void    OptimizeTriangles(unsigned short* pIndices, int numIndices, int numVertices);
+};
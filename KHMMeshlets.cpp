@@ -0,0 +1,439 @@
+#include "KHMMeshlets.h"
+#include "Kernel/Log.h"
+
+#include <math.h>
+#include <vector>
+
+namespace KHM {
+
+//
+// bounds
+//
+
+#define MESHLET_NO_VERTEX               0xFF    // sMeshletBuilder::lLocal, not in the open meshlet
+#define MESHLET_LAST_TRIANGLE_BONUS     0.5f    // score bonus per vertex a candidate finishes
+
+// Ritter: a sphere through the two far apart points, grown over the rest
+static void ComputeSphere(const Vector3* pVertices, const unsigned int* pVertexIndices, int numVertices, Vector3& center, float& radius)
+{
+    const Vector3& p0 = pVertices[pVertexIndices[0]];
+    int far1 = 0;
+    float maxDistSq = -1.0f;
+    for (int i = 0; i < numVertices; ++i)
+    {
+        const Vector3 d = pVertices[pVertexIndices[i]] - p0;
+        if (Dot3(d, d) > maxDistSq)
+        {
+            maxDistSq = Dot3(d, d);
+            far1 = i;
+        }
+    }
+
+    const Vector3& p1 = pVertices[pVertexIndices[far1]];
+    int far2 = far1;
+    maxDistSq = -1.0f;
+    for (int i = 0; i < numVertices; ++i)
+    {
+        const Vector3 d = pVertices[pVertexIndices[i]] - p1;
+        if (Dot3(d, d) > maxDistSq)
+        {
+            maxDistSq = Dot3(d, d);
+            far2 = i;
+        }
+    }
+
+    const Vector3& p2 = pVertices[pVertexIndices[far2]];
+    center = (p1 + p2) * 0.5f;
+    radius = Length3(p2 - p1) * 0.5f;
+
+    for (int i = 0; i < numVertices; ++i)
+    {
+        const Vector3& p = pVertices[pVertexIndices[i]];
+        const float dist = Length3(p - center);
+        if (dist > radius)
+        {
+            // the new sphere touches p and the far side of the old one
+            const float newRadius = (radius + dist) * 0.5f;
+            center = center + (p - center) * ((newRadius - radius) / dist);
+            radius = newRadius;
+        }
+    }
+}
+
+static void ComputeCone(const Vector3* pNormals, const unsigned int* pTriangles, int numTriangles, Vector3& axis, float& cutoff)
+{
+    Vector3 sum(0.0f, 0.0f, 0.0f);
+    for (int t = 0; t < numTriangles; ++t)
+        sum = sum + pNormals[pTriangles[t]];
+
+    axis = Normalize3(sum);
+    float minDot = (Dot3(axis, axis) > 0.0f) ? 1.0f : -1.0f;
+    for (int t = 0; t < numTriangles && minDot > KHM_MESHLET_MIN_CONE_DOT; ++t)
+    {
+        const Vector3& n = pNormals[pTriangles[t]];
+        minDot = Min(minDot, (Dot3(n, n) > 0.0f) ? Dot3(n, axis) : -1.0f);
+    }
+
+    cutoff = (minDot > KHM_MESHLET_MIN_CONE_DOT) ? sqrtf(Max(1.0f - minDot * minDot, 0.0f)) : 1.0f;
+}
+
+//
+// builder
+//
+
+struct sMeshletBuilder
+{
+    const sMeshletSource*           pSource;
+    const sMeshletSettings*         pSettings;
+    const Vector3*                  pNormals;       // per triangle, unit or zero
+
+    std::vector<unsigned int>       lAdjacencyOffsets;  // vertex -> first of its triangles in lAdjacency
+    std::vector<unsigned int>       lAdjacency;
+    std::vector<unsigned char>      lLive;          // triangle not emitted yet
+    std::vector<unsigned int>       lLiveCount;     // vertex -> its triangles not emitted yet
+    std::vector<unsigned char>      lLocal;         // vertex -> its index in the open meshlet
+
+    // the open meshlet
+    std::vector<unsigned int>       lVertices;
+    std::vector<unsigned int>       lTriangles;     // source triangles
+    std::vector<unsigned int>       lCandidates;    // live triangles touching lVertices; may hold dead ones
+    Vector3                         normalSum;
+
+    // output
+    std::vector<sMeshlet>           lMeshlets;
+    std::vector<sMeshletBounds>     lBounds;
+    std::vector<unsigned int>       lVertexIndices;
+    std::vector<unsigned char>      lLocalTriangles;
+};
+
+static void AddTriangle(sMeshletBuilder& builder, unsigned int tri)
+{
+    const unsigned int* pTri = &builder.pSource->pIndices[tri * 3];
+    for (int k = 0; k < 3; ++k)
+    {
+        const unsigned int v = pTri[k];
+        if (builder.lLocal[v] != MESHLET_NO_VERTEX)
+            continue;
+
+        builder.lLocal[v] = (unsigned char)builder.lVertices.size();
+        builder.lVertices.push_back(v);
+        for (unsigned int a = builder.lAdjacencyOffsets[v]; a < builder.lAdjacencyOffsets[v + 1]; ++a)
+        {
+            if (builder.lLive[builder.lAdjacency[a]])
+                builder.lCandidates.push_back(builder.lAdjacency[a]);
+        }
+    }
+
+    builder.lLive[tri] = 0;
+    for (int k = 0; k < 3; ++k)
+        --builder.lLiveCount[pTri[k]];
+
+    builder.lTriangles.push_back(tri);
+    builder.normalSum = builder.normalSum + builder.pNormals[tri];
+}
+
+// the candidate adding the fewest vertices, then the one closest to the meshlet's normal; -1 = nothing fits.
+// a vertex's last live triangle is taken early, else the meshlets close around it and strand it in a tiny one
+static int FindNextTriangle(sMeshletBuilder& builder)
+{
+    const Vector3 axis = Normalize3(builder.normalSum);
+    const int maxNewVertices = builder.pSettings->maxVertices - (int)builder.lVertices.size();
+
+    int best = -1;
+    float bestScore = 0.0f;
+    size_t numCandidates = 0;
+    for (size_t c = 0; c < builder.lCandidates.size(); ++c)
+    {
+        const unsigned int tri = builder.lCandidates[c];
+        if (!builder.lLive[tri])
+            continue;
+
+        // compact while scanning; a triangle can be in twice, once per shared vertex
+        builder.lCandidates[numCandidates++] = tri;
+
+        const unsigned int* pTri = &builder.pSource->pIndices[tri * 3];
+        int numNew = 0;
+        int numLast = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            numNew += (builder.lLocal[pTri[k]] == MESHLET_NO_VERTEX) ? 1 : 0;
+            numLast += (builder.lLiveCount[pTri[k]] == 1) ? 1 : 0;
+        }
+
+        if (numNew > maxNewVertices)
+            continue;
+
+        const float score = (float)numNew - MESHLET_LAST_TRIANGLE_BONUS * (float)numLast + builder.pSettings->coneWeight * (1.0f - Dot3(builder.pNormals[tri], axis));
+        if (best < 0 || score < bestScore)
+        {
+            best = (int)tri;
+            bestScore = score;
+        }
+    }
+
+    builder.lCandidates.resize(numCandidates);
+    return best;
+}
+
+static void FlushMeshlet(sMeshletBuilder& builder)
+{
+    if (builder.lTriangles.empty())
+        return;
+
+    sMeshlet meshlet;
+    meshlet.uiVertexOffset = (unsigned int)builder.lVertexIndices.size();
+    meshlet.uiTriangleOffset = (unsigned int)builder.lLocalTriangles.size();
+    meshlet.numVertices = (unsigned char)builder.lVertices.size();
+    meshlet.numTriangles = (unsigned char)builder.lTriangles.size();
+    meshlet.uiReserved = 0;
+    builder.lMeshlets.push_back(meshlet);
+
+    builder.lVertexIndices.insert(builder.lVertexIndices.end(), builder.lVertices.begin(), builder.lVertices.end());
+    for (size_t t = 0; t < builder.lTriangles.size(); ++t)
+    {
+        const unsigned int* pTri = &builder.pSource->pIndices[builder.lTriangles[t] * 3];
+        for (int k = 0; k < 3; ++k)
+            builder.lLocalTriangles.push_back(builder.lLocal[pTri[k]]);
+    }
+
+    sMeshletBounds bounds;
+    ComputeSphere(builder.pSource->pVertices, &builder.lVertices[0], (int)builder.lVertices.size(), bounds.center, bounds.radius);
+    ComputeCone(builder.pNormals, &builder.lTriangles[0], (int)builder.lTriangles.size(), bounds.coneAxis, bounds.coneCutoff);
+    builder.lBounds.push_back(bounds);
+
+    for (size_t v = 0; v < builder.lVertices.size(); ++v)
+        builder.lLocal[builder.lVertices[v]] = MESHLET_NO_VERTEX;
+
+    builder.lVertices.clear();
+    builder.lTriangles.clear();
+    builder.lCandidates.clear();
+    builder.normalSum = Vector3(0.0f, 0.0f, 0.0f);
+}
+
+sMeshletMesh* CreateMeshlets(const sMeshletSource& source, const sMeshletSettings& settings)
+{
+    if (!source.pVertices || source.numVertices <= 0 || !source.pIndices || source.numIndices <= 0 || source.numIndices % 3 ||
+        settings.maxVertices < 3 || settings.maxVertices >= MESHLET_NO_VERTEX || settings.maxTriangles < 1 || settings.maxTriangles > 255)
+    {
+        LOG_ERROR("[Error] CreateMeshlets() - bad source or settings\n");
+        return NULL;
+    }
+
+    const int numTriangles = source.numIndices / 3;
+    for (int i = 0; i < source.numIndices; ++i)
+    {
+        if (source.pIndices[i] >= (unsigned int)source.numVertices)
+        {
+            LOG_ERROR("[Error] CreateMeshlets() - index out of the vertex range\n");
+            return NULL;
+        }
+    }
+
+    sMeshletBuilder builder;
+    builder.pSource = &source;
+    builder.pSettings = &settings;
+    builder.normalSum = Vector3(0.0f, 0.0f, 0.0f);
+
+    // the face normals the mesh has, normalized again; computed otherwise
+    std::vector<Vector3> lNormals(numTriangles);
+    for (int t = 0; t < numTriangles; ++t)
+    {
+        const unsigned int* pTri = &source.pIndices[t * 3];
+        lNormals[t] = source.pFaceNormals ? Normalize3(source.pFaceNormals[t])
+                                          : Normalize3(Cross3(source.pVertices[pTri[1]] - source.pVertices[pTri[0]], source.pVertices[pTri[2]] - source.pVertices[pTri[0]]));
+    }
+    builder.pNormals = &lNormals[0];
+
+    // vertex -> triangles; degenerate triangles are left out and never emitted
+    builder.lLive.assign(numTriangles, 0);
+    builder.lAdjacencyOffsets.assign(source.numVertices + 1, 0);
+    for (int t = 0; t < numTriangles; ++t)
+    {
+        const unsigned int* pTri = &source.pIndices[t * 3];
+        if (pTri[0] == pTri[1] || pTri[1] == pTri[2] || pTri[0] == pTri[2])
+            continue;
+
+        builder.lLive[t] = 1;
+        for (int k = 0; k < 3; ++k)
+            ++builder.lAdjacencyOffsets[pTri[k] + 1];
+    }
+
+    for (int v = 0; v < source.numVertices; ++v)
+        builder.lAdjacencyOffsets[v + 1] += builder.lAdjacencyOffsets[v];
+
+    builder.lAdjacency.resize(builder.lAdjacencyOffsets[source.numVertices]);
+    std::vector<unsigned int> lFill(builder.lAdjacencyOffsets.begin(), builder.lAdjacencyOffsets.end() - 1);
+    for (int t = 0; t < numTriangles; ++t)
+    {
+        if (!builder.lLive[t])
+            continue;
+
+        for (int k = 0; k < 3; ++k)
+            builder.lAdjacency[lFill[source.pIndices[t * 3 + k]]++] = t;
+    }
+
+    builder.lLocal.assign(source.numVertices, MESHLET_NO_VERTEX);
+    builder.lLiveCount.resize(source.numVertices);
+    for (int v = 0; v < source.numVertices; ++v)
+        builder.lLiveCount[v] = builder.lAdjacencyOffsets[v + 1] - builder.lAdjacencyOffsets[v];
+
+    // a meshlet starts at the first live triangle in index order, which on a vertex cache optimized mesh is
+    // next to where the last one ended, and grows until nothing adjacent fits
+    int cursor = 0;
+    for (;;)
+    {
+        if (builder.lTriangles.empty())
+        {
+            while (cursor < numTriangles && !builder.lLive[cursor])
+                ++cursor;
+            if (cursor == numTriangles)
+                break;
+
+            AddTriangle(builder, cursor);
+            continue;
+        }
+
+        const int next = ((int)builder.lTriangles.size() < settings.maxTriangles) ? FindNextTriangle(builder) : -1;
+        if (next < 0)
+            FlushMeshlet(builder);
+        else
+            AddTriangle(builder, next);
+    }
+
+    sMeshletMesh* pMeshlets = new sMeshletMesh();
+    pMeshlets->numMeshlets = (int)builder.lMeshlets.size();
+    pMeshlets->pMeshlets = new sMeshlet[Max(pMeshlets->numMeshlets, 1)];
+    pMeshlets->pBounds = new sMeshletBounds[Max(pMeshlets->numMeshlets, 1)];
+    pMeshlets->numVertexIndices = (int)builder.lVertexIndices.size();
+    pMeshlets->pVertexIndices = new unsigned int[Max(pMeshlets->numVertexIndices, 1)];
+    pMeshlets->numTriangles = (int)builder.lLocalTriangles.size() / 3;
+    pMeshlets->pTriangles = new unsigned char[Max((int)builder.lLocalTriangles.size(), 1)];
+
+    if (pMeshlets->numMeshlets)
+    {
+        memcpy(pMeshlets->pMeshlets, &builder.lMeshlets[0], sizeof(sMeshlet) * pMeshlets->numMeshlets);
+        memcpy(pMeshlets->pBounds, &builder.lBounds[0], sizeof(sMeshletBounds) * pMeshlets->numMeshlets);
+        memcpy(pMeshlets->pVertexIndices, &builder.lVertexIndices[0], sizeof(unsigned int) * pMeshlets->numVertexIndices);
+        memcpy(pMeshlets->pTriangles, &builder.lLocalTriangles[0], builder.lLocalTriangles.size());
+    }
+
+    return pMeshlets;
+}
+
+sMeshletMesh* CreateMeshlets(const sObjectMesh* pMesh, const sMeshletSettings& settings)
+{
+    if (!pMesh || !pMesh->pVertices || !pMesh->pIndices)
+        return NULL;
+
+    std::vector<unsigned int> lIndices(pMesh->pIndices, pMesh->pIndices + pMesh->numIndices);
+
+    sMeshletSource source;
+    source.pVertices = pMesh->pVertices;
+    source.numVertices = pMesh->numVertices;
+    source.pIndices = lIndices.empty() ? NULL : &lIndices[0];
+    source.numIndices = pMesh->numIndices;
+    source.pFaceNormals = pMesh->pFaceNormals;
+    return CreateMeshlets(source, settings);
+}
+
+void DestroyMeshlets(sMeshletMesh* pMeshlets)
+{
+    if (!pMeshlets)
+        return;
+
+    delete[] pMeshlets->pMeshlets;
+    delete[] pMeshlets->pBounds;
+    delete[] pMeshlets->pVertexIndices;
+    delete[] pMeshlets->pTriangles;
+    delete pMeshlets;
+}
+
+//
+// culling
+//
+// a meshlet is entirely backfacing when every view direction to its sphere is within 90 degrees minus the cone's
+// half angle of the cone axis: dot( d, axis ) >= sin * |d| for every d from the camera into the sphere, which
+// holds for all of them when it holds for the center with the radius taken off both sides
+//
+
+int CullMeshlets(const sMeshletMesh* pMeshlets, const sMatrix3x4& world, const Vector3& cameraPosition, const sFrustum& frustum,
+                 unsigned int* pVisible, sMeshletCullStats* pStats)
+{
+    // radii scale by the largest axis; cones only survive a uniform scale
+    const Vector3 scale(Length3(Vector3(world.row[0][0], world.row[1][0], world.row[2][0])),
+                        Length3(Vector3(world.row[0][1], world.row[1][1], world.row[2][1])),
+                        Length3(Vector3(world.row[0][2], world.row[1][2], world.row[2][2])));
+    const float maxScale = Max(scale.x, Max(scale.y, scale.z));
+    const float minScale = Min(scale.x, Min(scale.y, scale.z));
+    const bool bCones = minScale > 0.0f && maxScale <= minScale * 1.001f;
+    const float invScale = bCones ? 1.0f / minScale : 0.0f;
+
+    int numVisible = 0;
+    int numFrustumCulled = 0;
+    int numConeCulled = 0;
+    int numTriangles = 0;
+    int numVisibleTriangles = 0;
+    for (int i = 0; i < pMeshlets->numMeshlets; ++i)
+    {
+        const sMeshletBounds& bounds = pMeshlets->pBounds[i];
+        const Vector3 center = TransformPoint(world, bounds.center);
+        const float radius = bounds.radius * maxScale;
+        numTriangles += pMeshlets->pMeshlets[i].numTriangles;
+
+        bool bInside = true;
+        for (int p = 0; p < 6 && bInside; ++p)
+        {
+            const float* plane = frustum.planes[p];
+            bInside = plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3] >= -radius;
+        }
+
+        if (!bInside)
+        {
+            ++numFrustumCulled;
+            continue;
+        }
+
+        if (bCones && bounds.coneCutoff < 1.0f)
+        {
+            const Vector3 axis = TransformVector(world, bounds.coneAxis) * invScale;
+            const Vector3 view = center - cameraPosition;
+            if (Dot3(view, axis) >= bounds.coneCutoff * Length3(view) + radius * (1.0f + bounds.coneCutoff))
+            {
+                ++numConeCulled;
+                continue;
+            }
+        }
+
+        pVisible[numVisible++] = i;
+        numVisibleTriangles += pMeshlets->pMeshlets[i].numTriangles;
+    }
+
+    if (pStats)
+    {
+        pStats->numMeshlets = pMeshlets->numMeshlets;
+        pStats->numVisible = numVisible;
+        pStats->numFrustumCulled = numFrustumCulled;
+        pStats->numConeCulled = numConeCulled;
+        pStats->numTriangles = numTriangles;
+        pStats->numVisibleTriangles = numVisibleTriangles;
+    }
+
+    return numVisible;
+}
+
+int WriteMeshletIndices(const sMeshletMesh* pMeshlets, const unsigned int* pMeshletIds, int numMeshletIds, unsigned int* pIndices)
+{
+    int numIndices = 0;
+    for (int m = 0; m < numMeshletIds; ++m)
+    {
+        const sMeshlet& meshlet = pMeshlets->pMeshlets[pMeshletIds[m]];
+        const unsigned int* pVertexIndices = pMeshlets->pVertexIndices + meshlet.uiVertexOffset;
+        const unsigned char* pTriangles = pMeshlets->pTriangles + meshlet.uiTriangleOffset;
+        for (int i = 0; i < meshlet.numTriangles * 3; ++i)
+            pIndices[numIndices++] = pVertexIndices[pTriangles[i]];
+    }
+
+    return numIndices;
+}
+
+}; // end namespace KHM
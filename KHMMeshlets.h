@@ -0,0 +1,104 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMMath.h"
+
+namespace KHM
+{
+    //
+    // common defines for meshlets
+    //
+
+    #define KHM_MESHLET_MAX_VERTICES        64      // defaults; local indices are 8 bit, so neither can go past 255
+    #define KHM_MESHLET_MAX_TRIANGLES       124
+    #define KHM_MESHLET_MIN_CONE_DOT        0.1f    // meshlets whose normals spread wider than ~84 degrees are never cone culled
+
+    //
+    // KHM Meshlet - a small cluster of triangles with its own vertex list
+    //
+    // triangles index the meshlet's vertices with 8 bits; the meshlet's vertices index the mesh with 32 bits, so a
+    // meshlet mesh isn't bound to the 65k vertices of the 16 bit index buffers
+    //
+
+    struct sMeshlet
+    {
+        unsigned int            uiVertexOffset;     // into sMeshletMesh::pVertexIndices
+        unsigned int            uiTriangleOffset;   // into sMeshletMesh::pTriangles, in bytes; 3 per triangle
+        unsigned char           numVertices;
+        unsigned char           numTriangles;
+        unsigned short          uiReserved;
+    };
+
+    // kept apart from sMeshlet, so culling only streams through these
+    struct sMeshletBounds
+    {
+        Vector3                 center;             // bounding sphere, model space
+        float                   radius;
+        Vector3                 coneAxis;           // average of the face normals
+        float                   coneCutoff;         // sin of the cone's half angle; 1 = never backfacing as a whole
+    };
+
+    struct sMeshletMesh
+    {
+        int                     numMeshlets;
+        sMeshlet*               pMeshlets;
+        sMeshletBounds*         pBounds;
+
+        int                     numVertexIndices;
+        unsigned int*           pVertexIndices;     // meshlet vertex -> mesh vertex
+        int                     numTriangles;
+        unsigned char*          pTriangles;         // 3 meshlet vertices per triangle
+    };
+
+    struct sMeshletSettings
+    {
+        sMeshletSettings()
+        {
+            maxVertices         = KHM_MESHLET_MAX_VERTICES;
+            maxTriangles        = KHM_MESHLET_MAX_TRIANGLES;
+            coneWeight          = 0.5f;     // 0 = grow by shared vertices only, higher trades vertex reuse for tighter cones
+        }
+
+        int                     maxVertices;
+        int                     maxTriangles;
+        float                   coneWeight;
+    };
+
+    // geometry to cluster; 32 bit indices, so props past 65k vertices can be built from their source data
+    struct sMeshletSource
+    {
+        const Vector3*          pVertices;
+        int                     numVertices;
+        const unsigned int*     pIndices;
+        int                     numIndices;
+        const Vector3*          pFaceNormals;       // optional, numIndices / 3; computed from the positions when NULL
+    };
+
+    // grows each meshlet over the triangles sharing its vertices, preferring the ones that add the fewest vertices and
+    // stay closest to the meshlet's normal. degenerate triangles are dropped. NULL on bad input
+    sMeshletMesh*   CreateMeshlets(const sMeshletSource& source, const sMeshletSettings& settings);
+    sMeshletMesh*   CreateMeshlets(const sObjectMesh* pMesh, const sMeshletSettings& settings);
+    void            DestroyMeshlets(sMeshletMesh* pMeshlets);
+
+    //
+    // meshlet culling
+    //
+
+    struct sMeshletCullStats
+    {
+        int                     numMeshlets;
+        int                     numVisible;
+        int                     numFrustumCulled;
+        int                     numConeCulled;      // entirely backfacing
+        int                     numTriangles;
+        int                     numVisibleTriangles;
+    };
+
+    // frustum and backface cone tests in world space; the cone test is skipped under non uniform scale. writes the
+    // indices of the visible meshlets to pVisible ( numMeshlets max ) and returns how many there are. pStats may be NULL
+    int             CullMeshlets(const sMeshletMesh* pMeshlets, const sMatrix3x4& world, const Vector3& cameraPosition, const sFrustum& frustum,
+                                 unsigned int* pVisible, sMeshletCullStats* pStats);
+
+    // triangle list of the given meshlets, in mesh vertices; pIndices holds 3 * their triangles. returns the index count
+    int             WriteMeshletIndices(const sMeshletMesh* pMeshlets, const unsigned int* pMeshletIds, int numMeshletIds, unsigned int* pIndices);
+};
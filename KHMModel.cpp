@@ -1,13 +1,123 @@
 
 #include "KHMModel.h"
+#include "KHMValidate.h"
+#include "KHMAnimation.h"
+#include "KHMAnimationCompression.h"
+#include "KHMMeshOptimizer.h"
+#include "KHMStats.h"
+#include "KHMHash.h"
+#include "KHMJobs.h"
+#include "KHMSimd.h"
 #include "Kernel/Log.h"
 
+#include <new>
+
 namespace KHM {
 
+//
+// model arena
+//
+
+static size_t AlignModelSize(size_t uiSize)
+{
+    return (uiSize + KHM_MODEL_ALIGNMENT - 1) & ~(size_t)(KHM_MODEL_ALIGNMENT - 1);
+}
+
+// keep the load factor under 50%
+static unsigned int GetNameIndexSize(int numObjects)
+{
+    if (numObjects <= 0)
+        return 0;
+
+    unsigned int uiSize = 4;
+    while (uiSize < (unsigned int)numObjects * 2)
+        uiSize <<= 1;
+
+    return uiSize;
+}
+
+static sModelArenaBlock* AllocArenaBlock(const sModelAllocator& allocator, size_t uiSize)
+{
+    // AlignedAlloc is KHM_SIMD_ALIGNMENT aligned, which is KHM_MODEL_ALIGNMENT
+    sModelArenaBlock* pBlock = (sModelArenaBlock*)(allocator.alloc ? allocator.alloc(allocator.pUserData, uiSize) : AlignedAlloc(uiSize));
+    if (!pBlock)
+        return NULL;
+
+    KHM_STATS_ALLOC(uiSize);
+    pBlock->pNext = NULL;
+    pBlock->uiSize = uiSize;
+    pBlock->uiUsed = AlignModelSize(sizeof(sModelArenaBlock));
+    return pBlock;
+}
+
+static void FreeArenaBlock(const sModelAllocator& allocator, sModelArenaBlock* pBlock)
+{
+    if (allocator.free)
+        allocator.free(allocator.pUserData, pBlock, pBlock->uiSize);
+    else
+        AlignedFree(pBlock);
+}
+
 //
 // sModelDefinition
 //
 
+void sModelDefinition::Destroy()
+{
+    // the stats are in the arena as well, they only have to leave the process totals
+    DestroyLoadStats(pLoadStats);
+    pLoadStats = NULL;
+
+    // everything else points to chunks from 'membuff' or lives in the arena; nothing in there owns memory of its own
+    while (pArena)
+    {
+        sModelArenaBlock* pBlock = pArena;
+        pArena = pBlock->pNext;
+        FreeArenaBlock(allocator, pBlock);
+    }
+}
+
+bool sModelDefinition::ReserveArena(size_t uiSize)
+{
+    ASSERT(!pArena);
+    pArena = AllocArenaBlock(allocator, AlignModelSize(sizeof(sModelArenaBlock)) + AlignModelSize(uiSize));
+    return pArena != NULL;
+}
+
+void* sModelDefinition::Alloc(size_t uiSize)
+{
+    uiSize = AlignModelSize(uiSize);
+    if (pArena && pArena->uiSize - pArena->uiUsed >= uiSize)
+    {
+        void* p = (unsigned char*)pArena + pArena->uiUsed;
+        pArena->uiUsed += uiSize;
+        return p;
+    }
+
+    // only what couldn't be sized up front gets here
+    sModelArenaBlock* pBlock = AllocArenaBlock(allocator, Max(AlignModelSize(sizeof(sModelArenaBlock)) + uiSize, (size_t)KHM_MODEL_ARENA_BLOCK_SIZE));
+    ASSERT(pBlock);
+    if (!pBlock)
+        return NULL;
+
+    void* p = (unsigned char*)pBlock + pBlock->uiUsed;
+    pBlock->uiUsed += uiSize;
+
+    // the block with the most room left stays in front, so a big request doesn't strand what the reserve still has
+    if (pArena && pArena->uiSize - pArena->uiUsed > pBlock->uiSize - pBlock->uiUsed)
+    {
+        pBlock->pNext = pArena->pNext;
+        pArena->pNext = pBlock;
+    }
+    else
+    {
+        pBlock->pNext = pArena;
+        pArena = pBlock;
+    }
+
+    return p;
+}
+
 const sObjectBase* sModelDefinition::GetObjectById(const unsigned int uiId) const
 {
     if (uiId < (unsigned int)numBones)
@@ -30,8 +140,67 @@ const sObjectBase* sModelDefinition::GetObjectById(const unsigned int uiId) cons
     return NULL;
 }
 
+const sObjectBase* sModelDefinition::GetIndexedObject(const sNameIndexEntry& entry) const
+{
+    switch (entry.type)
+    {
+        case NAME_INDEX_HELPER: return &lHelpers[entry.index];
+        case NAME_INDEX_BONE:   return &lBones[entry.index];
+        default:                return pMesh;
+    }
+}
+
+const sObjectBase* sModelDefinition::GetObjectByHash(const unsigned int uiNameHash) const
+{
+    if (lNameIndex)
+    {
+        for (unsigned int i = uiNameHash & uiNameIndexMask; lNameIndex[i].type != NAME_INDEX_EMPTY; i = (i + 1) & uiNameIndexMask)
+        {
+            if (lNameIndex[i].uiHash == uiNameHash)
+                return GetIndexedObject(lNameIndex[i]);
+        }
+
+        return NULL;
+    }
+
+    // no index ( a model put together by hand ); hash the names, in the order GetObjectByName looks at them
+    for (int i = 0; i < numHelpers; ++i)
+    {
+        if (HashName(lHelpers[i].szName) == uiNameHash)
+            return &lHelpers[i];
+    }
+
+    for (int i = 0; i < numBones; ++i)
+    {
+        if (HashName(lBones[i].szName) == uiNameHash)
+            return &lBones[i];
+    }
+
+    if (pMesh && HashName(pMesh->szName) == uiNameHash)
+        return pMesh;
+
+    return NULL;
+}
+
 const KHM::sObjectBase* sModelDefinition::GetObjectByName(const char* nodeName) const
 {
+    if (lNameIndex)
+    {
+        const unsigned int uiNameHash = HashName(nodeName);
+        for (unsigned int i = uiNameHash & uiNameIndexMask; lNameIndex[i].type != NAME_INDEX_EMPTY; i = (i + 1) & uiNameIndexMask)
+        {
+            if (lNameIndex[i].uiHash != uiNameHash)
+                continue;
+
+            // different names can share a hash, the name decides
+            const sObjectBase* obj = GetIndexedObject(lNameIndex[i]);
+            if (strcmp(nodeName, obj->szName) == 0)
+                return obj;
+        }
+
+        return NULL;
+    }
+
     // search in helpers first, this is usually what we want
     for (int i = 0; i < numHelpers; ++i)
     {
@@ -52,111 +221,179 @@ const KHM::sObjectBase* sModelDefinition::GetObjectByName(const char* nodeName)
     return NULL;
 }
 
+void sModelDefinition::ReserveNameIndex(int numObjects)
+{
+    const unsigned int uiSize = GetNameIndexSize(numObjects);
+    if (!uiSize || (lNameIndex && uiNameIndexMask + 1 >= uiSize))
+        return;
+
+    // a smaller table built before stays in the arena
+    lNameIndex = (sNameIndexEntry*)Alloc(sizeof(sNameIndexEntry) * uiSize);
+    uiNameIndexMask = uiSize - 1;
+    for (unsigned int i = 0; i < uiSize; ++i)
+        lNameIndex[i].type = NAME_INDEX_EMPTY;
+}
+
+void sModelDefinition::BuildNameIndex()
+{
+    KHM_STATS_STAGE(LOAD_STAGE_NAME_INDEX);
+
+    // a reserved table can be bigger than the objects need; that only lowers the load factor
+    ReserveNameIndex(numHelpers + numBones + (pMesh ? 1 : 0));
+    if (!lNameIndex)
+        return;
+
+    for (unsigned int i = 0; i <= uiNameIndexMask; ++i)
+        lNameIndex[i].type = NAME_INDEX_EMPTY;
+
+    // insertion order is the lookup priority: helpers, bones, mesh
+    for (int pass = NAME_INDEX_HELPER; pass <= NAME_INDEX_MESH; ++pass)
+    {
+        const int count = (pass == NAME_INDEX_HELPER) ? numHelpers : (pass == NAME_INDEX_BONE) ? numBones : (pMesh ? 1 : 0);
+        for (int obj = 0; obj < count; ++obj)
+        {
+            sNameIndexEntry entry;
+            entry.type = (unsigned short)pass;
+            entry.index = (unsigned short)obj;
+
+            const char* szName = GetIndexedObject(entry)->szName;
+            entry.uiHash = HashName(szName);
+
+            unsigned int i = entry.uiHash & uiNameIndexMask;
+            bool bDuplicate = false;
+            for (; lNameIndex[i].type != NAME_INDEX_EMPTY; i = (i + 1) & uiNameIndexMask)
+            {
+                if (lNameIndex[i].uiHash != entry.uiHash)
+                    continue;
+
+                // same name: the earlier object wins, like the linear search did
+                // different name, same hash: GetObjectByName still works, GetObjectByHash only sees the first one
+                if (strcmp(GetIndexedObject(lNameIndex[i])->szName, szName) == 0)
+                {
+                    bDuplicate = true;
+                    break;
+                }
+
+                LOG_ERROR("[Error] sModelDefinition::BuildNameIndex(%s) - hash collision between '%s' and '%s'\n", szFileName, GetIndexedObject(lNameIndex[i])->szName, szName);
+            }
+
+            if (!bDuplicate)
+                lNameIndex[i] = entry;
+        }
+    }
+}
+
 //
 // CLoader
 //
 
 CLoader::CLoader() :
-    buff(0),
-    buffsize(0),
-    buffread(0)
+    flags(0)
 {
+    allocator.alloc = NULL;
+    allocator.free = NULL;
+    allocator.pUserData = NULL;
 }
 
-void CLoader::ReadBytesSkip(int numBytesSkip)
+void CLoader::ReadBytesSkip(sReadCursor& ctx, int numBytesSkip) const
 {
-    buffread += numBytesSkip;
+    ctx.buffread += numBytesSkip;
+    ASSERT(ctx.buffread <= (int)ctx.buffsize);
     //bool result = m_pFile->Seek(numBytesSkip, File::SEEK_POS_CUR);
     //ASSERT(result);
 }
 
-unsigned char* CLoader::ReadBytes(int sizeToRead)
+// no checks in release; ValidateModel walked the same offsets before any of this runs
+unsigned char* CLoader::ReadBytes(sReadCursor& ctx, int sizeToRead) const
 {
-    buffread += sizeToRead;
-    return (buff + buffread - sizeToRead);
+    ctx.buffread += sizeToRead;
+    ASSERT(ctx.buffread <= (int)ctx.buffsize);
+    return (ctx.buff + ctx.buffread - sizeToRead);
 }
 
-void CLoader::ReadBytes( void* pDest, int sizeToRead )
+void CLoader::ReadBytes( sReadCursor& ctx, void* pDest, int sizeToRead ) const
 {
-    pDest = buff + buffread;
-    buffread += sizeToRead;
-    ASSERT(buffread <= (int)buffsize);
+    ASSERT(ctx.buffread + sizeToRead <= (int)ctx.buffsize);
+    memcpy(pDest, ctx.buff + ctx.buffread, sizeToRead);
+    ctx.buffread += sizeToRead;
 
     //unsigned int bytesRead = m_pFile->Read(pDest, sizeToRead);
     //ASSERT(bytesRead == (unsigned int)sizeToRead);
 }
 
-void CLoader::ReadText( char* szBuffer, unsigned int uiBufferLen )
+void CLoader::ReadText( sReadCursor& ctx, char* szBuffer, unsigned int uiBufferLen ) const
 {
     unsigned int uiTextLen;
-    ReadBytes( &uiTextLen, sizeof( uiTextLen ) );
+    ReadBytes( ctx, &uiTextLen, sizeof( uiTextLen ) );
 
     memset( szBuffer, 0x00, uiBufferLen * sizeof(char) );
     ASSERT( uiTextLen < uiBufferLen );
     if( uiTextLen < uiBufferLen )
     {
-        ReadBytes( szBuffer, uiTextLen );
+        ReadBytes( ctx, szBuffer, uiTextLen );
     }
     else
     {
-        ReadBytes( szBuffer, uiBufferLen );
+        ReadBytes( ctx, szBuffer, uiBufferLen );
         szBuffer[ uiBufferLen - 1 ] = '\0';
 
-        char tempBuff[1024];
-        ReadBytes(tempBuff, uiTextLen - uiBufferLen);
+        ReadBytesSkip(ctx, uiTextLen - uiBufferLen);
     }
 }
 
-void CLoader::ReadSkin( sObjectMesh* pMesh )
+void CLoader::ReadSkin( sReadCursor& ctx, sObjectMesh* pMesh ) const
 {
-    const unsigned char hasSkin = *(unsigned char*)ReadBytes(sizeof(hasSkin));
+    const unsigned char hasSkin = *(unsigned char*)ReadBytes(ctx, sizeof(hasSkin));
     if (!hasSkin)
         return; // no skin
 
-    pMesh->pSkinWeights = (Vector4*)ReadBytes(sizeof(Vector4) * pMesh->numVertices);
-    pMesh->pSkinBoneIndices = (sBoneIndices*)ReadBytes(sizeof(sBoneIndices) * pMesh->numVertices);
+    pMesh->pSkinWeights = (Vector4*)ReadBytes(ctx, sizeof(Vector4) * pMesh->numVertices);
+    pMesh->pSkinBoneIndices = (sBoneIndices*)ReadBytes(ctx, sizeof(sBoneIndices) * pMesh->numVertices);
 }
 
-void CLoader::ReadCollisionData( sObjectMesh* pMesh )
+void CLoader::ReadCollisionData( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const
 {
-    pMesh->numCollisions = *(int*)ReadBytes(sizeof(int));
+    KHM_STATS_STAGE(LOAD_STAGE_COLLISION);
+
+    sObjectMesh* pMesh = pModelDefinition->pMesh;
+    pMesh->numCollisions = *(int*)ReadBytes(ctx, sizeof(int));
     if (!pMesh->numCollisions)
         return;
 
-    pMesh->pCollisions = new sCollisionShape[pMesh->numCollisions];
+    pMesh->pCollisions = (sCollisionShape*)pModelDefinition->Alloc(sizeof(sCollisionShape) * pMesh->numCollisions);
     for (int i = 0; i < pMesh->numCollisions; ++i)
     {
-        sCollisionShape& col = pMesh->pCollisions[i];
+        sCollisionShape& col = *new (&pMesh->pCollisions[i]) sCollisionShape();
 
-        col.type = (sCollisionShape::eCollisionType)*(unsigned int*)ReadBytes(sizeof(unsigned int));
-        memcpy(&col.transform, ReadBytes(sizeof(float) * 16), sizeof(float) * 16);
+        col.type = (sCollisionShape::eCollisionType)*(unsigned int*)ReadBytes(ctx, sizeof(unsigned int));
+        memcpy(&col.transform, ReadBytes(ctx, sizeof(float) * 16), sizeof(float) * 16);
 
         switch (col.type)
         {
             case sCollisionShape::SPHERE:
-                col.params.sphere.radius = *(float*)ReadBytes(sizeof(float));
+                col.params.sphere.radius = *(float*)ReadBytes(ctx, sizeof(float));
                 break;
 
             case sCollisionShape::BOX:
-                memcpy(col.params.box.extents, ReadBytes(sizeof(float) * 3), sizeof(float) * 3);
+                memcpy(col.params.box.extents, ReadBytes(ctx, sizeof(float) * 3), sizeof(float) * 3);
                 break;
 
             case sCollisionShape::CAPSULE:
-                col.params.capsule.radius = *(float*)ReadBytes(sizeof(float));
-                col.params.capsule.halfHeight = *(float*)ReadBytes(sizeof(float));
+                col.params.capsule.radius = *(float*)ReadBytes(ctx, sizeof(float));
+                col.params.capsule.halfHeight = *(float*)ReadBytes(ctx, sizeof(float));
                 break;
 
             case sCollisionShape::CONVEX_MESH:
                 col.bShared = true;
 
-                col.params.mesh.numPolys = *(int*)ReadBytes(sizeof(int));
-                col.params.mesh.pPolygons = (sCollisionPolygon*)ReadBytes(sizeof(sCollisionPolygon) * col.params.mesh.numPolys);
+                col.params.mesh.numPolys = *(int*)ReadBytes(ctx, sizeof(int));
+                col.params.mesh.pPolygons = (sCollisionPolygon*)ReadBytes(ctx, sizeof(sCollisionPolygon) * col.params.mesh.numPolys);
 
-                col.params.mesh.numIndices = *(int*)ReadBytes(sizeof(int));
-                col.params.mesh.pIndices = (unsigned short*)ReadBytes(sizeof(unsigned short) * col.params.mesh.numIndices);
+                col.params.mesh.numIndices = *(int*)ReadBytes(ctx, sizeof(int));
+                col.params.mesh.pIndices = (unsigned short*)ReadBytes(ctx, sizeof(unsigned short) * col.params.mesh.numIndices);
 
-                col.params.mesh.numVertices = *(int*)ReadBytes(sizeof(int));
-                col.params.mesh.pVertices = (Vector3*)ReadBytes(sizeof(Vector3) * col.params.mesh.numVertices);
+                col.params.mesh.numVertices = *(int*)ReadBytes(ctx, sizeof(int));
+                col.params.mesh.pVertices = (Vector3*)ReadBytes(ctx, sizeof(Vector3) * col.params.mesh.numVertices);
                 break;
 
             default:
@@ -166,81 +403,98 @@ void CLoader::ReadCollisionData( sObjectMesh* pMesh )
     }
 }
 
-void CLoader::ReadGeometry(sObjectMesh* pMesh)
+static float ComputeMeshVolume(const sObjectMesh* pMesh)
 {
+    float volume = 0.0f;
+    for (int i = 0; i < pMesh->numCollisions; ++i)
+    {
+        const sCollisionShape& col = pMesh->pCollisions[i];
+        if (col.type == sCollisionShape::CONVEX_MESH || col.type == sCollisionShape::MESH)
+        {
+            Vector3 s = pMesh->max - pMesh->min;
+            volume += (s.x * s.y * s.z);
+        }
+        else
+        {
+            volume += col.GetVolume();
+        }
+    }
+
+    return volume;
+}
+
+void CLoader::ReadGeometry(sReadCursor& ctx, sModelDefinition* pModelDefinition) const
+{
+    sObjectMesh* pMesh = pModelDefinition->pMesh;
+
     // read verts
-    pMesh->numVertices = *(int*)ReadBytes(sizeof(int));
-    pMesh->pVertices = (Vector3*)ReadBytes(sizeof(Vector3) * pMesh->numVertices);
+    pMesh->numVertices = *(int*)ReadBytes(ctx, sizeof(int));
+    pMesh->pVertices = (Vector3*)ReadBytes(ctx, sizeof(Vector3) * pMesh->numVertices);
 
     // read normals
-    pMesh->pNormals = (Vector3*)ReadBytes(sizeof(Vector3) * pMesh->numVertices);
+    pMesh->pNormals = (Vector3*)ReadBytes(ctx, sizeof(Vector3) * pMesh->numVertices);
 
     // read triangle indices
-    pMesh->numIndices = *(int*)ReadBytes(sizeof(int));
-    pMesh->pIndices = (unsigned short*)ReadBytes(sizeof(unsigned short) * pMesh->numIndices);
+    pMesh->numIndices = *(int*)ReadBytes(ctx, sizeof(int));
+    pMesh->pIndices = (unsigned short*)ReadBytes(ctx, sizeof(unsigned short) * pMesh->numIndices);
 
     // read face normals
     const unsigned int uiNumFaces = pMesh->numIndices / 3;
-    pMesh->pFaceNormals = (Vector3*)ReadBytes(sizeof(Vector3) * uiNumFaces);
+    pMesh->pFaceNormals = (Vector3*)ReadBytes(ctx, sizeof(Vector3) * uiNumFaces);
 
     // read vtx colors
-    unsigned char hasVertColors = *(unsigned char*)ReadBytes(sizeof(hasVertColors));
+    unsigned char hasVertColors = *(unsigned char*)ReadBytes(ctx, sizeof(hasVertColors));
     if (hasVertColors)
     {
-        pMesh->pColors = (unsigned int*)ReadBytes(sizeof(unsigned int) * pMesh->numVertices);
+        pMesh->pColors = (unsigned int*)ReadBytes(ctx, sizeof(unsigned int) * pMesh->numVertices);
     }
 
     // read tx coords
-    unsigned int uiNumTxCoordMaps = *(unsigned int*)ReadBytes(sizeof(uiNumTxCoordMaps));
+    unsigned int uiNumTxCoordMaps = *(unsigned int*)ReadBytes(ctx, sizeof(uiNumTxCoordMaps));
     for(unsigned int i(0); i < uiNumTxCoordMaps; ++i)
     {
         if (i == 1)
         {
-            ReadBytesSkip(sizeof(Vector2) * pMesh->numVertices);
+            ReadBytesSkip(ctx, sizeof(Vector2) * pMesh->numVertices);
             //m_pFile->Seek(sizeof(Vector2) * pMesh->numVertices, File::SEEK_POS_CUR);
             continue; // TODO: we don't need these for now,  will see if necessary
         }
 
-        pMesh->pTexCoords[i] = (Vector2*)ReadBytes(sizeof(Vector2) * pMesh->numVertices);
+        pMesh->pTexCoords[i] = (Vector2*)ReadBytes(ctx, sizeof(Vector2) * pMesh->numVertices);
     }
 
     // read skin
-    ReadSkin(pMesh);
+    ReadSkin(ctx, pMesh);
 
     // read collision data
-    ReadCollisionData(pMesh);
+    ReadCollisionData(ctx, pModelDefinition);
 
     // read bounds
-    pMesh->min = *(Vector3*)ReadBytes(sizeof(Vector3));
-    pMesh->max = *(Vector3*)ReadBytes(sizeof(Vector3));
+    pMesh->min = *(Vector3*)ReadBytes(ctx, sizeof(Vector3));
+    pMesh->max = *(Vector3*)ReadBytes(ctx, sizeof(Vector3));
 
     // compute volume at load time (TODO: this is exporter's job)
-    pMesh->volume = 0.0f;
-    for (int i = 0; i < pMesh->numCollisions; ++i)
+    pMesh->volume = ComputeMeshVolume(pMesh);
+
+    if (flags & LOAD_OPTIMIZE_VERTEX_CACHE)
     {
-        const sCollisionShape& col = pMesh->pCollisions[i];
-        if (col.type == sCollisionShape::CONVEX_MESH || col.type == sCollisionShape::MESH)
-        {
-            Vector3 s = pMesh->max - pMesh->min;
-            pMesh->volume += (s.x * s.y * s.z);
-        }
-        else
-        {
-            pMesh->volume += col.GetVolume();
-        }
+        KHM_STATS_STAGE(LOAD_STAGE_OPTIMIZE);
+        OptimizeMesh(pMesh, NULL);
     }
 }
 
-void CLoader::ReadMeshes( sModelDefinition* pModelDefinition )
+void CLoader::ReadMeshes( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const
 {
-    const unsigned char hasMesh = *ReadBytes(sizeof(hasMesh));
+    KHM_STATS_STAGE(LOAD_STAGE_MESH);
+
+    const unsigned char hasMesh = *ReadBytes(ctx, sizeof(hasMesh));
     if (!hasMesh)
         return;
 
-    pModelDefinition->pMesh = new sObjectMesh();
+    pModelDefinition->pMesh = new (pModelDefinition->Alloc(sizeof(sObjectMesh))) sObjectMesh();
 
     sObjectBase* pObject = pModelDefinition->pMesh;
-    memcpy(pObject, ReadBytes(sizeof(sObjectBase)), sizeof(sObjectBase));
+    memcpy(pObject, ReadBytes(ctx, sizeof(sObjectBase)), sizeof(sObjectBase));
 
     ASSERT(pObject->uiId < 256);
     if (pObject->uiId >= 256) 
@@ -251,20 +505,22 @@ void CLoader::ReadMeshes( sModelDefinition* pModelDefinition )
         pObject->uiParentId = 255;
     }
 
-    ReadGeometry(pModelDefinition->pMesh);
+    ReadGeometry(ctx, pModelDefinition);
 
     //g_pLog->Write("mesh: %s, id=%d, parentId=%d\n", pObject->szName, pObject->uiId, pObject->uiParentId);
 }
 
-void CLoader::ReadBones( sModelDefinition* pModelDefinition )
+void CLoader::ReadBones( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const
 {
-    const unsigned char count = *(unsigned char*)ReadBytes(sizeof(count));
+    KHM_STATS_STAGE(LOAD_STAGE_SKELETON);
+
+    const unsigned char count = *(unsigned char*)ReadBytes(ctx, sizeof(count));
     if (!count)
         return;
 
     ASSERT(sizeof(sObjectBase) == (KHM_MAX_OBJECT_NAME + 4 + 4 + 64 + 64));
     pModelDefinition->numBones = count;
-    pModelDefinition->lBones = (sObjectBase*)ReadBytes(sizeof(sObjectBase) * count);
+    pModelDefinition->lBones = (sObjectBase*)ReadBytes(ctx, sizeof(sObjectBase) * count);
 
     //for (int i = 0; i < pModelDefinition->numBones; ++i) {
     //  const KHM::sObjectBase* pBone = &pModelDefinition->lBones[i];
@@ -272,15 +528,17 @@ void CLoader::ReadBones( sModelDefinition* pModelDefinition )
     //}
 }
 
-void CLoader::ReadHelpers( sModelDefinition* pModelDefinition )
+void CLoader::ReadHelpers( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const
 {
-    const unsigned char count = *(unsigned char*)ReadBytes(sizeof(count));
+    KHM_STATS_STAGE(LOAD_STAGE_SKELETON);
+
+    const unsigned char count = *(unsigned char*)ReadBytes(ctx, sizeof(count));
     if (!count)
         return;
 
     ASSERT(sizeof(sObjectBase) == (KHM_MAX_OBJECT_NAME + 4 + 4 + 64 + 64));
     pModelDefinition->numHelpers = count;
-    pModelDefinition->lHelpers = (sObjectBase*)ReadBytes(sizeof(sObjectBase) * count);
+    pModelDefinition->lHelpers = (sObjectBase*)ReadBytes(ctx, sizeof(sObjectBase) * count);
 
     //for (int i = 0; i < pModelDefinition->numHelpers; ++i) {
     //  const KHM::sObjectBase* pBone = &pModelDefinition->lHelpers[i];
@@ -288,21 +546,76 @@ void CLoader::ReadHelpers( sModelDefinition* pModelDefinition )
     //}
 }
 
-void CLoader::ReadAnimation( sModelDefinition* pModelDefinition )
+// the compressor sizes its block as it goes; the clip is relocatable, so it moves to the arena once it's done
+static sCompressedAnimation* MoveToArena(sModelDefinition* pModelDefinition, sCompressedAnimation* pCompressed)
+{
+    if (!pCompressed)
+        return NULL;
+
+    sCompressedAnimation* pMoved = (sCompressedAnimation*)pModelDefinition->Alloc(pCompressed->uiSize);
+    memcpy(pMoved, pCompressed, pCompressed->uiSize);
+    DestroyCompressedAnimation(pCompressed);
+    return pMoved;
+}
+
+// the runtime friendly copies of pNodeTransforms the flags ask for
+static void BuildAnimationCopies(sModelDefinition* pModelDefinition, sAnimation* pAnimation, unsigned int flags)
+{
+    KHM_STATS_STAGE(LOAD_STAGE_ANIMATION_COPIES);
+
+    pAnimation->pTracks = NULL;
+    pAnimation->pCompressed = NULL;
+
+    const size_t uiTracksSize = GetAnimationTracksSize(pAnimation->numNodes, pAnimation->numNodeFrames);
+    if ((flags & LOAD_ANIMATION_TRACKS) && uiTracksSize)
+        pAnimation->pTracks = CreateAnimationTracks(pAnimation, pModelDefinition->Alloc(uiTracksSize));
+
+    if (flags & LOAD_COMPRESS_ANIMATION)
+        pAnimation->pCompressed = MoveToArena(pModelDefinition, CompressAnimation(pAnimation, sCompressionSettings(), NULL));
+}
+
+// compile the names into a bitset; bones and helpers have to be loaded already
+static void CompileAnimationMask(const sModelDefinition* pModelDefinition, const sAnimationMaskEntry* pNodes, unsigned int numNodes, sAnimationMask* pMask)
+{
+#if KHM_ANIMATION_MASK_NAMES
+    pMask->pNodes = (sAnimationMaskEntry*)pNodes;
+    pMask->numNodes = numNodes; 
+#endif
+
+    memset(pMask->bits, 0, sizeof(pMask->bits));
+    for (unsigned int i = 0; i < numNodes; ++i)
+    {
+        if (!pNodes[i].mask)
+            continue;
+
+        const sObjectBase* pObject = pModelDefinition->GetObjectByName(pNodes[i].szObjectName);
+        if (!pObject || pObject->uiId >= KHM_MAX_BONES)
+        {
+            LOG_ERROR("[Error] CLoader::ReadAnimationMask(%s) - can't mask object '%s'\n", pModelDefinition->szFileName, pNodes[i].szObjectName);
+            continue;
+        }
+
+        pMask->bits[pObject->uiId >> 5] |= 1u << (pObject->uiId & 31);
+    }
+}
+
+void CLoader::ReadAnimation( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const
 {
-    const unsigned char hasAnim = *ReadBytes(sizeof(hasAnim));
+    KHM_STATS_STAGE(LOAD_STAGE_ANIMATION);
+
+    const unsigned char hasAnim = *ReadBytes(ctx, sizeof(hasAnim));
     if (!hasAnim)
         return;
 
-    sAnimation* pAnimation = new sAnimation();
+    sAnimation* pAnimation = new (pModelDefinition->Alloc(sizeof(sAnimation))) sAnimation();
     pModelDefinition->pAnimation = pAnimation;
 
     // read data
-    const int numNodes = *(int*)ReadBytes(sizeof(int));
-    const float startTimeS = *(float*)ReadBytes(sizeof(float)); // this is not 0 when the animation is exported from a clip and not the entire timeline
+    const int numNodes = *(int*)ReadBytes(ctx, sizeof(int));
+    const float startTimeS = *(float*)ReadBytes(ctx, sizeof(float)); // this is not 0 when the animation is exported from a clip and not the entire timeline
     //ASSERT(startTimeS == 0.f);
-    const float endTimeS = *(float*)ReadBytes(sizeof(float)) - startTimeS; //NOTE: Shift everything so it starts at time 0
-    const int numFrames = *(int*)ReadBytes(sizeof(int));
+    const float endTimeS = *(float*)ReadBytes(ctx, sizeof(float)) - startTimeS; //NOTE: Shift everything so it starts at time 0
+    const int numFrames = *(int*)ReadBytes(ctx, sizeof(int));
 
     // alloc space for node animations; node animations = animation track for a object
     pAnimation->numNodes = numNodes;
@@ -312,11 +625,12 @@ void CLoader::ReadAnimation( sModelDefinition* pModelDefinition )
     //const sNodeAnimation* na = (const sNodeAnimation*)ReadBytes(sizeof(sNodeAnimation) * numNodes);
 
     // no longer needed (TODO: remove from exporter as well)
-    ReadBytesSkip(sizeof(sNodeAnimation) * numNodes);
+    ReadBytesSkip(ctx, sizeof(sNodeAnimation) * numNodes);
 
     pAnimation->numNodeFrames = numFrames;
     pAnimation->frameDurationMs = (endTimeS * 1000.f) / (float)(Max(numFrames - 1, 1));
-    pAnimation->pNodeTransforms = (sNodeTransform*)ReadBytes(sizeof(sNodeTransform) * (numFrames * numNodes));
+    pAnimation->pNodeTransforms = (sNodeTransform*)ReadBytes(ctx, sizeof(sNodeTransform) * (numFrames * numNodes));
+    BuildAnimationCopies(pModelDefinition, pAnimation, flags);
 
     //for (int i = 0; i < numNodes; ++i) {
     //  const KHM::sNodeAnimation* pNode = &pAnimation->pNodeAnimations[i];
@@ -324,19 +638,23 @@ void CLoader::ReadAnimation( sModelDefinition* pModelDefinition )
     //}
 }
 
-void CLoader::ReadAnimationMask( sModelDefinition* pModelDefinition )
+void CLoader::ReadAnimationMask( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const
 {
-    const unsigned char hasAnimMask = *ReadBytes(sizeof(hasAnimMask));
+    KHM_STATS_STAGE(LOAD_STAGE_ANIMATION_MASK);
+
+    const unsigned char hasAnimMask = *ReadBytes(ctx, sizeof(hasAnimMask));
     if (!hasAnimMask)
         return;
 
-    sAnimationMask* pMask = new sAnimationMask();
+    sAnimationMask* pMask = new (pModelDefinition->Alloc(sizeof(sAnimationMask))) sAnimationMask();
     pModelDefinition->pAnimationMask = pMask;
 
-    const unsigned int numNodes = *(unsigned int*)ReadBytes(sizeof(unsigned int));
+    const unsigned int numNodes = *(unsigned int*)ReadBytes(ctx, sizeof(unsigned int));
     
-    pMask->pNodes = (sAnimationMaskEntry*)ReadBytes(sizeof(sAnimationMaskEntry) * numNodes);
-    pMask->numNodes = numNodes; 
+    const sAnimationMaskEntry* pNodes = (sAnimationMaskEntry*)ReadBytes(ctx, sizeof(sAnimationMaskEntry) * numNodes);
+
+    // bones and helpers are already loaded at this point
+    CompileAnimationMask(pModelDefinition, pNodes, numNodes, pMask);
 
     //for (int i = 0; i < numNodes; ++i) {
     //  if (pNewAnimationMask->lObjectMask[i].mask)
@@ -344,53 +662,448 @@ void CLoader::ReadAnimationMask( sModelDefinition* pModelDefinition )
     //}
 }
 
-bool CLoader::LoadModel(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize, sModelDefinition* pModelDefinition)
+bool CLoader::LoadModel(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize, sModelDefinition* pModelDefinition) const
+{
+    return LoadModelSections(pszFilePath, fileBuff, fileSize, MODEL_SECTIONS_ALL, pModelDefinition);
+}
+
+// everything a model loaded from the layout puts in its arena, so the load asks the allocator once. pCompressed is
+// the clip compressed ahead; a partial load leaves it out and the deferred animation gets a block of its own
+static size_t ComputeArenaSize(const sModelLayout& layout, unsigned int flags, const sCompressedAnimation* pCompressed)
+{
+    size_t uiSize = 0;
+    if (layout.uiMesh)
+        uiSize += AlignModelSize(sizeof(sObjectMesh));
+    if (layout.uiCollisions)
+        uiSize += AlignModelSize(sizeof(sCollisionShape) * layout.numCollisions);
+
+    if (layout.uiAnimation)
+    {
+        uiSize += AlignModelSize(sizeof(sAnimation));
+        if (flags & LOAD_ANIMATION_TRACKS)
+            uiSize += AlignModelSize(GetAnimationTracksSize(layout.numNodes, layout.numNodeFrames));
+        if (pCompressed)
+            uiSize += AlignModelSize(pCompressed->uiSize);
+    }
+
+    if (layout.uiMask)
+        uiSize += AlignModelSize(sizeof(sAnimationMask));
+
+    uiSize += AlignModelSize(sizeof(sNameIndexEntry) * GetNameIndexSize(layout.numBones + layout.numHelpers + (layout.uiMesh ? 1 : 0)));
+
+#if KHM_LOAD_STATS
+    if (flags & LOAD_COLLECT_STATS)
+        uiSize += AlignModelSize(sizeof(sLoadStats));
+#endif
+
+    return uiSize;
+}
+
+// the groups a load of uiSections reads: the mask is compiled against the object names, and the streams and shapes
+// hang off the mesh object
+static unsigned int AddSectionDependencies(unsigned int uiSections)
 {
-    buff = fileBuff;
-    buffsize = fileSize;
+    if (uiSections & MODEL_SECTION_ANIMATION_MASK)
+        uiSections |= MODEL_SECTION_SKELETON;
+    if (uiSections & (MODEL_SECTION_MESH | MODEL_SECTION_COLLISION))
+        uiSections |= MODEL_SECTION_MESH_INFO;
 
+    return uiSections;
+}
+
+static bool ReserveModelArena(const char* pszFilePath, size_t uiSize, sModelDefinition* pModelDefinition)
+{
+    if (pModelDefinition->ReserveArena(uiSize))
+        return true;
+
+    LOG_ERROR("[Error] CLoader::LoadModel(%s) - the allocator is out of memory ( %u bytes )\n", pszFilePath, (unsigned int)uiSize);
+    return false;
+}
+
+bool CLoader::LoadModelSections(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize, unsigned int uiSections, sModelDefinition* pModelDefinition) const
+{
     pModelDefinition->Init();
+    pModelDefinition->allocator = allocator;
+    CLoadStatsScope statsScope(pModelDefinition, flags);
 
-    // read file signature
-    sHeader* fileHeader = (sHeader*)ReadBytes(sizeof(sHeader));
+    // one bounded pass over what this load reads; everything after it runs unchecked
+    sModelLayout layout;
+    if (!ValidateModelSections(pszFilePath, fileBuff, fileSize, AddSectionDependencies(uiSections), &layout))
+        return false;
 
-    if( fileHeader->uiSig[0] != 'K' ||
-        fileHeader->uiSig[1] != 'H' ||
-        fileHeader->uiSig[2] != 'M' )
+    if (layout.uiVersion == KHM_VERSION_SECTIONS && uiSections != MODEL_SECTIONS_ALL)
     {
-        LOG_ERROR("[Error] CLoader::LoadModel(%s) - KHM header mismatch.\n", pszFilePath);
-        return false; // different kind of file
+        strcpy(pModelDefinition->szFileName, pszFilePath);
+
+        // sized for the whole file from the section counts alone, so the deferred sections fit as well without their
+        // pages being touched now; the name index is taken at its final size
+        sModelLayout counts;
+        if (!ValidateSectionCounts(fileBuff, fileSize, &counts))
+        {
+            LOG_ERROR("[Error] CLoader::LoadModel(%s) - bad section counts\n", pszFilePath);
+            return false;
+        }
+
+        if (!ReserveModelArena(pszFilePath, ComputeArenaSize(counts, flags, NULL), pModelDefinition))
+            return false;
+        pModelDefinition->ReserveNameIndex(counts.numBones + counts.numHelpers + (counts.uiMesh ? 1 : 0));
+
+        return statsScope.Result(ReadSections(fileBuff, uiSections, pModelDefinition));
     }
 
-    if( fileHeader->uiVer != KHM_VERSION )
+    return statsScope.Result(LoadValidatedModel(pszFilePath, fileBuff, layout, pModelDefinition));
+}
+
+bool CLoader::LoadDeferredSections(unsigned char* fileBuff, unsigned int fileSize, unsigned int uiSections, sModelDefinition* pModelDefinition) const
+{
+    const unsigned int uiNewSections = AddSectionDependencies(uiSections) & ~pModelDefinition->uiSections;
+    if (!uiNewSections)
+        return true;
+
+    CLoadStatsScope statsScope(pModelDefinition, flags);
+
+    // only what this call adds; the sections loaded before were checked by then
+    sModelLayout layout;
+    if (!ValidateModelSections(pModelDefinition->szFileName, fileBuff, fileSize, uiNewSections, &layout))
+        return false;
+
+    // v101 was loaded entirely in the first place
+    ASSERT(layout.uiVersion == KHM_VERSION_SECTIONS);
+    return statsScope.Result(ReadSections(fileBuff, uiSections, pModelDefinition));
+}
+
+// pointer into the file for a validated offset; parts that are not in the file stay NULL
+#define LAYOUT_DATA(type, uiOffset)     ((uiOffset) ? (type*)(fileBuff + (uiOffset)) : NULL)
+
+bool CLoader::LoadValidatedModel(const char* pszFilePath, unsigned char* fileBuff, const sModelLayout& layout, sModelDefinition* pModelDefinition) const
+{
+    pModelDefinition->Init();
+    pModelDefinition->allocator = allocator;
+    strcpy(pModelDefinition->szFileName, pszFilePath);
+    CLoadStatsScope statsScope(pModelDefinition, flags);
+
+    // the compressed clip is the one part the layout can't size, so it's built before the arena
+    sCompressedAnimation* pCompressed = NULL;
+    if (layout.uiAnimation && (flags & LOAD_COMPRESS_ANIMATION))
     {
-        LOG_ERROR("[Error] CLoader::LoadModel(%s) - wrong file version %u, expected %u\n", pszFilePath, fileHeader->uiVer, KHM_VERSION);
-        return false; // version mismatch!
+        KHM_STATS_STAGE(LOAD_STAGE_ANIMATION_COPIES);
+
+        sAnimation animation;
+        memset(&animation, 0, sizeof(animation));
+        animation.numNodes = layout.numNodes;
+        animation.numNodeFrames = layout.numNodeFrames;
+        animation.frameDurationMs = layout.frameDurationMs;
+        animation.pNodeTransforms = (sNodeTransform*)(fileBuff + layout.uiAnimation);
+        pCompressed = CompressAnimation(&animation, sCompressionSettings(), NULL);
     }
 
-    strcpy(pModelDefinition->szFileName, pszFilePath);
+    if (!ReserveModelArena(pszFilePath, ComputeArenaSize(layout, flags, pCompressed), pModelDefinition))
+    {
+        DestroyCompressedAnimation(pCompressed);
+        return false;
+    }
 
-    //
-    // read bones
-    ReadBones(pModelDefinition);
+    pModelDefinition->numBones = layout.numBones;
+    pModelDefinition->lBones = LAYOUT_DATA(sObjectBase, layout.uiBones);
+    pModelDefinition->numHelpers = layout.numHelpers;
+    pModelDefinition->lHelpers = LAYOUT_DATA(sObjectBase, layout.uiHelpers);
 
-    //
-    // read helpers
-    ReadHelpers(pModelDefinition);
-    
-    //
-    // read meshes
-    ReadMeshes(pModelDefinition);
+    if (layout.uiMesh)
+    {
+        KHM_STATS_STAGE(LOAD_STAGE_MESH);
+
+        sObjectMesh* pMesh = new (pModelDefinition->Alloc(sizeof(sObjectMesh))) sObjectMesh();
+        pModelDefinition->pMesh = pMesh;
+
+        // v101 keeps the object on its own, v102 at the start of sMeshInfo
+        memcpy((sObjectBase*)pMesh, fileBuff + layout.uiMesh, sizeof(sObjectBase));
+
+        pMesh->numVertices = layout.numVertices;
+        pMesh->numIndices = layout.numIndices;
+        pMesh->pVertices = LAYOUT_DATA(Vector3, layout.uiVertices);
+        pMesh->pNormals = LAYOUT_DATA(Vector3, layout.uiNormals);
+        pMesh->pIndices = LAYOUT_DATA(unsigned short, layout.uiIndices);
+        pMesh->pFaceNormals = LAYOUT_DATA(Vector3, layout.uiFaceNormals);
+        pMesh->pColors = LAYOUT_DATA(unsigned int, layout.uiColors);
+        pMesh->pTexCoords[0] = LAYOUT_DATA(Vector2, layout.uiTexCoords);
+        pMesh->pSkinWeights = LAYOUT_DATA(Vector4, layout.uiSkinWeights);
+        pMesh->pSkinBoneIndices = LAYOUT_DATA(sBoneIndices, layout.uiSkinIndices);
+        if (layout.uiMeshLods)
+        {
+            pMesh->numLods = layout.numMeshLods;
+            pMesh->pLods = ((const sMeshLodInfo*)(fileBuff + layout.uiMeshLods))->lods;
+            pMesh->numLodIndices = layout.numLodIndices;
+            pMesh->pLodIndices = LAYOUT_DATA(unsigned short, layout.uiLodIndices);
+        }
+
+        if (layout.uiCollisions)
+        {
+            sReadCursor ctx;
+            ctx.buff = fileBuff;
+            ctx.buffsize = layout.uiFileSize;
+            ctx.buffread = layout.uiCollisions;
+            ReadCollisionData(ctx, pModelDefinition);
+        }
+
+        memcpy(&pMesh->min, fileBuff + layout.uiBounds, sizeof(Vector3));
+        memcpy(&pMesh->max, fileBuff + layout.uiBounds + sizeof(Vector3), sizeof(Vector3));
+        if (layout.uiVolume)
+            memcpy(&pMesh->volume, fileBuff + layout.uiVolume, sizeof(float));
+        else
+            pMesh->volume = ComputeMeshVolume(pMesh);
+
+        if (flags & LOAD_OPTIMIZE_VERTEX_CACHE)
+        {
+            KHM_STATS_STAGE(LOAD_STAGE_OPTIMIZE);
+            OptimizeMesh(pMesh, NULL);
+        }
+    }
+
+    if (layout.uiAnimation)
+    {
+        KHM_STATS_STAGE(LOAD_STAGE_ANIMATION);
+
+        sAnimation* pAnimation = new (pModelDefinition->Alloc(sizeof(sAnimation))) sAnimation();
+        pAnimation->numNodes = layout.numNodes;
+        pAnimation->numNodeFrames = layout.numNodeFrames;
+        pAnimation->frameDurationMs = layout.frameDurationMs;
+        pAnimation->pNodeTransforms = (sNodeTransform*)(fileBuff + layout.uiAnimation);
+        BuildAnimationCopies(pModelDefinition, pAnimation, flags & ~LOAD_COMPRESS_ANIMATION);
+        pAnimation->pCompressed = MoveToArena(pModelDefinition, pCompressed);
+        if (layout.uiAnimationBounds)
+        {
+            pAnimation->pBounds = (const sAnimationBounds*)(fileBuff + layout.uiAnimationBounds);
+            pAnimation->numBoundsGroups = layout.numBoundsGroups;
+            pAnimation->framesPerBoundsGroup = layout.framesPerBoundsGroup;
+        }
+        pModelDefinition->pAnimation = pAnimation;
+    }
+
+    pModelDefinition->BuildNameIndex();
+
+    if (layout.uiMask)
+    {
+        KHM_STATS_STAGE(LOAD_STAGE_ANIMATION_MASK);
+
+        pModelDefinition->pAnimationMask = new (pModelDefinition->Alloc(sizeof(sAnimationMask))) sAnimationMask();
+        CompileAnimationMask(pModelDefinition, (const sAnimationMaskEntry*)(fileBuff + layout.uiMask), layout.numMaskEntries, pModelDefinition->pAnimationMask);
+    }
+
+    pModelDefinition->uiSections = MODEL_SECTIONS_ALL;
+    return statsScope.Result(true);
+}
 
-    //
-    // read animation
-    ReadAnimation(pModelDefinition);
+#undef LAYOUT_DATA
 
-    //
-    // read animation mask
-    ReadAnimationMask(pModelDefinition);
+//
+// v102 sections
+//
+
+const sSectionEntry* CLoader::FindSection(unsigned char* fileBuff, unsigned int uiType) const
+{
+    const sSectionTable* pTable = (const sSectionTable*)(fileBuff + sizeof(sHeader));
+    const sSectionEntry* lSections = (const sSectionEntry*)(pTable + 1);
+    for (unsigned int i = 0; i < pTable->numSections; ++i)
+    {
+        if (lSections[i].uiType == uiType)
+            return &lSections[i];
+    }
+
+    return NULL;
+}
+
+void* CLoader::GetSectionData(unsigned char* fileBuff, unsigned int uiType, unsigned int uiElementSize, unsigned int uiCount) const
+{
+    const sSectionEntry* pSection = FindSection(fileBuff, uiType);
+    if (!pSection || !uiCount || pSection->uiSize / uiElementSize < uiCount)
+        return NULL;
+
+    return fileBuff + pSection->uiOffset;
+}
+
+bool CLoader::ReadSections(unsigned char* fileBuff, unsigned int uiSections, sModelDefinition* pModelDefinition) const
+{
+    uiSections = AddSectionDependencies(uiSections) & ~pModelDefinition->uiSections;
+    const char* pszFilePath = pModelDefinition->szFileName;
+
+    if (uiSections & MODEL_SECTION_SKELETON)
+    {
+        KHM_STATS_STAGE(LOAD_STAGE_SKELETON);
+
+        const sSectionEntry* pBones = FindSection(fileBuff, SECTION_BONES);
+        if (pBones)
+        {
+            pModelDefinition->lBones = (sObjectBase*)GetSectionData(fileBuff, SECTION_BONES, sizeof(sObjectBase), pBones->uiCount);
+            pModelDefinition->numBones = pModelDefinition->lBones ? pBones->uiCount : 0;
+        }
+
+        const sSectionEntry* pHelpers = FindSection(fileBuff, SECTION_HELPERS);
+        if (pHelpers)
+        {
+            pModelDefinition->lHelpers = (sObjectBase*)GetSectionData(fileBuff, SECTION_HELPERS, sizeof(sObjectBase), pHelpers->uiCount);
+            pModelDefinition->numHelpers = pModelDefinition->lHelpers ? pHelpers->uiCount : 0;
+        }
+    }
+
+    const sMeshInfo* pMeshInfo = (const sMeshInfo*)GetSectionData(fileBuff, SECTION_MESH, sizeof(sMeshInfo), 1);
+    if ((uiSections & MODEL_SECTION_MESH_INFO) && pMeshInfo && !pModelDefinition->pMesh)
+    {
+        KHM_STATS_STAGE(LOAD_STAGE_MESH);
+
+        sObjectMesh* pMesh = new (pModelDefinition->Alloc(sizeof(sObjectMesh))) sObjectMesh();
+        memcpy((sObjectBase*)pMesh, &pMeshInfo->base, sizeof(sObjectBase));
+        pMesh->min = pMeshInfo->min;
+        pMesh->max = pMeshInfo->max;
+        pMesh->volume = pMeshInfo->volume;
+        pModelDefinition->pMesh = pMesh;
+    }
 
+    if ((uiSections & MODEL_SECTION_MESH) && pMeshInfo)
+    {
+        KHM_STATS_STAGE(LOAD_STAGE_MESH);
+
+        sObjectMesh* pMesh = pModelDefinition->pMesh;
+        const int numVertices = pMeshInfo->numVertices;
+        const int numIndices = pMeshInfo->numIndices;
+
+        pMesh->pVertices = (Vector3*)GetSectionData(fileBuff, SECTION_VERTICES, sizeof(Vector3), numVertices);
+        pMesh->pNormals = (Vector3*)GetSectionData(fileBuff, SECTION_NORMALS, sizeof(Vector3), numVertices);
+        pMesh->pIndices = (unsigned short*)GetSectionData(fileBuff, SECTION_INDICES, sizeof(unsigned short), numIndices);
+        pMesh->pFaceNormals = (Vector3*)GetSectionData(fileBuff, SECTION_FACE_NORMALS, sizeof(Vector3), numIndices / 3);
+        pMesh->pColors = (unsigned int*)GetSectionData(fileBuff, SECTION_COLORS, sizeof(unsigned int), numVertices);
+        pMesh->pTexCoords[0] = (Vector2*)GetSectionData(fileBuff, SECTION_TEXCOORDS, sizeof(Vector2), numVertices);
+        pMesh->pSkinWeights = (Vector4*)GetSectionData(fileBuff, SECTION_SKIN_WEIGHTS, sizeof(Vector4), numVertices);
+        pMesh->pSkinBoneIndices = (sBoneIndices*)GetSectionData(fileBuff, SECTION_SKIN_INDICES, sizeof(sBoneIndices), numVertices);
+
+        if ((numVertices && !pMesh->pVertices) || (numIndices && !pMesh->pIndices) || !pMesh->pSkinWeights != !pMesh->pSkinBoneIndices)
+        {
+            LOG_ERROR("[Error] CLoader::ReadSections(%s) - missing or truncated geometry sections\n", pszFilePath);
+            return false;
+        }
+
+        pMesh->numVertices = numVertices;
+        pMesh->numIndices = numIndices;
+
+        sMeshLodInfo* pLodInfo = (sMeshLodInfo*)GetSectionData(fileBuff, SECTION_MESH_LODS, sizeof(sMeshLodInfo), 1);
+        if (pLodInfo)
+        {
+            pMesh->numLods = pLodInfo->numLods;
+            pMesh->pLods = pLodInfo->lods;
+            pMesh->numLodIndices = pLodInfo->numIndices;
+            pMesh->pLodIndices = (unsigned short*)(pLodInfo + 1);
+        }
+
+        if (flags & LOAD_OPTIMIZE_VERTEX_CACHE)
+        {
+            KHM_STATS_STAGE(LOAD_STAGE_OPTIMIZE);
+            OptimizeMesh(pMesh, NULL);
+        }
+    }
+
+    if ((uiSections & MODEL_SECTION_COLLISION) && pModelDefinition->pMesh)
+    {
+        const sSectionEntry* pCollision = FindSection(fileBuff, SECTION_COLLISION);
+        if (pCollision)
+        {
+            sReadCursor ctx;
+            ctx.buff = fileBuff + pCollision->uiOffset;
+            ctx.buffsize = pCollision->uiSize;
+            ctx.buffread = 0;
+            ReadCollisionData(ctx, pModelDefinition);
+        }
+    }
+
+    if (uiSections & MODEL_SECTION_ANIMATION)
+    {
+        KHM_STATS_STAGE(LOAD_STAGE_ANIMATION);
+
+        const sSectionEntry* pSection = FindSection(fileBuff, SECTION_ANIMATION);
+        const sAnimationInfo* pInfo = (const sAnimationInfo*)GetSectionData(fileBuff, SECTION_ANIMATION, sizeof(sAnimationInfo), 1);
+        if (pInfo)
+        {
+            const unsigned long long uiTransformsSize = sizeof(sNodeTransform) * (unsigned long long)pInfo->numNodes * (unsigned long long)pInfo->numNodeFrames;
+            if (pInfo->numNodes < 0 || pInfo->numNodeFrames < 0 || pSection->uiSize - sizeof(sAnimationInfo) < uiTransformsSize)
+            {
+                LOG_ERROR("[Error] CLoader::ReadSections(%s) - truncated animation section\n", pszFilePath);
+                return false;
+            }
+
+            sAnimation* pAnimation = new (pModelDefinition->Alloc(sizeof(sAnimation))) sAnimation();
+            pAnimation->numNodes = pInfo->numNodes;
+            pAnimation->numNodeFrames = pInfo->numNodeFrames;
+            pAnimation->frameDurationMs = pInfo->frameDurationMs;
+            pAnimation->pNodeTransforms = (sNodeTransform*)(pInfo + 1);
+            BuildAnimationCopies(pModelDefinition, pAnimation, flags);
+
+            const sAnimationBoundsInfo* pBoundsInfo = (const sAnimationBoundsInfo*)GetSectionData(fileBuff, SECTION_ANIMATION_BOUNDS, sizeof(sAnimationBoundsInfo), 1);
+            if (pBoundsInfo)
+            {
+                pAnimation->pBounds = (const sAnimationBounds*)(pBoundsInfo + 1);
+                pAnimation->numBoundsGroups = pBoundsInfo->numGroups;
+                pAnimation->framesPerBoundsGroup = pBoundsInfo->framesPerGroup;
+            }
+            pModelDefinition->pAnimation = pAnimation;
+        }
+    }
+
+    if (uiSections & (MODEL_SECTION_SKELETON | MODEL_SECTION_MESH_INFO))
+        pModelDefinition->BuildNameIndex();
+
+    if (uiSections & MODEL_SECTION_ANIMATION_MASK)
+    {
+        KHM_STATS_STAGE(LOAD_STAGE_ANIMATION_MASK);
+
+        const sSectionEntry* pSection = FindSection(fileBuff, SECTION_ANIMATION_MASK);
+        if (pSection)
+        {
+            // an empty mask is still a mask; it masks everything
+            const sAnimationMaskEntry* pNodes = (const sAnimationMaskEntry*)GetSectionData(fileBuff, SECTION_ANIMATION_MASK, sizeof(sAnimationMaskEntry), pSection->uiCount);
+            pModelDefinition->pAnimationMask = new (pModelDefinition->Alloc(sizeof(sAnimationMask))) sAnimationMask();
+            CompileAnimationMask(pModelDefinition, pNodes, pNodes ? pSection->uiCount : 0, pModelDefinition->pAnimationMask);
+        }
+    }
+
+    pModelDefinition->uiSections |= uiSections;
     return true;
 }
 
+struct sLoadModelsJob
+{
+    const CLoader*      pLoader;
+    sLoadRequest*       pRequests;
+    std::atomic<int>    numLoaded;
+};
+
+void CLoader::LoadModelsJob(void* pUserData, int begin, int end)
+{
+    sLoadModelsJob* pJob = (sLoadModelsJob*)pUserData;
+
+    int numLoaded = 0;
+    for (int i = begin; i < end; ++i)
+    {
+        sLoadRequest& req = pJob->pRequests[i];
+        req.bResult = pJob->pLoader->LoadModel(req.pszFilePath, req.fileBuff, req.fileSize, req.pModelDefinition);
+        if (req.bResult)
+            ++numLoaded;
+    }
+
+    pJob->numLoaded += numLoaded;
+}
+
+int CLoader::LoadModels(sLoadRequest* pRequests, int numRequests, CJobPool* pJobPool) const
+{
+    sLoadModelsJob job;
+    job.pLoader = this;
+    job.pRequests = pRequests;
+    job.numLoaded = 0;
+
+    // models vary wildly in size, so keep the chunks small and let the pool balance them
+    if (pJobPool)
+        pJobPool->ParallelFor(numRequests, 4, LoadModelsJob, &job);
+    else
+        LoadModelsJob(&job, 0, numRequests);
+
+    return job.numLoaded;
+}
+
 }; // end namespace KHM
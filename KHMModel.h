@@ -12,10 +12,25 @@ namespace KHM
     // common defines for KHM
     //
 
-    #define KHM_VERSION                     101
+    #define KHM_VERSION_SEQUENTIAL          101 // bones, helpers, mesh, animation, mask; walked front to back
+    #define KHM_VERSION_SECTIONS            102 // section table; written by khm-bake
+    #define KHM_VERSION                     KHM_VERSION_SECTIONS
+    #define KHM_SECTION_ALIGNMENT           16
     #define KHM_MAX_OBJECT_NAME             48
     #define KHM_MAX_BONE_INFLUENCES         4 // max bone influences per vertex
     #define KHM_MAX_BONES                   64
+    #define KHM_MODEL_ALIGNMENT             32 // of every arena allocation; enough for the SIMD tracks ( KHM_SIMD_ALIGNMENT )
+    #define KHM_MODEL_ARENA_BLOCK_SIZE      1024 // smallest block chained on when the first one is full
+    #define KHM_MAX_MESH_LODS               8 // simplified levels after the full mesh
+
+    // keep the animation mask names around ( debugging only; the runtime uses the compiled bitset )
+    #ifndef KHM_ANIMATION_MASK_NAMES
+        #ifdef _DEBUG
+            #define KHM_ANIMATION_MASK_NAMES    1
+        #else
+            #define KHM_ANIMATION_MASK_NAMES    0
+        #endif
+    #endif
 
     //
     // header for KHM model
@@ -37,6 +52,49 @@ namespace KHM
         unsigned int            uiVer; // exporter model version
     };
 
+    //
+    // KHM v102 layout
+    //
+    //  [sHeader][sSectionTable][sSectionEntry * numSections][sections, KHM_SECTION_ALIGNMENT aligned]...
+    //
+    //  every section is a flat array ( or a small info struct followed by one ), so it can be used in place.
+    //  a loader only reads the table and the sections it was asked for
+    //
+
+    enum eSectionType
+    {
+        SECTION_BONES = 1,          // sObjectBase[count]
+        SECTION_HELPERS,            // sObjectBase[count]
+        SECTION_MESH,               // sMeshInfo
+        SECTION_VERTICES,           // Vector3[numVertices]
+        SECTION_NORMALS,            // Vector3[numVertices]
+        SECTION_INDICES,            // unsigned short[numIndices]
+        SECTION_FACE_NORMALS,       // Vector3[numIndices / 3]
+        SECTION_COLORS,             // unsigned int[numVertices]
+        SECTION_TEXCOORDS,          // Vector2[numVertices]; first set only
+        SECTION_SKIN_WEIGHTS,       // Vector4[numVertices]
+        SECTION_SKIN_INDICES,       // sBoneIndices[numVertices]
+        SECTION_COLLISION,          // count shapes, same records as v101
+        SECTION_ANIMATION,          // sAnimationInfo, then sNodeTransform[numNodeFrames * numNodes]
+        SECTION_ANIMATION_MASK,     // sAnimationMaskEntry[count]
+        SECTION_ANIMATION_BOUNDS,   // sAnimationBoundsInfo, then sAnimationBounds[numGroups]; needs SECTION_ANIMATION
+        SECTION_MESH_LODS,          // sMeshLodInfo, then unsigned short[numIndices]; needs SECTION_MESH
+    };
+
+    struct sSectionTable
+    {
+        unsigned int            numSections;
+        unsigned int            uiFileSize;
+    };
+
+    struct sSectionEntry
+    {
+        unsigned int            uiType;     // eSectionType
+        unsigned int            uiOffset;   // from the beginning of the file; KHM_SECTION_ALIGNMENT aligned
+        unsigned int            uiSize;     // in bytes
+        unsigned int            uiCount;    // number of elements, where it makes sense
+    };
+
 
     //
     // KHM Object Base ( common stuff for all objects )
@@ -63,6 +121,18 @@ namespace KHM
         unsigned char           ind[KHM_MAX_BONE_INFLUENCES];
     };
 
+    //
+    // KHM Mesh LOD - a simplified index buffer over the mesh's own vertices
+    //
+
+    struct sMeshLod // keep 4-byte aligned
+    {
+        unsigned int            uiFirstIndex;   // into sObjectMesh::pLodIndices
+        int                     numIndices;
+        float                   error;          // model space distance the level strays from the full mesh
+        unsigned int            uiReserved;
+    };
+
     //
     // KHM Mesh ( object with geometry )
     //
@@ -85,23 +155,10 @@ namespace KHM
             numCollisions       = 0;
             pCollisions         = NULL;
             volume              = 0.0f;
-        }
-
-        void Delete()
-        {
-            delete [] pVertices;
-            delete [] pNormals;
-            delete [] pColors;
-            delete [] pTexCoords[0];
-            delete [] pTexCoords[1];
-            delete [] pSkinWeights;
-            delete [] pSkinBoneIndices;
-            delete [] pIndices;
-            delete [] pFaceNormals;
-
-            for (int i = 0; i < numCollisions; ++i)
-                pCollisions[i].Destroy();
-            delete [] pCollisions;
+            numLods             = 0;
+            pLods               = NULL;
+            numLodIndices       = 0;
+            pLodIndices         = NULL;
         }
 
         int                     numVertices;
@@ -119,11 +176,37 @@ namespace KHM
         Vector3*                pFaceNormals;   // per-triangle normals
 
         int                     numCollisions;  // precise collisions for the object, using collision primitives
-        sCollisionShape*        pCollisions;
+        sCollisionShape*        pCollisions;    // hulls point into the file buffer ( bShared ), so no shape owns anything
 
         Vector3                 min;            // precomputed bounds for the entire model
         Vector3                 max;
         float                   volume;         // computed at load time, should export
+
+        // simplified levels, coarser and coarser; they share every vertex stream with the full mesh ( see KHMMeshLod.h )
+        int                     numLods;
+        const sMeshLod*         pLods;
+        int                     numLodIndices;
+        unsigned short*         pLodIndices;    // all levels, one after the other
+    };
+
+    // SECTION_MESH payload
+    struct sMeshInfo // keep 4-byte aligned
+    {
+        sObjectBase             base;
+        int                     numVertices;
+        int                     numIndices;
+        Vector3                 min;
+        Vector3                 max;
+        float                   volume;         // baked; v101 computes it at load time
+    };
+
+    // SECTION_MESH_LODS header; the indices of every level follow
+    struct sMeshLodInfo // keep 4-byte aligned
+    {
+        int                     numLods;
+        int                     numIndices;
+        unsigned int            uiReserved[2];
+        sMeshLod                lods[KHM_MAX_MESH_LODS];
     };
 
     //
@@ -152,24 +235,44 @@ namespace KHM
     // KHM Animation Mask
     //
 
-    // TODO: could be made better for runtime, since we only access the object names once, but the mask itself many times per frame
-    //  we should either keep a bitset or a bool masks[numBones]. The names should be kept in a different array, only for debugging purposes
+    // file layout; the names are resolved once at load time into sAnimationMask::bits
     struct sAnimationMaskEntry // keep 4-byte aligned
     {
         char                    szObjectName[KHM_MAX_OBJECT_NAME]; // object masked
         int                     mask; // true or false; 1 - use object; 0 - mask object
     };
 
+    #define KHM_ANIMATION_MASK_WORDS        ((KHM_MAX_BONES + 31) / 32)
+
     struct sAnimationMask
     {
-        sAnimationMaskEntry*    pNodes;
+        // bit per object id ( == animation node ); 1 - use object; 0 - mask object. objects not listed in the file are masked
+        unsigned int            bits[KHM_ANIMATION_MASK_WORDS];
+
+        bool IsUsed(const unsigned int uiId) const
+        {
+            return uiId < KHM_MAX_BONES && (bits[uiId >> 5] & (1u << (uiId & 31))) != 0;
+        }
+
+#if KHM_ANIMATION_MASK_NAMES
+        sAnimationMaskEntry*    pNodes;     // debug only side table, points into the file buffer
         int                     numNodes;
+#endif
     };
 
     //
     // KHM Animation Data
     //
 
+    struct sAnimationTracks;        // KHMAnimation.h
+    struct sCompressedAnimation;    // KHMAnimationCompression.h
+
+    // model space box of the skinned mesh over a group of keyframes
+    struct sAnimationBounds // keep 4-byte aligned
+    {
+        Vector3                 min;
+        Vector3                 max;
+    };
 
     struct sAnimation
     {
@@ -182,12 +285,78 @@ namespace KHM
         int                     numNodes;               //NOTE: This isn't necessarily equal to the number of nodes ( because of attachments )
         int                     numNodeFrames;          // number of frames per node
         float                   frameDurationMs;        // single frame duration in millis
+
+        sAnimationTracks*       pTracks;                // SoA copy of pNodeTransforms for sampling; only built with LOAD_ANIMATION_TRACKS
+        sCompressedAnimation*   pCompressed;            // compressed copy of pNodeTransforms; only built with LOAD_COMPRESS_ANIMATION
+
+        const sAnimationBounds* pBounds;                // skinned mesh boxes, baked; NULL = none ( see KHMAnimationBounds.h )
+        int                     numBoundsGroups;
+        int                     framesPerBoundsGroup;   // keyframes each box covers
+    };
+
+    // SECTION_ANIMATION header; the transforms follow, still 16-byte aligned
+    struct sAnimationInfo
+    {
+        int                     numNodes;
+        int                     numNodeFrames;
+        float                   frameDurationMs;
+        unsigned int            uiReserved;
+    };
+
+    // SECTION_ANIMATION_BOUNDS header; the boxes follow, one per framesPerGroup keyframes
+    struct sAnimationBoundsInfo
+    {
+        int                     numGroups;      // ( numNodeFrames + framesPerGroup - 1 ) / framesPerGroup
+        int                     framesPerGroup;
+        unsigned int            uiReserved[2];
+    };
+
+    //
+    // KHM Name Index - open addressing hash table over helpers, bones and the mesh
+    //
+
+    struct sNameIndexEntry
+    {
+        unsigned int            uiHash;         // HashName()
+        unsigned short          type;           // NAME_INDEX_*
+        unsigned short          index;          // into lHelpers / lBones
+    };
+
+    #define NAME_INDEX_HELPER               0
+    #define NAME_INDEX_BONE                 1
+    #define NAME_INDEX_MESH                 2
+    #define NAME_INDEX_EMPTY                0xFFFF
+
+    //
+    // KHM Model Allocator - where the memory a model keeps comes from
+    //
+
+    typedef void* (*ModelAllocFunc)(void* pUserData, size_t uiSize); // KHM_MODEL_ALIGNMENT aligned
+    typedef void (*ModelFreeFunc)(void* pUserData, void* pBlock, size_t uiSize);
+
+    struct sModelAllocator
+    {
+        ModelAllocFunc          alloc;          // NULL = the heap
+        ModelFreeFunc           free;
+        void*                   pUserData;
+    };
+
+    // header of every block a model holds. the loader sizes the first block from the validated counts, so a load asks
+    // the allocator once; blocks are only chained on for what couldn't be sized up front ( streamed v101 stages,
+    // sections deferred with LOAD_COMPRESS_ANIMATION )
+    struct sModelArenaBlock
+    {
+        sModelArenaBlock*       pNext;
+        size_t                  uiSize;         // this header included
+        size_t                  uiUsed;
     };
 
     //
     // KHM Model Definition
     //
 
+    struct sLoadStats;              // KHMStats.h
+
     struct sModelDefinition
     {
         void Init()
@@ -200,22 +369,30 @@ namespace KHM
             lBones = NULL;
             pAnimation = NULL;
             pAnimationMask = NULL;
+            lNameIndex = NULL;
+            uiNameIndexMask = 0;
+            uiSections = 0;
+            pLoadStats = NULL;
+            allocator.alloc = NULL;
+            allocator.free = NULL;
+            allocator.pUserData = NULL;
+            pArena = NULL;
         }
 
-        void Destroy()
-        {
-            // everything else points to chunks from 'membuff'
-            if (pMesh)
-            {
-                delete[] pMesh->pCollisions;
-                delete pMesh;
-            }
-            delete pAnimation;
-            delete pAnimationMask;
-        }
+        // frees the arena blocks; nothing in the model is freed on its own
+        void Destroy();
 
         const sObjectBase*      GetObjectById(const unsigned int uiId) const;
         const sObjectBase*      GetObjectByName(const char* nodeName) const;
+        const sObjectBase*      GetObjectByHash(const unsigned int uiNameHash) const; // HashName / HashNameConst; same priority as GetObjectByName, and the same scan without a name index
+
+        void                    BuildNameIndex();
+        void                    ReserveNameIndex(int numObjects); // so a later BuildNameIndex with up to numObjects doesn't allocate
+
+        // from the arena, KHM_MODEL_ALIGNMENT aligned; lives until Destroy
+        void*                   Alloc(size_t uiSize);
+        // first block of the arena, before anything is allocated
+        bool                    ReserveArena(size_t uiSize);
 
         char                    szFileName[MAX_PATH_STD]; // original filename, here only for debugging purposes
         sObjectMesh*            pMesh;          // list of all the meshes
@@ -225,39 +402,136 @@ namespace KHM
         sObjectBase*            lBones;         // list with all the bones
         sAnimation*             pAnimation;     // animations in the KHM file
         sAnimationMask*         pAnimationMask; // masks for this animation; to remove this ! and move it to the skeleton / animation manager
+
+        sNameIndexEntry*        lNameIndex;     // built at load time; power of 2 sized
+        unsigned int            uiNameIndexMask;
+
+        unsigned int            uiSections;     // MODEL_SECTION_* loaded so far
+        sLoadStats*             pLoadStats;     // LOAD_COLLECT_STATS only
+
+        sModelAllocator         allocator;      // the loader's; every block goes back through it
+        sModelArenaBlock*       pArena;         // the block with the most room left first; the mesh, shapes, animation and its copies, mask, name index, stats
+
+    private:
+        const sObjectBase*      GetIndexedObject(const sNameIndexEntry& entry) const;
+    };
+
+    //
+    // KHM Load Request - one entry of a batch load
+    //
+
+    struct sLoadRequest
+    {
+        const char*             pszFilePath;
+        unsigned char*          fileBuff;
+        unsigned int            fileSize;
+        sModelDefinition*       pModelDefinition;
+        bool                    bResult;        // filled by LoadModels
+    };
+
+    //
+    // KHM Loader flags
+    //
+
+    enum eLoadFlags
+    {
+        LOAD_ANIMATION_TRACKS           = (1 << 0), // build sAnimation::pTracks ( SoA, for SIMD pose sampling )
+        LOAD_COMPRESS_ANIMATION         = (1 << 1), // build sAnimation::pCompressed ( default sCompressionSettings )
+        LOAD_OPTIMIZE_VERTEX_CACHE      = (1 << 2), // reorder triangles / vertices for the GPU caches; writes to the file buffer
+        LOAD_COLLECT_STATS              = (1 << 3), // fill sModelDefinition::pLoadStats and the process totals ( KHMStats.h )
+    };
+
+    // flags that modify the file buffer; not allowed on read only buffers ( eg. CPack mappings )
+    #define LOAD_FLAGS_WRITE_BUFFER         (LOAD_OPTIMIZE_VERTEX_CACHE)
+
+    //
+    // KHM Model sections - what parts of a model to load
+    //
+
+    enum eModelSections
+    {
+        MODEL_SECTION_SKELETON          = (1 << 0), // bones and helpers
+        MODEL_SECTION_MESH              = (1 << 1), // mesh object and its vertex / index streams
+        MODEL_SECTION_COLLISION         = (1 << 2), // collision shapes of the mesh
+        MODEL_SECTION_ANIMATION         = (1 << 3),
+        MODEL_SECTION_ANIMATION_MASK    = (1 << 4), // needs the skeleton, pulls it in
+        MODEL_SECTION_MESH_INFO         = (1 << 5), // mesh object with its bounds and volume, no streams; implied by MESH and COLLISION
+
+        MODEL_SECTIONS_ALL              = 0x3F
     };
 
     //
     // KHM File Loader
     //
 
+    class CJobPool;
+    class CModelStream;
+    struct sModelLayout;
+
     class CLoader
     {
+        friend class CModelStream; // KHMStream.h; drives the Read* functions as the bytes arrive
+
         public:
             CLoader();
 
         public:
-            bool LoadModel(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize, sModelDefinition* pModelDefinition);
+            void SetFlags(unsigned int uiFlags) { flags = uiFlags; }
+            unsigned int GetFlags() const { return flags; }
+
+            // for the models loaded from now on; pools can pick a block by size, every load asks for one up front
+            void SetAllocator(const sModelAllocator& modelAllocator) { allocator = modelAllocator; }
+            const sModelAllocator& GetAllocator() const { return allocator; }
+
+            bool LoadModel(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize, sModelDefinition* pModelDefinition) const;
+
+            // every load validates what it reads first ( ValidateModelSections, KHMValidate.h ), so malformed files are rejected instead of
+            // read past. v102 only validates and reads the requested sections ( MODEL_SECTION_* ), plus the counts at the head of the others
+            // to size the memory; v101 files are always loaded entirely
+            bool LoadModelSections(const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize, unsigned int uiSections, sModelDefinition* pModelDefinition) const;
+
+            // adds more sections to a model loaded by LoadModelSections, from the same buffer; only the added sections are validated
+            bool LoadDeferredSections(unsigned char* fileBuff, unsigned int fileSize, unsigned int uiSections, sModelDefinition* pModelDefinition) const;
+
+            // fast path for files validated earlier ( eg. at cook time ); no checks at all, the layout must come from ValidateModel on these bytes
+            bool LoadValidatedModel(const char* pszFilePath, unsigned char* fileBuff, const sModelLayout& layout, sModelDefinition* pModelDefinition) const;
+
+            // loads all the requests in parallel on pJobPool ( or on the calling thread, if NULL ); returns the number of models loaded successfully
+            int LoadModels(sLoadRequest* pRequests, int numRequests, CJobPool* pJobPool) const;
 
         private:
-            void ReadAnimation( sModelDefinition* pModelDefinition );
-            void ReadAnimationMask( sModelDefinition* pModelDefinition );
+            // parse cursor, one per LoadModel call
+            struct sReadCursor
+            {
+                unsigned char*  buff;
+                unsigned int    buffsize;
+                int             buffread;
+            };
+
+            static void LoadModelsJob(void* pUserData, int begin, int end);
+
+            void ReadAnimation( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const;
+            void ReadAnimationMask( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const;
             
-            void ReadMeshes( sModelDefinition* pModelDefinition );
-            void ReadBones( sModelDefinition* pModelDefinition );
-            void ReadHelpers( sModelDefinition* pModelDefinition );
-
-            void ReadGeometry( sObjectMesh* pMesh );
-            void ReadSkin( sObjectMesh* pMesh );
-            void ReadCollisionData( sObjectMesh* pMesh );
-            void ReadText( char* szBuffer, unsigned int uiBufferLen );
-            void ReadBytes( void* pDest, int sizeToRead );
-            unsigned char* ReadBytes(int sizeToRead);
-            void ReadBytesSkip( int numBytesSkip );
+            void ReadMeshes( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const;
+            void ReadBones( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const;
+            void ReadHelpers( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const;
+
+            void ReadGeometry( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const;
+            void ReadSkin( sReadCursor& ctx, sObjectMesh* pMesh ) const;
+            void ReadCollisionData( sReadCursor& ctx, sModelDefinition* pModelDefinition ) const;
+            // v102
+            bool ReadSections( unsigned char* fileBuff, unsigned int uiSections, sModelDefinition* pModelDefinition ) const;
+            const sSectionEntry* FindSection( unsigned char* fileBuff, unsigned int uiType ) const;
+            void* GetSectionData( unsigned char* fileBuff, unsigned int uiType, unsigned int uiElementSize, unsigned int uiCount ) const;
+
+            void ReadText( sReadCursor& ctx, char* szBuffer, unsigned int uiBufferLen ) const;
+            void ReadBytes( sReadCursor& ctx, void* pDest, int sizeToRead ) const;
+            unsigned char* ReadBytes( sReadCursor& ctx, int sizeToRead ) const;
+            void ReadBytesSkip( sReadCursor& ctx, int numBytesSkip ) const;
 
-    private:
-            unsigned char* buff;
-            unsigned int buffsize;
-            int buffread;
+        private:
+            unsigned int flags; // eLoadFlags
+            sModelAllocator allocator;
     };
 };
@@ -0,0 +1,340 @@
+#include "KHMPack.h"
+#include "KHMHash.h"
+#include "Kernel/Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+namespace KHM {
+
+//
+// CPack
+//
+
+CPack::CPack() :
+    mapping(NULL),
+    mappingSize(0),
+    lEntries(NULL),
+    numEntries(0)
+#ifdef _WIN32
+    ,
+    hFile(INVALID_HANDLE_VALUE),
+    hMapping(NULL)
+#endif
+{
+}
+
+CPack::~CPack()
+{
+    Close();
+}
+
+bool CPack::Open(const char* pszPackPath)
+{
+    Close();
+
+#ifdef _WIN32
+    hFile = CreateFileA(pszPackPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        LOG_ERROR("[Error] CPack::Open(%s) - can't open file.\n", pszPackPath);
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx((HANDLE)hFile, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(sPackHeader))
+    {
+        LOG_ERROR("[Error] CPack::Open(%s) - file too small.\n", pszPackPath);
+        Close();
+        return false;
+    }
+
+    hMapping = CreateFileMappingA((HANDLE)hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping)
+        mapping = (unsigned char*)MapViewOfFile((HANDLE)hMapping, FILE_MAP_READ, 0, 0, 0);
+
+    mappingSize = (unsigned long long)fileSize.QuadPart;
+#else
+    const int fd = open(pszPackPath, O_RDONLY);
+    if (fd < 0)
+    {
+        LOG_ERROR("[Error] CPack::Open(%s) - can't open file.\n", pszPackPath);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(sPackHeader))
+    {
+        LOG_ERROR("[Error] CPack::Open(%s) - file too small.\n", pszPackPath);
+        close(fd);
+        return false;
+    }
+
+    // MAP_SHARED + read only: every process mapping this pack shares the same page cache pages
+    void* pView = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+
+    if (pView != MAP_FAILED)
+        mapping = (unsigned char*)pView;
+
+    mappingSize = (unsigned long long)st.st_size;
+#endif
+
+    if (!mapping)
+    {
+        LOG_ERROR("[Error] CPack::Open(%s) - can't map file.\n", pszPackPath);
+        Close();
+        return false;
+    }
+
+    const sPackHeader* pHeader = (const sPackHeader*)mapping;
+    if( pHeader->uiSig[0] != 'K' ||
+        pHeader->uiSig[1] != 'H' ||
+        pHeader->uiSig[2] != 'P' )
+    {
+        LOG_ERROR("[Error] CPack::Open(%s) - pack header mismatch.\n", pszPackPath);
+        Close();
+        return false;
+    }
+
+    if( pHeader->uiVer != KHM_PACK_VERSION )
+    {
+        LOG_ERROR("[Error] CPack::Open(%s) - wrong pack version %u, expected %u\n", pszPackPath, pHeader->uiVer, KHM_PACK_VERSION);
+        Close();
+        return false;
+    }
+
+    if( pHeader->uiDirOffset + (unsigned long long)pHeader->numEntries * sizeof(sPackEntry) > mappingSize )
+    {
+        LOG_ERROR("[Error] CPack::Open(%s) - directory out of bounds.\n", pszPackPath);
+        Close();
+        return false;
+    }
+
+    lEntries = (const sPackEntry*)(mapping + pHeader->uiDirOffset);
+    numEntries = (int)pHeader->numEntries;
+
+    for (int i = 0; i < numEntries; ++i)
+    {
+        // written so a huge uiOffset can't wrap around
+        if (lEntries[i].uiOffset > mappingSize || lEntries[i].uiSize > mappingSize - lEntries[i].uiOffset)
+        {
+            LOG_ERROR("[Error] CPack::Open(%s) - entry %d out of bounds.\n", pszPackPath, i);
+            Close();
+            return false;
+        }
+
+        // FindEntry is a binary search; CPackWriter never writes two entries with the same hash
+        if (i > 0 && lEntries[i].uiNameHash <= lEntries[i - 1].uiNameHash)
+        {
+            LOG_ERROR("[Error] CPack::Open(%s) - directory not sorted by hash at entry %d.\n", pszPackPath, i);
+            Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CPack::Close()
+{
+#ifdef _WIN32
+    if (mapping)
+        UnmapViewOfFile(mapping);
+    if (hMapping)
+        CloseHandle((HANDLE)hMapping);
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle((HANDLE)hFile);
+
+    hMapping = NULL;
+    hFile = INVALID_HANDLE_VALUE;
+#else
+    if (mapping)
+        munmap(mapping, (size_t)mappingSize);
+#endif
+
+    mapping = NULL;
+    mappingSize = 0;
+    lEntries = NULL;
+    numEntries = 0;
+}
+
+const sPackEntry* CPack::FindEntry(const unsigned int uiNameHash) const
+{
+    // directory is sorted by hash
+    int lo = 0;
+    int hi = numEntries - 1;
+    while (lo <= hi)
+    {
+        const int mid = (lo + hi) >> 1;
+        const unsigned int uiHash = lEntries[mid].uiNameHash;
+        if (uiHash == uiNameHash)
+            return &lEntries[mid];
+
+        if (uiHash < uiNameHash)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return NULL;
+}
+
+const sPackEntry* CPack::FindEntry(const char* pszModelPath) const
+{
+    return FindEntry(HashPath(pszModelPath));
+}
+
+bool CPack::LoadModel(const CLoader& loader, const char* pszModelPath, sModelDefinition* pModelDefinition) const
+{
+    const sPackEntry* pEntry = FindEntry(pszModelPath);
+    if (!pEntry)
+    {
+        LOG_ERROR("[Error] CPack::LoadModel(%s) - model not found in pack.\n", pszModelPath);
+        return false;
+    }
+
+    // the mapping is read only; flags that write to the file buffer have to be baked into the pack instead
+    if (loader.GetFlags() & LOAD_FLAGS_WRITE_BUFFER)
+    {
+        CLoader readOnlyLoader(loader);
+        readOnlyLoader.SetFlags(loader.GetFlags() & ~LOAD_FLAGS_WRITE_BUFFER);
+        return readOnlyLoader.LoadModel(pszModelPath, (unsigned char*)GetEntryData(pEntry), pEntry->uiSize, pModelDefinition);
+    }
+
+    return loader.LoadModel(pszModelPath, (unsigned char*)GetEntryData(pEntry), pEntry->uiSize, pModelDefinition);
+}
+
+//
+// CPackWriter
+//
+
+CPackWriter::CPackWriter() :
+    lPending(NULL),
+    numPending(0),
+    maxPending(0)
+{
+}
+
+CPackWriter::~CPackWriter()
+{
+    free(lPending);
+}
+
+bool CPackWriter::AddModel(const char* pszModelPath, const unsigned char* fileBuff, unsigned int fileSize)
+{
+    const sHeader* pHeader = (const sHeader*)fileBuff;
+    if( fileSize < sizeof(sHeader) ||
+        pHeader->uiSig[0] != 'K' ||
+        pHeader->uiSig[1] != 'H' ||
+        pHeader->uiSig[2] != 'M' )
+    {
+        LOG_ERROR("[Error] CPackWriter::AddModel(%s) - KHM header mismatch.\n", pszModelPath);
+        return false;
+    }
+
+    const unsigned int uiHash = HashPath(pszModelPath);
+    for (int i = 0; i < numPending; ++i)
+    {
+        if (lPending[i].entry.uiNameHash == uiHash)
+        {
+            LOG_ERROR("[Error] CPackWriter::AddModel(%s) - name hash collides with '%s'.\n", pszModelPath, lPending[i].szName);
+            return false;
+        }
+    }
+
+    if (numPending == maxPending)
+    {
+        const int maxGrown = Max(maxPending * 2, 64);
+        sPendingEntry* lGrown = (sPendingEntry*)realloc(lPending, sizeof(sPendingEntry) * maxGrown);
+        if (!lGrown)
+        {
+            LOG_ERROR("[Error] CPackWriter::AddModel(%s) - out of memory.\n", pszModelPath);
+            return false;
+        }
+
+        lPending = lGrown;
+        maxPending = maxGrown;
+    }
+
+    sPendingEntry& pending = lPending[numPending++];
+    memset(&pending, 0, sizeof(pending));
+    pending.entry.uiNameHash = uiHash;
+    pending.entry.uiVer = pHeader->uiVer;
+    pending.entry.uiSize = fileSize;
+    pending.pData = fileBuff;
+    strncpy(pending.szName, pszModelPath, MAX_PATH_STD - 1);
+
+    return true;
+}
+
+static int ComparePendingEntries(const void* a, const void* b)
+{
+    const unsigned int ha = ((const sPackEntry*)a)->uiNameHash;
+    const unsigned int hb = ((const sPackEntry*)b)->uiNameHash;
+    return (ha < hb) ? -1 : (ha > hb) ? 1 : 0;
+}
+
+bool CPackWriter::Write(const char* pszPackPath)
+{
+    // sPendingEntry starts with its sPackEntry, so we can sort on it directly
+    qsort(lPending, numPending, sizeof(sPendingEntry), ComparePendingEntries);
+
+    sPackHeader header;
+    header.numEntries = numPending;
+    header.uiDirOffset = sizeof(sPackHeader);
+
+    // directory goes right after the header, so opening a pack only touches the first pages
+    unsigned long long uiOffset = header.uiDirOffset + sizeof(sPackEntry) * numPending;
+    for (int i = 0; i < numPending; ++i)
+    {
+        uiOffset = (uiOffset + KHM_PACK_DATA_ALIGNMENT - 1) & ~(unsigned long long)(KHM_PACK_DATA_ALIGNMENT - 1);
+        lPending[i].entry.uiOffset = uiOffset;
+        uiOffset += lPending[i].entry.uiSize;
+    }
+
+    FILE* f = fopen(pszPackPath, "wb");
+    if (!f)
+    {
+        LOG_ERROR("[Error] CPackWriter::Write(%s) - can't open file for writing.\n", pszPackPath);
+        return false;
+    }
+
+    bool bOk = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (int i = 0; bOk && i < numPending; ++i)
+        bOk = fwrite(&lPending[i].entry, sizeof(sPackEntry), 1, f) == 1;
+
+    static const unsigned char padding[KHM_PACK_DATA_ALIGNMENT] = { 0 };
+    unsigned long long uiWritten = header.uiDirOffset + sizeof(sPackEntry) * numPending;
+    for (int i = 0; bOk && i < numPending; ++i)
+    {
+        const sPackEntry& entry = lPending[i].entry;
+        if (entry.uiOffset > uiWritten)
+            bOk = fwrite(padding, (size_t)(entry.uiOffset - uiWritten), 1, f) == 1;
+        if (bOk && entry.uiSize)
+            bOk = fwrite(lPending[i].pData, entry.uiSize, 1, f) == 1;
+        uiWritten = entry.uiOffset + entry.uiSize;
+    }
+
+    if (fclose(f) != 0)
+        bOk = false;
+
+    if (!bOk)
+        LOG_ERROR("[Error] CPackWriter::Write(%s) - write failed.\n", pszPackPath);
+
+    return bOk;
+}
+
+}; // end namespace KHM
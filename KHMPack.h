@@ -0,0 +1,126 @@
+#pragma once
+
+#include "KHMModel.h"
+
+namespace KHM
+{
+    //
+    // common defines for KHM packs
+    //
+
+    #define KHM_PACK_VERSION                1
+    #define KHM_PACK_DATA_ALIGNMENT         16 // every model starts on a 16 byte boundary inside the pack
+
+    //
+    // KHM Pack layout
+    //
+    //  [sPackHeader][sPackEntry * numEntries][model data, aligned]...
+    //
+    //  the directory is sorted by name hash, so lookups are a binary search over the mapped directory.
+    //  models are stored exactly as the exporter wrote them, so CLoader can parse them in place
+    //
+
+    struct sPackHeader
+    {
+        sPackHeader()
+        {
+            uiSig[0] = 'K';
+            uiSig[1] = 'H';
+            uiSig[2] = 'P';
+            uiSig[3] = '\0';
+
+            uiVer = KHM_PACK_VERSION;
+            numEntries = 0;
+            uiDirOffset = 0;
+        }
+
+        unsigned char           uiSig[4];   // file signature; static; 'KHP\0'
+        unsigned int            uiVer;      // pack version
+        unsigned int            numEntries; // number of models in the pack
+        unsigned int            uiDirOffset;// offset of the first sPackEntry
+    };
+
+    struct sPackEntry // keep 8-byte aligned
+    {
+        unsigned int            uiNameHash; // HashPath() of the model path
+        unsigned int            uiVer;      // KHM version of the model, copied from its sHeader
+        unsigned long long      uiOffset;   // offset of the model data from the beginning of the pack
+        unsigned int            uiSize;     // size of the model data
+        unsigned int            uiReserved;
+    };
+
+    //
+    // KHM Pack - read only, memory mapped view over a pack file
+    //
+    // the mapping is shared ( the OS keeps a single copy of the pages for every process mapping the same pack ),
+    // and nothing is read until a model is actually loaded, so we only pay for the pages we touch.
+    // models loaded from a pack point straight into the mapping, so the pack must outlive them
+    //
+
+    class CPack
+    {
+        public:
+            CPack();
+            ~CPack();
+
+        public:
+            bool Open(const char* pszPackPath);
+            void Close();
+            bool IsOpen() const { return mapping != NULL; }
+
+            int GetNumEntries() const { return numEntries; }
+            const sPackEntry* GetEntry(int index) const { return &lEntries[index]; }
+            const sPackEntry* FindEntry(const unsigned int uiNameHash) const;
+            const sPackEntry* FindEntry(const char* pszModelPath) const;
+            const unsigned char* GetEntryData(const sPackEntry* pEntry) const { return mapping + pEntry->uiOffset; }
+
+            bool LoadModel(const CLoader& loader, const char* pszModelPath, sModelDefinition* pModelDefinition) const;
+
+        private:
+            CPack(const CPack&);
+            CPack& operator=(const CPack&);
+
+        private:
+            unsigned char*          mapping;
+            unsigned long long      mappingSize;
+            const sPackEntry*       lEntries;
+            int                     numEntries;
+
+#ifdef _WIN32
+            void*                   hFile;
+            void*                   hMapping;
+#endif
+    };
+
+    //
+    // KHM Pack Writer - builds a pack out of already loaded .khm files
+    //
+
+    class CPackWriter
+    {
+        public:
+            CPackWriter();
+            ~CPackWriter();
+
+        public:
+            // fileBuff is not copied, it must stay valid until Write() returns
+            bool AddModel(const char* pszModelPath, const unsigned char* fileBuff, unsigned int fileSize);
+            bool Write(const char* pszPackPath);
+
+        private:
+            CPackWriter(const CPackWriter&);
+            CPackWriter& operator=(const CPackWriter&);
+
+            struct sPendingEntry
+            {
+                sPackEntry              entry;
+                const unsigned char*    pData;
+                char                    szName[MAX_PATH_STD];
+            };
+
+        private:
+            sPendingEntry*          lPending;
+            int                     numPending;
+            int                     maxPending;
+    };
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdlib.h>
+
+//
+// SIMD configuration for KHM runtime kernels
+//
+// kernels are selected at compile time; every SIMD path has a scalar fallback
+//
+
+// the AVX2 kernels use FMA; gcc and clang enable it with its own flag ( -mfma ), /arch:AVX2 enables both
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+    #define KHM_SIMD_AVX2                   1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define KHM_SIMD_SSE                    1
+#endif
+
+#if defined(KHM_SIMD_AVX2)
+    #include <immintrin.h>
+#elif defined(KHM_SIMD_SSE)
+    #include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+    #include <malloc.h>
+#endif
+
+namespace KHM
+{
+    #define KHM_SIMD_ALIGNMENT              32 // enough for AVX
+    #define KHM_SIMD_LANES                  8  // SoA arrays are padded to this, so kernels never need a scalar tail
+
+    inline int SimdPadCount(int count)
+    {
+        return (count + KHM_SIMD_LANES - 1) & ~(KHM_SIMD_LANES - 1);
+    }
+
+    inline void* AlignedAlloc(size_t size)
+    {
+#ifdef _WIN32
+        return _aligned_malloc(size, KHM_SIMD_ALIGNMENT);
+#else
+        void* p = NULL;
+        if (posix_memalign(&p, KHM_SIMD_ALIGNMENT, size) != 0)
+            return NULL;
+        return p;
+#endif
+    }
+
+    inline void AlignedFree(void* p)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+
+#if defined(KHM_SIMD_SSE)
+    // all ones for the lanes whose bit is set, bits i .. i + 3 of a bitset; i is a multiple of 4
+    inline __m128 SimdBitLanes4(const unsigned int* pBits, int i)
+    {
+        const __m128i vLaneBits = _mm_set_epi32(8, 4, 2, 1);
+        const unsigned int nibble = (pBits[i >> 5] >> (i & 31)) & 0xF;
+        const __m128i vBits = _mm_and_si128(_mm_set1_epi32((int)nibble), vLaneBits);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(vBits, vLaneBits));
+    }
+#endif
+};
@@ -0,0 +1,436 @@
+#include "KHMSkeleton.h"
+#include "KHMAnimation.h"
+#include "KHMJobs.h"
+#include "KHMSimd.h"
+#include "Kernel/Log.h"
+
+namespace KHM {
+
+//
+// skeleton
+//
+
+sSkeleton* CreateSkeleton(const sModelDefinition* pModelDefinition)
+{
+    return CreateSkeleton(pModelDefinition->lBones, pModelDefinition->numBones, pModelDefinition->lHelpers, pModelDefinition->numHelpers, pModelDefinition->szFileName);
+}
+
+sSkeleton* CreateSkeleton(const sObjectBase* lBones, int numBones, const sObjectBase* lHelpers, int numHelpers, const char* pszName)
+{
+    const int numJoints = numBones + numHelpers;
+    if (numJoints <= 0)
+        return NULL;
+
+    // gather bones and helpers, indexed by object id
+    int numObjects = 0;
+    for (int i = 0; i < numJoints; ++i)
+    {
+        const sObjectBase& obj = (i < numBones) ? lBones[i] : lHelpers[i - numBones];
+        numObjects = Max(numObjects, (int)obj.uiId + 1);
+    }
+
+    const sObjectBase** lObjects = new const sObjectBase*[numObjects];
+    memset(lObjects, 0, sizeof(sObjectBase*) * numObjects);
+    for (int i = 0; i < numJoints; ++i)
+    {
+        const sObjectBase& obj = (i < numBones) ? lBones[i] : lHelpers[i - numBones];
+        lObjects[obj.uiId] = &obj;
+    }
+
+    sSkeleton* pSkeleton = new sSkeleton();
+    pSkeleton->numJoints = numJoints;
+    pSkeleton->numObjects = numObjects;
+    pSkeleton->pParents = new short[numJoints];
+    pSkeleton->pObjectIds = new unsigned short[numJoints];
+    pSkeleton->pObjectToJoint = new short[numObjects];
+    pSkeleton->pBindLocals = (float*)AlignedAlloc(sizeof(float) * 12 * numJoints);
+    pSkeleton->numBones = numBones;
+    pSkeleton->pInverseBind = new sMatrix3x4[Max(numBones, 1)];
+
+    for (int i = 0; i < numObjects; ++i)
+        pSkeleton->pObjectToJoint[i] = -1;
+
+    // topological order: emit an object once its parent is in; whatever is left after that has a broken chain and becomes a root
+    int numSorted = 0;
+    for (bool bProgress = true; bProgress && numSorted < numJoints; )
+    {
+        bProgress = false;
+        for (int id = 0; id < numObjects; ++id)
+        {
+            const sObjectBase* pObj = lObjects[id];
+            if (!pObj || pSkeleton->pObjectToJoint[id] >= 0)
+                continue;
+
+            const unsigned int uiParentId = pObj->uiParentId;
+            const bool bRoot = uiParentId >= (unsigned int)numObjects || !lObjects[uiParentId] || uiParentId == (unsigned int)id;
+            if (!bRoot && pSkeleton->pObjectToJoint[uiParentId] < 0)
+                continue;
+
+            pSkeleton->pParents[numSorted] = bRoot ? -1 : pSkeleton->pObjectToJoint[uiParentId];
+            pSkeleton->pObjectIds[numSorted] = (unsigned short)id;
+            pSkeleton->pObjectToJoint[id] = (short)numSorted;
+            ++numSorted;
+            bProgress = true;
+        }
+    }
+
+    if (numSorted < numJoints)
+    {
+        LOG_ERROR("[Error] CreateSkeleton(%s) - cycle in the hierarchy, breaking it\n", pszName);
+        for (int id = 0; id < numObjects; ++id)
+        {
+            if (lObjects[id] && pSkeleton->pObjectToJoint[id] < 0)
+            {
+                pSkeleton->pParents[numSorted] = -1;
+                pSkeleton->pObjectIds[numSorted] = (unsigned short)id;
+                pSkeleton->pObjectToJoint[id] = (short)numSorted;
+                ++numSorted;
+            }
+        }
+    }
+
+    // SoA bind locals
+    for (int j = 0; j < numJoints; ++j)
+    {
+        sMatrix3x4 local;
+        Matrix3x4FromMatrix(lObjects[pSkeleton->pObjectIds[j]]->matLocal, local);
+        for (int e = 0; e < 12; ++e)
+            pSkeleton->pBindLocals[e * numJoints + j] = local.row[e >> 2][e & 3];
+    }
+
+    for (int b = 0; b < numBones; ++b)
+    {
+        sMatrix3x4 bindGlobal;
+        Matrix3x4FromMatrix(lBones[b].matGlobal, bindGlobal);
+        if (!InvertMatrix3x4(bindGlobal, pSkeleton->pInverseBind[b]))
+            SetIdentity(pSkeleton->pInverseBind[b]);
+    }
+
+    delete [] lObjects;
+    return pSkeleton;
+}
+
+void DestroySkeleton(sSkeleton* pSkeleton)
+{
+    if (!pSkeleton)
+        return;
+
+    delete [] pSkeleton->pParents;
+    delete [] pSkeleton->pObjectIds;
+    delete [] pSkeleton->pObjectToJoint;
+    AlignedFree(pSkeleton->pBindLocals);
+    delete [] pSkeleton->pInverseBind;
+    delete pSkeleton;
+}
+
+//
+// transforms
+//
+
+void ComposeMatrix3x4(const float* q, const float* t, const float* s, sMatrix3x4& out)
+{
+    const float x = q[0], y = q[1], z = q[2], w = q[3];
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float wx = w * x, wy = w * y, wz = w * z;
+
+    out.row[0][0] = (1.0f - 2.0f * (yy + zz)) * s[0];
+    out.row[0][1] = (2.0f * (xy - wz)) * s[1];
+    out.row[0][2] = (2.0f * (xz + wy)) * s[2];
+    out.row[0][3] = t[0];
+
+    out.row[1][0] = (2.0f * (xy + wz)) * s[0];
+    out.row[1][1] = (1.0f - 2.0f * (xx + zz)) * s[1];
+    out.row[1][2] = (2.0f * (yz - wx)) * s[2];
+    out.row[1][3] = t[1];
+
+    out.row[2][0] = (2.0f * (xz - wy)) * s[0];
+    out.row[2][1] = (2.0f * (yz + wx)) * s[1];
+    out.row[2][2] = (1.0f - 2.0f * (xx + yy)) * s[2];
+    out.row[2][3] = t[2];
+}
+
+void DecomposeMatrix3x4(const sMatrix3x4& m, float* q, float* t, float* s)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        t[c] = m.row[c][3];
+        s[c] = sqrtf(m.row[0][c] * m.row[0][c] + m.row[1][c] * m.row[1][c] + m.row[2][c] * m.row[2][c]);
+    }
+
+    const float det = m.row[0][0] * (m.row[1][1] * m.row[2][2] - m.row[1][2] * m.row[2][1])
+                    - m.row[0][1] * (m.row[1][0] * m.row[2][2] - m.row[1][2] * m.row[2][0])
+                    + m.row[0][2] * (m.row[1][0] * m.row[2][1] - m.row[1][1] * m.row[2][0]);
+    if (det < 0.0f)
+        s[0] = -s[0];
+
+    // pure rotation; a zero scale axis leaves its column out
+    float r[3][3];
+    for (int c = 0; c < 3; ++c)
+    {
+        const float invScale = (s[c] != 0.0f) ? 1.0f / s[c] : 0.0f;
+        for (int row = 0; row < 3; ++row)
+            r[row][c] = m.row[row][c] * invScale;
+    }
+
+    const float trace = r[0][0] + r[1][1] + r[2][2];
+    if (trace > 0.0f)
+    {
+        const float w = sqrtf(trace + 1.0f) * 0.5f, k = 0.25f / w;
+        q[0] = (r[2][1] - r[1][2]) * k; q[1] = (r[0][2] - r[2][0]) * k; q[2] = (r[1][0] - r[0][1]) * k; q[3] = w;
+    }
+    else if (r[0][0] >= r[1][1] && r[0][0] >= r[2][2])
+    {
+        const float x = sqrtf(Max(1.0f + r[0][0] - r[1][1] - r[2][2], 1e-12f)) * 0.5f, k = 0.25f / x;
+        q[0] = x; q[1] = (r[0][1] + r[1][0]) * k; q[2] = (r[0][2] + r[2][0]) * k; q[3] = (r[2][1] - r[1][2]) * k;
+    }
+    else if (r[1][1] >= r[2][2])
+    {
+        const float y = sqrtf(Max(1.0f + r[1][1] - r[0][0] - r[2][2], 1e-12f)) * 0.5f, k = 0.25f / y;
+        q[0] = (r[0][1] + r[1][0]) * k; q[1] = y; q[2] = (r[1][2] + r[2][1]) * k; q[3] = (r[0][2] - r[2][0]) * k;
+    }
+    else
+    {
+        const float z = sqrtf(Max(1.0f + r[2][2] - r[0][0] - r[1][1], 1e-12f)) * 0.5f, k = 0.25f / z;
+        q[0] = (r[0][2] + r[2][0]) * k; q[1] = (r[1][2] + r[2][1]) * k; q[2] = z; q[3] = (r[1][0] - r[0][1]) * k;
+    }
+
+    const float len = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    const float invLen = (len > 0.0f) ? 1.0f / len : 0.0f;
+    for (int c = 0; c < 4; ++c)
+        q[c] *= invLen;
+    if (invLen == 0.0f)
+        q[3] = 1.0f;
+}
+
+static bool GetPoseLocal(const sSkeleton* pSkeleton, const sPose* pPose, int joint, sMatrix3x4& local)
+{
+    const int node = pSkeleton->pObjectIds[joint];
+    if (pPose && node < pPose->numNodes)
+    {
+        float q[4], t[3], s[3];
+        for (int c = 0; c < 4; ++c)
+            q[c] = pPose->GetChannel(POSE_ROT_X + c)[node];
+        for (int c = 0; c < 3; ++c)
+        {
+            t[c] = pPose->GetChannel(POSE_TRANS_X + c)[node];
+            s[c] = pPose->GetChannel(POSE_SCALE_X + c)[node];
+        }
+        ComposeMatrix3x4(q, t, s, local);
+        return true;
+    }
+
+    for (int e = 0; e < 12; ++e)
+        local.row[e >> 2][e & 3] = pSkeleton->pBindLocals[e * pSkeleton->numJoints + joint];
+    return false;
+}
+
+void UpdateSkeletonInstanceReference(const sSkeleton* pSkeleton, const sSkeletonInstance& instance)
+{
+    for (int j = 0; j < pSkeleton->numJoints; ++j)
+    {
+        sMatrix3x4 local;
+        GetPoseLocal(pSkeleton, instance.pPose, j, local);
+
+        sMatrix3x4& global = instance.pGlobals[pSkeleton->pObjectIds[j]];
+        const int parent = pSkeleton->pParents[j];
+        if (parent >= 0)
+            MultiplyMatrix3x4(instance.pGlobals[pSkeleton->pObjectIds[parent]], local, global);
+        else if (instance.pRoot)
+            MultiplyMatrix3x4(*instance.pRoot, local, global);
+        else
+            global = local;
+    }
+}
+
+#if defined(KHM_SIMD_SSE)
+
+// a 3x4 matrix for 4 instances; m[element] holds the element for each lane
+struct sMatrix3x4x4
+{
+    __m128                  m[12];
+};
+
+static inline void MultiplyLanes(const sMatrix3x4x4& a, const sMatrix3x4x4& b, sMatrix3x4x4& out)
+{
+    for (int r = 0; r < 3; ++r)
+    {
+        const __m128 a0 = a.m[r * 4 + 0];
+        const __m128 a1 = a.m[r * 4 + 1];
+        const __m128 a2 = a.m[r * 4 + 2];
+        for (int c = 0; c < 4; ++c)
+        {
+            __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, b.m[c]), _mm_mul_ps(a1, b.m[4 + c])), _mm_mul_ps(a2, b.m[8 + c]));
+            if (c == 3)
+                v = _mm_add_ps(v, a.m[r * 4 + 3]);
+            out.m[r * 4 + c] = v;
+        }
+    }
+}
+
+static inline void ComposeLanes(const __m128* q, const __m128* t, const __m128* s, sMatrix3x4x4& out)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    const __m128 xx = _mm_mul_ps(q[0], q[0]), yy = _mm_mul_ps(q[1], q[1]), zz = _mm_mul_ps(q[2], q[2]);
+    const __m128 xy = _mm_mul_ps(q[0], q[1]), xz = _mm_mul_ps(q[0], q[2]), yz = _mm_mul_ps(q[1], q[2]);
+    const __m128 wx = _mm_mul_ps(q[3], q[0]), wy = _mm_mul_ps(q[3], q[1]), wz = _mm_mul_ps(q[3], q[2]);
+
+    out.m[0]  = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), s[0]);
+    out.m[1]  = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), s[1]);
+    out.m[2]  = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), s[2]);
+    out.m[3]  = t[0];
+
+    out.m[4]  = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), s[0]);
+    out.m[5]  = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), s[1]);
+    out.m[6]  = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), s[2]);
+    out.m[7]  = t[1];
+
+    out.m[8]  = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), s[0]);
+    out.m[9]  = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), s[1]);
+    out.m[10] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), s[2]);
+    out.m[11] = t[2];
+}
+
+static void UpdateSkeletonLanes(const sSkeleton* pSkeleton, const sSkeletonInstance* pInstances, int numLanes, sMatrix3x4x4* pGlobals)
+{
+    // unused lanes mirror the last instance and are never written back
+    const sSkeletonInstance* lanes[4];
+    for (int l = 0; l < 4; ++l)
+        lanes[l] = &pInstances[Min(l, numLanes - 1)];
+
+    sMatrix3x4x4 root;
+    bool bHasRoot = false;
+    for (int l = 0; l < 4; ++l)
+        bHasRoot |= (lanes[l]->pRoot != NULL);
+
+    if (bHasRoot)
+    {
+        float values[12][4];
+        for (int l = 0; l < 4; ++l)
+        {
+            sMatrix3x4 m;
+            if (lanes[l]->pRoot)
+                m = *lanes[l]->pRoot;
+            else
+                SetIdentity(m);
+
+            for (int e = 0; e < 12; ++e)
+                values[e][l] = m.row[e >> 2][e & 3];
+        }
+
+        for (int e = 0; e < 12; ++e)
+            root.m[e] = _mm_loadu_ps(values[e]);
+    }
+
+    for (int j = 0; j < pSkeleton->numJoints; ++j)
+    {
+        const int node = pSkeleton->pObjectIds[j];
+
+        bool bAllAnimated = true;
+        for (int l = 0; l < 4; ++l)
+            bAllAnimated &= (lanes[l]->pPose != NULL && node < lanes[l]->pPose->numNodes);
+
+        sMatrix3x4x4 local;
+        if (bAllAnimated)
+        {
+            // gather the pose channels of this node across the 4 instances, then compose in SIMD
+            __m128 channels[NUM_POSE_CHANNELS];
+            for (int ch = 0; ch < NUM_POSE_CHANNELS; ++ch)
+            {
+                channels[ch] = _mm_setr_ps(lanes[0]->pPose->GetChannel(ch)[node], lanes[1]->pPose->GetChannel(ch)[node],
+                                           lanes[2]->pPose->GetChannel(ch)[node], lanes[3]->pPose->GetChannel(ch)[node]);
+            }
+            ComposeLanes(&channels[POSE_ROT_X], &channels[POSE_TRANS_X], &channels[POSE_SCALE_X], local);
+        }
+        else
+        {
+            float values[12][4];
+            for (int l = 0; l < 4; ++l)
+            {
+                sMatrix3x4 m;
+                GetPoseLocal(pSkeleton, lanes[l]->pPose, j, m);
+                for (int e = 0; e < 12; ++e)
+                    values[e][l] = m.row[e >> 2][e & 3];
+            }
+
+            for (int e = 0; e < 12; ++e)
+                local.m[e] = _mm_loadu_ps(values[e]);
+        }
+
+        const int parent = pSkeleton->pParents[j];
+        if (parent >= 0)
+            MultiplyLanes(pGlobals[parent], local, pGlobals[j]);
+        else if (bHasRoot)
+            MultiplyLanes(root, local, pGlobals[j]);
+        else
+            pGlobals[j] = local;
+
+        // scatter back: 3 transposes turn [element][lane] into each lane's rows
+        for (int r = 0; r < 3; ++r)
+        {
+            __m128 c0 = pGlobals[j].m[r * 4 + 0];
+            __m128 c1 = pGlobals[j].m[r * 4 + 1];
+            __m128 c2 = pGlobals[j].m[r * 4 + 2];
+            __m128 c3 = pGlobals[j].m[r * 4 + 3];
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+            const __m128 rows[4] = { c0, c1, c2, c3 };
+            for (int l = 0; l < numLanes; ++l)
+                _mm_storeu_ps(pInstances[l].pGlobals[node].row[r], rows[l]);
+        }
+    }
+}
+
+#endif
+
+struct sSkeletonJob
+{
+    const sSkeleton*            pSkeleton;
+    const sSkeletonInstance*    pInstances;
+    int                         numInstances;
+};
+
+static void UpdateSkeletonJob(void* pUserData, int begin, int end)
+{
+    const sSkeletonJob* pJob = (const sSkeletonJob*)pUserData;
+
+#if defined(KHM_SIMD_SSE)
+    sMatrix3x4x4* pGlobals = (sMatrix3x4x4*)AlignedAlloc(sizeof(sMatrix3x4x4) * pJob->pSkeleton->numJoints);
+    for (int group = begin; group < end; ++group)
+    {
+        const int first = group * 4;
+        UpdateSkeletonLanes(pJob->pSkeleton, &pJob->pInstances[first], Min(4, pJob->numInstances - first), pGlobals);
+    }
+    AlignedFree(pGlobals);
+#else
+    for (int i = begin * 4; i < Min(end * 4, pJob->numInstances); ++i)
+        UpdateSkeletonInstanceReference(pJob->pSkeleton, pJob->pInstances[i]);
+#endif
+}
+
+void UpdateSkeletonInstances(const sSkeleton* pSkeleton, const sSkeletonInstance* pInstances, int numInstances, CJobPool* pJobPool)
+{
+    if (!pSkeleton || numInstances <= 0)
+        return;
+
+    sSkeletonJob job;
+    job.pSkeleton = pSkeleton;
+    job.pInstances = pInstances;
+    job.numInstances = numInstances;
+
+    const int numGroups = (numInstances + 3) / 4;
+    if (pJobPool)
+        pJobPool->ParallelFor(numGroups, 8, UpdateSkeletonJob, &job);
+    else
+        UpdateSkeletonJob(&job, 0, numGroups);
+}
+
+void BuildSkinningPalette(const sSkeleton* pSkeleton, const sMatrix3x4* pGlobals, sMatrix3x4* pPalette)
+{
+    for (int b = 0; b < pSkeleton->numBones; ++b)
+        MultiplyMatrix3x4(pGlobals[b], pSkeleton->pInverseBind[b], pPalette[b]);
+}
+
+}; // end namespace KHM
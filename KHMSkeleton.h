@@ -0,0 +1,60 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMMath.h"
+
+namespace KHM
+{
+    struct sPose;
+    class CJobPool;
+
+    //
+    // KHM Skeleton - compact runtime hierarchy for bones and helpers
+    //
+    // joints are sorted so parents always come before their children; a joint is an object ( bone or helper )
+    // and its object id is also its animation node index. locals are SoA 3x4, [element][joint]
+    //
+
+    struct sSkeleton
+    {
+        int                     numJoints;
+        int                     numObjects;     // max object id + 1
+        short*                  pParents;       // joint -> parent joint, -1 for roots
+        unsigned short*         pObjectIds;     // joint -> object id
+        short*                  pObjectToJoint; // object id -> joint, -1 if the id is unused
+        float*                  pBindLocals;    // [12][numJoints]; used for nodes the pose doesn't animate
+        int                     numBones;
+        sMatrix3x4*             pInverseBind;   // bone id -> inverse of the bind pose global matrix
+    };
+
+    sSkeleton*  CreateSkeleton(const sModelDefinition* pModelDefinition);
+    // same from loose object arrays; bone ids are 0 .. numBones - 1. pszName is for the log
+    sSkeleton*  CreateSkeleton(const sObjectBase* lBones, int numBones, const sObjectBase* lHelpers, int numHelpers, const char* pszName);
+    void        DestroySkeleton(sSkeleton* pSkeleton);
+
+    //
+    // KHM Skeleton Instance - one posed copy of a skeleton
+    //
+
+    struct sSkeletonInstance
+    {
+        const sPose*            pPose;          // local transforms, by animation node; NULL = bind pose
+        const sMatrix3x4*       pRoot;          // optional; applied on top of the roots
+        sMatrix3x4*             pGlobals;       // out; numObjects, by object id
+    };
+
+    // builds local 3x4s from the poses and walks the hierarchy for 4 instances at a time ( one per SIMD lane )
+    void        UpdateSkeletonInstances(const sSkeleton* pSkeleton, const sSkeletonInstance* pInstances, int numInstances, CJobPool* pJobPool);
+
+    // scalar reference for a single instance
+    void        UpdateSkeletonInstanceReference(const sSkeleton* pSkeleton, const sSkeletonInstance& instance);
+
+    // pPalette[bone] = global[bone] * inverseBind[bone]; ready for SkinInstances
+    void        BuildSkinningPalette(const sSkeleton* pSkeleton, const sMatrix3x4* pGlobals, sMatrix3x4* pPalette);
+
+    // local 3x4 from rotation / translation / scale: T * R * S
+    void        ComposeMatrix3x4(const float* q, const float* t, const float* s, sMatrix3x4& out);
+
+    // the other way around, for matrices without shear; a mirrored basis ends up as a negative x scale
+    void        DecomposeMatrix3x4(const sMatrix3x4& m, float* q, float* t, float* s);
+};
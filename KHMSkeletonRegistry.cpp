@@ -0,0 +1,380 @@
+#include "KHMSkeletonRegistry.h"
+#include "KHMHash.h"
+#include "Kernel/Log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace KHM {
+
+//
+// remapping
+//
+
+void RemapPose(const sSkeletonBinding* pBinding, const sPose* pModelPose, sPose* pSharedPose)
+{
+    ASSERT(pSharedPose->numNodes >= pBinding->pSkeleton->numObjects);
+
+    const int numPosed = Min(pBinding->numBones, pModelPose->numNodes);
+    for (int c = 0; c < NUM_POSE_CHANNELS; ++c)
+    {
+        const float* pSrc = pModelPose->GetChannel(c);
+        const float* pBind = pBinding->pBindPose->GetChannel(c);
+        float* pDst = pSharedPose->GetChannel(c);
+
+        if (pBinding->bIdentity)
+        {
+            memcpy(pDst, pSrc, sizeof(float) * numPosed);
+            memcpy(pDst + numPosed, pBind + numPosed, sizeof(float) * (pBinding->numBones - numPosed));
+            continue;
+        }
+
+        for (int b = 0; b < numPosed; ++b)
+            pDst[pBinding->pBoneRemap[b]] = pSrc[b];
+        for (int b = numPosed; b < pBinding->numBones; ++b)
+            pDst[pBinding->pBoneRemap[b]] = pBind[pBinding->pBoneRemap[b]];
+    }
+}
+
+void RemapSkinningPalette(const sSkeletonBinding* pBinding, const sMatrix3x4* pSharedPalette, sMatrix3x4* pModelPalette)
+{
+    if (pBinding->bIdentity)
+    {
+        memcpy(pModelPalette, pSharedPalette, sizeof(sMatrix3x4) * pBinding->numBones);
+        return;
+    }
+
+    for (int b = 0; b < pBinding->numBones; ++b)
+        pModelPalette[b] = pSharedPalette[pBinding->pBoneRemap[b]];
+}
+
+//
+// helpers
+//
+
+static int CompareNames(const char* pszA, const char* pszB)
+{
+    if (!pszA || !pszB)
+        return (pszA ? 1 : 0) - (pszB ? 1 : 0);
+    return strcmp(pszA, pszB);
+}
+
+// a bone's parent, if it is another bone; anything else ( a helper, a broken id ) makes it a root, as in CreateSkeleton
+static int GetParentBone(const sObjectBase* lBones, int numBones, int bone)
+{
+    const unsigned int uiParentId = lBones[bone].uiParentId;
+    return (uiParentId < (unsigned int)numBones && uiParentId != (unsigned int)bone) ? (int)uiParentId : -1;
+}
+
+static bool BindGlobalsMatch(const sMatrix3x4& a, const sMatrix3x4& b)
+{
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            const float scale = Max(1.0f, Max(fabsf(a.row[r][c]), fabsf(b.row[r][c])));
+            if (!(fabsf(a.row[r][c] - b.row[r][c]) <= KHM_SKELETON_BIND_TOLERANCE * scale))
+                return false;
+        }
+    }
+    return true;
+}
+
+//
+// CSkeletonRegistry
+//
+
+CSkeletonRegistry::CSkeletonRegistry()
+{
+    memset(lBuckets, 0, sizeof(lBuckets));
+    numSkeletons = 0;
+    numBindings = 0;
+    numAcquires = 0;
+    numDedups = 0;
+    numBindMismatches = 0;
+}
+
+CSkeletonRegistry::~CSkeletonRegistry()
+{
+    if (numBindings)
+        LOG_ERROR("[Error] CSkeletonRegistry::~CSkeletonRegistry() - %d bindings still held\n", numBindings);
+
+    for (int i = 0; i < KHM_SKELETON_REGISTRY_BUCKETS; ++i)
+    {
+        while (lBuckets[i])
+        {
+            sRegistrySkeleton* pShared = lBuckets[i];
+            lBuckets[i] = pShared->pNext;
+            DestroyShared(pShared);
+        }
+    }
+}
+
+// hash, then the names themselves, so equal hierarchies sort the same whatever order their bones are stored in
+int CSkeletonRegistry::CompareKeys(const void* pA, const void* pB)
+{
+    const sBoneKey* a = (const sBoneKey*)pA;
+    const sBoneKey* b = (const sBoneKey*)pB;
+
+    if (a->uiNameHash != b->uiNameHash)
+        return (a->uiNameHash < b->uiNameHash) ? -1 : 1;
+    if (a->uiParentHash != b->uiParentHash)
+        return (a->uiParentHash < b->uiParentHash) ? -1 : 1;
+
+    const int name = strcmp(a->pszName, b->pszName);
+    return name ? name : CompareNames(a->pszParentName, b->pszParentName);
+}
+
+void CSkeletonRegistry::BuildKeys(const sObjectBase* lBones, int numBones, sBoneKey* lKeys)
+{
+    for (int b = 0; b < numBones; ++b)
+    {
+        const int parent = GetParentBone(lBones, numBones, b);
+        sBoneKey& key = lKeys[b];
+        key.pszName = lBones[b].szName;
+        key.uiNameHash = HashName(key.pszName);
+        key.pszParentName = (parent >= 0) ? lBones[parent].szName : NULL;
+        key.uiParentHash = (parent >= 0) ? HashName(key.pszParentName) : 0;
+        key.bone = b;
+    }
+    qsort(lKeys, numBones, sizeof(sBoneKey), CompareKeys);
+}
+
+bool CSkeletonRegistry::Matches(const sRegistrySkeleton* pShared, const sObjectBase* lBones, const sBoneKey* lKeys, int numBones, unsigned char* lRemap, bool* pBindMismatch)
+{
+    if (pShared->bUnique || pShared->numBones != numBones)
+        return false;
+
+    for (int i = 0; i < numBones; ++i)
+    {
+        const sBoneKey& a = lKeys[i];
+        const sBoneKey& b = pShared->lKeys[i];
+        if (a.uiNameHash != b.uiNameHash || a.uiParentHash != b.uiParentHash || strcmp(a.pszName, b.pszName) || CompareNames(a.pszParentName, b.pszParentName))
+            return false;
+        lRemap[a.bone] = (unsigned char)b.bone;
+    }
+
+    for (int b = 0; b < numBones; ++b)
+    {
+        sMatrix3x4 bindGlobal;
+        Matrix3x4FromMatrix(lBones[b].matGlobal, bindGlobal);
+        if (!BindGlobalsMatch(bindGlobal, pShared->lBindGlobals[lRemap[b]]))
+        {
+            *pBindMismatch = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+CSkeletonRegistry::sRegistrySkeleton* CSkeletonRegistry::CreateShared(const sModelDefinition* pModelDefinition, const sBoneKey* lKeys, unsigned long long uiHash, bool bUnique)
+{
+    const int numBones = pModelDefinition->numBones;
+    sSkeleton* pSkeleton = CreateSkeleton(pModelDefinition->lBones, numBones, NULL, 0, pModelDefinition->szFileName);
+    if (!pSkeleton)
+        return NULL;
+
+    sRegistrySkeleton* pShared = new sRegistrySkeleton();
+    pShared->uiHash = uiHash;
+    pShared->bUnique = bUnique;
+    pShared->pSkeleton = pSkeleton;
+    pShared->numBones = numBones;
+    pShared->lKeys = new sBoneKey[numBones];
+    pShared->lNames = new char[numBones * KHM_MAX_OBJECT_NAME];
+    pShared->lBindGlobals = new sMatrix3x4[numBones];
+    pShared->numRefs = 0;
+    pShared->pNext = NULL;
+
+    if (!CreatePose(&pShared->bindPose, pSkeleton->numObjects))
+    {
+        DestroyShared(pShared);
+        return NULL;
+    }
+
+    for (int b = 0; b < numBones; ++b)
+    {
+        const sObjectBase& bone = pModelDefinition->lBones[b];
+        memcpy(pShared->lNames + b * KHM_MAX_OBJECT_NAME, bone.szName, KHM_MAX_OBJECT_NAME);
+        pShared->lNames[b * KHM_MAX_OBJECT_NAME + KHM_MAX_OBJECT_NAME - 1] = 0;
+        Matrix3x4FromMatrix(bone.matGlobal, pShared->lBindGlobals[b]);
+
+        sMatrix3x4 local;
+        Matrix3x4FromMatrix(bone.matLocal, local);
+        float q[4], t[3], s[3];
+        DecomposeMatrix3x4(local, q, t, s);
+        for (int c = 0; c < 4; ++c)
+            pShared->bindPose.GetChannel(POSE_ROT_X + c)[bone.uiId] = q[c];
+        for (int c = 0; c < 3; ++c)
+        {
+            pShared->bindPose.GetChannel(POSE_TRANS_X + c)[bone.uiId] = t[c];
+            pShared->bindPose.GetChannel(POSE_SCALE_X + c)[bone.uiId] = s[c];
+        }
+    }
+
+    // the keys point at the registry's copy of the names, the model may go first
+    for (int i = 0; i < numBones; ++i)
+    {
+        const int bone = lKeys[i].bone;
+        const int parent = GetParentBone(pModelDefinition->lBones, numBones, bone);
+        pShared->lKeys[i] = lKeys[i];
+        pShared->lKeys[i].pszName = pShared->lNames + bone * KHM_MAX_OBJECT_NAME;
+        pShared->lKeys[i].pszParentName = (parent >= 0) ? pShared->lNames + parent * KHM_MAX_OBJECT_NAME : NULL;
+    }
+
+    pShared->uiBytes = sizeof(sSkeleton) + sizeof(sRegistrySkeleton)
+                     + (unsigned long long)numBones * (sizeof(short) + sizeof(unsigned short) + sizeof(float) * 12 + sizeof(sMatrix3x4))
+                     + (unsigned long long)pSkeleton->numObjects * sizeof(short)
+                     + (unsigned long long)pShared->bindPose.numNodesPadded * NUM_POSE_CHANNELS * sizeof(float)
+                     + (unsigned long long)numBones * (sizeof(sBoneKey) + KHM_MAX_OBJECT_NAME + sizeof(sMatrix3x4));
+    return pShared;
+}
+
+void CSkeletonRegistry::DestroyShared(sRegistrySkeleton* pShared)
+{
+    DestroySkeleton(pShared->pSkeleton);
+    DestroyPose(&pShared->bindPose);
+    delete [] pShared->lKeys;
+    delete [] pShared->lNames;
+    delete [] pShared->lBindGlobals;
+    delete pShared;
+}
+
+const sSkeletonBinding* CSkeletonRegistry::Acquire(const sModelDefinition* pModelDefinition)
+{
+    if (!pModelDefinition || pModelDefinition->numBones <= 0 || !pModelDefinition->lBones)
+        return NULL;
+
+    const int numBones = pModelDefinition->numBones;
+    for (int b = 0; b < numBones; ++b)
+    {
+        if (pModelDefinition->lBones[b].uiId != (unsigned int)b)
+        {
+            LOG_ERROR("[Error] CSkeletonRegistry::Acquire(%s) - bone %d has id %u\n", pModelDefinition->szFileName, b, pModelDefinition->lBones[b].uiId);
+            return NULL;
+        }
+    }
+
+    // the key: the sorted ( name, parent name ) hash pairs
+    sBoneKey* lKeys = new sBoneKey[numBones];
+    BuildKeys(pModelDefinition->lBones, numBones, lKeys);
+
+    unsigned int* lHashes = new unsigned int[numBones * 2];
+    bool bUnique = false;
+    for (int i = 0; i < numBones; ++i)
+    {
+        lHashes[i * 2 + 0] = lKeys[i].uiNameHash;
+        lHashes[i * 2 + 1] = lKeys[i].uiParentHash;
+        if (i > 0 && CompareKeys(&lKeys[i - 1], &lKeys[i]) == 0)
+            bUnique = true;
+    }
+    const unsigned long long uiHash = HashData(lHashes, sizeof(unsigned int) * numBones * 2);
+    delete [] lHashes;
+
+    sRegistryBinding* pBinding = (sRegistryBinding*)malloc(sizeof(sRegistryBinding) + numBones);
+    if (!pBinding)
+    {
+        LOG_ERROR("[Error] CSkeletonRegistry::Acquire(%s) - out of memory\n", pModelDefinition->szFileName);
+        delete [] lKeys;
+        return NULL;
+    }
+    pBinding->pShared = NULL;
+
+    std::lock_guard<std::mutex> guard(lock);
+    ++numAcquires;
+
+    sRegistrySkeleton** ppBucket = &lBuckets[uiHash & (KHM_SKELETON_REGISTRY_BUCKETS - 1)];
+    bool bBindMismatch = false;
+    for (sRegistrySkeleton* pShared = *ppBucket; pShared; pShared = pShared->pNext)
+    {
+        if (pShared->uiHash == uiHash && Matches(pShared, pModelDefinition->lBones, lKeys, numBones, pBinding->lRemap, &bBindMismatch))
+        {
+            pBinding->pShared = pShared;
+            ++numDedups;
+            break;
+        }
+    }
+
+    if (!pBinding->pShared)
+    {
+        if (bBindMismatch)
+            ++numBindMismatches;
+
+        sRegistrySkeleton* pShared = CreateShared(pModelDefinition, lKeys, uiHash, bUnique);
+        if (!pShared)
+        {
+            LOG_ERROR("[Error] CSkeletonRegistry::Acquire(%s) - can't create the skeleton\n", pModelDefinition->szFileName);
+            delete [] lKeys;
+            free(pBinding);
+            return NULL;
+        }
+
+        pShared->pNext = *ppBucket;
+        *ppBucket = pShared;
+        ++numSkeletons;
+
+        pBinding->pShared = pShared;
+        for (int b = 0; b < numBones; ++b)
+            pBinding->lRemap[b] = (unsigned char)b;
+    }
+    delete [] lKeys;
+
+    sRegistrySkeleton* pShared = pBinding->pShared;
+    ++pShared->numRefs;
+    ++numBindings;
+
+    sSkeletonBinding& binding = pBinding->binding;
+    binding.pSkeleton = pShared->pSkeleton;
+    binding.pBindPose = &pShared->bindPose;
+    binding.numBones = numBones;
+    binding.pBoneRemap = pBinding->lRemap;
+    binding.bIdentity = true;
+    for (int b = 0; b < numBones; ++b)
+        binding.bIdentity = binding.bIdentity && pBinding->lRemap[b] == b;
+    return &binding;
+}
+
+void CSkeletonRegistry::Release(const sSkeletonBinding* pBinding)
+{
+    if (!pBinding)
+        return;
+
+    sRegistryBinding* pRegistryBinding = (sRegistryBinding*)pBinding;
+    sRegistrySkeleton* pShared = pRegistryBinding->pShared;
+    free(pRegistryBinding);
+
+    std::lock_guard<std::mutex> guard(lock);
+    ASSERT(pShared->numRefs > 0 && numBindings > 0);
+    --numBindings;
+    if (--pShared->numRefs > 0)
+        return;
+
+    for (sRegistrySkeleton** ppShared = &lBuckets[pShared->uiHash & (KHM_SKELETON_REGISTRY_BUCKETS - 1)]; *ppShared; ppShared = &(*ppShared)->pNext)
+    {
+        if (*ppShared == pShared)
+        {
+            *ppShared = pShared->pNext;
+            break;
+        }
+    }
+    --numSkeletons;
+    DestroyShared(pShared);
+}
+
+void CSkeletonRegistry::GetStats(sSkeletonRegistryStats* pStats) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    pStats->numAcquires = numAcquires;
+    pStats->numDedups = numDedups;
+    pStats->numBindMismatches = numBindMismatches;
+    pStats->numSkeletons = numSkeletons;
+    pStats->numBindings = numBindings;
+    pStats->uiBytesShared = 0;
+
+    for (int i = 0; i < KHM_SKELETON_REGISTRY_BUCKETS; ++i)
+    {
+        for (const sRegistrySkeleton* pShared = lBuckets[i]; pShared; pShared = pShared->pNext)
+            pStats->uiBytesShared += pShared->uiBytes;
+    }
+}
+
+}; // end namespace KHM
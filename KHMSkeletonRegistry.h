@@ -0,0 +1,130 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMSkeleton.h"
+#include "KHMAnimation.h"
+
+#include <mutex>
+
+namespace KHM
+{
+    //
+    // common defines for the skeleton registry
+    //
+
+    #define KHM_SKELETON_REGISTRY_BUCKETS   64      // power of 2; a game has tens of rigs, not thousands
+    #define KHM_SKELETON_BIND_TOLERANCE     1e-3f   // per bind global element, relative past 1; rigs further apart get their own skeleton
+
+    struct sSkeletonRegistryStats
+    {
+        unsigned long long      numAcquires;
+        unsigned long long      numDedups;          // acquires that found their rig registered
+        unsigned long long      numBindMismatches;  // same hierarchy as a registered rig, different bind pose
+        int                     numSkeletons;
+        int                     numBindings;
+        unsigned long long      uiBytesShared;      // every registered skeleton, with its bind pose, names and keys
+    };
+
+    //
+    // KHM Skeleton Binding - a model's view of a shared skeleton
+    //
+    // the shared skeleton holds bones only, with the ids of the first model that registered the rig; every model bound
+    // to it poses a pSkeleton->numObjects node pose, so pose buffers go from one model to the next. helpers are
+    // attachments of a model and stay with its own definition
+    //
+
+    struct sSkeletonBinding
+    {
+        const sSkeleton*        pSkeleton;      // shared; bone ids 0 .. numBones - 1
+        const sPose*            pBindPose;      // the shared bind locals, for bones a clip doesn't animate
+        int                     numBones;
+        const unsigned char*    pBoneRemap;     // model bone id -> shared bone id
+        bool                    bIdentity;      // the model's bones are in the shared order already
+    };
+
+    // gathers the bones of a pose by model node ( a clip of the model, attachments included ) into a pose of the shared
+    // skeleton; shared bones past pModelPose->numNodes get the bind pose. pSharedPose has pSkeleton->numObjects nodes
+    void        RemapPose(const sSkeletonBinding* pBinding, const sPose* pModelPose, sPose* pSharedPose);
+
+    // pModelPalette[bone] = pSharedPalette[remap[bone]]; for meshes whose bone indices are in the model's order
+    void        RemapSkinningPalette(const sSkeletonBinding* pBinding, const sMatrix3x4* pSharedPalette, sMatrix3x4* pModelPalette);
+
+    //
+    // KHM Skeleton Registry - one skeleton per distinct bone hierarchy, shared by every model on it
+    //
+    // rigs are keyed by a hash of their bones' names and their parents' names, in name order, so the same rig exported
+    // with its bones in a different order still matches; the names and parents are compared on a hash hit, and the bind
+    // globals have to agree within KHM_SKELETON_BIND_TOLERANCE for the inverse binds to be shared. rigs with two bones
+    // of the same name and parent are never shared.
+    //
+    // bindings are refcounted per model, a skeleton goes with its last binding. the registry is opt-in and sits next to
+    // the loader: nothing in CLoader calls it, model definitions keep their own bones and don't know about it. the
+    // caller acquires a binding once a model is loaded and uses the shared skeleton instead of calling CreateSkeleton
+    // for it; memory only goes down for callers that do. a single lock; a miss builds the skeleton under it, which
+    // happens once per rig
+    //
+
+    class CSkeletonRegistry
+    {
+        public:
+            CSkeletonRegistry();
+            ~CSkeletonRegistry();
+
+        public:
+            // NULL when the model has no bones
+            const sSkeletonBinding* Acquire(const sModelDefinition* pModelDefinition);
+            void Release(const sSkeletonBinding* pBinding);
+
+            void GetStats(sSkeletonRegistryStats* pStats) const;
+
+        private:
+            CSkeletonRegistry(const CSkeletonRegistry&);
+            CSkeletonRegistry& operator=(const CSkeletonRegistry&);
+
+            struct sBoneKey
+            {
+                unsigned int        uiNameHash;
+                unsigned int        uiParentHash;   // 0 for roots
+                const char*         pszName;
+                const char*         pszParentName;  // NULL for roots
+                int                 bone;
+            };
+
+            struct sRegistrySkeleton
+            {
+                unsigned long long  uiHash;
+                bool                bUnique;        // ambiguous names; never matched
+                sSkeleton*          pSkeleton;
+                sPose               bindPose;
+                int                 numBones;
+                sBoneKey*           lKeys;          // name order
+                char*               lNames;         // KHM_MAX_OBJECT_NAME per bone, by shared bone
+                sMatrix3x4*         lBindGlobals;   // by shared bone
+                unsigned long long  uiBytes;        // the skeleton and all of the above
+                int                 numRefs;
+                sRegistrySkeleton*  pNext;          // bucket chain
+            };
+
+            struct sRegistryBinding
+            {
+                sSkeletonBinding    binding;        // first, the handles point here
+                sRegistrySkeleton*  pShared;
+                unsigned char       lRemap[1];      // allocated to fit
+            };
+
+            static int CompareKeys(const void* pA, const void* pB);
+            static void BuildKeys(const sObjectBase* lBones, int numBones, sBoneKey* lKeys);
+            static bool Matches(const sRegistrySkeleton* pShared, const sObjectBase* lBones, const sBoneKey* lKeys, int numBones, unsigned char* lRemap, bool* pBindMismatch);
+            static sRegistrySkeleton* CreateShared(const sModelDefinition* pModelDefinition, const sBoneKey* lKeys, unsigned long long uiHash, bool bUnique);
+            static void DestroyShared(sRegistrySkeleton* pShared);
+
+        private:
+            mutable std::mutex              lock;
+            sRegistrySkeleton*              lBuckets[KHM_SKELETON_REGISTRY_BUCKETS];
+            int                             numSkeletons;
+            int                             numBindings;
+            unsigned long long              numAcquires;
+            unsigned long long              numDedups;
+            unsigned long long              numBindMismatches;
+    };
+};
@@ -0,0 +1,212 @@
+#include "KHMSkinning.h"
+#include "KHMJobs.h"
+#include "KHMSimd.h"
+
+#include <math.h>
+
+namespace KHM {
+
+//
+// skinning data
+//
+
+sSkinningData* CreateSkinningData(const sObjectMesh* pMesh)
+{
+    if (!pMesh || !pMesh->pSkinWeights || !pMesh->pSkinBoneIndices || pMesh->numVertices <= 0)
+        return NULL;
+
+    sSkinningData* pData = new sSkinningData();
+    pData->numVertices = pMesh->numVertices;
+    pData->numBlocks = (pMesh->numVertices + KHM_SKINNING_BLOCK_VERTICES - 1) / KHM_SKINNING_BLOCK_VERTICES;
+    pData->pWeights = new Vector4[pData->numVertices];
+    pData->pBoneIndices = new sBoneIndices[pData->numVertices];
+    pData->pBlockInfluences = new unsigned char[pData->numBlocks];
+    memset(pData->pBlockInfluences, 0, pData->numBlocks);
+
+    for (int v = 0; v < pData->numVertices; ++v)
+    {
+        float w[KHM_MAX_BONE_INFLUENCES];
+        unsigned char ind[KHM_MAX_BONE_INFLUENCES];
+        memcpy(w, &pMesh->pSkinWeights[v], sizeof(w));
+        memcpy(ind, pMesh->pSkinBoneIndices[v].ind, sizeof(ind));
+
+        // heaviest first, so the zero weights end up at the back
+        for (int i = 1; i < KHM_MAX_BONE_INFLUENCES; ++i)
+        {
+            for (int j = i; j > 0 && w[j] > w[j - 1]; --j)
+            {
+                const float tw = w[j]; w[j] = w[j - 1]; w[j - 1] = tw;
+                const unsigned char ti = ind[j]; ind[j] = ind[j - 1]; ind[j - 1] = ti;
+            }
+        }
+
+        int numInfluences = 0;
+        while (numInfluences < KHM_MAX_BONE_INFLUENCES && w[numInfluences] > 0.0f)
+            ++numInfluences;
+
+        // unused slots point at a valid bone with no weight
+        for (int i = numInfluences; i < KHM_MAX_BONE_INFLUENCES; ++i)
+        {
+            w[i] = 0.0f;
+            ind[i] = ind[0];
+        }
+
+        memcpy(&pData->pWeights[v], w, sizeof(w));
+        memcpy(pData->pBoneIndices[v].ind, ind, sizeof(ind));
+
+        unsigned char& blockInfluences = pData->pBlockInfluences[v / KHM_SKINNING_BLOCK_VERTICES];
+        blockInfluences = (unsigned char)Max((int)blockInfluences, numInfluences);
+    }
+
+    return pData;
+}
+
+void DestroySkinningData(sSkinningData* pData)
+{
+    if (!pData)
+        return;
+
+    delete [] pData->pWeights;
+    delete [] pData->pBoneIndices;
+    delete [] pData->pBlockInfluences;
+    delete pData;
+}
+
+//
+// kernels
+//
+
+struct sSkinningJob
+{
+    const sObjectMesh*          pMesh;
+    const Vector4*              pWeights;
+    const sBoneIndices*         pBoneIndices;
+    const unsigned char*        pBlockInfluences;   // NULL = always KHM_MAX_BONE_INFLUENCES
+    const sSkinningInstance*    pInstances;
+    int                         numChunks;
+};
+
+static void SkinVertices(const sSkinningJob& job, const sSkinningInstance& instance, int begin, int end)
+{
+    const Vector3* pSrcPositions = job.pMesh->pVertices;
+    const Vector3* pSrcNormals = instance.pNormals ? job.pMesh->pNormals : NULL;
+    const sMatrix3x4* pPalette = instance.pPalette;
+
+    for (int blockBegin = begin; blockBegin < end; blockBegin += KHM_SKINNING_BLOCK_VERTICES)
+    {
+        const int blockEnd = Min(blockBegin + KHM_SKINNING_BLOCK_VERTICES, end);
+        const int numInfluences = job.pBlockInfluences ? job.pBlockInfluences[blockBegin / KHM_SKINNING_BLOCK_VERTICES] : KHM_MAX_BONE_INFLUENCES;
+
+        for (int v = blockBegin; v < blockEnd; ++v)
+        {
+            const float* w = (const float*)&job.pWeights[v];
+            const unsigned char* ind = job.pBoneIndices[v].ind;
+            const Vector3& p = pSrcPositions[v];
+
+#if defined(KHM_SIMD_SSE)
+            // blend the 3 rows of the influencing matrices
+            __m128 r0 = _mm_setzero_ps();
+            __m128 r1 = _mm_setzero_ps();
+            __m128 r2 = _mm_setzero_ps();
+            for (int k = 0; k < numInfluences; ++k)
+            {
+                const sMatrix3x4& m = pPalette[ind[k]];
+                const __m128 wk = _mm_set1_ps(w[k]);
+                r0 = _mm_add_ps(r0, _mm_mul_ps(_mm_loadu_ps(m.row[0]), wk));
+                r1 = _mm_add_ps(r1, _mm_mul_ps(_mm_loadu_ps(m.row[1]), wk));
+                r2 = _mm_add_ps(r2, _mm_mul_ps(_mm_loadu_ps(m.row[2]), wk));
+            }
+
+            // rows -> columns, then p' = c0 * x + c1 * y + c2 * z + c3
+            __m128 c0 = r0, c1 = r1, c2 = r2, c3 = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+            float out[4];
+            const __m128 vPos = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p.x)), _mm_mul_ps(c1, _mm_set1_ps(p.y))),
+                                           _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p.z)), c3));
+            _mm_storeu_ps(out, vPos);
+            instance.pPositions[v] = Vector3(out[0], out[1], out[2]);
+
+            if (pSrcNormals)
+            {
+                const Vector3& n = pSrcNormals[v];
+                const __m128 vNrm = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n.x)), _mm_mul_ps(c1, _mm_set1_ps(n.y))),
+                                               _mm_mul_ps(c2, _mm_set1_ps(n.z)));
+                _mm_storeu_ps(out, vNrm);
+                const float len = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+                const float invLen = (len > 0.0f) ? 1.0f / len : 0.0f;
+                instance.pNormals[v] = Vector3(out[0] * invLen, out[1] * invLen, out[2] * invLen);
+            }
+#else
+            sMatrix3x4 blended;
+            memset(&blended, 0, sizeof(blended));
+            for (int k = 0; k < numInfluences; ++k)
+            {
+                const sMatrix3x4& m = pPalette[ind[k]];
+                for (int r = 0; r < 3; ++r)
+                    for (int c = 0; c < 4; ++c)
+                        blended.row[r][c] += m.row[r][c] * w[k];
+            }
+
+            instance.pPositions[v] = TransformPoint(blended, p);
+
+            if (pSrcNormals)
+            {
+                const Vector3 n = TransformVector(blended, pSrcNormals[v]);
+                const float len = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+                const float invLen = (len > 0.0f) ? 1.0f / len : 0.0f;
+                instance.pNormals[v] = Vector3(n.x * invLen, n.y * invLen, n.z * invLen);
+            }
+#endif
+        }
+    }
+}
+
+static void SkinInstancesJob(void* pUserData, int begin, int end)
+{
+    const sSkinningJob* pJob = (const sSkinningJob*)pUserData;
+    const int numVertices = pJob->pMesh->numVertices;
+
+    // task = instance * numChunks + chunk; consecutive tasks share an instance ( and its palette )
+    for (int task = begin; task < end; ++task)
+    {
+        const int instance = task / pJob->numChunks;
+        const int chunk = task % pJob->numChunks;
+        const int vtxBegin = chunk * KHM_SKINNING_CHUNK_VERTICES;
+        const int vtxEnd = Min(vtxBegin + KHM_SKINNING_CHUNK_VERTICES, numVertices);
+        SkinVertices(*pJob, pJob->pInstances[instance], vtxBegin, vtxEnd);
+    }
+}
+
+void SkinInstances(const sObjectMesh* pMesh, const sSkinningData* pSkinningData, const sSkinningInstance* pInstances, int numInstances, CJobPool* pJobPool)
+{
+    if (!pMesh || !pMesh->pSkinWeights || !pMesh->pSkinBoneIndices || pMesh->numVertices <= 0 || numInstances <= 0)
+        return;
+
+    sSkinningJob job;
+    job.pMesh = pMesh;
+    job.pInstances = pInstances;
+    job.numChunks = (pMesh->numVertices + KHM_SKINNING_CHUNK_VERTICES - 1) / KHM_SKINNING_CHUNK_VERTICES;
+
+    if (pSkinningData)
+    {
+        ASSERT(pSkinningData->numVertices == pMesh->numVertices);
+        job.pWeights = pSkinningData->pWeights;
+        job.pBoneIndices = pSkinningData->pBoneIndices;
+        job.pBlockInfluences = pSkinningData->pBlockInfluences;
+    }
+    else
+    {
+        job.pWeights = pMesh->pSkinWeights;
+        job.pBoneIndices = pMesh->pSkinBoneIndices;
+        job.pBlockInfluences = NULL;
+    }
+
+    const int numTasks = numInstances * job.numChunks;
+    if (pJobPool)
+        pJobPool->ParallelFor(numTasks, 1, SkinInstancesJob, &job);
+    else
+        SkinInstancesJob(&job, 0, numTasks);
+}
+
+}; // end namespace KHM
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMMath.h"
+
+namespace KHM
+{
+    //
+    // common defines for CPU skinning
+    //
+
+    #define KHM_SKINNING_CHUNK_VERTICES     512 // vertices per job; ~40KB of input + output streams, stays in L2
+    #define KHM_SKINNING_BLOCK_VERTICES     16  // granularity of the influence count in sSkinningData
+
+    class CJobPool;
+
+    //
+    // KHM Skinning Instance - one skinned copy of a mesh
+    //
+
+    struct sSkinningInstance
+    {
+        const sMatrix3x4*       pPalette;       // indexed by pSkinBoneIndices; bone global * inverse bind pose
+        Vector3*                pPositions;     // out; numVertices
+        Vector3*                pNormals;       // out; numVertices, optional
+    };
+
+    //
+    // KHM Skinning Data - per mesh influences, sorted by weight, with the zero weights dropped per block of vertices
+    //
+
+    struct sSkinningData
+    {
+        int                     numVertices;
+        int                     numBlocks;
+        Vector4*                pWeights;           // sorted, heaviest first
+        sBoneIndices*           pBoneIndices;
+        unsigned char*          pBlockInfluences;   // max non zero influences in each block of KHM_SKINNING_BLOCK_VERTICES
+    };
+
+    sSkinningData*  CreateSkinningData(const sObjectMesh* pMesh);
+    void            DestroySkinningData(sSkinningData* pData);
+
+    // linear blend skinning of positions ( and normals ) for every instance; work is split in chunks of vertices x instances.
+    // pSkinningData is optional; with it, blocks only pay for the influences they use
+    void            SkinInstances(const sObjectMesh* pMesh, const sSkinningData* pSkinningData, const sSkinningInstance* pInstances, int numInstances, CJobPool* pJobPool);
+};
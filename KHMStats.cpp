@@ -0,0 +1,405 @@
+#include "KHMStats.h"
+#include "KHMAnimation.h"
+#include "KHMAnimationCompression.h"
+#include "Kernel/Log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <chrono>
+
+namespace KHM {
+
+//
+// names
+//
+
+static const char* s_memoryCategoryNames[NUM_MEMORY_CATEGORIES] =
+{
+    "skeleton",
+    "geometry",
+    "collision",
+    "animation",
+    "animationMask",
+    "nameIndex",
+};
+
+static const char* s_loadStageNames[NUM_LOAD_STAGES] =
+{
+    "other",
+    "validate",
+    "skeleton",
+    "mesh",
+    "collision",
+    "optimize",
+    "animation",
+    "animationCopies",
+    "animationMask",
+    "nameIndex",
+};
+
+const char* GetMemoryCategoryName(int category)
+{
+    return (category >= 0 && category < NUM_MEMORY_CATEGORIES) ? s_memoryCategoryNames[category] : "unknown";
+}
+
+const char* GetLoadStageName(int stage)
+{
+    return (stage >= 0 && stage < NUM_LOAD_STAGES) ? s_loadStageNames[stage] : "unknown";
+}
+
+//
+// memory accounting
+//
+
+unsigned long long sModelMemory::GetFileBytes() const
+{
+    unsigned long long uiBytes = 0;
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; ++i)
+        uiBytes += uiFileBytes[i];
+    return uiBytes;
+}
+
+unsigned long long sModelMemory::GetHeapBytes() const
+{
+    unsigned long long uiBytes = 0;
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; ++i)
+        uiBytes += uiHeapBytes[i];
+    return uiBytes;
+}
+
+void ComputeModelMemory(const sModelDefinition* pModelDefinition, sModelMemory* pMemory)
+{
+    memset(pMemory, 0, sizeof(sModelMemory));
+
+    pMemory->uiFileBytes[MEMORY_SKELETON] = sizeof(sObjectBase) * (unsigned long long)(pModelDefinition->numBones + pModelDefinition->numHelpers);
+
+    const sObjectMesh* pMesh = pModelDefinition->pMesh;
+    if (pMesh)
+    {
+        const unsigned long long numVertices = pMesh->numVertices;
+        unsigned long long& uiGeometry = pMemory->uiFileBytes[MEMORY_GEOMETRY];
+        if (pMesh->pVertices)           uiGeometry += sizeof(Vector3) * numVertices;
+        if (pMesh->pNormals)            uiGeometry += sizeof(Vector3) * numVertices;
+        if (pMesh->pColors)             uiGeometry += sizeof(unsigned int) * numVertices;
+        if (pMesh->pTexCoords[0])       uiGeometry += sizeof(Vector2) * numVertices;
+        if (pMesh->pTexCoords[1])       uiGeometry += sizeof(Vector2) * numVertices;
+        if (pMesh->pSkinWeights)        uiGeometry += sizeof(Vector4) * numVertices;
+        if (pMesh->pSkinBoneIndices)    uiGeometry += sizeof(sBoneIndices) * numVertices;
+        if (pMesh->pIndices)            uiGeometry += sizeof(unsigned short) * (unsigned long long)pMesh->numIndices;
+        if (pMesh->pFaceNormals)        uiGeometry += sizeof(Vector3) * (unsigned long long)(pMesh->numIndices / 3);
+        if (pMesh->pLodIndices)         uiGeometry += sizeof(unsigned short) * (unsigned long long)pMesh->numLodIndices;
+        pMemory->uiHeapBytes[MEMORY_GEOMETRY] = sizeof(sObjectMesh);
+
+        pMemory->uiHeapBytes[MEMORY_COLLISION] = sizeof(sCollisionShape) * (unsigned long long)pMesh->numCollisions;
+        for (int i = 0; i < pMesh->numCollisions; ++i)
+        {
+            const sCollisionShape& col = pMesh->pCollisions[i];
+            if (col.type != sCollisionShape::CONVEX_MESH)
+                continue;
+
+            pMemory->uiFileBytes[MEMORY_COLLISION] += sizeof(sCollisionPolygon) * (unsigned long long)col.params.mesh.numPolys +
+                                                      sizeof(unsigned short) * (unsigned long long)col.params.mesh.numIndices +
+                                                      sizeof(Vector3) * (unsigned long long)col.params.mesh.numVertices;
+        }
+    }
+
+    const sAnimation* pAnimation = pModelDefinition->pAnimation;
+    if (pAnimation)
+    {
+        pMemory->uiFileBytes[MEMORY_ANIMATION] = sizeof(sNodeTransform) * (unsigned long long)pAnimation->numNodes * pAnimation->numNodeFrames +
+                                                 sizeof(sAnimationBounds) * (unsigned long long)pAnimation->numBoundsGroups;
+
+        unsigned long long& uiHeap = pMemory->uiHeapBytes[MEMORY_ANIMATION];
+        uiHeap = sizeof(sAnimation);
+        if (pAnimation->pTracks)
+            uiHeap += sizeof(sAnimationTracks) + sizeof(float) * NUM_POSE_CHANNELS * (unsigned long long)pAnimation->pTracks->numNodesPadded * pAnimation->pTracks->numNodeFrames;
+        if (pAnimation->pCompressed)
+            uiHeap += pAnimation->pCompressed->uiSize;
+    }
+
+    if (pModelDefinition->pAnimationMask)
+    {
+        pMemory->uiHeapBytes[MEMORY_ANIMATION_MASK] = sizeof(sAnimationMask);
+#if KHM_ANIMATION_MASK_NAMES
+        pMemory->uiFileBytes[MEMORY_ANIMATION_MASK] = sizeof(sAnimationMaskEntry) * (unsigned long long)pModelDefinition->pAnimationMask->numNodes;
+#endif
+    }
+
+    if (pModelDefinition->lNameIndex)
+        pMemory->uiHeapBytes[MEMORY_NAME_INDEX] = sizeof(sNameIndexEntry) * (unsigned long long)(pModelDefinition->uiNameIndexMask + 1);
+
+    for (const sModelArenaBlock* pBlock = pModelDefinition->pArena; pBlock; pBlock = pBlock->pNext)
+        pMemory->uiArenaBytes += pBlock->uiSize;
+}
+
+//
+// process totals
+//
+
+static std::mutex s_processLock;
+static sProcessLoadStats s_processStats; // zero initialized
+
+static void AddMemory(sModelMemory& dest, const sModelMemory& memory, bool bAdd)
+{
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; ++i)
+    {
+        dest.uiFileBytes[i] += bAdd ? memory.uiFileBytes[i] : 0 - memory.uiFileBytes[i];
+        dest.uiHeapBytes[i] += bAdd ? memory.uiHeapBytes[i] : 0 - memory.uiHeapBytes[i];
+    }
+    dest.uiArenaBytes += bAdd ? memory.uiArenaBytes : 0 - memory.uiArenaBytes;
+}
+
+void GetProcessLoadStats(sProcessLoadStats* pStats)
+{
+    std::lock_guard<std::mutex> lock(s_processLock);
+    *pStats = s_processStats;
+}
+
+void ResetProcessLoadStats()
+{
+    std::lock_guard<std::mutex> lock(s_processLock);
+    memset(s_processStats.totals.uiStageNs, 0, sizeof(s_processStats.totals.uiStageNs));
+    s_processStats.totals.numAllocations = 0;
+    s_processStats.totals.uiAllocatedBytes = 0;
+    s_processStats.totals.numLoadCalls = 0;
+    s_processStats.numLoads = 0;
+    s_processStats.numFailures = 0;
+}
+
+void DestroyLoadStats(sLoadStats* pStats)
+{
+    if (!pStats)
+        return;
+
+    // the stats themselves go with the model arena
+    std::lock_guard<std::mutex> lock(s_processLock);
+    AddMemory(s_processStats.totals.memory, pStats->memory, false);
+    --s_processStats.numModels;
+}
+
+//
+// recording
+//
+
+#if KHM_LOAD_STATS
+
+typedef std::chrono::steady_clock StatsClock;
+
+static void AddCounters(sLoadStats& dest, const sLoadStats& stats)
+{
+    for (int i = 0; i < NUM_LOAD_STAGES; ++i)
+        dest.uiStageNs[i] += stats.uiStageNs[i];
+    dest.numAllocations += stats.numAllocations;
+    dest.uiAllocatedBytes += stats.uiAllocatedBytes;
+    dest.numLoadCalls += stats.numLoadCalls;
+}
+
+struct sLoadRecorder
+{
+    sLoadStats*             pStats;     // NULL = not recording
+    int                     stage;
+    StatsClock::time_point  stageStart;
+};
+
+static thread_local sLoadRecorder t_recorder;
+
+static unsigned long long ElapsedNs(const StatsClock::time_point& start, const StatsClock::time_point& end)
+{
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+CLoadStatsScope::CLoadStatsScope(sModelDefinition* pModelDefinition_, unsigned int uiLoadFlags) :
+    pModelDefinition(pModelDefinition_),
+    bActive(false),
+    bOk(false)
+{
+    if (!(uiLoadFlags & LOAD_COLLECT_STATS) || t_recorder.pStats)
+        return;
+
+    bActive = true;
+    memset(&stats, 0, sizeof(stats));
+    stats.numLoadCalls = 1;
+
+    t_recorder.pStats = &stats;
+    t_recorder.stage = LOAD_STAGE_OTHER;
+    t_recorder.stageStart = StatsClock::now();
+}
+
+CLoadStatsScope::~CLoadStatsScope()
+{
+    if (!bActive)
+        return;
+
+    stats.uiStageNs[t_recorder.stage] += ElapsedNs(t_recorder.stageStart, StatsClock::now());
+    t_recorder.pStats = NULL;
+
+    if (!bOk)
+    {
+        std::lock_guard<std::mutex> lock(s_processLock);
+        AddCounters(s_processStats.totals, stats);
+        ++s_processStats.numFailures;
+        return;
+    }
+
+    // the first successful load of the model owns the stats; deferred loads and stream feeds add to them
+    const bool bFirstLoad = pModelDefinition->pLoadStats == NULL;
+    if (bFirstLoad)
+    {
+        pModelDefinition->pLoadStats = (sLoadStats*)pModelDefinition->Alloc(sizeof(sLoadStats));
+        memset(pModelDefinition->pLoadStats, 0, sizeof(sLoadStats));
+    }
+
+    sLoadStats* pStats = pModelDefinition->pLoadStats;
+    const sModelMemory previousMemory = pStats->memory;
+    ComputeModelMemory(pModelDefinition, &pStats->memory);
+    AddCounters(*pStats, stats);
+
+    std::lock_guard<std::mutex> lock(s_processLock);
+    AddCounters(s_processStats.totals, stats);
+    AddMemory(s_processStats.totals.memory, previousMemory, false);
+    AddMemory(s_processStats.totals.memory, pStats->memory, true);
+    if (bFirstLoad)
+    {
+        ++s_processStats.numModels;
+        ++s_processStats.numLoads;
+    }
+}
+
+CLoadStageTimer::CLoadStageTimer(int stage)
+{
+    sLoadRecorder& recorder = t_recorder;
+    if (!recorder.pStats)
+    {
+        previousStage = -1;
+        return;
+    }
+
+    // the running stage stops here and picks up again when this one is done
+    const StatsClock::time_point now = StatsClock::now();
+    recorder.pStats->uiStageNs[recorder.stage] += ElapsedNs(recorder.stageStart, now);
+    previousStage = recorder.stage;
+    recorder.stage = stage;
+    recorder.stageStart = now;
+}
+
+CLoadStageTimer::~CLoadStageTimer()
+{
+    sLoadRecorder& recorder = t_recorder;
+    if (previousStage < 0 || !recorder.pStats)
+        return;
+
+    const StatsClock::time_point now = StatsClock::now();
+    recorder.pStats->uiStageNs[recorder.stage] += ElapsedNs(recorder.stageStart, now);
+    recorder.stage = previousStage;
+    recorder.stageStart = now;
+}
+
+void RecordLoadAllocation(size_t uiBytes)
+{
+    sLoadStats* pStats = t_recorder.pStats;
+    if (!pStats || !uiBytes)
+        return;
+
+    ++pStats->numAllocations;
+    pStats->uiAllocatedBytes += uiBytes;
+}
+
+#endif // KHM_LOAD_STATS
+
+//
+// report
+//
+
+static void WriteJsonString(FILE* f, const char* psz)
+{
+    fputc('"', f);
+    for (const unsigned char* p = (const unsigned char*)psz; *p; ++p)
+    {
+        if (*p == '"' || *p == '\\')
+            fprintf(f, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(f, "\\u%04x", *p);
+        else
+            fputc(*p, f);
+    }
+    fputc('"', f);
+}
+
+static void WriteJsonMemory(FILE* f, const char* pszIndent, const sModelMemory& memory)
+{
+    fprintf(f, "%s\"fileBytes\": { ", pszIndent);
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; ++i)
+        fprintf(f, "%s\"%s\": %llu", i ? ", " : "", s_memoryCategoryNames[i], memory.uiFileBytes[i]);
+    fprintf(f, " },\n");
+
+    fprintf(f, "%s\"heapBytes\": { ", pszIndent);
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; ++i)
+        fprintf(f, "%s\"%s\": %llu", i ? ", " : "", s_memoryCategoryNames[i], memory.uiHeapBytes[i]);
+    fprintf(f, " },\n");
+
+    fprintf(f, "%s\"arenaBytes\": %llu", pszIndent, memory.uiArenaBytes);
+}
+
+static void WriteJsonCounters(FILE* f, const char* pszIndent, const sLoadStats& stats)
+{
+    fprintf(f, "%s\"stageNs\": { ", pszIndent);
+    for (int i = 0; i < NUM_LOAD_STAGES; ++i)
+        fprintf(f, "%s\"%s\": %llu", i ? ", " : "", s_loadStageNames[i], stats.uiStageNs[i]);
+    fprintf(f, " },\n");
+
+    fprintf(f, "%s\"allocations\": %llu,\n", pszIndent, stats.numAllocations);
+    fprintf(f, "%s\"allocatedBytes\": %llu,\n", pszIndent, stats.uiAllocatedBytes);
+    fprintf(f, "%s\"loadCalls\": %u,\n", pszIndent, stats.numLoadCalls);
+}
+
+bool WriteLoadStatsReport(const char* pszReportPath, const sModelDefinition* const* ppModels, int numModels)
+{
+    FILE* f = fopen(pszReportPath, "w");
+    if (!f)
+    {
+        LOG_ERROR("[Error] WriteLoadStatsReport(%s) - can't open file\n", pszReportPath);
+        return false;
+    }
+
+    sProcessLoadStats process;
+    GetProcessLoadStats(&process);
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"version\": %d,\n", KHM_LOAD_STATS_REPORT_VERSION);
+    fprintf(f, "  \"enabled\": %s,\n", KHM_LOAD_STATS ? "true" : "false");
+
+    fprintf(f, "  \"process\": {\n");
+    fprintf(f, "    \"models\": %u,\n", process.numModels);
+    fprintf(f, "    \"loads\": %u,\n", process.numLoads);
+    fprintf(f, "    \"failures\": %u,\n", process.numFailures);
+    WriteJsonCounters(f, "    ", process.totals);
+    WriteJsonMemory(f, "    ", process.totals.memory);
+    fprintf(f, "\n  },\n");
+
+    fprintf(f, "  \"models\": [");
+    for (int i = 0; i < numModels; ++i)
+    {
+        const sModelDefinition* pModelDefinition = ppModels[i];
+
+        fprintf(f, "%s\n    {\n      \"file\": ", i ? "," : "");
+        WriteJsonString(f, pModelDefinition->szFileName);
+        fprintf(f, ",\n");
+
+        sModelMemory memory;
+        ComputeModelMemory(pModelDefinition, &memory);
+        if (pModelDefinition->pLoadStats)
+            WriteJsonCounters(f, "      ", *pModelDefinition->pLoadStats);
+        WriteJsonMemory(f, "      ", memory);
+        fprintf(f, "\n    }");
+    }
+    fprintf(f, "%s]\n}\n", numModels ? "\n  " : "");
+
+    const bool bOk = ferror(f) == 0;
+    fclose(f);
+    if (!bOk)
+        LOG_ERROR("[Error] WriteLoadStatsReport(%s) - write failed\n", pszReportPath);
+    return bOk;
+}
+
+}; // end namespace KHM
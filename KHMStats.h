@@ -0,0 +1,150 @@
+#pragma once
+
+#include "KHMModel.h"
+
+#include <stddef.h>
+
+namespace KHM
+{
+    //
+    // common defines for loader statistics
+    //
+
+    // compile time switch; with 0 the loader has no trace of the instrumentation and LOAD_COLLECT_STATS is ignored.
+    // with 1 ( default ) a load without LOAD_COLLECT_STATS pays a thread local check per stage and per allocation
+    #ifndef KHM_LOAD_STATS
+        #define KHM_LOAD_STATS              1
+    #endif
+
+    #define KHM_LOAD_STATS_REPORT_VERSION   2
+
+    // where the bytes of a loaded model go
+    enum eMemoryCategory
+    {
+        MEMORY_SKELETON = 0,        // bones, helpers
+        MEMORY_GEOMETRY,            // mesh object and its vertex / index streams
+        MEMORY_COLLISION,           // collision shapes and their hulls
+        MEMORY_ANIMATION,           // pNodeTransforms and the copies built from them ( tracks, compressed )
+        MEMORY_ANIMATION_MASK,
+        MEMORY_NAME_INDEX,
+
+        NUM_MEMORY_CATEGORIES
+    };
+
+    // where the time of a load goes; exclusive, a stage running inside another one is only charged to itself
+    enum eLoadStage
+    {
+        LOAD_STAGE_OTHER = 0,       // everything outside the stages below
+        LOAD_STAGE_VALIDATE,
+        LOAD_STAGE_SKELETON,
+        LOAD_STAGE_MESH,
+        LOAD_STAGE_COLLISION,
+        LOAD_STAGE_OPTIMIZE,        // LOAD_OPTIMIZE_VERTEX_CACHE
+        LOAD_STAGE_ANIMATION,
+        LOAD_STAGE_ANIMATION_COPIES,// LOAD_ANIMATION_TRACKS, LOAD_COMPRESS_ANIMATION
+        LOAD_STAGE_ANIMATION_MASK,
+        LOAD_STAGE_NAME_INDEX,
+
+        NUM_LOAD_STAGES
+    };
+
+    struct sModelMemory
+    {
+        unsigned long long      uiFileBytes[NUM_MEMORY_CATEGORIES]; // used in place, from the file buffer
+        unsigned long long      uiHeapBytes[NUM_MEMORY_CATEGORIES]; // allocated by the loader and kept with the model
+        unsigned long long      uiArenaBytes;                       // what the model holds from its allocator: the heap bytes, alignment and unused space
+
+        unsigned long long GetFileBytes() const;
+        unsigned long long GetHeapBytes() const;
+    };
+
+    struct sLoadStats
+    {
+        sModelMemory            memory;                     // what the model holds now
+        unsigned long long      uiStageNs[NUM_LOAD_STAGES];
+        unsigned long long      numAllocations;             // every heap allocation of the loads, temporaries included
+        unsigned long long      uiAllocatedBytes;
+        unsigned int            numLoadCalls;               // LoadModel, LoadDeferredSections, stream feeds...
+    };
+
+    // process wide; the memory is what the models loaded with LOAD_COLLECT_STATS hold right now ( Destroy takes
+    // them out ), the rest adds up since the start or the last reset
+    struct sProcessLoadStats
+    {
+        sLoadStats              totals;
+        unsigned int            numModels;                  // models loaded with LOAD_COLLECT_STATS and not destroyed yet
+        unsigned int            numLoads;                   // successful first loads
+        unsigned int            numFailures;
+    };
+
+    // walks the model, no per element work; doesn't need LOAD_COLLECT_STATS
+    void ComputeModelMemory(const sModelDefinition* pModelDefinition, sModelMemory* pMemory);
+
+    void GetProcessLoadStats(sProcessLoadStats* pStats);
+    void ResetProcessLoadStats(); // the memory and the model count stay, they track live models
+
+    // JSON report: the process totals, then every model passed in ( the ones without stats only get their memory )
+    bool WriteLoadStatsReport(const char* pszReportPath, const sModelDefinition* const* ppModels, int numModels);
+
+    const char* GetMemoryCategoryName(int category);
+    const char* GetLoadStageName(int stage);
+
+    //
+    // recording; used by the loader
+    //
+
+    // sModelDefinition::Destroy; takes the model out of the process totals
+    void DestroyLoadStats(sLoadStats* pStats);
+
+#if KHM_LOAD_STATS
+
+    // active for the outermost scope of a thread only, when the flags ask for it. the result decides where the
+    // numbers go: a successful load gets them into sModelDefinition::pLoadStats, a failed one only counts as a failure
+    class CLoadStatsScope
+    {
+        public:
+            CLoadStatsScope(sModelDefinition* pModelDefinition, unsigned int uiLoadFlags);
+            ~CLoadStatsScope();
+
+            bool Result(bool bResult) { bOk = bResult; return bResult; }
+
+        private:
+            CLoadStatsScope(const CLoadStatsScope&);
+            CLoadStatsScope& operator=(const CLoadStatsScope&);
+
+        private:
+            sModelDefinition*       pModelDefinition;
+            sLoadStats              stats;
+            bool                    bActive;
+            bool                    bOk;
+    };
+
+    class CLoadStageTimer
+    {
+        public:
+            explicit CLoadStageTimer(int stage);
+            ~CLoadStageTimer();
+
+        private:
+            int                     previousStage; // -1 = not recording
+    };
+
+    void RecordLoadAllocation(size_t uiBytes);
+
+    #define KHM_STATS_STAGE(stage)          CLoadStageTimer loadStageTimer_(stage)
+    #define KHM_STATS_ALLOC(uiBytes)        RecordLoadAllocation(uiBytes)
+
+#else
+
+    class CLoadStatsScope
+    {
+        public:
+            CLoadStatsScope(sModelDefinition*, unsigned int) {}
+            bool Result(bool bResult) { return bResult; }
+    };
+
+    #define KHM_STATS_STAGE(stage)
+    #define KHM_STATS_ALLOC(uiBytes)
+
+#endif
+};
@@ -0,0 +1,397 @@
+#include "KHMStream.h"
+#include "KHMValidate.h"
+#include "KHMStats.h"
+#include "KHMJobs.h"
+#include "Kernel/Log.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace KHM {
+
+//
+// CModelStream
+//
+
+CModelStream::CModelStream() :
+    pLoader(NULL),
+    pszFilePath(NULL),
+    fileBuff(NULL),
+    fileSize(0),
+    uiAvailable(0),
+    pModelDefinition(NULL),
+    callback(NULL),
+    pUserData(NULL),
+    state(STREAM_FAILED),
+    uiVersion(0),
+    uiPublished(0),
+    stage(SEQUENTIAL_BONES),
+    uiStageOffset(0),
+    bTableValid(false),
+    uiValidatedTypes(0)
+{
+}
+
+void CModelStream::Begin(const CLoader* pLoader_, const char* pszFilePath_, unsigned char* fileBuff_, unsigned int fileSize_, sModelDefinition* pModelDefinition_, ModelStreamCallback callback_, void* pUserData_)
+{
+    pLoader = pLoader_;
+    pszFilePath = pszFilePath_;
+    fileBuff = fileBuff_;
+    fileSize = fileSize_;
+    uiAvailable = 0;
+    pModelDefinition = pModelDefinition_;
+    callback = callback_;
+    pUserData = pUserData_;
+
+    state = STREAM_PENDING;
+    uiVersion = 0;
+    uiPublished = 0;
+    stage = SEQUENTIAL_BONES;
+    uiStageOffset = sizeof(sHeader);
+    bTableValid = false;
+    uiValidatedTypes = 0;
+    layout = sModelLayout();
+
+    // the counts come in with the stages, so the arena grows a block at a time instead of being sized up front
+    pModelDefinition->Init();
+    pModelDefinition->allocator = pLoader->GetAllocator();
+    strcpy(pModelDefinition->szFileName, pszFilePath);
+}
+
+void CModelStream::Publish(unsigned int uiSections)
+{
+    uiPublished |= uiSections;
+    if (callback)
+        callback(pUserData, pModelDefinition, uiSections, false);
+}
+
+void CModelStream::Finish(eStreamState finalState)
+{
+    state = finalState;
+    if (finalState == STREAM_DONE)
+        pModelDefinition->uiSections = MODEL_SECTIONS_ALL;
+
+    if (callback)
+        callback(pUserData, pModelDefinition, 0, true);
+}
+
+void CModelStream::Abort()
+{
+    if (state == STREAM_PENDING)
+        Finish(STREAM_FAILED);
+}
+
+eStreamState CModelStream::Feed(unsigned int uiBytesAvailable)
+{
+    if (state != STREAM_PENDING)
+        return state;
+
+    uiAvailable = Min(uiBytesAvailable, fileSize);
+    if (!uiVersion)
+    {
+        if (uiAvailable < sizeof(sHeader))
+        {
+            if (uiAvailable == fileSize)
+            {
+                LOG_ERROR("[Error] CModelStream::Feed(%s) - KHM header mismatch.\n", pszFilePath);
+                Finish(STREAM_FAILED);
+            }
+            return state;
+        }
+
+        // the v102 table is checked once it's in
+        const sHeader* fileHeader = (const sHeader*)fileBuff;
+        if (fileHeader->uiSig[0] != 'K' || fileHeader->uiSig[1] != 'H' || fileHeader->uiSig[2] != 'M' ||
+            (fileHeader->uiVer != KHM_VERSION_SEQUENTIAL && fileHeader->uiVer != KHM_VERSION_SECTIONS))
+        {
+            LOG_ERROR("[Error] CModelStream::Feed(%s) - KHM header mismatch.\n", pszFilePath);
+            Finish(STREAM_FAILED);
+            return state;
+        }
+
+        uiVersion = fileHeader->uiVer;
+    }
+
+    // every feed is a load call of its own; the model collects them as it goes
+    CLoadStatsScope statsScope(pModelDefinition, pLoader->GetFlags());
+    const bool bOk = statsScope.Result((uiVersion == KHM_VERSION_SECTIONS) ? FeedSections() : FeedSequential());
+    if (!bOk)
+    {
+        Finish(STREAM_FAILED);
+    }
+    else if (uiPublished == MODEL_SECTIONS_ALL)
+    {
+        Finish(STREAM_DONE);
+    }
+    else if (uiAvailable == fileSize)
+    {
+        LOG_ERROR("[Error] CModelStream::Feed(%s) - file ends before the model does\n", pszFilePath);
+        Finish(STREAM_FAILED);
+    }
+
+    return state;
+}
+
+bool CModelStream::FeedSequential()
+{
+    while (stage < NUM_SEQUENTIAL_STAGES)
+    {
+        // the Read* functions don't check anything, the stage is validated before they see it
+        unsigned int uiStageEnd;
+        const eValidateResult result = ValidateSequentialStage(stage, fileBuff, uiAvailable, uiStageOffset, &uiStageEnd, &layout);
+        if (result == VALIDATE_NEED_MORE)
+            return true; // wait for more
+
+        if (result == VALIDATE_INVALID)
+        {
+            LOG_ERROR("[Error] CModelStream::Feed(%s) - %s\n", pszFilePath, layout.pszError);
+            return false;
+        }
+
+        CLoader::sReadCursor ctx;
+        ctx.buff = fileBuff;
+        ctx.buffsize = fileSize;
+        ctx.buffread = uiStageOffset;
+
+        unsigned int uiSections = 0;
+        switch (stage)
+        {
+            case SEQUENTIAL_BONES:
+                pLoader->ReadBones(ctx, pModelDefinition);
+                break;
+
+            case SEQUENTIAL_HELPERS:
+                pLoader->ReadHelpers(ctx, pModelDefinition);
+                pModelDefinition->BuildNameIndex();
+                uiSections = MODEL_SECTION_SKELETON;
+                break;
+
+            case SEQUENTIAL_MESH:
+                pLoader->ReadMeshes(ctx, pModelDefinition);
+                pModelDefinition->BuildNameIndex();
+                uiSections = MODEL_SECTION_MESH_INFO | MODEL_SECTION_MESH | MODEL_SECTION_COLLISION;
+                break;
+
+            case SEQUENTIAL_ANIMATION:
+                pLoader->ReadAnimation(ctx, pModelDefinition);
+                uiSections = MODEL_SECTION_ANIMATION;
+                break;
+
+            case SEQUENTIAL_MASK:
+                pLoader->ReadAnimationMask(ctx, pModelDefinition);
+                uiSections = MODEL_SECTION_ANIMATION_MASK;
+                break;
+        }
+
+        ASSERT((unsigned int)ctx.buffread == uiStageEnd);
+        uiStageOffset = uiStageEnd;
+        ++stage;
+
+        if (uiSections)
+        {
+            pModelDefinition->uiSections |= uiSections;
+            Publish(uiSections);
+        }
+    }
+
+    return true;
+}
+
+bool CModelStream::ValidateSections(unsigned int uiTypes)
+{
+    const sSectionTable* pTable = (const sSectionTable*)(fileBuff + sizeof(sHeader));
+    const sSectionEntry* lSections = (const sSectionEntry*)(pTable + 1);
+
+    // in type order, like ValidateModel; the table has no duplicates
+    for (unsigned int uiType = SECTION_BONES; uiType <= SECTION_MESH_LODS; ++uiType)
+    {
+        if (!(uiTypes & (1u << uiType)) || (uiValidatedTypes & (1u << uiType)))
+            continue;
+
+        for (unsigned int i = 0; i < pTable->numSections; ++i)
+        {
+            if (lSections[i].uiType == uiType && !ValidateSection(fileBuff, lSections[i], &layout))
+            {
+                LOG_ERROR("[Error] CModelStream::Feed(%s) - %s\n", pszFilePath, layout.pszError);
+                return false;
+            }
+        }
+
+        uiValidatedTypes |= 1u << uiType;
+    }
+
+    return true;
+}
+
+bool CModelStream::FeedSections()
+{
+    if (!bTableValid)
+    {
+        const eValidateResult result = ValidateSectionTable(fileBuff, uiAvailable, fileSize, &layout);
+        if (result == VALIDATE_NEED_MORE)
+            return true;
+
+        if (result == VALIDATE_INVALID)
+        {
+            LOG_ERROR("[Error] CModelStream::Feed(%s) - %s\n", pszFilePath, layout.pszError);
+            return false;
+        }
+
+        bTableValid = true;
+    }
+
+    // section types by bit; the mesh and the animation read sections that come after the mask
+#define SECTION_TYPES(first, last)      ((2u << (last)) - (1u << (first)))
+    static const struct { unsigned int uiGroup; unsigned int uiTypes; } s_groups[] =
+    {
+        { MODEL_SECTION_SKELETON,       SECTION_TYPES(SECTION_BONES, SECTION_HELPERS) },
+        { MODEL_SECTION_MESH_INFO,      SECTION_TYPES(SECTION_MESH, SECTION_MESH) },
+        { MODEL_SECTION_MESH,           SECTION_TYPES(SECTION_MESH, SECTION_SKIN_INDICES) | SECTION_TYPES(SECTION_MESH_LODS, SECTION_MESH_LODS) },
+        { MODEL_SECTION_COLLISION,      SECTION_TYPES(SECTION_COLLISION, SECTION_COLLISION) },
+        { MODEL_SECTION_ANIMATION,      SECTION_TYPES(SECTION_ANIMATION, SECTION_ANIMATION) | SECTION_TYPES(SECTION_ANIMATION_BOUNDS, SECTION_ANIMATION_BOUNDS) },
+        { MODEL_SECTION_ANIMATION_MASK, SECTION_TYPES(SECTION_ANIMATION_MASK, SECTION_ANIMATION_MASK) },
+    };
+#undef SECTION_TYPES
+
+    // the end of the last byte each group reads; missing sections don't hold anything up
+    const sSectionTable* pTable = (const sSectionTable*)(fileBuff + sizeof(sHeader));
+    const sSectionEntry* lSections = (const sSectionEntry*)(pTable + 1);
+    unsigned int lGroupEnd[sizeof(s_groups) / sizeof(s_groups[0])];
+    for (unsigned int g = 0; g < sizeof(s_groups) / sizeof(s_groups[0]); ++g)
+    {
+        lGroupEnd[g] = 0;
+        for (unsigned int i = 0; i < pTable->numSections; ++i)
+        {
+            if (lSections[i].uiType < 32 && (s_groups[g].uiTypes & (1u << lSections[i].uiType)))
+                lGroupEnd[g] = Max(lGroupEnd[g], lSections[i].uiOffset + lSections[i].uiSize);
+        }
+    }
+
+    for (unsigned int g = 0; g < sizeof(s_groups) / sizeof(s_groups[0]); ++g)
+    {
+        const unsigned int uiGroup = s_groups[g].uiGroup;
+        if ((uiPublished & uiGroup) || lGroupEnd[g] > uiAvailable)
+            continue;
+
+        // what the group depends on has to be in as well; ReadSections pulls it in with the group.
+        // the groups before this one in the list were validated by then
+        if ((uiGroup & (MODEL_SECTION_MESH | MODEL_SECTION_COLLISION)) && lGroupEnd[1] > uiAvailable)
+            continue;
+        if ((uiGroup & (MODEL_SECTION_MESH | MODEL_SECTION_ANIMATION_MASK)) && lGroupEnd[0] > uiAvailable)
+            continue;
+
+        if (!ValidateSections(s_groups[g].uiTypes))
+            return false;
+
+        const unsigned int uiBefore = pModelDefinition->uiSections;
+        if (!pLoader->ReadSections(fileBuff, uiGroup, pModelDefinition))
+            return false;
+
+        Publish(pModelDefinition->uiSections & ~uiBefore);
+    }
+
+    return true;
+}
+
+//
+// thread pool reader
+//
+
+struct sStreamModelsJob
+{
+    const CLoader*          pLoader;
+    sStreamRequest*         pRequests;
+    unsigned int            uiChunkSize;
+    ModelStreamCallback     callback;
+    void*                   pUserData;
+    std::atomic<int>        numLoaded;
+};
+
+static bool StreamModel(sStreamModelsJob* pJob, sStreamRequest& req)
+{
+    req.fileBuff = NULL;
+    req.fileSize = 0;
+
+    FILE* f = fopen(req.pszFilePath, "rb");
+    if (f)
+    {
+        fseek(f, 0, SEEK_END);
+        const long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        req.fileSize = (size > 0) ? (unsigned int)size : 0;
+        req.fileBuff = (unsigned char*)malloc(Max(req.fileSize, 1u));
+    }
+
+    // failures go through the stream too, so the callback always gets its finished call
+    CModelStream stream;
+    stream.Begin(pJob->pLoader, req.pszFilePath, req.fileBuff, req.fileSize, req.pModelDefinition, pJob->callback, pJob->pUserData);
+    if (!f || !req.fileBuff)
+    {
+        LOG_ERROR("[Error] StreamModels(%s) - %s\n", req.pszFilePath, f ? "out of memory" : "can't open file");
+        stream.Abort();
+        if (f)
+            fclose(f);
+        return false;
+    }
+
+    // each chunk is parsed right after it's read, on this thread; the groups it completes are published before the
+    // next read, so they're usable while the rest of the file is still to come
+    unsigned int uiRead = 0;
+    eStreamState state = stream.Feed(0);
+    while (state == STREAM_PENDING && uiRead < req.fileSize)
+    {
+        const unsigned int uiChunk = Min(pJob->uiChunkSize, req.fileSize - uiRead);
+        if (fread(req.fileBuff + uiRead, uiChunk, 1, f) != 1)
+        {
+            LOG_ERROR("[Error] StreamModels(%s) - read failed\n", req.pszFilePath);
+            stream.Abort();
+            state = stream.GetState();
+            break;
+        }
+
+        uiRead += uiChunk;
+        state = stream.Feed(uiRead);
+    }
+
+    fclose(f);
+    return state == STREAM_DONE;
+}
+
+static void StreamModelsJob(void* pUserData, int begin, int end)
+{
+    sStreamModelsJob* pJob = (sStreamModelsJob*)pUserData;
+
+    int numLoaded = 0;
+    for (int i = begin; i < end; ++i)
+    {
+        sStreamRequest& req = pJob->pRequests[i];
+        req.bResult = StreamModel(pJob, req);
+        if (req.bResult)
+            ++numLoaded;
+    }
+
+    pJob->numLoaded += numLoaded;
+}
+
+int StreamModels(const CLoader& loader, sStreamRequest* pRequests, int numRequests, unsigned int uiChunkSize, CJobPool* pJobPool, ModelStreamCallback callback, void* pUserData)
+{
+    sStreamModelsJob job;
+    job.pLoader = &loader;
+    job.pRequests = pRequests;
+    job.uiChunkSize = Max(uiChunkSize, 1u);
+    job.callback = callback;
+    job.pUserData = pUserData;
+    job.numLoaded = 0;
+
+    // one file per task; a thread blocked on the disk doesn't hold up the files queued behind it on others
+    if (pJobPool)
+        pJobPool->ParallelFor(numRequests, 1, StreamModelsJob, &job);
+    else
+        StreamModelsJob(&job, 0, numRequests);
+
+    return job.numLoaded;
+}
+
+}; // end namespace KHM
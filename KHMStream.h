@@ -0,0 +1,98 @@
+#pragma once
+
+#include "KHMModel.h"
+#include "KHMValidate.h"
+
+namespace KHM
+{
+    //
+    // common defines for streaming loads
+    //
+
+    #define KHM_STREAM_CHUNK_SIZE           (256 * 1024) // StreamModels read size
+
+    enum eStreamState
+    {
+        STREAM_PENDING = 0,
+        STREAM_DONE,
+        STREAM_FAILED,
+    };
+
+    // called on the feeding thread every time a group of MODEL_SECTION_* becomes usable; bFinished is set on the
+    // last call ( uiNewSections is 0 if the stream failed )
+    typedef void (*ModelStreamCallback)(void* pUserData, sModelDefinition* pModelDefinition, unsigned int uiNewSections, bool bFinished);
+
+    //
+    // KHM Model Stream - parses a model while its file is still arriving
+    //
+    // the caller owns a buffer big enough for the whole file and writes the chunks into it in order, then reports
+    // how many bytes are in. v102 files publish each section group as soon as its bytes are in, so the skeleton and
+    // the mesh bounds come long before the vertex and animation payloads; v101 files publish stage by stage
+    // ( bones and helpers, mesh, animation, mask ), since the file can only be walked front to back
+    //
+
+    class CModelStream
+    {
+        public:
+            CModelStream();
+
+        public:
+            // the model points into fileBuff, so it must outlive the model
+            void Begin(const CLoader* pLoader, const char* pszFilePath, unsigned char* fileBuff, unsigned int fileSize, sModelDefinition* pModelDefinition, ModelStreamCallback callback, void* pUserData);
+
+            // uiBytesAvailable: total bytes written to fileBuff so far
+            eStreamState Feed(unsigned int uiBytesAvailable);
+
+            // fails a pending stream whose file can't be read any further; the callback gets its finished call
+            void Abort();
+
+            eStreamState GetState() const { return state; }
+            unsigned int GetPublishedSections() const { return uiPublished; }
+
+        private:
+            bool FeedSequential();
+            bool FeedSections();
+            bool ValidateSections(unsigned int uiTypes);    // bit per eSectionType
+            void Publish(unsigned int uiSections);
+            void Finish(eStreamState finalState);
+
+        private:
+            const CLoader*          pLoader;
+            const char*             pszFilePath;
+            unsigned char*          fileBuff;
+            unsigned int            fileSize;
+            unsigned int            uiAvailable;
+            sModelDefinition*       pModelDefinition;
+            ModelStreamCallback     callback;
+            void*                   pUserData;
+
+            eStreamState            state;
+            unsigned int            uiVersion;      // 0 until the header is in
+            unsigned int            uiPublished;    // MODEL_SECTION_*
+            sModelLayout            layout;         // validated so far
+
+            // v101
+            int                     stage;
+            unsigned int            uiStageOffset;
+
+            // v102
+            bool                    bTableValid;
+            unsigned int            uiValidatedTypes; // 1 << eSectionType
+    };
+
+    //
+    // thread pool reader: every file is read in chunks and fed to its own CModelStream as the chunks land
+    //
+
+    struct sStreamRequest
+    {
+        const char*             pszFilePath;
+        sModelDefinition*       pModelDefinition;
+        unsigned char*          fileBuff;       // out; malloc'd, the model points into it; free() after Destroy()
+        unsigned int            fileSize;       // out
+        bool                    bResult;        // out
+    };
+
+    // returns the number of models loaded successfully; the callback is called from the pool threads
+    int StreamModels(const CLoader& loader, sStreamRequest* pRequests, int numRequests, unsigned int uiChunkSize, CJobPool* pJobPool, ModelStreamCallback callback, void* pUserData);
+};
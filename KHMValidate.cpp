@@ -0,0 +1,825 @@
+#include "KHMValidate.h"
+#include "KHMStats.h"
+#include "Kernel/Log.h"
+
+namespace KHM {
+
+sModelLayout::sModelLayout()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+//
+// helpers
+//
+
+// bounded cursor over the bytes that are in; offsets are from the beginning of the file
+struct sValidateCursor
+{
+    const unsigned char*    buff;
+    unsigned int            size;
+    unsigned int            pos;
+
+    bool Skip(unsigned long long numBytes)
+    {
+        if (numBytes > size - pos)
+            return false;
+        pos += (unsigned int)numBytes;
+        return true;
+    }
+
+    bool Read(void* pDest, unsigned int numBytes)
+    {
+        if (numBytes > size - pos)
+            return false;
+        memcpy(pDest, buff + pos, numBytes);
+        pos += numBytes;
+        return true;
+    }
+
+    bool ReadInt(int& value) { return Read(&value, sizeof(value)); }
+    bool ReadFloat(float& value) { return Read(&value, sizeof(value)); }
+    bool ReadByte(unsigned char& value) { return Read(&value, sizeof(value)); }
+};
+
+#define VALIDATE_READ(expr)             { if (!(expr)) return VALIDATE_NEED_MORE; }
+#define VALIDATE_CHECK(cond, msg)       { if (!(cond)) { pLayout->pszError = (msg); return VALIDATE_INVALID; } }
+
+static bool CheckHeader(const unsigned char* fileBuff, sModelLayout* pLayout)
+{
+    const sHeader* fileHeader = (const sHeader*)fileBuff;
+    if (fileHeader->uiSig[0] != 'K' || fileHeader->uiSig[1] != 'H' || fileHeader->uiSig[2] != 'M')
+    {
+        pLayout->pszError = "KHM header mismatch";
+        return false;
+    }
+
+    if (fileHeader->uiVer != KHM_VERSION_SEQUENTIAL && fileHeader->uiVer != KHM_VERSION_SECTIONS)
+    {
+        pLayout->pszError = "wrong file version";
+        return false;
+    }
+
+    pLayout->uiVersion = fileHeader->uiVer;
+    return true;
+}
+
+// names are looked up with strcmp, and GetObjectById expects every object at its id
+static bool CheckObjects(const unsigned char* pObjects, int count, unsigned int uiFirstId, sModelLayout* pLayout)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        const unsigned char* pObject = pObjects + sizeof(sObjectBase) * i;
+        if (!memchr(pObject + offsetof(sObjectBase, szName), 0, KHM_MAX_OBJECT_NAME))
+        {
+            pLayout->pszError = "object name is not terminated";
+            return false;
+        }
+
+        unsigned int uiId;
+        memcpy(&uiId, pObject + offsetof(sObjectBase, uiId), sizeof(uiId));
+        if (uiId != uiFirstId + i)
+        {
+            pLayout->pszError = "object id doesn't match its position";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ReadMeshes asserts on these
+static bool CheckMeshObject(const unsigned char* pObject, sModelLayout* pLayout)
+{
+    unsigned int uiId, uiParentId;
+    memcpy(&uiId, pObject + offsetof(sObjectBase, uiId), sizeof(uiId));
+    memcpy(&uiParentId, pObject + offsetof(sObjectBase, uiParentId), sizeof(uiParentId));
+    if (!memchr(pObject + offsetof(sObjectBase, szName), 0, KHM_MAX_OBJECT_NAME) || uiId >= 256 || (uiParentId >= 256 && uiParentId != (unsigned int)-1))
+    {
+        pLayout->pszError = "bad mesh object";
+        return false;
+    }
+
+    return true;
+}
+
+static bool CheckIndices(const unsigned char* pIndices, int numIndices, int numVertices, sModelLayout* pLayout)
+{
+    // a max reduction instead of a compare per index; this is the one check that scales with the mesh, and it vectorizes
+    unsigned short maxIndex = 0;
+    for (int i = 0; i < numIndices; ++i)
+    {
+        unsigned short index;
+        memcpy(&index, pIndices + sizeof(index) * i, sizeof(index));
+        maxIndex = Max(maxIndex, index);
+    }
+
+    if (numIndices && maxIndex >= numVertices)
+    {
+        pLayout->pszError = "index out of the vertex range";
+        return false;
+    }
+
+    return true;
+}
+
+// the skinning palette has a matrix per bone; unused influences still point at one. A model without bones has no
+// palette to skin with ( ComputeAnimationBounds and the like check for bones ), so its indices are left alone
+static bool CheckBoneIndices(const unsigned char* pBoneIndices, int numVertices, int numBones, sModelLayout* pLayout)
+{
+    if (!numBones)
+        return true;
+
+    unsigned char maxIndex = 0;
+    for (long long i = 0; i < (long long)numVertices * KHM_MAX_BONE_INFLUENCES; ++i)
+        maxIndex = Max(maxIndex, pBoneIndices[i]);
+
+    if (numVertices && maxIndex >= numBones)
+    {
+        pLayout->pszError = "bone index out of the bone range";
+        return false;
+    }
+
+    return true;
+}
+
+static bool CheckMaskEntries(const unsigned char* pEntries, int numEntries, sModelLayout* pLayout)
+{
+    for (int i = 0; i < numEntries; ++i)
+    {
+        if (!memchr(pEntries + sizeof(sAnimationMaskEntry) * i + offsetof(sAnimationMaskEntry, szObjectName), 0, KHM_MAX_OBJECT_NAME))
+        {
+            pLayout->pszError = "mask entry name is not terminated";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// same records ReadCollisionData parses
+static eValidateResult ValidateCollisions(sValidateCursor& cur, sModelLayout* pLayout)
+{
+    int numCollisions;
+    VALIDATE_READ(cur.ReadInt(numCollisions));
+    VALIDATE_CHECK(numCollisions >= 0, "negative collision count");
+
+    for (int i = 0; i < numCollisions; ++i)
+    {
+        int type;
+        VALIDATE_READ(cur.ReadInt(type));
+        VALIDATE_READ(cur.Skip(sizeof(float) * 16));
+
+        switch (type)
+        {
+            case sCollisionShape::SPHERE:
+                VALIDATE_READ(cur.Skip(sizeof(float)));
+                break;
+
+            case sCollisionShape::BOX:
+                VALIDATE_READ(cur.Skip(sizeof(float) * 3));
+                break;
+
+            case sCollisionShape::CAPSULE:
+                VALIDATE_READ(cur.Skip(sizeof(float) * 2));
+                break;
+
+            case sCollisionShape::CONVEX_MESH:
+            {
+                int numPolys, numIndices, numVertices;
+                VALIDATE_READ(cur.ReadInt(numPolys));
+                VALIDATE_CHECK(numPolys >= 0, "negative hull polygon count");
+                const unsigned int uiPolygons = cur.pos;
+                VALIDATE_READ(cur.Skip(sizeof(sCollisionPolygon) * (unsigned long long)numPolys));
+
+                VALIDATE_READ(cur.ReadInt(numIndices));
+                VALIDATE_CHECK(numIndices >= 0, "negative hull index count");
+                const unsigned int uiIndices = cur.pos;
+                VALIDATE_READ(cur.Skip(sizeof(unsigned short) * (unsigned long long)numIndices));
+
+                VALIDATE_READ(cur.ReadInt(numVertices));
+                VALIDATE_CHECK(numVertices >= 0, "negative hull vertex count");
+                VALIDATE_READ(cur.Skip(sizeof(Vector3) * (unsigned long long)numVertices));
+
+                // the collision queries walk the polygons through the indices
+                for (int p = 0; p < numPolys; ++p)
+                {
+                    sCollisionPolygon polygon;
+                    memcpy(&polygon, cur.buff + uiPolygons + sizeof(sCollisionPolygon) * p, sizeof(polygon));
+                    VALIDATE_CHECK((int)polygon.indexBase + (int)polygon.numVerts <= numIndices, "hull polygon out of the index range");
+                }
+
+                VALIDATE_CHECK(CheckIndices(cur.buff + uiIndices, numIndices, numVertices, pLayout), pLayout->pszError);
+                break;
+            }
+
+            default:
+                VALIDATE_CHECK(false, "unknown collision shape");
+        }
+    }
+
+    pLayout->numCollisions = numCollisions;
+    return VALIDATE_OK;
+}
+
+//
+// v101
+//
+
+static eValidateResult ValidateObjects(sValidateCursor& cur, bool bBones, sModelLayout* pLayout)
+{
+    unsigned char count;
+    VALIDATE_READ(cur.ReadByte(count));
+
+    const unsigned int uiObjects = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(sObjectBase) * count));
+    VALIDATE_CHECK(CheckObjects(cur.buff + uiObjects, count, bBones ? 0 : pLayout->numBones, pLayout), pLayout->pszError);
+
+    if (bBones)
+    {
+        pLayout->uiBones = count ? uiObjects : 0;
+        pLayout->numBones = count;
+    }
+    else
+    {
+        pLayout->uiHelpers = count ? uiObjects : 0;
+        pLayout->numHelpers = count;
+    }
+
+    return VALIDATE_OK;
+}
+
+static eValidateResult ValidateMesh(sValidateCursor& cur, sModelLayout* pLayout)
+{
+    unsigned char hasMesh;
+    VALIDATE_READ(cur.ReadByte(hasMesh));
+    if (!hasMesh)
+        return VALIDATE_OK;
+
+    const unsigned int uiMesh = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(sObjectBase)));
+    VALIDATE_CHECK(CheckMeshObject(cur.buff + uiMesh, pLayout), pLayout->pszError);
+
+    int numVertices;
+    VALIDATE_READ(cur.ReadInt(numVertices));
+    VALIDATE_CHECK(numVertices >= 0, "negative vertex count");
+
+    const unsigned long long uiVertices = (unsigned int)numVertices;
+    pLayout->uiVertices = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(Vector3) * uiVertices));
+    pLayout->uiNormals = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(Vector3) * uiVertices));
+
+    int numIndices;
+    VALIDATE_READ(cur.ReadInt(numIndices));
+    VALIDATE_CHECK(numIndices >= 0, "negative index count");
+
+    pLayout->uiIndices = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(unsigned short) * (unsigned long long)numIndices));
+    VALIDATE_CHECK(CheckIndices(cur.buff + pLayout->uiIndices, numIndices, numVertices, pLayout), pLayout->pszError);
+
+    pLayout->uiFaceNormals = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(Vector3) * (unsigned long long)(numIndices / 3)));
+
+    unsigned char hasColors;
+    VALIDATE_READ(cur.ReadByte(hasColors));
+    pLayout->uiColors = hasColors ? cur.pos : 0;
+    VALIDATE_READ(cur.Skip(hasColors ? sizeof(unsigned int) * uiVertices : 0));
+
+    // ReadGeometry has room for two sets
+    int numTexCoordMaps;
+    VALIDATE_READ(cur.ReadInt(numTexCoordMaps));
+    VALIDATE_CHECK(numTexCoordMaps >= 0 && numTexCoordMaps <= 2, "too many uv sets");
+    pLayout->uiTexCoords = numTexCoordMaps ? cur.pos : 0;
+    VALIDATE_READ(cur.Skip(sizeof(Vector2) * uiVertices * numTexCoordMaps));
+
+    unsigned char hasSkin;
+    VALIDATE_READ(cur.ReadByte(hasSkin));
+    pLayout->uiSkinWeights = hasSkin ? cur.pos : 0;
+    VALIDATE_READ(cur.Skip(hasSkin ? sizeof(Vector4) * uiVertices : 0));
+    pLayout->uiSkinIndices = hasSkin ? cur.pos : 0;
+    VALIDATE_READ(cur.Skip(hasSkin ? sizeof(sBoneIndices) * uiVertices : 0));
+    VALIDATE_CHECK(!hasSkin || CheckBoneIndices(cur.buff + pLayout->uiSkinIndices, numVertices, pLayout->numBones, pLayout), pLayout->pszError);
+
+    pLayout->uiCollisions = cur.pos;
+    const eValidateResult result = ValidateCollisions(cur, pLayout);
+    if (result != VALIDATE_OK)
+        return result;
+
+    pLayout->uiBounds = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(Vector3) * 2));
+
+    pLayout->uiMesh = uiMesh;
+    pLayout->uiVolume = 0;
+    pLayout->numVertices = numVertices;
+    pLayout->numIndices = numIndices;
+    return VALIDATE_OK;
+}
+
+static eValidateResult ValidateAnimation(sValidateCursor& cur, sModelLayout* pLayout)
+{
+    unsigned char hasAnim;
+    VALIDATE_READ(cur.ReadByte(hasAnim));
+    if (!hasAnim)
+        return VALIDATE_OK;
+
+    int numNodes, numFrames;
+    float startTimeS, endTimeS;
+    VALIDATE_READ(cur.ReadInt(numNodes));
+    VALIDATE_READ(cur.ReadFloat(startTimeS));
+    VALIDATE_READ(cur.ReadFloat(endTimeS));
+    VALIDATE_READ(cur.ReadInt(numFrames));
+    VALIDATE_CHECK(numNodes >= 0 && numFrames >= 0, "negative animation size");
+
+    VALIDATE_READ(cur.Skip(sizeof(sNodeAnimation) * (unsigned long long)numNodes));
+    pLayout->uiAnimation = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(sNodeTransform) * (unsigned long long)numNodes * (unsigned long long)numFrames));
+
+    // same math as ReadAnimation
+    endTimeS -= startTimeS;
+    pLayout->numNodes = numNodes;
+    pLayout->numNodeFrames = numFrames;
+    pLayout->frameDurationMs = (endTimeS * 1000.f) / (float)(Max(numFrames - 1, 1));
+    return VALIDATE_OK;
+}
+
+static eValidateResult ValidateAnimationMask(sValidateCursor& cur, sModelLayout* pLayout)
+{
+    unsigned char hasMask;
+    VALIDATE_READ(cur.ReadByte(hasMask));
+    if (!hasMask)
+        return VALIDATE_OK;
+
+    int numEntries;
+    VALIDATE_READ(cur.ReadInt(numEntries));
+    VALIDATE_CHECK(numEntries >= 0, "negative mask entry count");
+
+    const unsigned int uiMask = cur.pos;
+    VALIDATE_READ(cur.Skip(sizeof(sAnimationMaskEntry) * (unsigned long long)numEntries));
+    VALIDATE_CHECK(CheckMaskEntries(cur.buff + uiMask, numEntries, pLayout), pLayout->pszError);
+
+    pLayout->uiMask = uiMask;
+    pLayout->numMaskEntries = numEntries;
+    return VALIDATE_OK;
+}
+
+eValidateResult ValidateSequentialStage(int stage, const unsigned char* fileBuff, unsigned int uiAvailable, unsigned int uiOffset, unsigned int* puiStageEnd, sModelLayout* pLayout)
+{
+    KHM_STATS_STAGE(LOAD_STAGE_VALIDATE);
+
+    sValidateCursor cur;
+    cur.buff = fileBuff;
+    cur.size = uiAvailable;
+    cur.pos = uiOffset;
+
+    eValidateResult result = VALIDATE_INVALID;
+    switch (stage)
+    {
+        case SEQUENTIAL_BONES:      result = ValidateObjects(cur, true, pLayout); break;
+        case SEQUENTIAL_HELPERS:    result = ValidateObjects(cur, false, pLayout); break;
+        case SEQUENTIAL_MESH:       result = ValidateMesh(cur, pLayout); break;
+        case SEQUENTIAL_ANIMATION:  result = ValidateAnimation(cur, pLayout); break;
+        case SEQUENTIAL_MASK:       result = ValidateAnimationMask(cur, pLayout); break;
+        default:                    pLayout->pszError = "unknown stage"; break;
+    }
+
+    *puiStageEnd = cur.pos;
+    return result;
+}
+
+//
+// v102
+//
+
+eValidateResult ValidateSectionTable(const unsigned char* fileBuff, unsigned int uiAvailable, unsigned int fileSize, sModelLayout* pLayout)
+{
+    KHM_STATS_STAGE(LOAD_STAGE_VALIDATE);
+
+    const unsigned int uiTableStart = sizeof(sHeader) + sizeof(sSectionTable);
+    VALIDATE_READ(uiAvailable >= uiTableStart);
+    VALIDATE_CHECK(CheckHeader(fileBuff, pLayout), pLayout->pszError);
+    VALIDATE_CHECK(pLayout->uiVersion == KHM_VERSION_SECTIONS, "not a section table file");
+
+    const sSectionTable* pTable = (const sSectionTable*)(fileBuff + sizeof(sHeader));
+    VALIDATE_CHECK(pTable->uiFileSize <= fileSize && pTable->numSections <= (fileSize - uiTableStart) / sizeof(sSectionEntry), "truncated section table");
+
+    const unsigned int uiSectionsStart = uiTableStart + pTable->numSections * sizeof(sSectionEntry);
+    VALIDATE_READ(uiAvailable >= uiSectionsStart);
+
+    const sSectionEntry* lSections = (const sSectionEntry*)(pTable + 1);
+    unsigned int uiTypesSeen = 0;
+    for (unsigned int i = 0; i < pTable->numSections; ++i)
+    {
+        const sSectionEntry& section = lSections[i];
+        VALIDATE_CHECK(section.uiOffset >= uiSectionsStart && section.uiOffset <= fileSize && section.uiSize <= fileSize - section.uiOffset, "section is out of the file");
+        VALIDATE_CHECK((section.uiOffset & (KHM_SECTION_ALIGNMENT - 1)) == 0, "misaligned section");
+
+        // unknown types are skipped, known ones are looked up by type
+        if (section.uiType >= SECTION_BONES && section.uiType <= SECTION_MESH_LODS)
+        {
+            VALIDATE_CHECK(!(uiTypesSeen & (1u << section.uiType)), "duplicate section");
+            uiTypesSeen |= 1u << section.uiType;
+        }
+    }
+
+    pLayout->uiFileSize = fileSize;
+    return VALIDATE_OK;
+}
+
+bool ValidateSection(const unsigned char* fileBuff, const sSectionEntry& section, sModelLayout* pLayout)
+{
+    KHM_STATS_STAGE(LOAD_STAGE_VALIDATE);
+
+    const unsigned char* pData = fileBuff + section.uiOffset;
+    const unsigned int uiCount = section.uiCount;
+
+    // geometry streams: absent, or big enough for the mesh; pointers to empty ones stay NULL, like GetSectionData
+    unsigned int* puiStream = NULL;
+    unsigned int uiElementSize = 0;
+    unsigned int uiRequired = 0;
+
+    switch (section.uiType)
+    {
+        case SECTION_BONES:
+        case SECTION_HELPERS:
+        {
+            const bool bBones = section.uiType == SECTION_BONES;
+            const unsigned int uiFirstId = bBones ? 0 : pLayout->numBones;
+            if (uiCount > 255 - uiFirstId || section.uiSize / sizeof(sObjectBase) < uiCount)
+            {
+                pLayout->pszError = "bad object section size";
+                return false;
+            }
+
+            if (!CheckObjects(pData, uiCount, uiFirstId, pLayout))
+                return false;
+
+            (bBones ? pLayout->uiBones : pLayout->uiHelpers) = uiCount ? section.uiOffset : 0;
+            (bBones ? pLayout->numBones : pLayout->numHelpers) = uiCount;
+            return true;
+        }
+
+        case SECTION_MESH:
+        {
+            sMeshInfo info;
+            if (section.uiSize < sizeof(sMeshInfo))
+            {
+                pLayout->pszError = "truncated mesh section";
+                return false;
+            }
+
+            memcpy(&info, pData, sizeof(info));
+            if (!CheckMeshObject(pData, pLayout))
+                return false;
+
+            if (info.numVertices < 0 || info.numIndices < 0)
+            {
+                pLayout->pszError = "bad mesh info";
+                return false;
+            }
+
+            pLayout->uiMesh = section.uiOffset;
+            pLayout->uiBounds = section.uiOffset + offsetof(sMeshInfo, min);
+            pLayout->uiVolume = section.uiOffset + offsetof(sMeshInfo, volume);
+            pLayout->numVertices = info.numVertices;
+            pLayout->numIndices = info.numIndices;
+            return true;
+        }
+
+        case SECTION_VERTICES:      puiStream = &pLayout->uiVertices;       uiElementSize = sizeof(Vector3);        uiRequired = pLayout->numVertices; break;
+        case SECTION_NORMALS:       puiStream = &pLayout->uiNormals;        uiElementSize = sizeof(Vector3);        uiRequired = pLayout->numVertices; break;
+        case SECTION_INDICES:       puiStream = &pLayout->uiIndices;        uiElementSize = sizeof(unsigned short); uiRequired = pLayout->numIndices; break;
+        case SECTION_FACE_NORMALS:  puiStream = &pLayout->uiFaceNormals;    uiElementSize = sizeof(Vector3);        uiRequired = pLayout->numIndices / 3; break;
+        case SECTION_COLORS:        puiStream = &pLayout->uiColors;         uiElementSize = sizeof(unsigned int);   uiRequired = pLayout->numVertices; break;
+        case SECTION_TEXCOORDS:     puiStream = &pLayout->uiTexCoords;      uiElementSize = sizeof(Vector2);        uiRequired = pLayout->numVertices; break;
+        case SECTION_SKIN_WEIGHTS:  puiStream = &pLayout->uiSkinWeights;    uiElementSize = sizeof(Vector4);        uiRequired = pLayout->numVertices; break;
+        case SECTION_SKIN_INDICES:  puiStream = &pLayout->uiSkinIndices;    uiElementSize = sizeof(sBoneIndices);   uiRequired = pLayout->numVertices; break;
+
+        case SECTION_COLLISION:
+        {
+            sValidateCursor cur;
+            cur.buff = fileBuff;
+            cur.size = section.uiOffset + section.uiSize;
+            cur.pos = section.uiOffset;
+
+            const eValidateResult result = ValidateCollisions(cur, pLayout);
+            if (result != VALIDATE_OK)
+            {
+                if (result == VALIDATE_NEED_MORE)
+                    pLayout->pszError = "truncated collision section";
+                return false;
+            }
+
+            pLayout->uiCollisions = section.uiOffset;
+            return true;
+        }
+
+        case SECTION_ANIMATION:
+        {
+            sAnimationInfo info;
+            if (section.uiSize < sizeof(sAnimationInfo))
+            {
+                pLayout->pszError = "truncated animation section";
+                return false;
+            }
+
+            memcpy(&info, pData, sizeof(info));
+            const unsigned long long uiTransformsSize = sizeof(sNodeTransform) * (unsigned long long)(unsigned int)info.numNodes * (unsigned long long)(unsigned int)info.numNodeFrames;
+            if (info.numNodes < 0 || info.numNodeFrames < 0 || section.uiSize - sizeof(sAnimationInfo) < uiTransformsSize)
+            {
+                pLayout->pszError = "truncated animation section";
+                return false;
+            }
+
+            pLayout->uiAnimation = section.uiOffset + sizeof(sAnimationInfo);
+            pLayout->numNodes = info.numNodes;
+            pLayout->numNodeFrames = info.numNodeFrames;
+            pLayout->frameDurationMs = info.frameDurationMs;
+            return true;
+        }
+
+        case SECTION_ANIMATION_MASK:
+        {
+            if (section.uiSize / sizeof(sAnimationMaskEntry) < uiCount)
+            {
+                pLayout->pszError = "truncated mask section";
+                return false;
+            }
+
+            if (!CheckMaskEntries(pData, uiCount, pLayout))
+                return false;
+
+            pLayout->uiMask = section.uiOffset;
+            pLayout->numMaskEntries = uiCount;
+            return true;
+        }
+
+        case SECTION_ANIMATION_BOUNDS:
+        {
+            // validated after SECTION_ANIMATION, so the frame count is known
+            sAnimationBoundsInfo info;
+            if (section.uiSize < sizeof(sAnimationBoundsInfo))
+            {
+                pLayout->pszError = "truncated animation bounds section";
+                return false;
+            }
+
+            memcpy(&info, pData, sizeof(info));
+            if (!pLayout->uiAnimation || info.framesPerGroup < 1 || info.numGroups != ((long long)pLayout->numNodeFrames + info.framesPerGroup - 1) / info.framesPerGroup)
+            {
+                pLayout->pszError = "animation bounds don't match the animation";
+                return false;
+            }
+
+            if ((section.uiSize - sizeof(sAnimationBoundsInfo)) / sizeof(sAnimationBounds) < (unsigned int)info.numGroups)
+            {
+                pLayout->pszError = "truncated animation bounds section";
+                return false;
+            }
+
+            // culling trusts these; an inverted or NaN box would hide the model for good
+            for (int i = 0; i < info.numGroups; ++i)
+            {
+                float box[6];
+                memcpy(box, pData + sizeof(sAnimationBoundsInfo) + sizeof(sAnimationBounds) * i, sizeof(box));
+                if (!(box[0] <= box[3] && box[1] <= box[4] && box[2] <= box[5]))
+                {
+                    pLayout->pszError = "invalid animation bounds";
+                    return false;
+                }
+            }
+
+            pLayout->uiAnimationBounds = section.uiOffset + sizeof(sAnimationBoundsInfo);
+            pLayout->numBoundsGroups = info.numGroups;
+            pLayout->framesPerBoundsGroup = info.framesPerGroup;
+            return true;
+        }
+
+        case SECTION_MESH_LODS:
+        {
+            // validated after SECTION_MESH, so the vertex count is known
+            sMeshLodInfo info;
+            if (section.uiSize < sizeof(sMeshLodInfo))
+            {
+                pLayout->pszError = "truncated mesh lod section";
+                return false;
+            }
+
+            memcpy(&info, pData, sizeof(info));
+            if (!pLayout->uiMesh || info.numLods < 1 || info.numLods > KHM_MAX_MESH_LODS || info.numIndices < 0)
+            {
+                pLayout->pszError = "bad mesh lod info";
+                return false;
+            }
+
+            if ((section.uiSize - sizeof(sMeshLodInfo)) / sizeof(unsigned short) < (unsigned int)info.numIndices)
+            {
+                pLayout->pszError = "truncated mesh lod section";
+                return false;
+            }
+
+            // the selection walks the errors in order, so they can only grow; NaN fails the compare too
+            float lastError = 0.0f;
+            for (int i = 0; i < info.numLods; ++i)
+            {
+                const sMeshLod& lod = info.lods[i];
+                if (lod.numIndices < 0 || lod.numIndices % 3 || lod.uiFirstIndex > (unsigned int)info.numIndices ||
+                    (unsigned int)lod.numIndices > (unsigned int)info.numIndices - lod.uiFirstIndex || !(lod.error >= lastError))
+                {
+                    pLayout->pszError = "bad mesh lod";
+                    return false;
+                }
+                lastError = lod.error;
+            }
+
+            if (!CheckIndices(pData + sizeof(sMeshLodInfo), info.numIndices, pLayout->numVertices, pLayout))
+                return false;
+
+            pLayout->uiMeshLods = section.uiOffset;
+            pLayout->uiLodIndices = section.uiOffset + sizeof(sMeshLodInfo);
+            pLayout->numMeshLods = info.numLods;
+            pLayout->numLodIndices = info.numIndices;
+            return true;
+        }
+
+        default:
+            return true;
+    }
+
+    if (section.uiSize / uiElementSize < uiRequired)
+    {
+        pLayout->pszError = "geometry section is smaller than the mesh";
+        return false;
+    }
+
+    if (section.uiType == SECTION_INDICES && !CheckIndices(pData, pLayout->numIndices, pLayout->numVertices, pLayout))
+        return false;
+    if (section.uiType == SECTION_SKIN_INDICES && !CheckBoneIndices(pData, pLayout->numVertices, pLayout->numBones, pLayout))
+        return false;
+
+    *puiStream = uiRequired ? section.uiOffset : 0;
+    return true;
+}
+
+//
+// whole file
+//
+
+// v102 section types a load of the MODEL_SECTION_* groups reads, with the ones their checks need: the streams are
+// sized by the mesh info and the skin indices checked against the bones
+static unsigned int GetSectionTypes(unsigned int uiSections)
+{
+    unsigned int uiTypes = 0;
+    if (uiSections & MODEL_SECTION_SKELETON)
+        uiTypes |= (1u << SECTION_BONES) | (1u << SECTION_HELPERS);
+    if (uiSections & MODEL_SECTION_MESH_INFO)
+        uiTypes |= 1u << SECTION_MESH;
+    if (uiSections & MODEL_SECTION_MESH)
+    {
+        uiTypes |= (1u << SECTION_BONES) | (1u << SECTION_MESH) | (1u << SECTION_MESH_LODS);
+        for (unsigned int uiType = SECTION_VERTICES; uiType <= SECTION_SKIN_INDICES; ++uiType)
+            uiTypes |= 1u << uiType;
+    }
+    if (uiSections & MODEL_SECTION_COLLISION)
+        uiTypes |= 1u << SECTION_COLLISION;
+    if (uiSections & MODEL_SECTION_ANIMATION)
+        uiTypes |= (1u << SECTION_ANIMATION) | (1u << SECTION_ANIMATION_BOUNDS);
+    if (uiSections & MODEL_SECTION_ANIMATION_MASK)
+        uiTypes |= 1u << SECTION_ANIMATION_MASK;
+
+    return uiTypes;
+}
+
+static bool ValidateSections(const unsigned char* fileBuff, unsigned int fileSize, unsigned int uiTypes, sModelLayout* pLayout)
+{
+    if (ValidateSectionTable(fileBuff, fileSize, fileSize, pLayout) != VALIDATE_OK)
+    {
+        if (!pLayout->pszError)
+            pLayout->pszError = "truncated section table";
+        return false;
+    }
+
+    // in type order; the objects and the streams depend on the sections before them
+    const sSectionTable* pTable = (const sSectionTable*)(fileBuff + sizeof(sHeader));
+    const sSectionEntry* lSections = (const sSectionEntry*)(pTable + 1);
+    for (unsigned int uiType = SECTION_BONES; uiType <= SECTION_MESH_LODS; ++uiType)
+    {
+        if (!(uiTypes & (1u << uiType)))
+            continue;
+
+        for (unsigned int i = 0; i < pTable->numSections; ++i)
+        {
+            if (lSections[i].uiType == uiType && !ValidateSection(fileBuff, lSections[i], pLayout))
+                return false;
+        }
+    }
+
+    // the same rules ReadSections applies to a partial load
+    if ((uiTypes & (1u << SECTION_VERTICES)) && pLayout->uiMesh && ((pLayout->numVertices && !pLayout->uiVertices) || (pLayout->numIndices && !pLayout->uiIndices) || !pLayout->uiSkinWeights != !pLayout->uiSkinIndices))
+    {
+        pLayout->pszError = "missing geometry sections";
+        return false;
+    }
+
+    return true;
+}
+
+bool ValidateModel(const char* pszFilePath, const unsigned char* fileBuff, unsigned int fileSize, sModelLayout* pLayout)
+{
+    return ValidateModelSections(pszFilePath, fileBuff, fileSize, MODEL_SECTIONS_ALL, pLayout);
+}
+
+bool ValidateModelSections(const char* pszFilePath, const unsigned char* fileBuff, unsigned int fileSize, unsigned int uiSections, sModelLayout* pLayout)
+{
+    KHM_STATS_STAGE(LOAD_STAGE_VALIDATE);
+
+    *pLayout = sModelLayout();
+    pLayout->uiFileSize = fileSize;
+
+    bool bOk = fileSize >= sizeof(sHeader) && CheckHeader(fileBuff, pLayout);
+    if (!bOk && !pLayout->pszError)
+        pLayout->pszError = "KHM header mismatch";
+
+    if (bOk && pLayout->uiVersion == KHM_VERSION_SECTIONS)
+    {
+        bOk = ValidateSections(fileBuff, fileSize, GetSectionTypes(uiSections), pLayout);
+    }
+    else if (bOk)
+    {
+        unsigned int uiOffset = sizeof(sHeader);
+        for (int stage = 0; stage < NUM_SEQUENTIAL_STAGES && bOk; ++stage)
+        {
+            const eValidateResult result = ValidateSequentialStage(stage, fileBuff, fileSize, uiOffset, &uiOffset, pLayout);
+            if (result == VALIDATE_NEED_MORE)
+                pLayout->pszError = "file ends before the model does";
+            bOk = result == VALIDATE_OK;
+        }
+    }
+
+    if (!bOk && pszFilePath)
+        LOG_ERROR("[Error] ValidateModel(%s) - %s\n", pszFilePath, pLayout->pszError);
+
+    return bOk;
+}
+
+bool ValidateSectionCounts(const unsigned char* fileBuff, unsigned int fileSize, sModelLayout* pLayout)
+{
+    KHM_STATS_STAGE(LOAD_STAGE_VALIDATE);
+
+    *pLayout = sModelLayout();
+    if (ValidateSectionTable(fileBuff, fileSize, fileSize, pLayout) != VALIDATE_OK)
+        return false;
+
+    const sSectionTable* pTable = (const sSectionTable*)(fileBuff + sizeof(sHeader));
+    const sSectionEntry* lSections = (const sSectionEntry*)(pTable + 1);
+    for (unsigned int i = 0; i < pTable->numSections; ++i)
+    {
+        const sSectionEntry& section = lSections[i];
+        const unsigned char* pData = fileBuff + section.uiOffset;
+        switch (section.uiType)
+        {
+            case SECTION_BONES:
+            case SECTION_HELPERS:
+                if (section.uiCount > 255 || section.uiSize / sizeof(sObjectBase) < section.uiCount)
+                    return false;
+                (section.uiType == SECTION_BONES ? pLayout->numBones : pLayout->numHelpers) = section.uiCount;
+                break;
+
+            case SECTION_MESH:
+                if (section.uiSize < sizeof(sMeshInfo))
+                    return false;
+                pLayout->uiMesh = section.uiOffset;
+                break;
+
+            case SECTION_COLLISION:
+            {
+                // the smallest record is a sphere: type, matrix, radius
+                int numCollisions;
+                if (section.uiSize < sizeof(int))
+                    return false;
+                memcpy(&numCollisions, pData, sizeof(int));
+                if (numCollisions < 0 || (unsigned int)numCollisions > (section.uiSize - sizeof(int)) / (sizeof(int) + sizeof(float) * 17))
+                    return false;
+                pLayout->uiCollisions = section.uiOffset;
+                pLayout->numCollisions = numCollisions;
+                break;
+            }
+
+            case SECTION_ANIMATION:
+                // only reads the info; the size check covers the transforms without touching them
+                if (!ValidateSection(fileBuff, section, pLayout))
+                    return false;
+                break;
+
+            case SECTION_ANIMATION_MASK:
+                if (section.uiSize / sizeof(sAnimationMaskEntry) < section.uiCount)
+                    return false;
+                pLayout->uiMask = section.uiOffset;
+                break;
+        }
+    }
+
+    return true;
+}
+
+}; // end namespace KHM
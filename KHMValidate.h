@@ -0,0 +1,108 @@
+#pragma once
+
+#include "KHMModel.h"
+
+namespace KHM
+{
+    //
+    // KHM Model Layout - where everything is in a file that passed validation
+    //
+    // every offset is from the beginning of the file and 0 when the part is not there ( nothing lives at 0, that's
+    // the header ). all counts and sizes were checked against the buffer, so CLoader::LoadValidatedModel can build
+    // the model straight from here without a single check
+    //
+
+    struct sModelLayout
+    {
+        sModelLayout();
+
+        unsigned int            uiVersion;
+        unsigned int            uiFileSize;
+
+        unsigned int            uiBones;            // sObjectBase[numBones]
+        unsigned int            uiHelpers;          // sObjectBase[numHelpers]
+        int                     numBones;
+        int                     numHelpers;
+
+        unsigned int            uiMesh;             // sObjectBase ( v101 ) or sMeshInfo ( v102, starts with one )
+        unsigned int            uiVertices;
+        unsigned int            uiNormals;
+        unsigned int            uiIndices;
+        unsigned int            uiFaceNormals;
+        unsigned int            uiColors;
+        unsigned int            uiTexCoords;        // first set; the loader skips the second
+        unsigned int            uiSkinWeights;
+        unsigned int            uiSkinIndices;
+        unsigned int            uiCollisions;       // the records ReadCollisionData parses, count first
+        unsigned int            uiBounds;           // min, max
+        unsigned int            uiVolume;           // 0 = computed at load ( v101 )
+        int                     numVertices;
+        int                     numIndices;
+        int                     numCollisions;
+
+        unsigned int            uiMeshLods;         // sMeshLodInfo; v102 only
+        unsigned int            uiLodIndices;       // unsigned short[numLodIndices]
+        int                     numMeshLods;
+        int                     numLodIndices;
+
+        unsigned int            uiAnimation;        // sNodeTransform[numNodeFrames * numNodes]
+        int                     numNodes;
+        int                     numNodeFrames;
+        float                   frameDurationMs;
+
+        unsigned int            uiAnimationBounds;  // sAnimationBounds[numBoundsGroups]; v102 only
+        int                     numBoundsGroups;
+        int                     framesPerBoundsGroup;
+
+        unsigned int            uiMask;             // sAnimationMaskEntry[numMaskEntries]; an empty mask still masks
+        int                     numMaskEntries;
+
+        const char*             pszError;           // what failed; static string
+    };
+
+    enum eValidateResult
+    {
+        VALIDATE_OK = 0,
+        VALIDATE_NEED_MORE,     // ran out of bytes; a truncated file when the whole file is in
+        VALIDATE_INVALID,
+    };
+
+    // v101 stages, in file order
+    enum eSequentialStage
+    {
+        SEQUENTIAL_BONES = 0,
+        SEQUENTIAL_HELPERS,
+        SEQUENTIAL_MESH,
+        SEQUENTIAL_ANIMATION,
+        SEQUENTIAL_MASK,
+
+        NUM_SEQUENTIAL_STAGES
+    };
+
+    // walks the whole file once: every count and size against the buffer, names terminated, object ids where the
+    // runtime looks for them, triangle and hull indices in range. pszFilePath is only used for the log; NULL = quiet
+    bool ValidateModel(const char* pszFilePath, const unsigned char* fileBuff, unsigned int fileSize, sModelLayout* pLayout);
+
+    // v102: the header, the section table and only the sections a load of the MODEL_SECTION_* groups in uiSections
+    // reads ( and the ones their checks need ), so the pages of the others are never touched; the layout holds just
+    // those. v101 has no table and is walked whole
+    bool ValidateModelSections(const char* pszFilePath, const unsigned char* fileBuff, unsigned int fileSize, unsigned int uiSections, sModelLayout* pLayout);
+
+    // v102: only the object counts and the infos at the head of each section, which is what a loader sizes its memory
+    // with; one page per section at most. The layout is for sizing only: the section contents are neither read nor checked
+    bool ValidateSectionCounts(const unsigned char* fileBuff, unsigned int fileSize, sModelLayout* pLayout);
+
+    //
+    // piecewise validation, for files that are still arriving ( CModelStream )
+    //
+
+    // v101 stage starting at uiOffset, with uiAvailable bytes of the file in; *puiStageEnd is where the next one starts
+    eValidateResult ValidateSequentialStage(int stage, const unsigned char* fileBuff, unsigned int uiAvailable, unsigned int uiOffset, unsigned int* puiStageEnd, sModelLayout* pLayout);
+
+    // v102 header and section table, with uiAvailable bytes of the file in
+    eValidateResult ValidateSectionTable(const unsigned char* fileBuff, unsigned int uiAvailable, unsigned int fileSize, sModelLayout* pLayout);
+
+    // v102 section, once its bytes are in; the table has to be validated, SECTION_BONES before SECTION_HELPERS and
+    // SECTION_MESH before the geometry streams
+    bool ValidateSection(const unsigned char* fileBuff, const sSectionEntry& section, sModelLayout* pLayout);
+};
@@ -0,0 +1,397 @@
+#include "KHMVertexStream.h"
+#include "Kernel/Log.h"
+
+#include <math.h>
+
+namespace KHM {
+
+//
+// layout
+//
+
+static const int s_vertexFormatSizes[NUM_VERTEX_FORMATS] =
+{
+    8,  // VERTEX_FORMAT_FLOAT2
+    12, // VERTEX_FORMAT_FLOAT3
+    16, // VERTEX_FORMAT_FLOAT4
+    8,  // VERTEX_FORMAT_HALF4
+    4,  // VERTEX_FORMAT_OCT_SNORM16
+    4,  // VERTEX_FORMAT_UNORM16_2
+    4,  // VERTEX_FORMAT_UNORM8_4
+    4,  // VERTEX_FORMAT_UINT8_4
+};
+
+int GetVertexFormatSize(eVertexFormat format)
+{
+    return s_vertexFormatSizes[format];
+}
+
+void sVertexLayout::Add(eVertexSemantic semantic, eVertexFormat format)
+{
+    ASSERT(numElements < NUM_VERTEX_SEMANTICS);
+
+    sVertexElement& element = elements[numElements++];
+    element.semantic = (unsigned char)semantic;
+    element.format = (unsigned char)format;
+    element.offset = (unsigned short)stride;
+
+    stride += (GetVertexFormatSize(format) + 3) & ~3;
+}
+
+static bool IsFormatSupported(int semantic, int format)
+{
+    switch (semantic)
+    {
+        case VERTEX_POSITION:       return format == VERTEX_FORMAT_FLOAT3 || format == VERTEX_FORMAT_FLOAT4 || format == VERTEX_FORMAT_HALF4;
+        case VERTEX_NORMAL:         return format == VERTEX_FORMAT_FLOAT3 || format == VERTEX_FORMAT_OCT_SNORM16;
+        case VERTEX_COLOR:          return format == VERTEX_FORMAT_UNORM8_4;
+        case VERTEX_TEXCOORD0:
+        case VERTEX_TEXCOORD1:      return format == VERTEX_FORMAT_FLOAT2 || format == VERTEX_FORMAT_UNORM16_2;
+        case VERTEX_SKIN_WEIGHTS:   return format == VERTEX_FORMAT_FLOAT4 || format == VERTEX_FORMAT_UNORM8_4;
+        case VERTEX_SKIN_INDICES:   return format == VERTEX_FORMAT_UINT8_4;
+        default:                    return false;
+    }
+}
+
+//
+// half floats
+//
+
+unsigned short FloatToHalf(float value)
+{
+    unsigned int f;
+    memcpy(&f, &value, sizeof(f));
+
+    const unsigned int sign = (f >> 16) & 0x8000;
+    const unsigned int fexp = (f >> 23) & 0xFF;
+    unsigned int mant = f & 0x7FFFFF;
+
+    if (fexp == 0xFF)
+        return (unsigned short)(sign | 0x7C00 | (mant ? 0x200 : 0)); // inf / nan
+
+    const int exp = (int)fexp - 127 + 15;
+    if (exp >= 31)
+        return (unsigned short)(sign | 0x7C00); // overflow
+
+    if (exp <= 0)
+    {
+        // denormal ( or too small )
+        if (exp < -10)
+            return (unsigned short)sign;
+
+        mant |= 0x800000;
+        const unsigned int shift = (unsigned int)(14 - exp);
+        unsigned int h = mant >> shift;
+        const unsigned int rem = mant & ((1u << shift) - 1);
+        const unsigned int halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1)))
+            ++h;
+        return (unsigned short)(sign | h);
+    }
+
+    // round to nearest even; a carry into the exponent is still the right result
+    unsigned int h = sign | ((unsigned int)exp << 10) | (mant >> 13);
+    const unsigned int rem = mant & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        ++h;
+    return (unsigned short)h;
+}
+
+float HalfToFloat(unsigned short value)
+{
+    const unsigned int sign = (unsigned int)(value & 0x8000) << 16;
+    unsigned int exp = (value >> 10) & 0x1F;
+    unsigned int mant = value & 0x3FF;
+
+    unsigned int f;
+    if (exp == 0x1F)
+    {
+        f = sign | 0x7F800000 | (mant << 13);
+    }
+    else if (exp == 0)
+    {
+        if (mant == 0)
+        {
+            f = sign;
+        }
+        else
+        {
+            // denormal, normalize it
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400))
+            {
+                mant <<= 1;
+                --exp;
+            }
+            f = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+        }
+    }
+    else
+    {
+        f = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+
+    float result;
+    memcpy(&result, &f, sizeof(result));
+    return result;
+}
+
+//
+// encoders
+//
+
+static short FloatToSnorm16(float v)
+{
+    v = Max(-1.0f, Min(v, 1.0f));
+    return (short)(v * 32767.0f + (v >= 0.0f ? 0.5f : -0.5f)); // round half away from zero
+}
+
+static unsigned short FloatToUnorm16(float v)
+{
+    v = Max(0.0f, Min(v, 1.0f));
+    return (unsigned short)(v * 65535.0f + 0.5f);
+}
+
+static float SignNotZero(float v)
+{
+    return (v >= 0.0f) ? 1.0f : -1.0f;
+}
+
+static void EncodeOctahedral(const Vector3& n, short* pOut)
+{
+    const float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float x = (l1 > 0.0f) ? n.x / l1 : 0.0f;
+    float y = (l1 > 0.0f) ? n.y / l1 : 0.0f;
+    if (n.z < 0.0f)
+    {
+        // fold the lower hemisphere over the diagonals
+        const float fx = (1.0f - fabsf(y)) * SignNotZero(x);
+        const float fy = (1.0f - fabsf(x)) * SignNotZero(y);
+        x = fx;
+        y = fy;
+    }
+
+    pOut[0] = FloatToSnorm16(x);
+    pOut[1] = FloatToSnorm16(y);
+}
+
+static Vector3 DecodeOctahedral(const short* pIn)
+{
+    float x = Max(-1.0f, (float)pIn[0] / 32767.0f);
+    float y = Max(-1.0f, (float)pIn[1] / 32767.0f);
+    const float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f)
+    {
+        const float fx = (1.0f - fabsf(y)) * SignNotZero(x);
+        const float fy = (1.0f - fabsf(x)) * SignNotZero(y);
+        x = fx;
+        y = fy;
+    }
+
+    const float len = sqrtf(x * x + y * y + z * z);
+    return Vector3(x / len, y / len, z / len);
+}
+
+static void EncodeWeights(const float* w, unsigned char* pOut)
+{
+    // round, then give the rounding leftovers to the heaviest influence so the weights still sum to 1
+    int sum = 0;
+    int heaviest = 0;
+    for (int i = 0; i < KHM_MAX_BONE_INFLUENCES; ++i)
+    {
+        pOut[i] = (unsigned char)(Max(0.0f, Min(w[i], 1.0f)) * 255.0f + 0.5f);
+        sum += pOut[i];
+        if (w[i] > w[heaviest])
+            heaviest = i;
+    }
+
+    if (sum > 0)
+        pOut[heaviest] = (unsigned char)Max(0, Min((int)pOut[heaviest] + (255 - sum), 255));
+}
+
+//
+// builder
+//
+
+static const void* GetSourceStream(const sObjectMesh* pMesh, int semantic)
+{
+    switch (semantic)
+    {
+        case VERTEX_POSITION:       return pMesh->pVertices;
+        case VERTEX_NORMAL:         return pMesh->pNormals;
+        case VERTEX_COLOR:          return pMesh->pColors;
+        case VERTEX_TEXCOORD0:      return pMesh->pTexCoords[0];
+        case VERTEX_TEXCOORD1:      return pMesh->pTexCoords[1];
+        case VERTEX_SKIN_WEIGHTS:   return pMesh->pSkinWeights;
+        case VERTEX_SKIN_INDICES:   return pMesh->pSkinBoneIndices;
+        default:                    return NULL;
+    }
+}
+
+static const int s_sourceSizes[NUM_VERTEX_SEMANTICS] =
+{
+    sizeof(Vector3),        // VERTEX_POSITION
+    sizeof(Vector3),        // VERTEX_NORMAL
+    sizeof(unsigned int),   // VERTEX_COLOR
+    sizeof(Vector2),        // VERTEX_TEXCOORD0
+    sizeof(Vector2),        // VERTEX_TEXCOORD1
+    sizeof(Vector4),        // VERTEX_SKIN_WEIGHTS
+    sizeof(sBoneIndices),   // VERTEX_SKIN_INDICES
+};
+
+bool BuildVertexStream(const sObjectMesh* pMesh, const sVertexLayout& layout, void* pDest, sVertexDequantization* pDequantization, sVertexStreamStats* pStats)
+{
+    for (int e = 0; e < layout.numElements; ++e)
+    {
+        const sVertexElement& element = layout.elements[e];
+        if (!IsFormatSupported(element.semantic, element.format))
+        {
+            LOG_ERROR("[Error] BuildVertexStream(%s) - format %d not supported for semantic %d\n", pMesh->szName, element.format, element.semantic);
+            return false;
+        }
+
+        if (!GetSourceStream(pMesh, element.semantic))
+        {
+            LOG_ERROR("[Error] BuildVertexStream(%s) - mesh has no stream for semantic %d\n", pMesh->szName, element.semantic);
+            return false;
+        }
+    }
+
+    // dequantization: positions go to [-1, 1] over the mesh bounds, uvs to [0, 1] over their own bounds
+    sVertexDequantization dequant;
+    for (int c = 0; c < 3; ++c)
+    {
+        const float lo = (&pMesh->min.x)[c];
+        const float hi = (&pMesh->max.x)[c];
+        dequant.positionScale[c] = Max((hi - lo) * 0.5f, 1e-6f);
+        dequant.positionBias[c] = (hi + lo) * 0.5f;
+    }
+
+    for (int set = 0; set < 2; ++set)
+    {
+        const Vector2* pUVs = pMesh->pTexCoords[set];
+        float lo[2] = { 0.0f, 0.0f };
+        float hi[2] = { 1.0f, 1.0f };
+        for (int v = 0; pUVs && v < pMesh->numVertices; ++v)
+        {
+            if (v == 0)
+            {
+                lo[0] = hi[0] = pUVs[v].x;
+                lo[1] = hi[1] = pUVs[v].y;
+            }
+            lo[0] = Min(lo[0], pUVs[v].x); hi[0] = Max(hi[0], pUVs[v].x);
+            lo[1] = Min(lo[1], pUVs[v].y); hi[1] = Max(hi[1], pUVs[v].y);
+        }
+
+        for (int c = 0; c < 2; ++c)
+        {
+            dequant.texCoordScale[set][c] = Max(hi[c] - lo[c], 1e-6f);
+            dequant.texCoordBias[set][c] = lo[c];
+        }
+    }
+
+    float maxError[NUM_VERTEX_SEMANTICS];
+    memset(maxError, 0, sizeof(maxError));
+
+    unsigned char* pVertex = (unsigned char*)pDest;
+    for (int v = 0; v < pMesh->numVertices; ++v, pVertex += layout.stride)
+    {
+        for (int e = 0; e < layout.numElements; ++e)
+        {
+            const sVertexElement& element = layout.elements[e];
+            unsigned char* pOut = pVertex + element.offset;
+            const unsigned char* pSrc = (const unsigned char*)GetSourceStream(pMesh, element.semantic) + (size_t)v * s_sourceSizes[element.semantic];
+            float& err = maxError[element.semantic];
+
+            switch (element.format)
+            {
+                case VERTEX_FORMAT_FLOAT2:
+                case VERTEX_FORMAT_FLOAT3:
+                case VERTEX_FORMAT_FLOAT4:
+                {
+                    memcpy(pOut, pSrc, s_sourceSizes[element.semantic]);
+                    if (element.semantic == VERTEX_POSITION && element.format == VERTEX_FORMAT_FLOAT4)
+                        ((float*)pOut)[3] = 1.0f;
+                    break;
+                }
+
+                case VERTEX_FORMAT_HALF4:
+                {
+                    const float* p = (const float*)pSrc;
+                    unsigned short* h = (unsigned short*)pOut;
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        h[c] = FloatToHalf((p[c] - dequant.positionBias[c]) / dequant.positionScale[c]);
+                        err = Max(err, fabsf(HalfToFloat(h[c]) * dequant.positionScale[c] + dequant.positionBias[c] - p[c]));
+                    }
+                    h[3] = FloatToHalf(1.0f);
+                    break;
+                }
+
+                case VERTEX_FORMAT_OCT_SNORM16:
+                {
+                    const Vector3& n = *(const Vector3*)pSrc;
+                    EncodeOctahedral(n, (short*)pOut);
+
+                    const float len = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+                    if (len > 0.0f)
+                    {
+                        const Vector3 d = DecodeOctahedral((const short*)pOut);
+                        err = Max(err, Max(fabsf(d.x - n.x / len), Max(fabsf(d.y - n.y / len), fabsf(d.z - n.z / len))));
+                    }
+                    break;
+                }
+
+                case VERTEX_FORMAT_UNORM16_2:
+                {
+                    const int set = element.semantic - VERTEX_TEXCOORD0;
+                    const float* uv = (const float*)pSrc;
+                    unsigned short* q = (unsigned short*)pOut;
+                    for (int c = 0; c < 2; ++c)
+                    {
+                        q[c] = FloatToUnorm16((uv[c] - dequant.texCoordBias[set][c]) / dequant.texCoordScale[set][c]);
+                        err = Max(err, fabsf((float)q[c] / 65535.0f * dequant.texCoordScale[set][c] + dequant.texCoordBias[set][c] - uv[c]));
+                    }
+                    break;
+                }
+
+                case VERTEX_FORMAT_UNORM8_4:
+                {
+                    if (element.semantic == VERTEX_COLOR)
+                    {
+                        memcpy(pOut, pSrc, 4); // already 8 bits per channel
+                        break;
+                    }
+
+                    const float* w = (const float*)pSrc;
+                    EncodeWeights(w, pOut);
+                    for (int c = 0; c < KHM_MAX_BONE_INFLUENCES; ++c)
+                        err = Max(err, fabsf((float)pOut[c] / 255.0f - w[c]));
+                    break;
+                }
+
+                case VERTEX_FORMAT_UINT8_4:
+                    memcpy(pOut, pSrc, 4);
+                    break;
+            }
+        }
+    }
+
+    if (pDequantization)
+        *pDequantization = dequant;
+
+    if (pStats)
+    {
+        unsigned int uiSourceVertexBytes = 0;
+        for (int e = 0; e < layout.numElements; ++e)
+            uiSourceVertexBytes += s_sourceSizes[layout.elements[e].semantic];
+
+        pStats->uiSourceBytes = uiSourceVertexBytes * pMesh->numVertices;
+        pStats->uiStreamBytes = (unsigned int)layout.stride * pMesh->numVertices;
+        memcpy(pStats->maxError, maxError, sizeof(maxError));
+    }
+
+    return true;
+}
+
+}; // end namespace KHM
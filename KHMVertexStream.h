@@ -0,0 +1,88 @@
+#pragma once
+
+#include "KHMModel.h"
+
+namespace KHM
+{
+    //
+    // vertex layout description
+    //
+
+    enum eVertexSemantic
+    {
+        VERTEX_POSITION = 0,
+        VERTEX_NORMAL,
+        VERTEX_COLOR,
+        VERTEX_TEXCOORD0,
+        VERTEX_TEXCOORD1,
+        VERTEX_SKIN_WEIGHTS,
+        VERTEX_SKIN_INDICES,
+
+        NUM_VERTEX_SEMANTICS
+    };
+
+    enum eVertexFormat
+    {
+        VERTEX_FORMAT_FLOAT2 = 0,   // 8 bytes
+        VERTEX_FORMAT_FLOAT3,       // 12 bytes
+        VERTEX_FORMAT_FLOAT4,       // 16 bytes
+        VERTEX_FORMAT_HALF4,        // 8 bytes; positions, normalized to the mesh bounds ( w = 1 )
+        VERTEX_FORMAT_OCT_SNORM16,  // 4 bytes; octahedral encoded unit vector
+        VERTEX_FORMAT_UNORM16_2,    // 4 bytes; texture coordinates, normalized to the mesh uv bounds
+        VERTEX_FORMAT_UNORM8_4,     // 4 bytes; colors ( as is ) and skin weights ( sum to 255 )
+        VERTEX_FORMAT_UINT8_4,      // 4 bytes; skin bone indices
+
+        NUM_VERTEX_FORMATS
+    };
+
+    struct sVertexElement
+    {
+        unsigned char           semantic;       // eVertexSemantic
+        unsigned char           format;         // eVertexFormat
+        unsigned short          offset;         // in bytes, from the start of the vertex
+    };
+
+    struct sVertexLayout
+    {
+        sVertexLayout()
+        {
+            numElements = 0;
+            stride = 0;
+        }
+
+        // elements are packed in the order they are added, 4-byte aligned
+        void Add(eVertexSemantic semantic, eVertexFormat format);
+
+        sVertexElement          elements[NUM_VERTEX_SEMANTICS];
+        int                     numElements;
+        int                     stride;
+    };
+
+    //
+    // dequantization constants; decoded = encoded * scale + bias
+    //
+
+    struct sVertexDequantization
+    {
+        float                   positionScale[3];
+        float                   positionBias[3];
+        float                   texCoordScale[2][2];
+        float                   texCoordBias[2][2];
+    };
+
+    struct sVertexStreamStats
+    {
+        unsigned int            uiSourceBytes;  // the separate float streams the layout reads from
+        unsigned int            uiStreamBytes;  // numVertices * stride
+        float                   maxError[NUM_VERTEX_SEMANTICS]; // largest component error after a decode round trip
+    };
+
+    int     GetVertexFormatSize(eVertexFormat format);
+
+    // interleaves ( and quantizes ) the mesh streams into pDest ( numVertices * layout.stride bytes ).
+    // fails if the layout asks for a stream the mesh doesn't have
+    bool    BuildVertexStream(const sObjectMesh* pMesh, const sVertexLayout& layout, void* pDest, sVertexDequantization* pDequantization, sVertexStreamStats* pStats);
+
+    unsigned short  FloatToHalf(float value);
+    float           HalfToFloat(unsigned short value);
+};
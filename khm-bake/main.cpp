@@ -0,0 +1,101 @@
+//
+// khm-bake - converts KHM v101 files to the v102 section layout
+//
+//  usage: khm-bake [-optimize] [-bounds N] [-lods N] <input.khm> <output.khm>
+//
+//  -optimize   reorders the mesh for the vertex caches before baking, so the runtime doesn't have to
+//  -bounds N   bakes the box of the skinned mesh for every N keyframes of the animation, for culling
+//  -lods N     bakes up to N simplified levels of the mesh, each with about half the triangles of the one before
+//
+
+#include "KHMModel.h"
+#include "KHMBake.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace KHM;
+
+static unsigned char* ReadFile(const char* pszPath, unsigned int* pSize)
+{
+    FILE* f = fopen(pszPath, "rb");
+    if (!f)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    unsigned char* pBuff = (size > 0) ? (unsigned char*)malloc(size) : NULL;
+    if (pBuff && fread(pBuff, size, 1, f) != 1)
+    {
+        free(pBuff);
+        pBuff = NULL;
+    }
+
+    fclose(f);
+    *pSize = (unsigned int)size;
+    return pBuff;
+}
+
+int main(int argc, char** argv)
+{
+    bool bOptimize = false;
+    int boundsFrames = 0;
+    int numLods = 0;
+    const char* pszInput = NULL;
+    const char* pszOutput = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-optimize") == 0)
+            bOptimize = true;
+        else if (strcmp(argv[i], "-bounds") == 0 && i + 1 < argc)
+            boundsFrames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-lods") == 0 && i + 1 < argc)
+            numLods = atoi(argv[++i]);
+        else if (!pszInput)
+            pszInput = argv[i];
+        else if (!pszOutput)
+            pszOutput = argv[i];
+    }
+
+    if (!pszInput || !pszOutput)
+    {
+        printf("usage: khm-bake [-optimize] [-bounds N] [-lods N] <input.khm> <output.khm>\n");
+        return 1;
+    }
+
+    unsigned int uiSize = 0;
+    unsigned char* pBuff = ReadFile(pszInput, &uiSize);
+    if (!pBuff)
+    {
+        printf("khm-bake: can't read '%s'\n", pszInput);
+        return 1;
+    }
+
+    CLoader loader;
+    loader.SetFlags(bOptimize ? LOAD_OPTIMIZE_VERTEX_CACHE : 0);
+
+    sModelDefinition model;
+    if (!loader.LoadModel(pszInput, pBuff, uiSize, &model))
+    {
+        printf("khm-bake: can't load '%s'\n", pszInput);
+        model.Destroy();
+        free(pBuff);
+        return 1;
+    }
+
+    CBaker baker;
+    baker.SetAnimationBoundsFrames(boundsFrames);
+    baker.SetMeshLods(numLods);
+    const bool bOk = baker.Bake(&model) && baker.Write(pszOutput);
+    if (bOk)
+        printf("khm-bake: %s ( %u bytes ) -> %s ( %u bytes )\n", pszInput, uiSize, pszOutput, baker.GetSize());
+    else
+        printf("khm-bake: can't bake '%s'\n", pszInput);
+
+    model.Destroy();
+    free(pBuff);
+    return bOk ? 0 : 1;
+}
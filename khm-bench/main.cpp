@@ -0,0 +1,1928 @@
+//
+// khm-bench - loader, lookup, animation, animation graph, crowd scheduler, culling, meshlet, mesh LOD, cache, skeleton registry, ray cast, convex hull and skinning benchmarks on a synthetic corpus
+//
+//  usage: khm-bench [-iterations N] [-threads N] [-corpus <dir>] [-stats <file>] [-stats-baseline <file>] [model.khm ...]
+//
+//  -iterations N   loads per model in the load, validation and stats benchmarks ( default 200 )
+//  -threads N      max threads for the scaling runs; 0 = one per hardware thread ( default )
+//  -corpus <dir>   writes the generated corpus to <dir> and exits
+//  -stats <file>   writes the load stats report ( JSON ) of the corpus to <file>
+//  -stats-baseline <file>
+//                  a KHM_LOAD_STATS=0 build writes its load rates to <file>; a stats build reads them and reports the
+//                  stats overhead against them
+//  model.khm       benchmarks these files instead of the generated corpus
+//
+
+#include "KHMModel.h"
+#include "KHMGenerator.h"
+#include "KHMValidate.h"
+#include "KHMAnimation.h"
+#include "KHMAnimationGraph.h"
+#include "KHMAnimationScheduler.h"
+#include "KHMAnimationBounds.h"
+#include "KHMMeshlets.h"
+#include "KHMMeshLod.h"
+#include "KHMMeshOptimizer.h"
+#include "KHMVertexStream.h"
+#include "KHMSkinning.h"
+#include "KHMJobs.h"
+#include "KHMCache.h"
+#include "KHMSkeletonRegistry.h"
+#include "KHMCollision.h"
+#include "KHMConvex.h"
+#include "KHMStats.h"
+#include "KHMHash.h"
+#include "KHMSimd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+using namespace KHM;
+
+//
+// allocation counting; every operator new in the process goes through here
+//
+
+// kept out of line: inlined, gcc sees the malloc and the free inside them and reports every new / delete pair as mismatched
+#if defined(_MSC_VER)
+    #define BENCH_NOINLINE      __declspec(noinline)
+#else
+    #define BENCH_NOINLINE      __attribute__((noinline))
+#endif
+
+static std::atomic<unsigned long long> g_numAllocations(0);
+
+BENCH_NOINLINE void* operator new(size_t size)
+{
+    ++g_numAllocations;
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+BENCH_NOINLINE void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+BENCH_NOINLINE void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+BENCH_NOINLINE void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+// model arenas don't go through operator new; the load benchmark hands its loader this one to count them
+static std::atomic<unsigned long long> g_numArenaBlocks(0);
+
+static void* CountingModelAlloc(void*, size_t uiSize)
+{
+    ++g_numArenaBlocks;
+    return AlignedAlloc(uiSize);
+}
+
+static void CountingModelFree(void*, void* pBlock, size_t)
+{
+    AlignedFree(pBlock);
+}
+
+static unsigned long long GetAllocationCount()
+{
+    return g_numAllocations + g_numArenaBlocks;
+}
+
+//
+// helpers
+//
+
+#define BENCH_LOOKUPS               8192    // queries per lookup run
+#define BENCH_LOOKUP_BATCH          16      // lookups per timed sample; a single one is below the clock resolution
+#define BENCH_POSE_SAMPLES          2048
+#define BENCH_SCALING_REQUESTS      128
+#define BENCH_CACHE_ALIASES         4       // names per corpus model; they all dedup to one
+#define BENCH_CACHE_ACQUIRES        20000   // per thread
+#define BENCH_GRAPH_CHARACTERS      4096
+#define BENCH_GRAPH_FRAMES          8       // evaluations per timed run
+#define BENCH_CROWD_FRAMES          64      // scheduler updates per timed run; a multiple of the coarsest interval
+#define BENCH_CULL_INSTANCES        16384
+#define BENCH_CULL_FRAMES           16      // culling passes per timed run
+#define BENCH_BOUNDS_FRAMES         4       // keyframes per baked box
+#define BENCH_MESHLET_PROP_SEGMENTS 384     // the large prop is a sphere of ( N + 1 )^2 vertices; past the 16 bit indices
+#define BENCH_MESHLET_CULLS         64      // culling passes per timed run
+#define BENCH_LOD_PROP_SEGMENTS     160     // the LOD prop is a skinned sphere of ( N + 1 )^2 vertices
+#define BENCH_LOD_PIXEL_ERROR       1.0f    // at 1080 lines and a 60 degree fov
+#define BENCH_REGISTRY_RIGS         4
+#define BENCH_REGISTRY_MODELS       32      // cycling through the rigs, each with its own helpers, mesh and clip
+#define BENCH_REGISTRY_BONES        64
+#define BENCH_COLLISION_INSTANCES   16      // a 4 x 4 grid of copies
+#define BENCH_COLLISION_RAYS        4096    // rows of 64; every other row sweeps a sphere
+#define BENCH_COLLISION_CHECKS      16      // rays also cast through CastRayReference, which is brute force
+#define BENCH_HULL_QUERIES          4096    // support directions per timed run; contacts run an eighth of it
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double SecondsSince(const BenchClock::time_point& start)
+{
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// the SIMD and tree paths against their references; a difference is reported and fails the run
+static int g_numMismatches = 0;
+
+static void BenchCheck(bool bCondition, const char* pszName, const char* pszWhat)
+{
+    if (bCondition)
+        return;
+
+    fprintf(stderr, "khm-bench: MISMATCH %s: %s\n", pszName, pszWhat);
+    ++g_numMismatches;
+}
+
+struct sCorpusModel
+{
+    const char*                 pszName;
+    std::vector<unsigned char>  data;
+};
+
+static bool ReadFile(const char* pszPath, std::vector<unsigned char>& data)
+{
+    FILE* f = fopen(pszPath, "rb");
+    if (!f)
+        return false;
+
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data.resize(size > 0 ? size : 0);
+    const bool bOk = size > 0 && fread(&data[0], size, 1, f) == 1;
+    fclose(f);
+    return bOk;
+}
+
+static void BuildCorpus(std::vector<sCorpusModel>& corpus)
+{
+    struct sPreset
+    {
+        const char* pszName;
+        int         numBones;
+        int         numHelpers;
+        int         numVertices;
+        int         numFrames;
+        int         numCollisions;
+    };
+
+    static const sPreset s_presets[] =
+    {
+        { "prop",       0,  2,  256,    0,      1 },
+        { "small",      16, 4,  1024,   30,     2 },
+        { "character",  64, 16, 16384,  120,    4 },
+        { "large",      64, 32, 65536,  600,    8 },
+    };
+
+    for (unsigned int i = 0; i < sizeof(s_presets) / sizeof(s_presets[0]); ++i)
+    {
+        sGeneratorSettings settings;
+        settings.uiSeed = i + 1;
+        settings.numBones = s_presets[i].numBones;
+        settings.numHelpers = s_presets[i].numHelpers;
+        settings.numVertices = s_presets[i].numVertices;
+        settings.numFrames = s_presets[i].numFrames;
+        settings.numCollisions = s_presets[i].numCollisions;
+        settings.numMaskEntries = s_presets[i].numBones / 4;
+        settings.numTexCoordMaps = 2;
+
+        CGenerator generator;
+        if (!generator.Generate(settings))
+            continue;
+
+        sCorpusModel model;
+        model.pszName = s_presets[i].pszName;
+        model.data.assign(generator.GetData(), generator.GetData() + generator.GetSize());
+        corpus.push_back(model);
+    }
+}
+
+static void PrintPercentiles(const char* pszName, std::vector<double>& samples)
+{
+    if (samples.empty())
+        return;
+
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    printf("  %-24s p50 %8.1f ns  p90 %8.1f ns  p99 %8.1f ns  max %8.1f ns\n", pszName,
+           samples[n / 2], samples[(n * 9) / 10], samples[(n * 99) / 100], samples[n - 1]);
+}
+
+//
+// benchmarks
+//
+
+static void BenchLoad(const sCorpusModel& model, int iterations)
+{
+    sModelAllocator allocator;
+    allocator.alloc = CountingModelAlloc;
+    allocator.free = CountingModelFree;
+    allocator.pUserData = NULL;
+
+    CLoader loader;
+    loader.SetAllocator(allocator);
+    std::vector<unsigned char> buff(model.data);
+    const unsigned int uiSize = (unsigned int)buff.size();
+
+    // warm up; first touch of the buffer and the allocator
+    sModelDefinition md;
+    loader.LoadModel(model.pszName, &buff[0], uiSize, &md);
+    md.Destroy();
+
+    unsigned long long numAllocations = 0;
+    double seconds = 0.0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        const unsigned long long uiAllocsBefore = GetAllocationCount();
+        const BenchClock::time_point start = BenchClock::now();
+        const bool bOk = loader.LoadModel(model.pszName, &buff[0], uiSize, &md);
+        seconds += SecondsSince(start);
+        numAllocations += GetAllocationCount() - uiAllocsBefore;
+
+        md.Destroy();
+        if (!bOk)
+        {
+            printf("  %-10s load failed\n", model.pszName);
+            return;
+        }
+    }
+
+    printf("  %-10s %9u bytes  %10.0f loads/s  %8.1f MB/s  %6.1f allocs/load\n", model.pszName, uiSize,
+           iterations / seconds, (double)uiSize * iterations / seconds / (1024.0 * 1024.0), (double)numAllocations / iterations);
+}
+
+// LoadModel = ValidateModel + LoadValidatedModel; the split shows what the checks cost
+static void BenchValidation(const sCorpusModel& model, int iterations)
+{
+    CLoader loader;
+    std::vector<unsigned char> buff(model.data);
+    const unsigned int uiSize = (unsigned int)buff.size();
+
+    sModelLayout layout;
+    if (!ValidateModel(model.pszName, &buff[0], uiSize, &layout))
+        return;
+
+    const BenchClock::time_point validateStart = BenchClock::now();
+    for (int i = 0; i < iterations; ++i)
+        ValidateModel(model.pszName, &buff[0], uiSize, &layout);
+    const double validateSeconds = SecondsSince(validateStart);
+
+    sModelDefinition md;
+    double loadSeconds = 0.0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        const BenchClock::time_point start = BenchClock::now();
+        loader.LoadValidatedModel(model.pszName, &buff[0], layout, &md);
+        loadSeconds += SecondsSince(start);
+        md.Destroy();
+    }
+
+    printf("  %-10s validate %10.0f /s  %8.1f MB/s   fast path %10.0f loads/s   validate share %4.1f%%\n", model.pszName,
+           iterations / validateSeconds, (double)uiSize * iterations / validateSeconds / (1024.0 * 1024.0),
+           iterations / loadSeconds, 100.0 * validateSeconds / (validateSeconds + loadSeconds));
+}
+
+// plain load rate of a KHM_LOAD_STATS=0 build, one line per model in the -stats-baseline file
+struct sLoadBaseline
+{
+    char                szName[64];
+    double              loadsPerSecond;
+};
+
+static bool ReadLoadBaseline(const char* pszPath, std::vector<sLoadBaseline>& baseline)
+{
+    FILE* f = fopen(pszPath, "r");
+    if (!f)
+        return false;
+
+    sLoadBaseline entry;
+    while (fscanf(f, "%63s %lf", entry.szName, &entry.loadsPerSecond) == 2)
+        baseline.push_back(entry);
+
+    fclose(f);
+    return true;
+}
+
+static bool WriteLoadBaseline(const char* pszPath, const std::vector<sLoadBaseline>& baseline)
+{
+    FILE* f = fopen(pszPath, "w");
+    if (!f)
+        return false;
+
+    for (size_t i = 0; i < baseline.size(); ++i)
+        fprintf(f, "%s %.1f\n", baseline[i].szName, baseline[i].loadsPerSecond);
+
+    return fclose(f) == 0;
+}
+
+static const sLoadBaseline* FindLoadBaseline(const std::vector<sLoadBaseline>& baseline, const char* pszName)
+{
+    for (size_t i = 0; i < baseline.size(); ++i)
+    {
+        if (strcmp(baseline[i].szName, pszName) == 0)
+            return &baseline[i];
+    }
+
+    return NULL;
+}
+
+// what LOAD_COLLECT_STATS costs, and what a load spends where. After a warm-up load each, the off and on passes
+// alternate over BENCH_LOAD_STATS_ROUNDS rounds and the best round of each counts, so neither pays for a cold cache
+// or a noisy neighbour. A KHM_LOAD_STATS=0 build only times the plain load, and adds it to the baseline
+#define BENCH_LOAD_STATS_ROUNDS     5
+
+static void BenchLoadStats(const sCorpusModel& model, int iterations, std::vector<sLoadBaseline>& baseline)
+{
+    std::vector<unsigned char> buff(model.data);
+    const unsigned int uiSize = (unsigned int)buff.size();
+    const int numPasses = KHM_LOAD_STATS ? 2 : 1;
+
+    CLoader lLoaders[2];
+    lLoaders[1].SetFlags(LOAD_COLLECT_STATS);
+
+    double lSeconds[2] = { 1e30, 1e30 };
+    sLoadStats stats;
+    memset(&stats, 0, sizeof(stats));
+    for (int round = -1; round < BENCH_LOAD_STATS_ROUNDS; ++round)
+    {
+        for (int p = 0; p < numPasses; ++p)
+        {
+            // every other round starts with stats on, so a drift over the run doesn't land on one side
+            const int pass = (round & 1) ? numPasses - 1 - p : p;
+            const int numLoads = round < 0 ? 1 : iterations;
+
+            sModelDefinition md;
+            const BenchClock::time_point start = BenchClock::now();
+            for (int i = 0; i < numLoads; ++i)
+            {
+                lLoaders[pass].LoadModel(model.pszName, &buff[0], uiSize, &md);
+                if (md.pLoadStats)
+                    stats = *md.pLoadStats;
+                md.Destroy();
+            }
+
+            if (round >= 0)
+                lSeconds[pass] = Min(lSeconds[pass], SecondsSince(start) / numLoads);
+        }
+    }
+
+    const double lLoadsPerSecond[2] = { 1.0 / lSeconds[0], 1.0 / lSeconds[1] };
+    if (!KHM_LOAD_STATS)
+    {
+        sLoadBaseline entry;
+        snprintf(entry.szName, sizeof(entry.szName), "%s", model.pszName);
+        entry.loadsPerSecond = lLoadsPerSecond[0];
+        baseline.push_back(entry);
+
+        printf("  %-10s %10.0f loads/s  ( KHM_LOAD_STATS=0 )\n", model.pszName, lLoadsPerSecond[0]);
+        return;
+    }
+
+    // extra time per load; without a baseline it is against stats off in this build, which still pays the runtime checks
+    const sLoadBaseline* pBaseline = FindLoadBaseline(baseline, model.pszName);
+    const double baseLoadsPerSecond = pBaseline ? pBaseline->loadsPerSecond : lLoadsPerSecond[0];
+    printf("  %-10s off %10.0f loads/s ( %+5.1f%% )  on %10.0f loads/s ( %+5.1f%% ) against %s  heap %7llu bytes  file %9llu bytes\n",
+           model.pszName, lLoadsPerSecond[0], 100.0 * (baseLoadsPerSecond / lLoadsPerSecond[0] - 1.0), lLoadsPerSecond[1],
+           100.0 * (baseLoadsPerSecond / lLoadsPerSecond[1] - 1.0), pBaseline ? "KHM_LOAD_STATS=0" : "off",
+           stats.memory.GetHeapBytes(), stats.memory.GetFileBytes());
+
+    unsigned long long uiTotalNs = 0;
+    for (int i = 0; i < NUM_LOAD_STAGES; ++i)
+        uiTotalNs += stats.uiStageNs[i];
+
+    printf("  %-10s", "");
+    for (int i = 0; i < NUM_LOAD_STAGES; ++i)
+    {
+        if (stats.uiStageNs[i])
+            printf(" %s %.0f%%", GetLoadStageName(i), 100.0 * stats.uiStageNs[i] / Max(uiTotalNs, 1ull));
+    }
+    printf("\n");
+}
+
+static void WriteStatsReport(const std::vector<sCorpusModel>& corpus, const char* pszReportPath)
+{
+    CLoader loader;
+    loader.SetFlags(LOAD_COLLECT_STATS | LOAD_ANIMATION_TRACKS);
+
+    std::vector<std::vector<unsigned char> > buffers(corpus.size());
+    std::vector<sModelDefinition> models(corpus.size());
+    std::vector<const sModelDefinition*> loaded;
+    for (size_t i = 0; i < corpus.size(); ++i)
+    {
+        buffers[i] = corpus[i].data;
+        if (loader.LoadModel(corpus[i].pszName, &buffers[i][0], (unsigned int)buffers[i].size(), &models[i]))
+            loaded.push_back(&models[i]);
+    }
+
+    const bool bOk = WriteLoadStatsReport(pszReportPath, loaded.empty() ? NULL : &loaded[0], (int)loaded.size());
+    printf("khm-bench: %s %s\n", bOk ? "wrote" : "can't write", pszReportPath);
+
+    for (size_t i = 0; i < models.size(); ++i)
+        models[i].Destroy();
+}
+
+static void BenchLookups(const sCorpusModel& model)
+{
+    CLoader loader;
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md))
+        return;
+
+    std::vector<const sObjectBase*> objects;
+    for (int i = 0; i < md.numBones; ++i)
+        objects.push_back(&md.lBones[i]);
+    for (int i = 0; i < md.numHelpers; ++i)
+        objects.push_back(&md.lHelpers[i]);
+    if (md.pMesh)
+        objects.push_back(md.pMesh);
+
+    if (objects.empty())
+    {
+        md.Destroy();
+        return;
+    }
+
+    printf(" %s ( %u objects )\n", model.pszName, (unsigned int)objects.size());
+
+    std::vector<const char*> hitNames(BENCH_LOOKUPS);
+    std::vector<unsigned int> hitIds(BENCH_LOOKUPS), hitHashes(BENCH_LOOKUPS);
+    std::vector<char> missNames(BENCH_LOOKUPS * KHM_MAX_OBJECT_NAME);
+    unsigned int uiSeed = 12345;
+    for (int i = 0; i < BENCH_LOOKUPS; ++i)
+    {
+        uiSeed = uiSeed * 1664525u + 1013904223u;
+        const sObjectBase* pObject = objects[(uiSeed >> 8) % objects.size()];
+        hitNames[i] = pObject->szName;
+        hitIds[i] = pObject->uiId;
+        hitHashes[i] = HashName(pObject->szName);
+
+        // misses share the prefix, the worst case for a compare
+        snprintf(&missNames[i * KHM_MAX_OBJECT_NAME], KHM_MAX_OBJECT_NAME, "%.38s_missing", pObject->szName);
+    }
+
+    enum { LOOKUP_NAME, LOOKUP_NAME_MISS, LOOKUP_ID, LOOKUP_HASH, NUM_LOOKUPS };
+    static const char* s_lookupNames[NUM_LOOKUPS] = { "GetObjectByName", "GetObjectByName ( miss )", "GetObjectById", "GetObjectByHash" };
+
+    volatile size_t uiSink = 0;
+    for (int type = 0; type < NUM_LOOKUPS; ++type)
+    {
+        std::vector<double> samples;
+        samples.reserve(BENCH_LOOKUPS / BENCH_LOOKUP_BATCH);
+        for (int i = 0; i < BENCH_LOOKUPS; i += BENCH_LOOKUP_BATCH)
+        {
+            size_t uiFound = 0;
+            const BenchClock::time_point start = BenchClock::now();
+            for (int j = i; j < i + BENCH_LOOKUP_BATCH; ++j)
+            {
+                switch (type)
+                {
+                    case LOOKUP_NAME:       uiFound += (size_t)md.GetObjectByName(hitNames[j]); break;
+                    case LOOKUP_NAME_MISS:  uiFound += (size_t)md.GetObjectByName(&missNames[j * KHM_MAX_OBJECT_NAME]); break;
+                    case LOOKUP_ID:         uiFound += (size_t)md.GetObjectById(hitIds[j]); break;
+                    case LOOKUP_HASH:       uiFound += (size_t)md.GetObjectByHash(hitHashes[j]); break;
+                }
+            }
+            samples.push_back(SecondsSince(start) * 1e9 / BENCH_LOOKUP_BATCH);
+            uiSink += uiFound;
+        }
+
+        PrintPercentiles(s_lookupNames[type], samples);
+    }
+
+    md.Destroy();
+}
+
+static void BenchAnimation(const sCorpusModel& model)
+{
+    CLoader loader;
+    loader.SetFlags(LOAD_ANIMATION_TRACKS);
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pAnimation)
+    {
+        md.Destroy();
+        return;
+    }
+
+    const sAnimation* pAnimation = md.pAnimation;
+    const float fLengthMs = pAnimation->frameDurationMs * Max(pAnimation->numNodeFrames - 1, 1);
+    printf(" %s ( %d nodes, %d frames )\n", model.pszName, pAnimation->numNodes, pAnimation->numNodeFrames);
+
+    sPose pose;
+    CreatePose(&pose, pAnimation->numNodes);
+
+    std::vector<float> times(BENCH_POSE_SAMPLES);
+    for (int i = 0; i < BENCH_POSE_SAMPLES; ++i)
+        times[i] = fLengthMs * (float)((i * 7919) % BENCH_POSE_SAMPLES) / (float)BENCH_POSE_SAMPLES;
+
+    // raw keyframe access: find the frames, read every node's transform out of the file layout
+    std::vector<double> samples;
+    volatile float fSink = 0.0f;
+    for (int i = 0; i < BENCH_POSE_SAMPLES; ++i)
+    {
+        const BenchClock::time_point start = BenchClock::now();
+        int frame0, frame1;
+        float alpha;
+        GetKeyframes(pAnimation->numNodeFrames, pAnimation->frameDurationMs, times[i], true, frame0, frame1, alpha);
+        const sNodeTransform* pFrame0 = pAnimation->pNodeTransforms + (size_t)frame0 * pAnimation->numNodes;
+        const sNodeTransform* pFrame1 = pAnimation->pNodeTransforms + (size_t)frame1 * pAnimation->numNodes;
+        float fSum = 0.0f;
+        for (int n = 0; n < pAnimation->numNodes; ++n)
+            fSum += pFrame0[n].vTrans.x + (pFrame1[n].vTrans.x - pFrame0[n].vTrans.x) * alpha;
+        samples.push_back(SecondsSince(start) * 1e9);
+        fSink = fSink + fSum;
+    }
+    PrintPercentiles("keyframe access", samples);
+
+    samples.clear();
+    for (int i = 0; i < BENCH_POSE_SAMPLES; ++i)
+    {
+        const BenchClock::time_point start = BenchClock::now();
+        SamplePoseReference(pAnimation, times[i], true, &pose);
+        samples.push_back(SecondsSince(start) * 1e9);
+    }
+    PrintPercentiles("SamplePoseReference", samples);
+
+    if (pAnimation->pTracks)
+    {
+        samples.clear();
+        for (int i = 0; i < BENCH_POSE_SAMPLES; ++i)
+        {
+            const BenchClock::time_point start = BenchClock::now();
+            SamplePose(pAnimation->pTracks, times[i], true, &pose);
+            samples.push_back(SecondsSince(start) * 1e9);
+        }
+        PrintPercentiles("SamplePose ( tracks )", samples);
+
+        sPose reference;
+        CreatePose(&reference, pAnimation->numNodes);
+        float maxDifference = 0.0f;
+        for (int i = 0; i < BENCH_POSE_SAMPLES; i += 16)
+        {
+            SamplePose(pAnimation->pTracks, times[i], true, &pose);
+            SamplePoseReference(pAnimation, times[i], true, &reference);
+            maxDifference = Max(maxDifference, ComparePoses(&pose, &reference));
+        }
+        DestroyPose(&reference);
+
+        printf("  SamplePose against SamplePoseReference: max difference %g\n", maxDifference);
+        BenchCheck(maxDifference < 1e-5f, model.pszName, "SamplePose doesn't match SamplePoseReference");
+    }
+
+    DestroyPose(&pose);
+    md.Destroy();
+}
+
+static void BenchAnimationGraph(const sCorpusModel& model, int maxThreads)
+{
+    CLoader loader;
+    loader.SetFlags(LOAD_ANIMATION_TRACKS);
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pAnimation || !md.pAnimation->pTracks)
+    {
+        md.Destroy();
+        return;
+    }
+
+    // locomotion style graph out of the model's clip: a 2 clip base blend, a masked override and an additive layer
+    sAnimationGraph graph;
+    memset(&graph, 0, sizeof(graph));
+    graph.numLayers = 3;
+    graph.layers[0].numClips = 2;
+    graph.layers[1].numClips = 1;
+    graph.layers[1].pMask = md.pAnimationMask;
+    graph.layers[2].mode = LAYER_ADDITIVE;
+    graph.layers[2].numClips = 1;
+    for (int l = 0; l < graph.numLayers; ++l)
+    {
+        for (int c = 0; c < graph.layers[l].numClips; ++c)
+        {
+            graph.layers[l].clips[c].pAnimation = md.pAnimation;
+            graph.layers[l].clips[c].bLoop = true;
+        }
+    }
+
+    if (!CreateAnimationGraph(&graph))
+    {
+        md.Destroy();
+        return;
+    }
+
+    const float fLengthMs = md.pAnimation->frameDurationMs * Max(md.pAnimation->numNodeFrames - 1, 1);
+    std::vector<sPose> poses(BENCH_GRAPH_CHARACTERS);
+    std::vector<sAnimationGraphInstance> instances(BENCH_GRAPH_CHARACTERS);
+    for (int i = 0; i < BENCH_GRAPH_CHARACTERS; ++i)
+    {
+        CreatePose(&poses[i], graph.numNodes);
+        InitAnimationGraphInstance(&instances[i], &graph, &poses[i]);
+        instances[i].clipTimesMs[0][0] = fLengthMs * (float)((i * 7919) % BENCH_GRAPH_CHARACTERS) / BENCH_GRAPH_CHARACTERS;
+        instances[i].clipTimesMs[0][1] = instances[i].clipTimesMs[0][0] * 0.5f;
+        instances[i].clipWeights[0][1] = 0.5f;
+        instances[i].clipTimesMs[1][0] = instances[i].clipTimesMs[0][0] * 0.25f;
+        instances[i].layerWeights[1] = 0.5f;
+        instances[i].clipTimesMs[2][0] = instances[i].clipTimesMs[0][0] * 0.75f;
+    }
+
+    printf(" %s ( %d nodes, %d layers )\n", model.pszName, graph.numNodes, graph.numLayers);
+
+    double fSingleRate = 0.0;
+    // powers of two, then the max
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads = (numThreads < maxThreads && numThreads * 2 > maxThreads) ? maxThreads : numThreads * 2)
+    {
+        CJobPool pool;
+        pool.Init(numThreads);
+        EvaluateAnimationGraphs(&instances[0], BENCH_GRAPH_CHARACTERS, &pool, NULL);
+
+        const BenchClock::time_point start = BenchClock::now();
+        for (int f = 0; f < BENCH_GRAPH_FRAMES; ++f)
+            EvaluateAnimationGraphs(&instances[0], BENCH_GRAPH_CHARACTERS, &pool, NULL);
+        const double seconds = SecondsSince(start) / BENCH_GRAPH_FRAMES;
+        pool.Shutdown();
+
+        const double fRate = BENCH_GRAPH_CHARACTERS / (seconds * 1e3);
+        if (numThreads == 1)
+            fSingleRate = fRate;
+
+        printf("  %-10s %2d threads  %8.3f ms/frame  %10.1f characters/ms  x%.2f\n", model.pszName, numThreads, seconds * 1e3, fRate, fRate / fSingleRate);
+    }
+
+    sPose reference;
+    CreatePose(&reference, graph.numNodes);
+    sAnimationGraphScratch scratch;
+    float maxDifference = 0.0f;
+    for (int i = 0; i < BENCH_GRAPH_CHARACTERS; i += BENCH_GRAPH_CHARACTERS / 64)
+    {
+        sAnimationGraphInstance instance = instances[i];
+        instance.pPose = &reference;
+        EvaluateAnimationGraphReference(instance, &scratch);
+        maxDifference = Max(maxDifference, ComparePoses(&poses[i], &reference));
+    }
+    DestroyAnimationGraphScratch(&scratch);
+    DestroyPose(&reference);
+
+    printf("  %-10s against EvaluateAnimationGraphReference: max difference %g\n", model.pszName, maxDifference);
+    BenchCheck(maxDifference < 1e-4f, model.pszName, "EvaluateAnimationGraphs doesn't match EvaluateAnimationGraphReference");
+
+    for (int i = 0; i < BENCH_GRAPH_CHARACTERS; ++i)
+        DestroyPose(&poses[i]);
+    DestroyAnimationGraph(&graph);
+    md.Destroy();
+}
+
+static void BenchAnimationScheduler(const sCorpusModel& model, int maxThreads)
+{
+    CLoader loader;
+    loader.SetFlags(LOAD_COMPRESS_ANIMATION);
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pAnimation || !md.pAnimation->pCompressed)
+    {
+        md.Destroy();
+        return;
+    }
+
+    // a 2 clip blend for the whole crowd, compressed clips as crowds use them; a few shared start times, like a crowd
+    // spawned in groups
+    sAnimationGraph graph;
+    memset(&graph, 0, sizeof(graph));
+    graph.numLayers = 1;
+    graph.layers[0].numClips = 2;
+    for (int c = 0; c < 2; ++c)
+    {
+        graph.layers[0].clips[c].pAnimation = md.pAnimation;
+        graph.layers[0].clips[c].bLoop = true;
+    }
+
+    if (!CreateAnimationGraph(&graph))
+    {
+        md.Destroy();
+        return;
+    }
+
+    const float fLengthMs = md.pAnimation->frameDurationMs * Max(md.pAnimation->numNodeFrames - 1, 1);
+    std::vector<sPose> poses(BENCH_GRAPH_CHARACTERS);
+    std::vector<sAnimationAgent> agents(BENCH_GRAPH_CHARACTERS);
+    for (int i = 0; i < BENCH_GRAPH_CHARACTERS; ++i)
+    {
+        CreatePose(&poses[i], graph.numNodes);
+        InitAnimationAgent(&agents[i], &graph, &poses[i]);
+        agents[i].instance.clipTimesMs[0][0] = fLengthMs * (float)(i % 16) / 16.0f;
+        agents[i].instance.clipTimesMs[0][1] = fLengthMs * (float)(i % 8) / 8.0f;
+        agents[i].instance.clipWeights[0][1] = 0.5f;
+    }
+
+    CJobPool pool;
+    pool.Init(maxThreads);
+
+    printf(" %s ( %d nodes )\n", model.pszName, graph.numNodes);
+
+    // every agent at full rate, then a distance spread ( 1/8 full rate, the rest every 2, 4, 8 frames ), with and without
+    // shared samples, then under a budget
+    static const char* s_pszRuns[] = { "full rate", "LODs", "LODs shared", "LODs budget" };
+    for (int run = 0; run < 4; ++run)
+    {
+        sAnimationSchedulerSettings settings;
+        memset(&settings, 0, sizeof(settings));
+        settings.numLods = 4;
+        settings.updateIntervals[0] = 1;
+        settings.updateIntervals[1] = 2;
+        settings.updateIntervals[2] = 4;
+        settings.updateIntervals[3] = 8;
+        settings.bShareSamples = (run >= 2);
+        settings.maxEvaluationsPerFrame = (run == 3) ? BENCH_GRAPH_CHARACTERS / 8 : 0;
+
+        for (int i = 0; i < BENCH_GRAPH_CHARACTERS; ++i)
+        {
+            agents[i].lod = (run == 0) ? 0 : Min(i % 8, 3);
+            agents[i].span = 0;
+            agents[i].frame = 0;
+        }
+
+        CAnimationScheduler scheduler;
+        scheduler.Init(settings);
+        scheduler.Update(&agents[0], BENCH_GRAPH_CHARACTERS, 16.6f, &pool);
+        scheduler.ResetStats();
+
+        const BenchClock::time_point start = BenchClock::now();
+        for (int f = 0; f < BENCH_CROWD_FRAMES; ++f)
+            scheduler.Update(&agents[0], BENCH_GRAPH_CHARACTERS, 16.6f, &pool);
+        const double seconds = SecondsSince(start) / BENCH_CROWD_FRAMES;
+
+        sAnimationSchedulerStats stats;
+        scheduler.GetStats(&stats);
+        printf("  %-12s %8.3f ms/frame  %10.1f characters/ms  evaluated %6.1f%%  interpolated %6.1f%%  deferred %6llu  samples %6.1f%% of %llu\n",
+               s_pszRuns[run], seconds * 1e3, BENCH_GRAPH_CHARACTERS / (seconds * 1e3), 100.0 * stats.numEvaluations / stats.numAgentUpdates,
+               100.0 * stats.numInterpolations / stats.numAgentUpdates, stats.numDeferrals,
+               stats.numSamplesRequested ? 100.0 * stats.numSamplesTaken / stats.numSamplesRequested : 0.0, stats.numSamplesRequested);
+    }
+
+    pool.Shutdown();
+    for (int i = 0; i < BENCH_GRAPH_CHARACTERS; ++i)
+    {
+        DestroyAnimationAgent(&agents[i]);
+        DestroyPose(&poses[i]);
+    }
+    DestroyAnimationGraph(&graph);
+    md.Destroy();
+}
+
+static void BenchCulling(const sCorpusModel& model, int maxThreads)
+{
+    CLoader loader;
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pAnimation || !md.pMesh || !md.pMesh->pSkinWeights)
+    {
+        md.Destroy();
+        return;
+    }
+
+    // what khm-bake -bounds does, into our own memory
+    sAnimation* pAnimation = md.pAnimation;
+    std::vector<sAnimationBounds> bounds(GetAnimationBoundsGroups(pAnimation->numNodeFrames, BENCH_BOUNDS_FRAMES));
+    const BenchClock::time_point bakeStart = BenchClock::now();
+    const bool bBaked = ComputeAnimationBounds(&md, pAnimation, BENCH_BOUNDS_FRAMES, &bounds[0], NULL);
+    const double bakeSeconds = SecondsSince(bakeStart);
+    if (!bBaked)
+    {
+        md.Destroy();
+        return;
+    }
+
+    // how far the bind pose box is from what the animation covers
+    sAnimationBounds clip = bounds[0];
+    double fGroupVolume = 0.0;
+    for (size_t g = 0; g < bounds.size(); ++g)
+    {
+        const sAnimationBounds& b = bounds[g];
+        clip.min = Vector3(Min(clip.min.x, b.min.x), Min(clip.min.y, b.min.y), Min(clip.min.z, b.min.z));
+        clip.max = Vector3(Max(clip.max.x, b.max.x), Max(clip.max.y, b.max.y), Max(clip.max.z, b.max.z));
+        fGroupVolume += (double)(b.max.x - b.min.x) * (b.max.y - b.min.y) * (b.max.z - b.min.z) / bounds.size();
+    }
+    const double fClipVolume = (double)(clip.max.x - clip.min.x) * (clip.max.y - clip.min.y) * (clip.max.z - clip.min.z);
+    const Vector3& bindMin = md.pMesh->min;
+    const Vector3& bindMax = md.pMesh->max;
+    const double fBindVolume = (double)(bindMax.x - bindMin.x) * (bindMax.y - bindMin.y) * (bindMax.z - bindMin.z);
+
+    pAnimation->pBounds = &bounds[0];
+    pAnimation->numBoundsGroups = (int)bounds.size();
+    pAnimation->framesPerBoundsGroup = BENCH_BOUNDS_FRAMES;
+
+    // a crowd spread on a 1km square around a camera looking down +z; about a quarter of it in view
+    const float fLengthMs = pAnimation->frameDurationMs * Max(pAnimation->numNodeFrames - 1, 1);
+    std::vector<sMatrix3x4> worlds(BENCH_CULL_INSTANCES);
+    std::vector<sCullInstance> instances(BENCH_CULL_INSTANCES);
+    unsigned int uiRandom = 12345;
+    for (int i = 0; i < BENCH_CULL_INSTANCES; ++i)
+    {
+        SetIdentity(worlds[i]);
+        uiRandom = uiRandom * 1664525u + 1013904223u;
+        worlds[i].row[0][3] = (float)(uiRandom >> 16) / 65536.0f * 1000.0f - 500.0f;
+        uiRandom = uiRandom * 1664525u + 1013904223u;
+        worlds[i].row[2][3] = (float)(uiRandom >> 16) / 65536.0f * 1000.0f - 500.0f;
+
+        instances[i].pAnimation = pAnimation;
+        instances[i].pMesh = md.pMesh;
+        instances[i].timeMs = fLengthMs * (float)(i % 64) / 64.0f;
+        instances[i].bLoop = true;
+        instances[i].pWorld = &worlds[i];
+    }
+
+    Matrix viewProj;
+    memset(&viewProj, 0, sizeof(viewProj));
+    float* m = (float*)&viewProj;
+    const float fNear = 0.5f, fFar = 1000.0f;
+    m[0] = 1.0f;
+    m[5] = 1.0f;
+    m[10] = fFar / (fFar - fNear);
+    m[11] = 1.0f;
+    m[14] = -fNear * fFar / (fFar - fNear);
+    sFrustum frustum;
+    SetFrustum(viewProj, frustum);
+
+    printf(" %s ( %d vertices, %d frames ) bake %.2f ms  box volume: bind %.1f  per %d frames %.1f  whole clip %.1f\n", model.pszName,
+           md.pMesh->numVertices, pAnimation->numNodeFrames, bakeSeconds * 1e3, fBindVolume, BENCH_BOUNDS_FRAMES, fGroupVolume, fClipVolume);
+
+    CJobPool pool;
+    pool.Init(maxThreads);
+
+    // the SIMD runs have to pick the same instances as the reference, not just as many
+    std::vector<unsigned char> visible(BENCH_CULL_INSTANCES);
+    std::vector<unsigned char> referenceVisible(BENCH_CULL_INSTANCES);
+    int numReferenceVisible = 0;
+    static const char* s_pszRuns[] = { "reference", "SIMD", "SIMD jobs" };
+    for (int run = 0; run < 3; ++run)
+    {
+        int numVisible = 0;
+        const BenchClock::time_point start = BenchClock::now();
+        for (int f = 0; f < BENCH_CULL_FRAMES; ++f)
+        {
+            if (run == 0)
+                numVisible = CullInstancesReference(frustum, &instances[0], BENCH_CULL_INSTANCES, &visible[0]);
+            else
+                numVisible = CullInstances(frustum, &instances[0], BENCH_CULL_INSTANCES, &visible[0], (run == 2) ? &pool : NULL);
+        }
+        const double seconds = SecondsSince(start) / BENCH_CULL_FRAMES;
+
+        printf("  %-10s %8.3f ms/frame  %10.1f instances/ms  visible %5.1f%%\n", s_pszRuns[run], seconds * 1e3,
+               BENCH_CULL_INSTANCES / (seconds * 1e3), 100.0 * numVisible / BENCH_CULL_INSTANCES);
+
+        if (run == 0)
+        {
+            referenceVisible = visible;
+            numReferenceVisible = numVisible;
+            continue;
+        }
+
+        BenchCheck(numVisible == numReferenceVisible, model.pszName, "CullInstances visible count differs from CullInstancesReference");
+        for (int i = 0; i < BENCH_CULL_INSTANCES; ++i)
+        {
+            if (visible[i] != referenceVisible[i])
+            {
+                BenchCheck(false, model.pszName, "CullInstances visibility differs from CullInstancesReference");
+                break;
+            }
+        }
+    }
+
+    pool.Shutdown();
+    pAnimation->pBounds = NULL;
+    md.Destroy();
+}
+
+static void PrintMeshletCulling(const char* pszName, const sMeshletMesh* pMeshlets, const sMatrix3x4& world, const Vector3& cameraPosition, const sFrustum& frustum)
+{
+    std::vector<unsigned int> visible(Max(pMeshlets->numMeshlets, 1));
+    sMeshletCullStats stats;
+    CullMeshlets(pMeshlets, world, cameraPosition, frustum, &visible[0], &stats);
+
+    const BenchClock::time_point start = BenchClock::now();
+    for (int i = 0; i < BENCH_MESHLET_CULLS; ++i)
+        CullMeshlets(pMeshlets, world, cameraPosition, frustum, &visible[0], NULL);
+    const double seconds = SecondsSince(start) / BENCH_MESHLET_CULLS;
+
+    printf("  %-22s %8.3f ms  %10.1f meshlets/ms  frustum %5d  cone %5d  triangles %8d of %8d ( %5.1f%% )\n", pszName, seconds * 1e3,
+           stats.numMeshlets / (seconds * 1e3), stats.numFrustumCulled, stats.numConeCulled, stats.numVisibleTriangles, stats.numTriangles,
+           100.0 * stats.numVisibleTriangles / Max(stats.numTriangles, 1));
+}
+
+static void BenchMeshlets(const sCorpusModel& model, const sFrustum& frustum)
+{
+    CLoader loader;
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pMesh || !md.pMesh->numIndices)
+    {
+        md.Destroy();
+        return;
+    }
+
+    const BenchClock::time_point start = BenchClock::now();
+    sMeshletMesh* pMeshlets = CreateMeshlets(md.pMesh, sMeshletSettings());
+    const double seconds = SecondsSince(start);
+    if (pMeshlets)
+    {
+        printf(" %s ( %d triangles ) build %.2f ms  %d meshlets  %.1f vertices  %.1f triangles per meshlet\n", model.pszName,
+               md.pMesh->numIndices / 3, seconds * 1e3, pMeshlets->numMeshlets, (double)pMeshlets->numVertexIndices / pMeshlets->numMeshlets,
+               (double)pMeshlets->numTriangles / pMeshlets->numMeshlets);
+
+        // the terrain seen from above the middle, then from below
+        sMatrix3x4 world;
+        SetIdentity(world);
+        const float fHalf = (md.pMesh->max.x - md.pMesh->min.x) * 0.5f;
+        world.row[0][3] = -fHalf;
+        world.row[1][3] = -20.0f;
+        world.row[2][3] = 5.0f;
+        PrintMeshletCulling("camera above", pMeshlets, world, Vector3(0.0f, 0.0f, 0.0f), frustum);
+        world.row[1][3] = 20.0f;
+        PrintMeshletCulling("camera below", pMeshlets, world, Vector3(0.0f, 0.0f, 0.0f), frustum);
+    }
+
+    DestroyMeshlets(pMeshlets);
+    md.Destroy();
+}
+
+// a prop too large for 16 bit indices: a sphere, outward facing, built straight from 32 bit indices
+static void BenchMeshletProp(const sFrustum& frustum)
+{
+    const int segments = BENCH_MESHLET_PROP_SEGMENTS;
+    std::vector<Vector3> vertices;
+    std::vector<unsigned int> indices;
+    for (int j = 0; j <= segments; ++j)
+    {
+        for (int i = 0; i <= segments; ++i)
+        {
+            const float theta = 3.14159265f * j / segments;
+            const float phi = 2.0f * 3.14159265f * i / segments;
+            vertices.push_back(Vector3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * 10.0f);
+        }
+    }
+
+    for (int j = 0; j < segments; ++j)
+    {
+        for (int i = 0; i < segments; ++i)
+        {
+            const unsigned int a = j * (segments + 1) + i;
+            const unsigned int lQuad[6] = { a, a + 1, a + segments + 1, a + 1, a + segments + 2, a + segments + 1 };
+            indices.insert(indices.end(), lQuad, lQuad + 6);
+        }
+    }
+
+    sMeshletSource source;
+    source.pVertices = &vertices[0];
+    source.numVertices = (int)vertices.size();
+    source.pIndices = &indices[0];
+    source.numIndices = (int)indices.size();
+    source.pFaceNormals = NULL;
+
+    const BenchClock::time_point start = BenchClock::now();
+    sMeshletMesh* pMeshlets = CreateMeshlets(source, sMeshletSettings());
+    const double seconds = SecondsSince(start);
+    if (!pMeshlets)
+        return;
+
+    printf(" prop ( %d vertices, %d triangles ) build %.2f ms  %d meshlets  %.1f vertices  %.1f triangles per meshlet\n", source.numVertices,
+           source.numIndices / 3, seconds * 1e3, pMeshlets->numMeshlets, (double)pMeshlets->numVertexIndices / pMeshlets->numMeshlets,
+           (double)pMeshlets->numTriangles / pMeshlets->numMeshlets);
+
+    // in full view, then close enough for the frustum to clip it
+    sMatrix3x4 world;
+    SetIdentity(world);
+    world.row[2][3] = 40.0f;
+    PrintMeshletCulling("in view", pMeshlets, world, Vector3(0.0f, 0.0f, 0.0f), frustum);
+    world.row[2][3] = 12.0f;
+    PrintMeshletCulling("close up", pMeshlets, world, Vector3(0.0f, 0.0f, 0.0f), frustum);
+
+    DestroyMeshlets(pMeshlets);
+}
+
+static void PrintMeshLods(const char* pszName, const sObjectMesh* pMesh)
+{
+    const BenchClock::time_point start = BenchClock::now();
+    sMeshLodChain* pChain = CreateMeshLods(pMesh, sMeshLodSettings());
+    const double seconds = SecondsSince(start);
+    if (!pChain)
+        return;
+
+    printf("  %-22s %8.2f ms  %d triangles", pszName, seconds * 1e3, pMesh->numIndices / 3);
+    for (int l = 0; l < pChain->numLods; ++l)
+        printf(" -> %d ( %.3f )", pChain->lods[l].numIndices / 3, pChain->lods[l].error);
+    printf("\n");
+
+    DestroyMeshLods(pChain);
+}
+
+static void BenchMeshLods(const sCorpusModel& model)
+{
+    CLoader loader;
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pMesh || !md.pMesh->numIndices)
+    {
+        md.Destroy();
+        return;
+    }
+
+    // the generator's colors and weights are noise, so no two neighbours agree and every collapse is refused
+    printf(" %s\n", model.pszName);
+    PrintMeshLods("as generated", md.pMesh);
+    md.pMesh->pColors = NULL;
+    md.pMesh->pSkinWeights = NULL;
+    md.pMesh->pSkinBoneIndices = NULL;
+    PrintMeshLods("positions only", md.pMesh);
+
+    md.Destroy();
+}
+
+// a skinned sphere with a uv seam: two bones blending across the equator, a color per hemisphere
+static void BenchMeshLodProp()
+{
+    const int segments = BENCH_LOD_PROP_SEGMENTS;
+    std::vector<Vector3> vertices;
+    std::vector<unsigned int> colors;
+    std::vector<Vector4> weights;
+    std::vector<sBoneIndices> bones;
+    for (int j = 0; j <= segments; ++j)
+    {
+        for (int i = 0; i <= segments; ++i)
+        {
+            const float theta = 3.14159265f * j / segments;
+            const float phi = 2.0f * 3.14159265f * i / segments;
+            const Vector3 p = Vector3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * 10.0f;
+            vertices.push_back(p);
+            colors.push_back(p.x > 0.0f ? 0xFFC04020u : 0xFF2040C0u);
+
+            Vector4 w;
+            w.x = Max(0.0f, Min(1.0f, (p.y + 2.0f) * 0.25f));
+            w.y = 1.0f - w.x;
+            w.z = w.w = 0.0f;
+            weights.push_back(w);
+
+            sBoneIndices b;
+            b.ind[0] = 1;
+            b.ind[1] = 2;
+            b.ind[2] = b.ind[3] = 0;
+            bones.push_back(b);
+        }
+    }
+
+    std::vector<unsigned short> indices;
+    for (int j = 0; j < segments; ++j)
+    {
+        for (int i = 0; i < segments; ++i)
+        {
+            // the pole rows only keep their non degenerate half
+            const unsigned short a = (unsigned short)(j * (segments + 1) + i);
+            const unsigned short lQuad[6] = { a, (unsigned short)(a + 1), (unsigned short)(a + segments + 1), (unsigned short)(a + 1), (unsigned short)(a + segments + 2), (unsigned short)(a + segments + 1) };
+            if (j > 0)
+                indices.insert(indices.end(), lQuad, lQuad + 3);
+            if (j < segments - 1)
+                indices.insert(indices.end(), lQuad + 3, lQuad + 6);
+        }
+    }
+
+    sObjectMesh mesh;
+    mesh.numVertices = (int)vertices.size();
+    mesh.pVertices = &vertices[0];
+    mesh.pColors = &colors[0];
+    mesh.pSkinWeights = &weights[0];
+    mesh.pSkinBoneIndices = &bones[0];
+    mesh.numIndices = (int)indices.size();
+    mesh.pIndices = &indices[0];
+
+    printf(" prop ( %d vertices, skinned )\n", mesh.numVertices);
+    PrintMeshLods("skinned sphere", &mesh);
+
+    sMeshLodChain* pChain = CreateMeshLods(&mesh, sMeshLodSettings());
+    if (!pChain)
+        return;
+
+    const float screenScale = GetLodScreenScale(1080.0f, 60.0f * 3.14159265f / 180.0f);
+    printf("  selection at %.0f px:", BENCH_LOD_PIXEL_ERROR);
+    for (float distance = 10.0f; distance <= 1280.0f; distance *= 2.0f)
+    {
+        const int level = SelectMeshLod(pChain->lods, pChain->numLods, distance, screenScale, BENCH_LOD_PIXEL_ERROR);
+        const int numIndices = level ? pChain->lods[level - 1].numIndices : mesh.numIndices;
+        printf("  %.0f m: %d ( %d )", distance, level, numIndices / 3);
+    }
+    printf("\n");
+
+    const BenchClock::time_point start = BenchClock::now();
+    int total = 0;
+    for (int i = 0; i < BENCH_LOOKUPS; ++i)
+        total += SelectMeshLod(pChain->lods, pChain->numLods, 10.0f + (float)(i % 1024), screenScale, BENCH_LOD_PIXEL_ERROR);
+    const double seconds = SecondsSince(start);
+    printf("  SelectMeshLod %.1f ns ( %d )\n", seconds * 1e9 / BENCH_LOOKUPS, total);
+
+    DestroyMeshLods(pChain);
+}
+
+// what LOAD_OPTIMIZE_VERTEX_CACHE does to the post-transform cache, and what a quantized interleaved stream of the
+// optimized mesh costs next to the float streams it is built from
+static void BenchVertexCache(const sCorpusModel& model)
+{
+    CLoader loader;
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pMesh || !md.pMesh->numIndices)
+    {
+        md.Destroy();
+        return;
+    }
+
+    sObjectMesh* pMesh = md.pMesh;
+    sMeshOptimizeStats optimizeStats;
+    BenchClock::time_point start = BenchClock::now();
+    const bool bOptimized = OptimizeMesh(pMesh, &optimizeStats);
+    const double optimizeSeconds = SecondsSince(start);
+    if (!bOptimized)
+    {
+        md.Destroy();
+        return;
+    }
+
+    // the reordering targets a KHM_FORSYTH_CACHE_SIZE cache; a FIFO of that size, for reference
+    sVertexCacheStats lruStats;
+    AnalyzeVertexCache(pMesh->pIndices, pMesh->numIndices, pMesh->numVertices, KHM_FORSYTH_CACHE_SIZE, &lruStats);
+
+    printf(" %s ( %d vertices, %d triangles ) OptimizeMesh %.2f ms\n", model.pszName, pMesh->numVertices, pMesh->numIndices / 3, optimizeSeconds * 1e3);
+    printf("  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f  ( FIFO %d )  ACMR %.3f ( FIFO %d )\n", optimizeStats.before.acmr, optimizeStats.after.acmr,
+           optimizeStats.before.atvr, optimizeStats.after.atvr, KHM_FIFO_CACHE_SIZE, lruStats.acmr, KHM_FORSYTH_CACHE_SIZE);
+    BenchCheck(optimizeStats.after.numTransforms <= optimizeStats.before.numTransforms, model.pszName, "OptimizeMesh made the vertex cache worse");
+
+    sVertexLayout layout;
+    layout.Add(VERTEX_POSITION, VERTEX_FORMAT_HALF4);
+    if (pMesh->pNormals)
+        layout.Add(VERTEX_NORMAL, VERTEX_FORMAT_OCT_SNORM16);
+    if (pMesh->pColors)
+        layout.Add(VERTEX_COLOR, VERTEX_FORMAT_UNORM8_4);
+    if (pMesh->pTexCoords[0])
+        layout.Add(VERTEX_TEXCOORD0, VERTEX_FORMAT_UNORM16_2);
+    if (pMesh->pTexCoords[1])
+        layout.Add(VERTEX_TEXCOORD1, VERTEX_FORMAT_UNORM16_2);
+    if (pMesh->pSkinWeights && pMesh->pSkinBoneIndices)
+    {
+        layout.Add(VERTEX_SKIN_WEIGHTS, VERTEX_FORMAT_UNORM8_4);
+        layout.Add(VERTEX_SKIN_INDICES, VERTEX_FORMAT_UINT8_4);
+    }
+
+    std::vector<unsigned char> stream((size_t)pMesh->numVertices * layout.stride);
+    sVertexDequantization dequantization;
+    sVertexStreamStats streamStats;
+    start = BenchClock::now();
+    const bool bBuilt = BuildVertexStream(pMesh, layout, &stream[0], &dequantization, &streamStats);
+    const double streamSeconds = SecondsSince(start);
+    if (bBuilt)
+    {
+        printf("  vertex stream %d bytes per vertex, %u bytes from %u ( %.2fx ) in %.2f ms  max error: position %g normal %g uv %g weight %g\n",
+               layout.stride, streamStats.uiStreamBytes, streamStats.uiSourceBytes, (double)streamStats.uiSourceBytes / Max(streamStats.uiStreamBytes, 1u),
+               streamSeconds * 1e3, streamStats.maxError[VERTEX_POSITION], streamStats.maxError[VERTEX_NORMAL],
+               streamStats.maxError[VERTEX_TEXCOORD0], streamStats.maxError[VERTEX_SKIN_WEIGHTS]);
+    }
+
+    md.Destroy();
+}
+
+// models sharing a handful of rigs: what the registry keeps against a skeleton per model, and what remapping a pose costs
+static void BenchSkeletonRegistry()
+{
+    CLoader loader;
+    std::vector< std::vector<unsigned char> > files(BENCH_REGISTRY_MODELS);
+    std::vector<sModelDefinition> models(BENCH_REGISTRY_MODELS);
+    for (int i = 0; i < BENCH_REGISTRY_MODELS; ++i)
+    {
+        sGeneratorSettings settings;
+        settings.uiSeed = 1 + i % BENCH_REGISTRY_RIGS;
+        settings.numBones = BENCH_REGISTRY_BONES;
+        settings.numHelpers = i / BENCH_REGISTRY_RIGS;
+        settings.numVertices = 256 * (1 + i % 3);
+        settings.numFrames = 10 + i;
+
+        CGenerator generator;
+        models[i].Init();
+        if (!generator.Generate(settings))
+            return;
+        files[i].assign(generator.GetData(), generator.GetData() + generator.GetSize());
+        if (!loader.LoadModel("rig", &files[i][0], (unsigned int)files[i].size(), &models[i]))
+            return;
+    }
+
+    // a skeleton per model, the way it is for callers that don't use the registry
+    unsigned long long uiOwnBytes = 0;
+    for (int i = 0; i < BENCH_REGISTRY_MODELS; ++i)
+    {
+        sSkeleton* pSkeleton = CreateSkeleton(models[i].lBones, models[i].numBones, NULL, 0, models[i].szFileName);
+        uiOwnBytes += sizeof(sSkeleton) + (unsigned long long)pSkeleton->numJoints * (sizeof(short) + sizeof(unsigned short) + sizeof(float) * 12 + sizeof(sMatrix3x4))
+                    + (unsigned long long)pSkeleton->numObjects * sizeof(short);
+        DestroySkeleton(pSkeleton);
+    }
+
+    CSkeletonRegistry registry;
+    std::vector<const sSkeletonBinding*> bindings(BENCH_REGISTRY_MODELS);
+    BenchClock::time_point start = BenchClock::now();
+    for (int i = 0; i < BENCH_REGISTRY_MODELS; ++i)
+        bindings[i] = registry.Acquire(&models[i]);
+    const double acquireSeconds = SecondsSince(start);
+
+    sSkeletonRegistryStats stats;
+    registry.GetStats(&stats);
+    printf("  %d models, %d rigs: %d skeletons, %llu dedups, %.1f us per acquire\n", BENCH_REGISTRY_MODELS, BENCH_REGISTRY_RIGS,
+           stats.numSkeletons, stats.numDedups, acquireSeconds * 1e6 / BENCH_REGISTRY_MODELS);
+    printf("  skeleton bytes: %llu built with one per model, %llu in the registry\n", uiOwnBytes, stats.uiBytesShared);
+
+    // the first rig with its bones stored in another order
+    std::vector<sObjectBase> bones(models[0].lBones, models[0].lBones + BENCH_REGISTRY_BONES);
+    for (int b = 0; b < BENCH_REGISTRY_BONES; ++b)
+    {
+        sObjectBase& bone = bones[(b * 37 + 11) % BENCH_REGISTRY_BONES];
+        bone = models[0].lBones[b];
+        bone.uiId = (b * 37 + 11) % BENCH_REGISTRY_BONES;
+        if (bone.uiParentId < BENCH_REGISTRY_BONES)
+            bone.uiParentId = (bone.uiParentId * 37 + 11) % BENCH_REGISTRY_BONES;
+    }
+    sModelDefinition shuffled;
+    shuffled.Init();
+    shuffled.numBones = BENCH_REGISTRY_BONES;
+    shuffled.lBones = &bones[0];
+    const sSkeletonBinding* pShuffled = registry.Acquire(&shuffled);
+
+    sPose modelPose, sharedPose;
+    CreatePose(&modelPose, models[0].numBones + models[0].numHelpers);
+    CreatePose(&sharedPose, bindings[0]->pSkeleton->numObjects);
+    const sSkeletonBinding* lTimed[] = { bindings[0], pShuffled };
+    for (int t = 0; t < 2; ++t)
+    {
+        start = BenchClock::now();
+        for (int i = 0; i < BENCH_POSE_SAMPLES; ++i)
+            RemapPose(lTimed[t], &modelPose, &sharedPose);
+        const double seconds = SecondsSince(start);
+        printf("  RemapPose %-10s %6.1f ns ( shared skeleton %s )\n", lTimed[t]->bIdentity ? "in order" : "shuffled", seconds * 1e9 / BENCH_POSE_SAMPLES,
+               lTimed[t]->pSkeleton == bindings[0]->pSkeleton ? "matched" : "not matched");
+    }
+    DestroyPose(&modelPose);
+    DestroyPose(&sharedPose);
+
+    registry.Release(pShuffled);
+    for (int i = 0; i < BENCH_REGISTRY_MODELS; ++i)
+    {
+        registry.Release(bindings[i]);
+        models[i].Destroy();
+    }
+}
+
+// a copy of the model on a grid, shot at from far away, where the precision of the primitive tests gets tested hardest
+static void BenchCollision(const sCorpusModel& model, int maxThreads)
+{
+    CLoader loader;
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pMesh)
+    {
+        md.Destroy();
+        return;
+    }
+
+    const BenchClock::time_point buildStart = BenchClock::now();
+    sCollisionBVH* pBVH = CreateCollisionBVH(&md, COLLISION_BVH_SHAPES | COLLISION_BVH_TRIANGLES);
+    const double buildSeconds = SecondsSince(buildStart);
+    if (!pBVH)
+    {
+        md.Destroy();
+        return;
+    }
+
+    const Vector3 size = md.pMesh->max - md.pMesh->min;
+    const float spacing = 1.5f * Max(size.x, Max(size.y, size.z));
+    std::vector<sCollisionInstance> instances(BENCH_COLLISION_INSTANCES);
+    for (int i = 0; i < BENCH_COLLISION_INSTANCES; ++i)
+    {
+        sMatrix3x4 world;
+        SetIdentity(world);
+        world.row[0][3] = (i % 4 - 1.5f) * spacing;
+        world.row[2][3] = (i / 4 - 1.5f) * spacing;
+        SetCollisionInstance(instances[i], pBVH, world);
+    }
+
+    // rows of rays across the grid, from above and a long way back; every other row sweeps a sphere
+    const Vector3 eye(0.0f, 10.0f * spacing, -40.0f * spacing);
+    const float centerY = 0.5f * (md.pMesh->min.y + md.pMesh->max.y);
+    std::vector<sRay> rays(BENCH_COLLISION_RAYS);
+    for (int i = 0; i < BENCH_COLLISION_RAYS; ++i)
+    {
+        const float u = (i % 64 + 0.5f) / 64.0f;
+        const float v = (i / 64 + 0.5f) / (BENCH_COLLISION_RAYS / 64);
+        const Vector3 target((u - 0.5f) * 4.0f * spacing, centerY, (v - 0.5f) * 4.0f * spacing);
+
+        rays[i].origin = eye;
+        rays[i].dir = Normalize3(target - eye);
+        rays[i].maxT = 2.0f * Length3(target - eye);
+        rays[i].radius = ((i / 64) & 1) ? 0.02f * spacing : 0.0f;
+    }
+
+    CJobPool pool;
+    pool.Init(maxThreads);
+
+    std::vector<sRayHit> hits(BENCH_COLLISION_RAYS);
+    double lSeconds[2];
+    for (int run = 0; run < 2; ++run)
+    {
+        const BenchClock::time_point start = BenchClock::now();
+        CastRays(&instances[0], BENCH_COLLISION_INSTANCES, &rays[0], BENCH_COLLISION_RAYS, &hits[0], run ? &pool : NULL);
+        lSeconds[run] = SecondsSince(start);
+    }
+
+    int numHits = 0;
+    for (int i = 0; i < BENCH_COLLISION_RAYS; ++i)
+        numHits += (hits[i].instance >= 0) ? 1 : 0;
+
+    // the reference is brute force, so only a sample; a primitive shared by two triangles can go either way, the t can't
+    int numMismatches = 0;
+    const BenchClock::time_point start = BenchClock::now();
+    for (int i = 0; i < BENCH_COLLISION_RAYS; i += BENCH_COLLISION_RAYS / BENCH_COLLISION_CHECKS)
+    {
+        sRayHit hit;
+        CastRayReference(&instances[0], BENCH_COLLISION_INSTANCES, rays[i], hit);
+        if ((hit.instance >= 0) != (hits[i].instance >= 0) || fabsf(hit.t - hits[i].t) > 1e-4f * Max(1.0f, hit.t))
+            ++numMismatches;
+    }
+    const double referenceSeconds = SecondsSince(start);
+
+    printf(" %s ( %d primitives, %d nodes ) build %.2f ms  hits %.1f%%\n", model.pszName, pBVH->numPrimitives, pBVH->numNodes, buildSeconds * 1e3,
+           100.0 * numHits / BENCH_COLLISION_RAYS);
+    printf("  CastRays %8.1f ns/ray  jobs %8.1f ns/ray  reference %8.1f us/ray  %d of %d sampled rays differ\n", lSeconds[0] * 1e9 / BENCH_COLLISION_RAYS,
+           lSeconds[1] * 1e9 / BENCH_COLLISION_RAYS, referenceSeconds * 1e6 / BENCH_COLLISION_CHECKS, numMismatches, BENCH_COLLISION_CHECKS);
+    BenchCheck(numMismatches == 0, model.pszName, "CastRays doesn't match CastRayReference");
+
+    pool.Shutdown();
+    DestroyCollisionBVH(pBVH);
+    md.Destroy();
+}
+
+// a lat-long sphere the way a tool exports a hull: quads, with the seam column and the pole rows repeating their vertices
+struct sBenchHull
+{
+    std::vector<Vector3>            vertices;
+    std::vector<unsigned short>     indices;
+    std::vector<sCollisionPolygon>  polygons;
+    sCollisionShape                 shape;
+};
+
+static void BuildBenchHull(sBenchHull& hull, int segments, float radius)
+{
+    for (int j = 0; j <= segments; ++j)
+    {
+        for (int i = 0; i <= segments; ++i)
+        {
+            const float theta = 3.14159265f * j / segments;
+            const float phi = 2.0f * 3.14159265f * (i % segments) / segments;
+            if (j == 0 || j == segments)
+                hull.vertices.push_back(Vector3(0.0f, j ? -radius : radius, 0.0f));
+            else
+                hull.vertices.push_back(Vector3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * radius);
+        }
+    }
+
+    for (int j = 0; j < segments; ++j)
+    {
+        for (int i = 0; i < segments; ++i)
+        {
+            const unsigned short a = (unsigned short)(j * (segments + 1) + i);
+            sCollisionPolygon polygon;
+            memset(&polygon, 0, sizeof(polygon));
+            polygon.numVerts = 4;
+            polygon.indexBase = (int)hull.indices.size();
+            hull.polygons.push_back(polygon);
+            hull.indices.push_back(a);
+            hull.indices.push_back((unsigned short)(a + segments + 1));
+            hull.indices.push_back((unsigned short)(a + segments + 2));
+            hull.indices.push_back((unsigned short)(a + 1));
+        }
+    }
+
+    float* m = (float*)&hull.shape.transform;
+    for (int k = 0; k < 16; ++k)
+        m[k] = (k % 5 == 0) ? 1.0f : 0.0f;
+    hull.shape.type = sCollisionShape::CONVEX_MESH;
+    hull.shape.bShared = true;
+    hull.shape.params.mesh.numPolys = (int)hull.polygons.size();
+    hull.shape.params.mesh.pPolygons = &hull.polygons[0];
+    hull.shape.params.mesh.numIndices = (int)hull.indices.size();
+    hull.shape.params.mesh.pIndices = &hull.indices[0];
+    hull.shape.params.mesh.numVertices = (int)hull.vertices.size();
+    hull.shape.params.mesh.pVertices = &hull.vertices[0];
+}
+
+static void RandomPlacement(unsigned int& uiSeed, float range, sMatrix3x4& placement)
+{
+    float r[7];
+    for (int k = 0; k < 7; ++k)
+    {
+        uiSeed = uiSeed * 1664525u + 1013904223u;
+        r[k] = (uiSeed >> 8) * (2.0f / 16777216.0f) - 1.0f;
+    }
+    const float length = Max(1e-3f, sqrtf(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3]));
+    const float q[4] = { r[0] / length, r[1] / length, r[2] / length, r[3] / length };
+    const float t[3] = { r[4] * range, r[5] * range, r[6] * range };
+    const float s[3] = { 1.0f, 1.0f, 1.0f };
+    ComposeMatrix3x4(q, t, s, placement);
+}
+
+// support mapping and GJK / EPA on hulls of growing size: the shape's vertices brute force, the SIMD scan, and the
+// adjacency climb from a cold start and from the last support
+static void BenchConvexHulls()
+{
+    const int lSegments[] = { 4, 8, 16, 32, 64 };
+    const int numSizes = sizeof(lSegments) / sizeof(lSegments[0]);
+
+    std::vector<Vector3> directions(BENCH_HULL_QUERIES);
+    for (int i = 0; i < BENCH_HULL_QUERIES; ++i)
+    {
+        // a slow spin, the way a query against a moving body asks
+        const float angle = 0.01f * i;
+        directions[i] = Vector3(cosf(angle) * cosf(angle * 0.37f), sinf(angle * 0.37f), sinf(angle) * cosf(angle * 0.37f));
+    }
+
+    sBenchHull other;
+    BuildBenchHull(other, 16, 1.0f);
+    sConvexHull* pOtherHull = CreateConvexHull(other.shape, true);
+
+    for (int s = 0; s < numSizes; ++s)
+    {
+        sBenchHull hull;
+        BuildBenchHull(hull, lSegments[s], 2.0f);
+        sConvexHull* pHull = CreateConvexHull(hull.shape, true);
+        sConvexHull* pScanHull = CreateConvexHull(hull.shape, false);
+        if (!pHull || !pScanHull || !pOtherHull)
+            return;
+
+        // support queries
+        double lSupportNs[4];
+        int total = 0;
+        for (int mode = 0; mode < 4; ++mode)
+        {
+            const BenchClock::time_point start = BenchClock::now();
+            int support = 0;
+            for (int i = 0; i < BENCH_HULL_QUERIES; ++i)
+            {
+                if (mode == 0)
+                    support = GetShapeSupportReference(hull.shape, directions[i]);
+                else if (mode == 1)
+                    support = GetHullSupportScan(pScanHull, directions[i]);
+                else
+                    support = GetHullSupport(pHull, directions[i], mode == 2 ? 0 : support);
+                total += support;
+            }
+            lSupportNs[mode] = SecondsSince(start) * 1e9 / BENCH_HULL_QUERIES;
+        }
+
+        // contacts against the small hull, the same placements for every mode
+        const sConvexHull* lHulls[3] = { NULL, pScanHull, pHull };
+        double lContactNs[3];
+        float lDistances[3][BENCH_HULL_QUERIES / 8];
+        int numIterations = 0;
+        for (int mode = 0; mode < 3; ++mode)
+        {
+            unsigned int uiSeed = 12345;
+            const BenchClock::time_point start = BenchClock::now();
+            for (int i = 0; i < BENCH_HULL_QUERIES / 8; ++i)
+            {
+                sMatrix3x4 placementA, placementB;
+                RandomPlacement(uiSeed, 0.5f, placementA);
+                RandomPlacement(uiSeed, 3.0f, placementB);
+
+                sConvexShape a, b;
+                SetConvexShape(a, hull.shape, lHulls[mode], placementA);
+                SetConvexShape(b, other.shape, pOtherHull, placementB);
+                sConvexContact contact;
+                ComputeConvexContact(a, b, contact);
+                lDistances[mode][i] = contact.distance;
+                if (mode == 2)
+                    numIterations += contact.numIterations;
+            }
+            lContactNs[mode] = SecondsSince(start) * 1e9 / (BENCH_HULL_QUERIES / 8);
+        }
+
+        float maxDifference = 0.0f;
+        for (int i = 0; i < BENCH_HULL_QUERIES / 8; ++i)
+            maxDifference = Max(maxDifference, Max(fabsf(lDistances[1][i] - lDistances[0][i]), fabsf(lDistances[2][i] - lDistances[0][i])));
+
+        float maxSupportDifference = 0.0f;
+        for (int i = 0; i < BENCH_HULL_QUERIES; i += 16)
+        {
+            const float reference = Dot3(hull.vertices[GetShapeSupportReference(hull.shape, directions[i])], directions[i]);
+            maxSupportDifference = Max(maxSupportDifference, fabsf(Dot3(GetHullVertex(pScanHull, GetHullSupportScan(pScanHull, directions[i])), directions[i]) - reference));
+            maxSupportDifference = Max(maxSupportDifference, fabsf(Dot3(GetHullVertex(pHull, GetHullSupport(pHull, directions[i], 0)), directions[i]) - reference));
+        }
+        BenchCheck(maxSupportDifference < 1e-5f, "convex hulls", "GetHullSupport doesn't match GetShapeSupportReference");
+        BenchCheck(maxDifference < 1e-3f, "convex hulls", "GJK with hulls doesn't match GJK over the shape's vertices");
+
+        printf("  %4d vertices ( %4d welded ): support brute %7.1f ns, scan %6.1f ns, climb cold %6.1f ns, warm %5.1f ns ( %d )\n",
+               hull.shape.params.mesh.numVertices, pHull->numVertices, lSupportNs[0], lSupportNs[1], lSupportNs[2], lSupportNs[3], total & 0xFF);
+        printf("  %29s GJK brute %7.1f ns, scan %6.1f ns, %s %6.1f ns, %.1f iterations, max difference %g\n", "",
+               lContactNs[0], lContactNs[1], pHull->numVertices < KHM_HULL_CLIMB_MIN_VERTICES ? "scan" : "climb", lContactNs[2],
+               (double)numIterations / (BENCH_HULL_QUERIES / 8), maxDifference);
+
+        DestroyConvexHull(pHull);
+        DestroyConvexHull(pScanHull);
+    }
+
+    DestroyConvexHull(pOtherHull);
+}
+
+static void BenchLoadModelsScaling(const sCorpusModel& model, int maxThreads)
+{
+    CLoader loader;
+    std::vector<std::vector<unsigned char> > buffers(BENCH_SCALING_REQUESTS, model.data);
+    std::vector<sModelDefinition> models(BENCH_SCALING_REQUESTS);
+    std::vector<sLoadRequest> requests(BENCH_SCALING_REQUESTS);
+
+    double fSingleRate = 0.0;
+    // powers of two, then the max
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads = (numThreads < maxThreads && numThreads * 2 > maxThreads) ? maxThreads : numThreads * 2)
+    {
+        for (int i = 0; i < BENCH_SCALING_REQUESTS; ++i)
+        {
+            requests[i].pszFilePath = model.pszName;
+            requests[i].fileBuff = &buffers[i][0];
+            requests[i].fileSize = (unsigned int)buffers[i].size();
+            requests[i].pModelDefinition = &models[i];
+            requests[i].bResult = false;
+        }
+
+        CJobPool pool;
+        pool.Init(numThreads);
+
+        const BenchClock::time_point start = BenchClock::now();
+        const int numLoaded = loader.LoadModels(&requests[0], BENCH_SCALING_REQUESTS, &pool);
+        const double seconds = SecondsSince(start);
+
+        pool.Shutdown();
+        for (int i = 0; i < BENCH_SCALING_REQUESTS; ++i)
+            models[i].Destroy();
+
+        const double fRate = numLoaded / seconds;
+        if (numThreads == 1)
+            fSingleRate = fRate;
+
+        printf("  %-10s %2d threads  %10.0f loads/s  x%.2f\n", model.pszName, numThreads, fRate, fRate / fSingleRate);
+    }
+}
+
+static void BenchSkinning(const sCorpusModel& model, int maxThreads)
+{
+    CLoader loader;
+    std::vector<unsigned char> buff(model.data);
+    sModelDefinition md;
+    if (!loader.LoadModel(model.pszName, &buff[0], (unsigned int)buff.size(), &md) || !md.pMesh || !md.pMesh->pSkinWeights)
+    {
+        md.Destroy();
+        return;
+    }
+
+    const sObjectMesh* pMesh = md.pMesh;
+    sSkinningData* pSkinningData = CreateSkinningData(pMesh);
+
+    std::vector<sMatrix3x4> palette(KHM_MAX_BONES);
+    for (int i = 0; i < KHM_MAX_BONES; ++i)
+    {
+        SetIdentity(palette[i]);
+        palette[i].row[0][3] = (float)i * 0.01f;
+    }
+
+    CJobPool pool;
+    pool.Init(maxThreads);
+
+    static const int s_instanceCounts[] = { 1, 4, 16, 64, 256 };
+    for (unsigned int c = 0; c < sizeof(s_instanceCounts) / sizeof(s_instanceCounts[0]); ++c)
+    {
+        const int numInstances = s_instanceCounts[c];
+        std::vector<Vector3> positions((size_t)numInstances * pMesh->numVertices);
+        std::vector<Vector3> normals((size_t)numInstances * pMesh->numVertices);
+        std::vector<sSkinningInstance> instances(numInstances);
+        for (int i = 0; i < numInstances; ++i)
+        {
+            instances[i].pPalette = &palette[0];
+            instances[i].pPositions = &positions[(size_t)i * pMesh->numVertices];
+            instances[i].pNormals = &normals[(size_t)i * pMesh->numVertices];
+        }
+
+        // with the per-block influence counts, and without them ( every vertex blends all its influences )
+        for (int variant = 0; variant < 2; ++variant)
+        {
+            const sSkinningData* pData = variant == 0 ? pSkinningData : NULL;
+            positions.assign(positions.size(), Vector3(0.0f, 0.0f, 0.0f));   // so the check sees this variant's output
+
+            // enough passes to get past the clock resolution on the small counts
+            const int numPasses = Max(1, 256 / numInstances);
+            SkinInstances(pMesh, pData, &instances[0], numInstances, &pool);
+
+            const BenchClock::time_point start = BenchClock::now();
+            for (int p = 0; p < numPasses; ++p)
+                SkinInstances(pMesh, pData, &instances[0], numInstances, &pool);
+            const double seconds = SecondsSince(start) / numPasses;
+
+            printf("  %-10s %4d instances  %-8s %8.3f ms  %8.1f Mverts/s\n", model.pszName, numInstances, pData ? "blocks" : "no data",
+                   seconds * 1e3, (double)numInstances * pMesh->numVertices / seconds / 1e6);
+
+            // the palette only translates along x, so every instance's vertices are the weighted sum of those offsets
+            float maxDifference = 0.0f;
+            for (int i = 0; i < numInstances; ++i)
+            {
+                for (int v = 0; v < pMesh->numVertices; ++v)
+                {
+                    const float* w = (const float*)&pMesh->pSkinWeights[v];
+                    const unsigned char* ind = pMesh->pSkinBoneIndices[v].ind;
+                    Vector3 expected = pMesh->pVertices[v] * (w[0] + w[1] + w[2] + w[3]);
+                    for (int k = 0; k < KHM_MAX_BONE_INFLUENCES; ++k)
+                        expected.x += w[k] * palette[ind[k]].row[0][3];
+
+                    const Vector3 d = instances[i].pPositions[v] - expected;
+                    maxDifference = Max(maxDifference, Max(fabsf(d.x), Max(fabsf(d.y), fabsf(d.z))) / Max(1.0f, Length3(expected)));
+                }
+            }
+            BenchCheck(maxDifference < 1e-5f, model.pszName, pData ? "SkinInstances doesn't match the scalar blend" :
+                       "SkinInstances without skinning data doesn't match the scalar blend");
+        }
+    }
+
+    pool.Shutdown();
+    DestroySkinningData(pSkinningData);
+    md.Destroy();
+}
+
+struct sBenchCacheJob
+{
+    CModelCache*                        pCache;
+    const std::vector<sCorpusModel>*    pCorpus;
+};
+
+static void BenchCacheJob(void* pUserData, int begin, int end)
+{
+    sBenchCacheJob* pJob = (sBenchCacheJob*)pUserData;
+    const std::vector<sCorpusModel>& corpus = *pJob->pCorpus;
+
+    for (int t = begin; t < end; ++t)
+    {
+        unsigned int uiRandom = 0x9E3779B9u * (t + 1);
+        for (int i = 0; i < BENCH_CACHE_ACQUIRES; ++i)
+        {
+            uiRandom = uiRandom * 1664525u + 1013904223u;
+            const unsigned int uiModel = (uiRandom >> 8) % (unsigned int)corpus.size();
+            char szPath[MAX_PATH_STD];
+            snprintf(szPath, sizeof(szPath), "%s_%u.khm", corpus[uiModel].pszName, (uiRandom >> 24) % BENCH_CACHE_ALIASES);
+
+            // in-memory source: the bytes are only copied on a miss
+            const sModelDefinition* pModelDefinition = pJob->pCache->Find(szPath);
+            if (!pModelDefinition)
+            {
+                const std::vector<unsigned char>& data = corpus[uiModel].data;
+                unsigned char* fileBuff = (unsigned char*)malloc(data.size());
+                memcpy(fileBuff, &data[0], data.size());
+                pModelDefinition = pJob->pCache->Acquire(szPath, fileBuff, (unsigned int)data.size());
+            }
+            pJob->pCache->Release(pModelDefinition);
+        }
+    }
+}
+
+static void BenchCache(const std::vector<sCorpusModel>& corpus, int maxThreads)
+{
+    if (corpus.empty())
+        return;
+
+    unsigned long long uiCorpusBytes = 0;
+    for (size_t i = 0; i < corpus.size(); ++i)
+        uiCorpusBytes += corpus[i].data.size();
+
+    CLoader loader;
+    const unsigned long long lBudgets[] = { uiCorpusBytes * 2, uiCorpusBytes / 2 };
+    for (unsigned int b = 0; b < sizeof(lBudgets) / sizeof(lBudgets[0]); ++b)
+    {
+        for (int numThreads = 1; numThreads <= maxThreads; numThreads = (numThreads < maxThreads) ? maxThreads : numThreads + 1)
+        {
+            CModelCache cache;
+            cache.Init(&loader, lBudgets[b]);
+
+            CJobPool pool;
+            pool.Init(numThreads);
+
+            sBenchCacheJob job;
+            job.pCache = &cache;
+            job.pCorpus = &corpus;
+
+            const BenchClock::time_point start = BenchClock::now();
+            pool.ParallelFor(numThreads, 1, BenchCacheJob, &job);
+            const double seconds = SecondsSince(start);
+            pool.Shutdown();
+
+            sCacheStats stats;
+            cache.GetStats(&stats);
+            const double numAcquires = (double)numThreads * BENCH_CACHE_ACQUIRES;
+            printf("  budget %6.0f%%  %2d threads  %10.0f acquires/s  hits %5.1f%%  dedups %6llu  evictions %6llu  resident %9llu bytes\n",
+                   100.0 * lBudgets[b] / uiCorpusBytes, numThreads, numAcquires / seconds, 100.0 * stats.numHits / numAcquires,
+                   stats.numDedups, stats.numEvictions, stats.uiBytesResident);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 200;
+    int maxThreads = 0;
+    const char* pszCorpusDir = NULL;
+    const char* pszStatsPath = NULL;
+    const char* pszBaselinePath = NULL;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-iterations") == 0 && i + 1 < argc)
+            iterations = Max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            maxThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-corpus") == 0 && i + 1 < argc)
+            pszCorpusDir = argv[++i];
+        else if (strcmp(argv[i], "-stats") == 0 && i + 1 < argc)
+            pszStatsPath = argv[++i];
+        else if (strcmp(argv[i], "-stats-baseline") == 0 && i + 1 < argc)
+            pszBaselinePath = argv[++i];
+        else if (argv[i][0] == '-')
+        {
+            printf("usage: khm-bench [-iterations N] [-threads N] [-corpus <dir>] [-stats <file>] [-stats-baseline <file>] [model.khm ...]\n");
+            return 1;
+        }
+        else
+            files.push_back(argv[i]);
+    }
+
+    if (maxThreads <= 0)
+        maxThreads = Max((int)std::thread::hardware_concurrency(), 1);
+    maxThreads = Min(maxThreads, KHM_MAX_JOB_THREADS);
+
+    std::vector<sCorpusModel> corpus;
+    if (files.empty())
+    {
+        BuildCorpus(corpus);
+    }
+    else
+    {
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            sCorpusModel model;
+            model.pszName = files[i];
+            if (!ReadFile(files[i], model.data))
+            {
+                printf("khm-bench: can't read '%s'\n", files[i]);
+                return 1;
+            }
+            corpus.push_back(model);
+        }
+    }
+
+    if (pszCorpusDir)
+    {
+        for (size_t i = 0; i < corpus.size(); ++i)
+        {
+            char szPath[MAX_PATH_STD];
+            snprintf(szPath, sizeof(szPath), "%s/%s.khm", pszCorpusDir, corpus[i].pszName);
+
+            FILE* f = fopen(szPath, "wb");
+            const bool bOk = f && fwrite(&corpus[i].data[0], corpus[i].data.size(), 1, f) == 1;
+            if (f)
+                fclose(f);
+
+            printf("khm-bench: %s %s\n", bOk ? "wrote" : "can't write", szPath);
+        }
+        return 0;
+    }
+
+    printf("load ( %d iterations )\n", iterations);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchLoad(corpus[i], iterations);
+
+    printf("validation ( %d iterations )\n", iterations);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchValidation(corpus[i], iterations);
+
+    std::vector<sLoadBaseline> baseline;
+    if (KHM_LOAD_STATS && pszBaselinePath && !ReadLoadBaseline(pszBaselinePath, baseline))
+    {
+        printf("khm-bench: can't read '%s'\n", pszBaselinePath);
+        return 1;
+    }
+
+    printf("load stats ( %d iterations, best of %d rounds )\n", iterations, BENCH_LOAD_STATS_ROUNDS);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchLoadStats(corpus[i], iterations, baseline);
+
+    if (!KHM_LOAD_STATS && pszBaselinePath)
+        printf("khm-bench: %s %s\n", WriteLoadBaseline(pszBaselinePath, baseline) ? "wrote" : "can't write", pszBaselinePath);
+
+    printf("lookups ( per call )\n");
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchLookups(corpus[i]);
+
+    printf("animation ( per pose )\n");
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchAnimation(corpus[i]);
+
+    printf("animation graph ( %d characters )\n", BENCH_GRAPH_CHARACTERS);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchAnimationGraph(corpus[i], maxThreads);
+
+    printf("crowd scheduler ( %d characters, %d threads )\n", BENCH_GRAPH_CHARACTERS, maxThreads);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchAnimationScheduler(corpus[i], maxThreads);
+
+    printf("culling ( %d instances, %d threads )\n", BENCH_CULL_INSTANCES, maxThreads);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchCulling(corpus[i], maxThreads);
+
+    {
+        // camera at the origin looking down +z
+        Matrix viewProj;
+        memset(&viewProj, 0, sizeof(viewProj));
+        float* m = (float*)&viewProj;
+        const float fNear = 0.5f, fFar = 1000.0f;
+        m[0] = 1.0f;
+        m[5] = 1.0f;
+        m[10] = fFar / (fFar - fNear);
+        m[11] = 1.0f;
+        m[14] = -fNear * fFar / (fFar - fNear);
+        sFrustum frustum;
+        SetFrustum(viewProj, frustum);
+
+        printf("meshlets ( %d vertices, %d triangles max )\n", KHM_MESHLET_MAX_VERTICES, KHM_MESHLET_MAX_TRIANGLES);
+        for (size_t i = 0; i < corpus.size(); ++i)
+            BenchMeshlets(corpus[i], frustum);
+        BenchMeshletProp(frustum);
+    }
+
+    printf("mesh LODs ( reduction %.2f, max error %.2f of the bounds )\n", sMeshLodSettings().reduction, sMeshLodSettings().maxError);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchMeshLods(corpus[i]);
+    BenchMeshLodProp();
+
+    printf("vertex cache and streams\n");
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchVertexCache(corpus[i]);
+
+    printf("LoadModels scaling ( %d models )\n", BENCH_SCALING_REQUESTS);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchLoadModelsScaling(corpus[i], maxThreads);
+
+    printf("cache ( %d names per model )\n", BENCH_CACHE_ALIASES);
+    BenchCache(corpus, maxThreads);
+
+    printf("skeleton registry ( %d bones )\n", BENCH_REGISTRY_BONES);
+    BenchSkeletonRegistry();
+
+    printf("ray casts ( %d instances, %d rays )\n", BENCH_COLLISION_INSTANCES, BENCH_COLLISION_RAYS);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchCollision(corpus[i], maxThreads);
+
+    printf("convex hulls ( climbing from %d vertices )\n", KHM_HULL_CLIMB_MIN_VERTICES);
+    BenchConvexHulls();
+
+    printf("skinning ( %d threads )\n", maxThreads);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        BenchSkinning(corpus[i], maxThreads);
+
+    if (pszStatsPath)
+        WriteStatsReport(corpus, pszStatsPath);
+
+    if (g_numMismatches)
+    {
+        fprintf(stderr, "khm-bench: %d mismatches against the references\n", g_numMismatches);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,367 @@
+//
+// khm-fuzz - fuzz entry point for the validator and the unchecked paths it guards
+//
+//  libFuzzer:  build with -fsanitize=fuzzer,address -DKHM_FUZZ_LIBFUZZER
+//  replay:     khm-fuzz <file> ...         runs every file through the same entry point
+//  seeds:      khm-fuzz -seeds <dir>       writes a small v101 / v102 seed corpus to <dir>
+//
+// every input is copied into a buffer of exactly its size, so a read past the end shows up under ASan.
+// inputs that validate are loaded through LoadValidatedModel, every array is touched and one pose is skinned; every
+// input is also streamed in small chunks, and the stream has to agree with ValidateModel. the model arenas are
+// counted: a load from a validated layout asks for exactly one block, and Destroy gives every block back
+//
+
+#include "KHMModel.h"
+#include "KHMValidate.h"
+#include "KHMStream.h"
+#include "KHMGenerator.h"
+#include "KHMBake.h"
+#include "KHMAnimationGraph.h"
+#include "KHMAnimationBounds.h"
+#include "KHMSkeleton.h"
+#include "KHMSkinning.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace KHM;
+
+#define FUZZ_MAX_INPUT_SIZE         (16 * 1024 * 1024)
+#define FUZZ_STREAM_CHUNK_SIZE      61 // odd, so chunks end in the middle of everything
+
+static volatile float g_fSink;
+
+static int g_numArenaAllocs;    // since the last reset
+static int g_numArenaBlocks;    // live
+
+static void* FuzzModelAlloc(void*, size_t uiSize)
+{
+    ++g_numArenaAllocs;
+    ++g_numArenaBlocks;
+    return malloc(uiSize); // the fuzzer doesn't touch the tracks with SIMD loads
+}
+
+static void FuzzModelFree(void*, void* pBlock, size_t)
+{
+    --g_numArenaBlocks;
+    free(pBlock);
+}
+
+static void CheckArena(bool bCondition, const char* pszWhat)
+{
+    if (bCondition)
+        return;
+
+    fprintf(stderr, "khm-fuzz: %s ( %d allocations, %d blocks live )\n", pszWhat, g_numArenaAllocs, g_numArenaBlocks);
+    abort();
+}
+
+static float TouchFloats(const void* pData, size_t numFloats)
+{
+    float fSum = 0.0f;
+    const unsigned char* pBytes = (const unsigned char*)pData;
+    for (size_t i = 0; i < numFloats; ++i)
+    {
+        float f;
+        memcpy(&f, pBytes + sizeof(float) * i, sizeof(f));
+        fSum += f;
+    }
+    return fSum;
+}
+
+static void TouchModel(const sModelDefinition& md)
+{
+    float fSum = 0.0f;
+    for (int i = 0; i < md.numBones; ++i)
+        fSum += (md.GetObjectByName(md.lBones[i].szName) != NULL) + (md.GetObjectById(md.lBones[i].uiId) != NULL);
+    for (int i = 0; i < md.numHelpers; ++i)
+        fSum += (md.GetObjectByName(md.lHelpers[i].szName) != NULL) + (md.GetObjectById(md.lHelpers[i].uiId) != NULL);
+
+    const sObjectMesh* pMesh = md.pMesh;
+    if (pMesh)
+    {
+        const size_t numVertices = pMesh->numVertices;
+        if (pMesh->pVertices)           fSum += TouchFloats(pMesh->pVertices, numVertices * 3);
+        if (pMesh->pNormals)            fSum += TouchFloats(pMesh->pNormals, numVertices * 3);
+        if (pMesh->pFaceNormals)        fSum += TouchFloats(pMesh->pFaceNormals, (pMesh->numIndices / 3) * 3);
+        if (pMesh->pColors)             fSum += TouchFloats(pMesh->pColors, numVertices);
+        if (pMesh->pTexCoords[0])       fSum += TouchFloats(pMesh->pTexCoords[0], numVertices * 2);
+        if (pMesh->pSkinWeights)        fSum += TouchFloats(pMesh->pSkinWeights, numVertices * 4);
+        if (pMesh->pSkinBoneIndices)    fSum += TouchFloats(pMesh->pSkinBoneIndices, numVertices);
+
+        // indices through the vertices, the way every consumer reads them
+        for (int i = 0; pMesh->pIndices && i < pMesh->numIndices; ++i)
+            fSum += TouchFloats(&pMesh->pVertices[pMesh->pIndices[i]], 3);
+
+        for (int i = 0; i < pMesh->numCollisions; ++i)
+        {
+            const sCollisionShape& col = pMesh->pCollisions[i];
+            if (col.type != sCollisionShape::CONVEX_MESH)
+                continue;
+
+            for (int p = 0; p < col.params.mesh.numPolys; ++p)
+            {
+                const sCollisionPolygon& polygon = col.params.mesh.pPolygons[p];
+                for (int k = 0; k < polygon.numVerts; ++k)
+                    fSum += TouchFloats(&col.params.mesh.pVertices[col.params.mesh.pIndices[polygon.indexBase + k]], 3);
+            }
+        }
+    }
+
+    if (md.pAnimation)
+        fSum += TouchFloats(md.pAnimation->pNodeTransforms, (size_t)md.pAnimation->numNodes * md.pAnimation->numNodeFrames * (sizeof(sNodeTransform) / sizeof(float)));
+
+    g_fSink = fSum;
+}
+
+// the first keyframe ( or the bind pose ) through the skeleton and the skinning, the way a renderer uses the model;
+// the bone indices and the hierarchy only get read for real here
+static void SkinModel(const sModelDefinition& md)
+{
+    const sObjectMesh* pMesh = md.pMesh;
+    if (md.pAnimation && pMesh)
+    {
+        sAnimationBounds bounds;
+        GetAnimationBounds(md.pAnimation, pMesh, 0.0f, true, bounds);
+        g_fSink = bounds.max.x - bounds.min.x;
+    }
+
+    // the bone indices are only checked against a skeleton that has bones
+    if (!pMesh || !pMesh->pSkinWeights || !pMesh->pSkinBoneIndices || pMesh->numVertices <= 0 || md.numBones <= 0)
+        return;
+
+    sSkeleton* pSkeleton = CreateSkeleton(&md);
+    if (!pSkeleton)
+        return;
+
+    sPose pose;
+    const bool bPose = md.pAnimation && md.pAnimation->numNodeFrames > 0;
+    if (bPose)
+    {
+        CreatePose(&pose, md.pAnimation->numNodes);
+        SampleAnimation(md.pAnimation, 0.0f, true, &pose);
+    }
+
+    const int numVertices = pMesh->numVertices;
+    sMatrix3x4* pGlobals = new sMatrix3x4[Max(pSkeleton->numObjects, 1)];
+    sMatrix3x4* pPalette = new sMatrix3x4[pSkeleton->numBones];
+    Vector3* pPositions = new Vector3[numVertices];
+    Vector3* pNormals = new Vector3[numVertices];
+
+    sSkeletonInstance skeleton;
+    skeleton.pPose = bPose ? &pose : NULL;
+    skeleton.pRoot = NULL;
+    skeleton.pGlobals = pGlobals;
+    UpdateSkeletonInstances(pSkeleton, &skeleton, 1, NULL);
+    BuildSkinningPalette(pSkeleton, pGlobals, pPalette);
+
+    sSkinningData* pSkinningData = CreateSkinningData(pMesh);
+    sSkinningInstance skin;
+    skin.pPalette = pPalette;
+    skin.pPositions = pPositions;
+    skin.pNormals = pMesh->pNormals ? pNormals : NULL;
+    SkinInstances(pMesh, pSkinningData, &skin, 1, NULL);
+    g_fSink = TouchFloats(pPositions, (size_t)numVertices * 3);
+
+    DestroySkinningData(pSkinningData);
+    delete [] pNormals;
+    delete [] pPositions;
+    delete [] pPalette;
+    delete [] pGlobals;
+    if (bPose)
+        DestroyPose(&pose);
+    DestroySkeleton(pSkeleton);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size)
+{
+    if (size > FUZZ_MAX_INPUT_SIZE)
+        return 0;
+
+    const unsigned int fileSize = (unsigned int)size;
+    unsigned char* fileBuff = (unsigned char*)malloc(size ? size : 1);
+    memcpy(fileBuff, data, size);
+
+    sModelAllocator allocator;
+    allocator.alloc = FuzzModelAlloc;
+    allocator.free = FuzzModelFree;
+    allocator.pUserData = NULL;
+
+    sModelLayout layout;
+    const bool bValid = ValidateModel(NULL, fileBuff, fileSize, &layout);
+    if (bValid)
+    {
+        CLoader loader;
+        loader.SetFlags(LOAD_ANIMATION_TRACKS);
+        loader.SetAllocator(allocator);
+
+        sModelDefinition md;
+        g_numArenaAllocs = 0;
+        loader.LoadValidatedModel("fuzz", fileBuff, layout, &md);
+        CheckArena(g_numArenaAllocs == 1, "LoadValidatedModel has to allocate once");
+        TouchModel(md);
+        SkinModel(md);
+        md.Destroy();
+        CheckArena(g_numArenaBlocks == 0, "Destroy left arena blocks behind");
+    }
+
+    // a partial load checks only what it reads, and the deferred rest makes up the difference
+    {
+        CLoader loader;
+        loader.SetAllocator(allocator);
+
+        sModelDefinition md;
+        g_numArenaAllocs = 0;
+        const bool bLoaded = loader.LoadModelSections("fuzz", fileBuff, fileSize, MODEL_SECTION_ANIMATION, &md) &&
+            loader.LoadDeferredSections(fileBuff, fileSize, MODEL_SECTIONS_ALL, &md);
+        if (bLoaded != bValid)
+        {
+            fprintf(stderr, "khm-fuzz: partial loads and ValidateModel disagree ( %s )\n", layout.pszError ? layout.pszError : "valid");
+            abort();
+        }
+
+        if (bLoaded)
+        {
+            CheckArena(g_numArenaAllocs == 1, "the partial arena has to fit the deferred sections");
+            TouchModel(md);
+        }
+
+        md.Destroy();
+        CheckArena(g_numArenaBlocks == 0, "Destroy left arena blocks behind");
+    }
+
+    // the stream validates piecewise, on the same rules
+    {
+        CLoader loader;
+        loader.SetAllocator(allocator);
+
+        sModelDefinition md;
+        CModelStream stream;
+        stream.Begin(&loader, "fuzz", fileBuff, fileSize, &md, NULL, NULL);
+
+        eStreamState state = stream.Feed(0);
+        for (unsigned int uiAvailable = 0; state == STREAM_PENDING && uiAvailable < fileSize; )
+        {
+            uiAvailable = Min(uiAvailable + FUZZ_STREAM_CHUNK_SIZE, fileSize);
+            state = stream.Feed(uiAvailable);
+        }
+
+        if (state == STREAM_DONE)
+            TouchModel(md);
+
+        if ((state == STREAM_DONE) != bValid)
+        {
+            fprintf(stderr, "khm-fuzz: stream and ValidateModel disagree ( %s )\n", layout.pszError ? layout.pszError : "valid");
+            abort();
+        }
+
+        md.Destroy();
+        CheckArena(g_numArenaBlocks == 0, "Destroy left arena blocks behind");
+    }
+
+    free(fileBuff);
+    return 0;
+}
+
+#ifndef KHM_FUZZ_LIBFUZZER
+
+static bool WriteSeed(const char* pszDir, const char* pszName, const unsigned char* pData, unsigned int uiSize)
+{
+    char szPath[MAX_PATH_STD];
+    snprintf(szPath, sizeof(szPath), "%s/%s", pszDir, pszName);
+
+    FILE* f = fopen(szPath, "wb");
+    const bool bOk = f && fwrite(pData, uiSize, 1, f) == 1;
+    if (f)
+        fclose(f);
+
+    printf("khm-fuzz: %s %s\n", bOk ? "wrote" : "can't write", szPath);
+    return bOk;
+}
+
+// a copy of a valid file with a skin bone index past the bones; the validator has to turn it down
+static bool WriteBadBoneIndexSeed(const char* pszDir, const char* pszName, const unsigned char* pData, unsigned int uiSize)
+{
+    sModelLayout layout;
+    if (!ValidateModel(pszName, pData, uiSize, &layout) || !layout.uiSkinIndices)
+        return false;
+
+    unsigned char* fileBuff = (unsigned char*)malloc(uiSize);
+    memcpy(fileBuff, pData, uiSize);
+    fileBuff[layout.uiSkinIndices + 1] = 250;
+
+    const bool bOk = !ValidateModel(NULL, fileBuff, uiSize, &layout) && WriteSeed(pszDir, pszName, fileBuff, uiSize);
+    free(fileBuff);
+    return bOk;
+}
+
+static int WriteSeeds(const char* pszDir)
+{
+    // small models, so the fuzzer spends its time on the structure and not on the payloads
+    sGeneratorSettings settings;
+    settings.numBones = 4;
+    settings.numHelpers = 2;
+    settings.numVertices = 16;
+    settings.numFrames = 3;
+    settings.numCollisions = 4;
+    settings.numMaskEntries = 2;
+
+    CGenerator generator;
+    if (!generator.Generate(settings) || !WriteSeed(pszDir, "seed101.khm", generator.GetData(), generator.GetSize()))
+        return 1;
+
+    unsigned char* fileBuff = (unsigned char*)malloc(generator.GetSize());
+    memcpy(fileBuff, generator.GetData(), generator.GetSize());
+
+    CLoader loader;
+    sModelDefinition md;
+    CBaker baker;
+    const bool bOk = loader.LoadModel("seed101.khm", fileBuff, generator.GetSize(), &md) && baker.Bake(&md) &&
+                     WriteSeed(pszDir, "seed102.khm", baker.GetData(), baker.GetSize()) &&
+                     WriteBadBoneIndexSeed(pszDir, "seed101-bone-index.khm", generator.GetData(), generator.GetSize()) &&
+                     WriteBadBoneIndexSeed(pszDir, "seed102-bone-index.khm", baker.GetData(), baker.GetSize());
+
+    md.Destroy();
+    free(fileBuff);
+    return bOk ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 3 && strcmp(argv[1], "-seeds") == 0)
+        return WriteSeeds(argv[2]);
+
+    if (argc < 2)
+    {
+        printf("usage: khm-fuzz -seeds <dir> | khm-fuzz <file> ...\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        FILE* f = fopen(argv[i], "rb");
+        if (!f)
+        {
+            printf("khm-fuzz: can't read '%s'\n", argv[i]);
+            return 1;
+        }
+
+        fseek(f, 0, SEEK_END);
+        const long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        unsigned char* pData = (unsigned char*)malloc(size > 0 ? size : 1);
+        const bool bRead = size <= 0 || fread(pData, size, 1, f) == 1;
+        fclose(f);
+
+        if (bRead)
+            LLVMFuzzerTestOneInput(pData, size > 0 ? size : 0);
+        printf("khm-fuzz: %s %s\n", argv[i], bRead ? "ok" : "read failed");
+        free(pData);
+    }
+
+    return 0;
+}
+
+#endif // KHM_FUZZ_LIBFUZZER